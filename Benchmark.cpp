@@ -0,0 +1,1214 @@
+#include "Benchmark.h"
+#include "ColorConverter.h"
+#include "ComponentLabeler.h"
+#include "DepthBackground.h"
+#include "DepthConverter.h"
+#include "DepthCodec.h"
+#include "FrameWorker.h"
+#include "OpenCVHelper.h"
+#include "OpenCVFrameHelper.h"
+#include "PyramidRefiner.h"
+#include "ReplayFrameSource.h"
+#include "SceneChangeGate.h"
+#include "SimdSupport.h"
+#include "TableCalibration.h"
+#include "TiledEdgeChain.h"
+#include "WarpEngine.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#pragma warning(pop)
+
+using namespace cv;
+using namespace Microsoft::KinectBridge;
+
+const NUI_IMAGE_RESOLUTION Benchmark::RESOLUTIONS[] =
+{
+    NUI_IMAGE_RESOLUTION_80x60,
+    NUI_IMAGE_RESOLUTION_320x240,
+    NUI_IMAGE_RESOLUTION_640x480,
+    NUI_IMAGE_RESOLUTION_1280x960
+};
+
+const int Benchmark::RESOLUTION_COUNT = ARRAYSIZE(Benchmark::RESOLUTIONS);
+
+namespace
+{
+    // Names for printing
+    const char* const COLOR_FORMAT_NAMES[] = { "bgra", "rgba", "bgr", "gray" };
+    const char* const PATH_NAMES[] = { "auto", "scalar", "sse2", "ssse3", "avx2" };
+
+    // Most depth frames of a recording the pyramid benchmark keeps in memory
+    const size_t MAX_RECORDED_FRAMES = 100;
+
+    /// <summary>
+    /// Gets the path of a kernel to time after a path, in order from the scalar one
+    /// </summary>
+    /// <param name="path">path just timed</param>
+    /// <param name="kernelPaths">paths the kernel implements, as bits 1 << path</param>
+    /// <returns>next path the kernel implements and the running processor supports, PATH_AUTO after the last one</returns>
+    SimdPath GetNextPath(SimdPath path, UINT kernelPaths)
+    {
+        const SimdPath bestPath = GetBestPath(kernelPaths);
+        for (int next = path + 1; next <= bestPath; ++next)
+        {
+            if (kernelPaths & (1 << next))
+            {
+                return static_cast<SimdPath>(next);
+            }
+        }
+
+        return PATH_AUTO;
+    }
+
+    /// <summary>
+    /// Reads the performance counter in seconds
+    /// </summary>
+    /// <returns>current time in seconds</returns>
+    double GetSeconds()
+    {
+        static LARGE_INTEGER frequency = {};
+        if (frequency.QuadPart == 0)
+        {
+            QueryPerformanceFrequency(&frequency);
+        }
+
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return static_cast<double>(counter.QuadPart) / frequency.QuadPart;
+    }
+
+    /// <summary>
+    /// Fills a buffer with repeatable pseudo random bytes
+    /// </summary>
+    /// <param name="pData">buffer to fill</param>
+    /// <param name="size">size of the buffer</param>
+    void FillFrame(BYTE* pData, size_t size)
+    {
+        UINT seed = 0x12345678;
+        for (size_t i = 0; i < size; ++i)
+        {
+            seed = seed * 1664525 + 1013904223;
+            pData[i] = static_cast<BYTE>(seed >> 24);
+        }
+    }
+
+    /// <summary>
+    /// Fills a depth frame with a repeatable scene: a sloped floor, a nearer player with a
+    /// shadow of unknown depth beside it, a strip out of range and a little sensor noise
+    /// </summary>
+    /// <param name="pData">frame to fill, 16 bits per pixel without padding</param>
+    /// <param name="width">width in pixels</param>
+    /// <param name="height">height in pixels</param>
+    void FillDepthFrame(USHORT* pData, UINT width, UINT height)
+    {
+        UINT seed = 0x12345678;
+        for (UINT y = 0; y < height; ++y)
+        {
+            for (UINT x = 0; x < width; ++x)
+            {
+                seed = seed * 1664525 + 1013904223;
+                int noise = static_cast<int>(seed >> 30) - 2;
+
+                int dx = static_cast<int>(x * 4) - static_cast<int>(width * 2);
+                int dy = static_cast<int>(y * 2) - static_cast<int>(height);
+                bool isPlayer = dx * dx + dy * dy * 4 < static_cast<int>(width * width / 2);
+                bool isShadow = !isPlayer && dx < 0 && dx * dx + dy * dy * 4 < static_cast<int>(width * width * 3 / 4);
+
+                USHORT value;
+                if (x >= width - width / 16)
+                {
+                    value = 65535;
+                }
+                else if (isShadow)
+                {
+                    value = 0;
+                }
+                else if (isPlayer)
+                {
+                    value = static_cast<USHORT>(((1200 + dy / 4 + noise) << NUI_IMAGE_PLAYER_INDEX_SHIFT) | 1);
+                }
+                else
+                {
+                    value = static_cast<USHORT>((3000 - y * 1500 / height + x * 300 / width + noise) << NUI_IMAGE_PLAYER_INDEX_SHIFT);
+                }
+                pData[y * width + x] = value;
+            }
+        }
+    }
+
+    /// <summary>
+    /// Fills rectified band masks with targets: discs out of the band on a table in the band,
+    /// at sub-pixel positions that move from frame to frame
+    /// </summary>
+    /// <param name="pFrames">pointer to the frames to add to</param>
+    /// <param name="count">number of frames to add</param>
+    void FillTargetFrames(std::vector<Mat>* pFrames, int count)
+    {
+        // Centers and radii in sixteenths of a pixel
+        const int shift = 4;
+        for (int n = 0; n < count; ++n)
+        {
+            Mat frame(Size(640, 480), CV_8UC1, Scalar(255));
+            for (int i = 0; i < 40; ++i)
+            {
+                Point center(((40 + (i % 8) * 75) << shift) + (n * 7 + i * 3) % 16, ((60 + (i / 8) * 90) << shift) + (n * 5 + i) % 16);
+                circle(frame, center, (10 + i % 6) << shift, Scalar(0), FILLED, LINE_8, shift);
+            }
+            pFrames->push_back(frame);
+        }
+    }
+
+    /// <summary>
+    /// Loads the depth frames of a recording as the rectified band masks the depth edge filters see
+    /// </summary>
+    /// <param name="path">path of the recording</param>
+    /// <param name="pHelper">helper to rectify the band masks with</param>
+    /// <param name="pFrames">pointer to the frames to add to</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT LoadDepthFrames(LPCWSTR path, OpenCVHelper* pHelper, std::vector<Mat>* pFrames)
+    {
+        // As fast as the frames are read, without looping
+        ReplayFrameSource source;
+        HRESULT hr = source.Open(path, false, false);
+        if (SUCCEEDED(hr))
+        {
+            hr = source.Initialize(NUI_INITIALIZE_FLAG_USES_DEPTH_AND_PLAYER_INDEX);
+        }
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        DWORD width, height;
+        NuiImageResolutionToSize(source.GetDepthResolution(), width, height);
+        Mat mask(Size(width, height), CV_8UC1);
+
+        // The trapezoid is calibrated on 640x480 depth images
+        Mat calibrated(Size(640, 480), CV_8UC1);
+
+        HANDLE hNextFrameEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        HANDLE hStream = NULL;
+        hr = source.OpenImageStream(NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX, source.GetDepthResolution(), 0, hNextFrameEvent, &hStream);
+
+        SourceFrame frame;
+        while (SUCCEEDED(hr) && pFrames->size() < MAX_RECORDED_FRAMES && SUCCEEDED(source.GetNextImageFrame(hStream, 0, &frame)))
+        {
+            DepthConverter::ToBandMask(frame.pBits, frame.pitch, mask.data, mask.step, width, height, MIN_RDIS, MAX_RDIS);
+            source.ReleaseImageFrame(hStream, &frame);
+
+            Mat src = mask;
+            if (mask.size() != calibrated.size())
+            {
+                resize(mask, calibrated, calibrated.size(), 0, 0, INTER_NEAREST);
+                src = calibrated;
+            }
+
+            Mat rectified;
+            hr = pHelper->RectifyDepth(src, &rectified);
+            if (SUCCEEDED(hr))
+            {
+                pFrames->push_back(rectified);
+            }
+        }
+
+        source.Shutdown();
+        CloseHandle(hNextFrameEvent);
+        return hr;
+    }
+
+    /// <summary>
+    /// Gets the distance from a point to the nearest centroid of a set of components
+    /// </summary>
+    /// <param name="point">point at full resolution</param>
+    /// <param name="components">components</param>
+    /// <param name="scale">scale from the components' resolution to full resolution</param>
+    /// <param name="offset">offset added after scaling, for the pixel centers of a coarser level</param>
+    /// <returns>distance in pixels, DBL_MAX if there are no components</returns>
+    double GetNearestDistance(Point2d point, const std::vector<Component>& components, double scale, double offset)
+    {
+        double nearest = DBL_MAX;
+        for (size_t i = 0; i < components.size(); ++i)
+        {
+            double dx = components[i].centroid.x * scale + offset - point.x;
+            double dy = components[i].centroid.y * scale + offset - point.y;
+            double distance = sqrt(dx * dx + dy * dy);
+            nearest = distance < nearest ? distance : nearest;
+        }
+        return nearest;
+    }
+}
+
+/// <summary>
+/// Runs all benchmarks
+/// </summary>
+/// <param name="replayPath">path of a recording for the benchmarks that can use recorded frames, or NULL</param>
+/// <returns>0</returns>
+int Benchmark::Run(LPCWSTR replayPath)
+{
+    const CpuFeatures& features = GetCpuFeatures();
+    printf("CPU features: sse2 %d, ssse3 %d, sse4.1 %d, avx2 %d\n",
+        features.hasSse2, features.hasSsse3, features.hasSse41, features.hasAvx2);
+
+    RunColorConversion();
+    RunDepthConversion();
+    RunDepthMask();
+    RunDepthCodec();
+    RunWarp();
+    RunStreams();
+    RunSceneGate();
+    RunLabeling();
+    RunPyramid(replayPath);
+    RunTiledEdges();
+    RunDepthBackground();
+    RunTableCalibration();
+
+    return 0;
+}
+
+/// <summary>
+/// Times the original per-pixel color copy against every color format and code path
+/// </summary>
+void Benchmark::RunColorConversion()
+{
+    printf("\nColor conversion from BGRA\n");
+
+    for (int i = 0; i < RESOLUTION_COUNT; ++i)
+    {
+        DWORD width, height;
+        NuiImageResolutionToSize(RESOLUTIONS[i], width, height);
+
+        const size_t pitch = width * 4;
+        const size_t frameSize = pitch * height;
+        const int iterations = GetIterations(width * height);
+
+        std::vector<BYTE> frame(frameSize);
+        FillFrame(&frame[0], frameSize);
+        const BYTE* pBuffer = &frame[0];
+
+        printf("%lux%lu, %d frames\n", width, height, iterations);
+
+        // The per-pixel Vec4b copy GetColorData used before the conversion engine
+        Mat baseline(height, width, CV_8UC4);
+        double start = GetSeconds();
+        for (int n = 0; n < iterations; ++n)
+        {
+            for (UINT y = 0; y < height; ++y)
+            {
+                Vec4b* pColorRow = baseline.ptr<Vec4b>(y);
+
+                for (UINT x = 0; x < width; ++x)
+                {
+                    pColorRow[x] = Vec4b(pBuffer[y * pitch + x * 4 + 0],
+                        pBuffer[y * pitch + x * 4 + 1],
+                        pBuffer[y * pitch + x * 4 + 2],
+                        pBuffer[y * pitch + x * 4 + 3]);
+                }
+            }
+        }
+        PrintResult("bgra per-pixel", GetSeconds() - start, iterations, frameSize);
+
+        for (int format = COLOR_FORMAT_BGRA; format <= COLOR_FORMAT_GRAY; ++format)
+        {
+            ColorFormat colorFormat = static_cast<ColorFormat>(format);
+            Mat converted(height, width, CV_8UC(ColorConverter::GetChannels(colorFormat)));
+
+            Mat scalarConverted;
+            for (SimdPath path = PATH_SCALAR; path != PATH_AUTO; path = GetNextPath(path, ColorConverter::PATHS))
+            {
+                // BGRA is a copy, which does not depend on the path
+                if (colorFormat == COLOR_FORMAT_BGRA && path != PATH_SCALAR)
+                {
+                    break;
+                }
+
+                start = GetSeconds();
+                for (int n = 0; n < iterations; ++n)
+                {
+                    ColorConverter::Convert(pBuffer, pitch, converted.data, converted.step, width, height, colorFormat, path);
+                }
+                double seconds = GetSeconds() - start;
+
+                if (path == PATH_SCALAR)
+                {
+                    scalarConverted = converted.clone();
+                }
+
+                // countNonZero only takes one channel, so the channels are compared as one wider image
+                const bool isSame = countNonZero(converted.reshape(1) != scalarConverted.reshape(1)) == 0;
+
+                char name[32];
+                sprintf_s(name, "%s %s%s", COLOR_FORMAT_NAMES[format], colorFormat == COLOR_FORMAT_BGRA ? "memcpy" : PATH_NAMES[path], isSame ? "" : " MISMATCH");
+                PrintResult(name, seconds, iterations, frameSize);
+            }
+        }
+    }
+}
+
+/// <summary>
+/// Times the original per-pixel depth colorization against the depth to color table
+/// </summary>
+void Benchmark::RunDepthConversion()
+{
+    printf("\nDepth colorization to ARGB\n");
+
+    // The table for the default depth band
+    OpenCVFrameHelper frameHelper;
+    const UINT* pTable = frameHelper.GetDepthArgbTable();
+
+    for (int i = 0; i < RESOLUTION_COUNT; ++i)
+    {
+        DWORD width, height;
+        NuiImageResolutionToSize(RESOLUTIONS[i], width, height);
+
+        const size_t pitch = width * sizeof(USHORT);
+        const size_t frameSize = pitch * height;
+        const int iterations = GetIterations(width * height);
+
+        std::vector<BYTE> frame(frameSize);
+        FillFrame(&frame[0], frameSize);
+        const BYTE* pBuffer = &frame[0];
+
+        printf("%lux%lu, %d frames\n", width, height, iterations);
+
+        // The per-pixel DepthShortToRgb colorization GetDepthDataAsArgb used before the table
+        Mat converted(height, width, CV_8UC4);
+        double start = GetSeconds();
+        for (int n = 0; n < iterations; ++n)
+        {
+            for (UINT y = 0; y < height; ++y)
+            {
+                const USHORT* pDepthRow = reinterpret_cast<const USHORT*>(pBuffer + y * pitch);
+                Vec4b* pDepthRgbRow = converted.ptr<Vec4b>(y);
+
+                for (UINT x = 0; x < width; ++x)
+                {
+                    USHORT rawDepth = pDepthRow[x];
+                    if (rawDepth != USHRT_MAX)
+                    {
+                        USHORT realDepth = NuiDepthPixelToDepth(rawDepth);
+                        BYTE r = static_cast<BYTE>(realDepth >= MIN_RDIS && realDepth <= MAX_RDIS ? 255 - (realDepth - MIN_RDIS) * 255 / DIF_RDIS : 0);
+                        BYTE b = static_cast<BYTE>(realDepth >= MIN_RDIS && realDepth <= MAX_RDIS ? 0 : 100);
+                        BYTE g = static_cast<BYTE>(realDepth >= MIN_RDIS && realDepth <= MAX_RDIS ? realDepth / 10 : 0);
+                        pDepthRgbRow[x] = Vec4b(r, g, b, 1);
+                    }
+                    else
+                    {
+                        pDepthRgbRow[x] = 0;
+                    }
+                }
+            }
+        }
+        PrintResult("per-pixel", GetSeconds() - start, iterations, frameSize);
+
+        Mat scalarConverted;
+        for (SimdPath path = PATH_SCALAR; path != PATH_AUTO; path = GetNextPath(path, DepthConverter::PATHS))
+        {
+            // The table has no SSE2 path, there is no gather before AVX2
+            if (path == PATH_SSE2)
+            {
+                continue;
+            }
+
+            start = GetSeconds();
+            for (int n = 0; n < iterations; ++n)
+            {
+                DepthConverter::ApplyTable(pBuffer, pitch, converted.data, converted.step, width, height, pTable, path);
+            }
+            double seconds = GetSeconds() - start;
+
+            if (path == PATH_SCALAR)
+            {
+                scalarConverted = converted.clone();
+            }
+
+            // countNonZero only takes one channel, so the channels are compared as one wider image
+            const bool isSame = countNonZero(converted.reshape(1) != scalarConverted.reshape(1)) == 0;
+
+            char name[32];
+            sprintf_s(name, "table %s%s", PATH_NAMES[path], isSame ? "" : " MISMATCH");
+            PrintResult(name, seconds, iterations, frameSize);
+        }
+    }
+}
+
+/// <summary>
+/// Times the colorize and convert to gray round trip the depth edge filter used against the band mask
+/// </summary>
+void Benchmark::RunDepthMask()
+{
+    printf("\nDepth band mask\n");
+
+    OpenCVFrameHelper frameHelper;
+    const UINT* pTable = frameHelper.GetDepthArgbTable();
+
+    USHORT minDepth, maxDepth;
+    frameHelper.GetDepthBand(&minDepth, &maxDepth);
+
+    for (int i = 0; i < RESOLUTION_COUNT; ++i)
+    {
+        DWORD width, height;
+        NuiImageResolutionToSize(RESOLUTIONS[i], width, height);
+
+        const size_t pitch = width * sizeof(USHORT);
+        const size_t frameSize = pitch * height;
+        const int iterations = GetIterations(width * height);
+
+        std::vector<BYTE> frame(frameSize);
+        FillFrame(&frame[0], frameSize);
+        const BYTE* pBuffer = &frame[0];
+
+        printf("%lux%lu, %d frames\n", width, height, iterations);
+
+        Mat argb(height, width, CV_8UC4);
+        Mat mask(height, width, CV_8UC1);
+        double start = GetSeconds();
+        for (int n = 0; n < iterations; ++n)
+        {
+            DepthConverter::ApplyTable(pBuffer, pitch, argb.data, argb.step, width, height, pTable);
+            cvtColor(argb, mask, COLOR_RGBA2GRAY);
+        }
+        PrintResult("argb and gray", GetSeconds() - start, iterations, frameSize);
+
+        Mat scalarMask;
+        for (SimdPath path = PATH_SCALAR; path != PATH_AUTO; path = GetNextPath(path, DepthConverter::PATHS))
+        {
+            start = GetSeconds();
+            for (int n = 0; n < iterations; ++n)
+            {
+                DepthConverter::ToBandMask(pBuffer, pitch, mask.data, mask.step, width, height, minDepth, maxDepth, path);
+            }
+            double seconds = GetSeconds() - start;
+
+            if (path == PATH_SCALAR)
+            {
+                scalarMask = mask.clone();
+            }
+
+            char name[32];
+            sprintf_s(name, "mask %s%s", PATH_NAMES[path], countNonZero(mask != scalarMask) == 0 ? "" : " MISMATCH");
+            PrintResult(name, seconds, iterations, frameSize);
+        }
+    }
+}
+
+/// <summary>
+/// Times encoding and decoding depth frames with the lossless depth codec
+/// </summary>
+void Benchmark::RunDepthCodec()
+{
+    printf("\nDepth codec\n");
+
+    for (int i = 0; i < RESOLUTION_COUNT; ++i)
+    {
+        DWORD width, height;
+        NuiImageResolutionToSize(RESOLUTIONS[i], width, height);
+
+        const size_t pitch = width * sizeof(USHORT);
+        const size_t frameSize = pitch * height;
+        const int iterations = GetIterations(width * height);
+
+        std::vector<USHORT> frame(width * height);
+        FillDepthFrame(&frame[0], width, height);
+        const BYTE* pBuffer = reinterpret_cast<const BYTE*>(&frame[0]);
+
+        std::vector<BYTE> encoded(DepthCodec::GetMaxEncodedSize(width, height));
+        size_t encodedSize = 0;
+
+        double start = GetSeconds();
+        for (int n = 0; n < iterations; ++n)
+        {
+            encodedSize = DepthCodec::Encode(pBuffer, pitch, width, height, &encoded[0]);
+        }
+        double encodeSeconds = GetSeconds() - start;
+
+        printf("%lux%lu, %d frames, %.2f:1 (%lu of %lu bytes)\n", width, height, iterations,
+            static_cast<double>(frameSize) / encodedSize, static_cast<DWORD>(encodedSize), static_cast<DWORD>(frameSize));
+        PrintResult("encode", encodeSeconds, iterations, frameSize);
+
+        std::vector<USHORT> decoded(width * height);
+        for (SimdPath path = PATH_SCALAR; path != PATH_AUTO; path = GetNextPath(path, DepthCodec::PATHS))
+        {
+            start = GetSeconds();
+            for (int n = 0; n < iterations; ++n)
+            {
+                DepthCodec::Decode(&encoded[0], encodedSize, reinterpret_cast<BYTE*>(&decoded[0]), pitch, width, height, path);
+            }
+            double seconds = GetSeconds() - start;
+
+            char name[32];
+            sprintf_s(name, "decode %s%s", PATH_NAMES[path], decoded == frame ? "" : " MISMATCH");
+            PrintResult(name, seconds, iterations, frameSize);
+        }
+    }
+}
+
+/// <summary>
+/// Times the two chained perspective warps of the depth edge filter against one pass of the warp engine
+/// </summary>
+void Benchmark::RunWarp()
+{
+    printf("\nDepth warp to the rectified trapezoid\n");
+
+    // The depth to color alignment and the trapezoid rectification of the edge filter
+    const Point2f frameCorners[4] = { Point2f(0, 0), Point2f(639, 0), Point2f(0, 479), Point2f(639, 479) };
+    const Point2f alignedCorners[4] = { Point2f(38, 36), Point2f(621, 36), Point2f(38, 473), Point2f(621, 473) };
+    const Point2f trapezoidCorners[4] = { Point2f(156, 138), Point2f(468, 138), Point2f(163, 340), Point2f(463, 340) };
+    const Point2f rectangleCorners[4] = { Point2f(20, 20), Point2f(619, 20), Point2f(20, 459), Point2f(619, 459) };
+    const Mat chain[] = { getPerspectiveTransform(frameCorners, alignedCorners), getPerspectiveTransform(trapezoidCorners, rectangleCorners) };
+
+    const Size size(640, 480);
+    const int iterations = GetIterations(size.area());
+
+    // A band mask like the one the filter warps
+    std::vector<USHORT> depth(size.area());
+    FillDepthFrame(&depth[0], size.width, size.height);
+    Mat mask(size, CV_8UC1);
+    DepthConverter::ToBandMask(reinterpret_cast<const BYTE*>(&depth[0]), size.width * sizeof(USHORT), mask.data, mask.step,
+        size.width, size.height, 800, 4000);
+
+    printf("%dx%d, %d frames\n", size.width, size.height, iterations);
+
+    Mat warped, rectified;
+    double start = GetSeconds();
+    for (int n = 0; n < iterations; ++n)
+    {
+        warpPerspective(mask, warped, chain[0], size);
+        warpPerspective(warped, rectified, chain[1], size);
+    }
+    PrintResult("chained", GetSeconds() - start, iterations, size.area());
+
+    WarpEngine warpEngine;
+    start = GetSeconds();
+    warpEngine.SetTransform(chain, ARRAYSIZE(chain), size, size);
+    PrintResult("build tables", GetSeconds() - start, 1, size.area());
+
+    start = GetSeconds();
+    for (int n = 0; n < iterations; ++n)
+    {
+        // As in the filter, the transform is checked every frame
+        warpEngine.SetTransform(chain, ARRAYSIZE(chain), size, size);
+        warpEngine.Apply(mask, &warped);
+    }
+    PrintResult("composed", GetSeconds() - start, iterations, size.area());
+}
+
+/// <summary>
+/// Times the latency of the color and depth edge filters run one after the other against run concurrently
+/// </summary>
+void Benchmark::RunStreams()
+{
+    printf("\nColor and depth edge filters\n");
+
+    // Depth frame handed to the worker
+    struct DepthJob
+    {
+        OpenCVHelper* pHelper;
+        Socket* pSocket;
+        Mat mask;
+
+        static HRESULT Run(LPVOID pContext)
+        {
+            DepthJob* pJob = reinterpret_cast<DepthJob*>(pContext);
+            Mat depthImage = pJob->mask;
+            return pJob->pHelper->ApplyDepthFilter(&depthImage, pJob->pSocket);
+        }
+    };
+
+    const Size size(640, 480);
+    const int iterations = GetIterations(size.area());
+
+    // A color frame and a band mask like the ones the filters get, the socket is never connected
+    Mat color(size, CV_8UC4);
+    FillFrame(color.data, color.total() * color.elemSize());
+
+    std::vector<USHORT> depth(size.area());
+    FillDepthFrame(&depth[0], size.width, size.height);
+    Mat mask(size, CV_8UC1);
+    DepthConverter::ToBandMask(reinterpret_cast<const BYTE*>(&depth[0]), size.width * sizeof(USHORT), mask.data, mask.step,
+        size.width, size.height, 800, 4000);
+
+    OpenCVHelper helper;
+    helper.SetColorFilter(IDM_COLOR_FILTER_CANNYEDGE);
+    helper.SetDepthFilter(IDM_DEPTH_FILTER_CANNYEDGE);
+    Socket socket;
+
+    printf("%dx%d, %d frame pairs\n", size.width, size.height, iterations);
+
+    DepthJob job = { &helper, &socket, mask };
+
+    double start = GetSeconds();
+    for (int n = 0; n < iterations; ++n)
+    {
+        Mat colorImage = color;
+        helper.ApplyColorFilter(&colorImage, &socket);
+        DepthJob::Run(&job);
+    }
+    PrintResult("serial", GetSeconds() - start, iterations, size.area() * 5);
+
+    FrameWorker worker;
+    worker.Start(DepthJob::Run, &job);
+
+    start = GetSeconds();
+    for (int n = 0; n < iterations; ++n)
+    {
+        worker.Post();
+        Mat colorImage = color;
+        helper.ApplyColorFilter(&colorImage, &socket);
+        worker.Wait();
+    }
+    PrintResult("concurrent", GetSeconds() - start, iterations, size.area() * 5);
+}
+
+/// <summary>
+/// Times the depth edge filter on a still scene without and with the scene gate, and the gate's change count
+/// </summary>
+void Benchmark::RunSceneGate()
+{
+    printf("\nDepth edge filter on a still scene\n");
+
+    const Size size(640, 480);
+    const int iterations = GetIterations(size.area());
+
+    std::vector<USHORT> depth(size.area());
+    FillDepthFrame(&depth[0], size.width, size.height);
+    Mat mask(size, CV_8UC1);
+    DepthConverter::ToBandMask(reinterpret_cast<const BYTE*>(&depth[0]), size.width * sizeof(USHORT), mask.data, mask.step,
+        size.width, size.height, 800, 4000);
+
+    printf("%dx%d, %d frames\n", size.width, size.height, iterations);
+
+    // The socket is never connected
+    Socket socket;
+    const double thresholds[] = { 0.0, 0.005 };
+    const char* const names[] = { "ungated", "gated" };
+    for (int i = 0; i < ARRAYSIZE(thresholds); ++i)
+    {
+        OpenCVHelper helper;
+        helper.SetDepthFilter(IDM_DEPTH_FILTER_CANNYEDGE);
+        helper.SetSceneGate(thresholds[i]);
+
+        double start = GetSeconds();
+        for (int n = 0; n < iterations; ++n)
+        {
+            Mat depthImage = mask;
+            helper.ApplyDepthFilter(&depthImage, &socket);
+        }
+        PrintResult(names[i], GetSeconds() - start, iterations, size.area());
+    }
+
+    // The thumbnail of the trapezoid the gate compares
+    const Size thumbnailSize(80, 52);
+    Mat thumbnail(thumbnailSize, CV_8UC1);
+    Mat reference(thumbnailSize, CV_8UC1);
+    FillFrame(thumbnail.data, thumbnail.total());
+    FillFrame(reference.data, reference.total());
+    reference.data[0] ^= 0xff;
+
+    const int countIterations = GetIterations(thumbnailSize.area());
+    size_t scalarCount = 0;
+    for (SimdPath path = PATH_SCALAR; path != PATH_AUTO; path = GetNextPath(path, SceneChangeGate::PATHS))
+    {
+        size_t changed = 0;
+        double start = GetSeconds();
+        for (int n = 0; n < countIterations; ++n)
+        {
+            changed += SceneChangeGate::CountChanged(thumbnail.data, reference.data, thumbnail.total(),
+                SceneChangeGate::DEFAULT_PIXEL_THRESHOLD, path);
+        }
+        double seconds = GetSeconds() - start;
+
+        if (path == PATH_SCALAR)
+        {
+            scalarCount = changed;
+        }
+
+        char name[32];
+        sprintf_s(name, "count %s%s", PATH_NAMES[path], changed == scalarCount ? "" : " MISMATCH");
+        PrintResult(name, seconds, countIterations, thumbnailSize.area() * 2);
+    }
+}
+
+/// <summary>
+/// Times finding the target candidates with a contour tree against the component labeler
+/// </summary>
+void Benchmark::RunLabeling()
+{
+    printf("\nTarget candidates in the edges\n");
+
+    const Size size(640, 480);
+    const int iterations = GetIterations(size.area());
+
+    // The closed edges of a band mask, with rings of a target's size scattered over it
+    std::vector<USHORT> depth(size.area());
+    FillDepthFrame(&depth[0], size.width, size.height);
+    Mat mask(size, CV_8UC1);
+    DepthConverter::ToBandMask(reinterpret_cast<const BYTE*>(&depth[0]), size.width * sizeof(USHORT), mask.data, mask.step,
+        size.width, size.height, 800, 4000);
+
+    Mat blurred, edges;
+    blur(mask, blurred, Size(7, 7));
+    Canny(blurred, edges, 5.0, 20.0);
+    for (int i = 0; i < 40; ++i)
+    {
+        circle(edges, Point(40 + (i % 8) * 75, 60 + (i / 8) * 90), 8 + i % 6, Scalar(255), 2);
+    }
+
+    printf("%dx%d, %d frames\n", size.width, size.height, iterations);
+
+    std::vector<std::vector<Point> > contours;
+    std::vector<Vec4i> hierarchy;
+    size_t treeCount = 0;
+    double start = GetSeconds();
+    for (int n = 0; n < iterations; ++n)
+    {
+        findContours(edges, contours, hierarchy, RETR_TREE, CHAIN_APPROX_SIMPLE);
+
+        treeCount = 0;
+        for (size_t i = 0; i < contours.size(); ++i)
+        {
+            double area = contourArea(contours[i]);
+            if (area > 200 && area < 700)
+            {
+                moments(contours[i]);
+                ++treeCount;
+            }
+        }
+    }
+    PrintResult("contour tree", GetSeconds() - start, iterations, size.area());
+
+    ComponentLabeler labeler;
+    std::vector<Point> contour;
+    start = GetSeconds();
+    for (int n = 0; n < iterations; ++n)
+    {
+        labeler.Label(edges, 200, 700);
+        for (size_t i = 0; i < labeler.GetComponents().size(); ++i)
+        {
+            labeler.GetContour(i, &contour);
+        }
+    }
+    PrintResult("labeler", GetSeconds() - start, iterations, size.area());
+
+    printf("  %u candidates in the contour tree, %u components\n", static_cast<UINT>(treeCount),
+        static_cast<UINT>(labeler.GetComponents().size()));
+}
+
+/// <summary>
+/// Times the edge detection at full resolution against the pyramid one stage by stage, and
+/// compares the candidates they find
+/// </summary>
+/// <param name="replayPath">path of a recording whose depth frames to detect on, or NULL for synthetic frames</param>
+void Benchmark::RunPyramid(LPCWSTR replayPath)
+{
+    printf("\nPyramid edge detection\n");
+
+    OpenCVHelper helper;
+    std::vector<Mat> frames;
+    if (replayPath && FAILED(LoadDepthFrames(replayPath, &helper, &frames)))
+    {
+        printf("  could not read the recording, using synthetic frames\n");
+        frames.clear();
+    }
+
+    const bool isRecorded = !frames.empty();
+    if (!isRecorded)
+    {
+        FillTargetFrames(&frames, 8);
+    }
+
+    const int frameCount = static_cast<int>(frames.size());
+    const Size size = frames[0].size();
+    const Size coarseSize((size.width + 1) / 2, (size.height + 1) / 2);
+    int passes = GetIterations(size.area()) / frameCount;
+    passes = passes < 1 ? 1 : passes;
+
+    printf("%dx%d, %d %s frames, %d passes\n", size.width, size.height, frameCount, isRecorded ? "recorded" : "synthetic", passes);
+
+    // The edge chain of the depth edge filter at the full rectified resolution and at half of it,
+    // as OpenCVHelper::SetRoiResolution sizes the kernels and CoarseLabelStage widens the area range
+    const Size blurSize(7, 7);
+    const Size coarseBlurSize(5, 5);
+    const Mat element = getStructuringElement(MORPH_ELLIPSE, Size(5, 5), Point(2, 2));
+    const Mat coarseElement = getStructuringElement(MORPH_ELLIPSE, Size(3, 3), Point(1, 1));
+    const double minThreshold = 5.0;
+    const double maxThreshold = 20.0;
+    const int minArea = 200;
+    const int maxArea = 700;
+    const int minCoarseArea = minArea / 8;
+    const int maxCoarseArea = maxArea / 2;
+
+    enum Stage
+    {
+        FULL_BLUR = 0,
+        FULL_CANNY,
+        FULL_CLOSE,
+        FULL_LABEL,
+        PYRAMID_DOWN,
+        COARSE_BLUR,
+        COARSE_CANNY,
+        COARSE_CLOSE,
+        COARSE_LABEL,
+        REFINE,
+        STAGE_COUNT
+    };
+    const char* const stageNames[STAGE_COUNT] =
+    {
+        "full blur", "full canny", "full close", "full label",
+        "pyramid down", "coarse blur", "coarse canny", "coarse close", "coarse label", "refine"
+    };
+    double seconds[STAGE_COUNT] = {};
+    double marks[STAGE_COUNT + 1];
+
+    PyramidRefiner::Settings settings;
+    settings.blurSize = blurSize;
+    settings.edgeElement = element;
+    settings.minThreshold = minThreshold;
+    settings.maxThreshold = maxThreshold;
+    settings.minArea = minArea;
+    settings.maxArea = maxArea;
+
+    Mat blurred, edges, morph;
+    Mat coarse, coarseBlurred, coarseEdges, coarseMorph;
+    ComponentLabeler labeler;
+    ComponentLabeler coarseLabeler;
+    PyramidRefiner refiner;
+    std::vector<Point> contour;
+    std::vector<Component> refined;
+    std::vector<std::vector<Point> > refinedContours;
+
+    // Candidates at full resolution and how close the refined and the coarse ones come to them
+    UINT fullCount = 0;
+    UINT foundCount = 0;
+    UINT refinedCount = 0;
+    double refinedError = 0.0;
+    double maxRefinedError = 0.0;
+    double coarseError = 0.0;
+    double maxCoarseError = 0.0;
+    double windowCount = 0.0;
+    double filteredPixelCount = 0.0;
+
+    for (int pass = 0; pass < passes; ++pass)
+    {
+        for (int f = 0; f < frameCount; ++f)
+        {
+            const Mat& frame = frames[f];
+
+            marks[FULL_BLUR] = GetSeconds();
+            blur(frame, blurred, blurSize);
+            marks[FULL_CANNY] = GetSeconds();
+            Canny(blurred, edges, minThreshold, maxThreshold);
+            marks[FULL_CLOSE] = GetSeconds();
+            dilate(edges, morph, element);
+            erode(morph, edges, element);
+            marks[FULL_LABEL] = GetSeconds();
+            labeler.Label(edges, minArea, maxArea);
+            for (size_t i = 0; i < labeler.GetComponents().size(); ++i)
+            {
+                labeler.GetContour(i, &contour);
+            }
+
+            marks[PYRAMID_DOWN] = GetSeconds();
+            pyrDown(frame, coarse, coarseSize);
+            marks[COARSE_BLUR] = GetSeconds();
+            blur(coarse, coarseBlurred, coarseBlurSize);
+            marks[COARSE_CANNY] = GetSeconds();
+            Canny(coarseBlurred, coarseEdges, minThreshold, maxThreshold);
+            marks[COARSE_CLOSE] = GetSeconds();
+            dilate(coarseEdges, coarseMorph, coarseElement);
+            erode(coarseMorph, coarseEdges, coarseElement);
+            marks[COARSE_LABEL] = GetSeconds();
+            coarseLabeler.Label(coarseEdges, minCoarseArea, maxCoarseArea);
+            marks[REFINE] = GetSeconds();
+            refiner.Refine(frame, coarseLabeler.GetComponents(), settings, &refined, &refinedContours);
+            marks[STAGE_COUNT] = GetSeconds();
+
+            for (int stage = 0; stage < STAGE_COUNT; ++stage)
+            {
+                seconds[stage] += marks[stage + 1] - marks[stage];
+            }
+
+            if (pass > 0)
+            {
+                continue;
+            }
+
+            // The pixel centers of the half resolution level are at 2x + 0.5 at full resolution
+            const std::vector<Component>& components = labeler.GetComponents();
+            for (size_t i = 0; i < components.size(); ++i)
+            {
+                ++fullCount;
+
+                double error = GetNearestDistance(components[i].centroid, refined, 1.0, 0.0);
+                if (error <= 1.0)
+                {
+                    ++foundCount;
+                    refinedError += error;
+                    maxRefinedError = error > maxRefinedError ? error : maxRefinedError;
+                }
+
+                error = GetNearestDistance(components[i].centroid, coarseLabeler.GetComponents(), 2.0, 0.5);
+                error = error < 4.0 ? error : 4.0;
+                coarseError += error;
+                maxCoarseError = error > maxCoarseError ? error : maxCoarseError;
+            }
+            refinedCount += static_cast<UINT>(refined.size());
+            windowCount += refiner.GetWindowCount();
+            filteredPixelCount += refiner.GetFilteredPixelCount();
+        }
+    }
+
+    const int runs = passes * frameCount;
+    double fullSeconds = 0.0;
+    double pyramidSeconds = 0.0;
+    for (int stage = 0; stage < STAGE_COUNT; ++stage)
+    {
+        // Bytes read by the stage: a full frame, a coarse one, or the refined windows
+        size_t bytes = coarseSize.area();
+        if (stage <= PYRAMID_DOWN)
+        {
+            bytes = size.area();
+        }
+        else if (stage == REFINE)
+        {
+            bytes = static_cast<size_t>(filteredPixelCount / frameCount);
+        }
+        PrintResult(stageNames[stage], seconds[stage], runs, bytes);
+
+        if (stage < PYRAMID_DOWN)
+        {
+            fullSeconds += seconds[stage];
+        }
+        else
+        {
+            pyramidSeconds += seconds[stage];
+        }
+    }
+    PrintResult("full total", fullSeconds, runs, size.area());
+    PrintResult("pyramid total", pyramidSeconds, runs, size.area());
+
+    printf("  %u candidates at full resolution, %u found by the pyramid, %u missed, %u extra\n",
+        fullCount, foundCount, fullCount - foundCount, refinedCount > foundCount ? refinedCount - foundCount : 0);
+    printf("  centroid error: refined mean %.3f max %.3f px, coarse mean %.3f max %.3f px\n",
+        foundCount ? refinedError / foundCount : 0.0, maxRefinedError,
+        fullCount ? coarseError / fullCount : 0.0, maxCoarseError);
+    printf("  refined %.1f windows, %.1f%% of the pixels per frame\n",
+        windowCount / frameCount, filteredPixelCount * 100.0 / (static_cast<double>(frameCount) * size.area()));
+}
+
+/// <summary>
+/// Times the blur, Canny and closing of the edge filter one after the other against the
+/// tiled edge chain on 1 to N threads, and checks the edges are the same
+/// </summary>
+void Benchmark::RunTiledEdges()
+{
+    printf("\nTiled edge chain\n");
+
+    const Size size(640, 480);
+    const int iterations = GetIterations(size.area());
+
+    // A band mask like the one the depth filter gets, and noise whose edges cross every band
+    std::vector<USHORT> depth(size.area());
+    FillDepthFrame(&depth[0], size.width, size.height);
+    Mat mask(size, CV_8UC1);
+    DepthConverter::ToBandMask(reinterpret_cast<const BYTE*>(&depth[0]), size.width * sizeof(USHORT), mask.data, mask.step,
+        size.width, size.height, 800, 4000);
+
+    Mat noise(size, CV_8UC1);
+    FillFrame(noise.data, noise.total());
+
+    TiledEdgeChain::Settings settings;
+    settings.blurSize = Size(7, 7);
+    settings.edgeElement = getStructuringElement(MORPH_ELLIPSE, Size(5, 5), Point(2, 2));
+    settings.minThreshold = 5.0;
+    settings.maxThreshold = 20.0;
+
+    // One thread per processor, the calling thread included
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    const int processorCount = static_cast<int>(systemInfo.dwNumberOfProcessors);
+    const int maxThreadCount = processorCount < TiledEdgeChain::MAX_THREAD_COUNT ? processorCount : TiledEdgeChain::MAX_THREAD_COUNT;
+
+    printf("%dx%d, %d frames, %d processors\n", size.width, size.height, iterations, processorCount);
+
+    const Mat images[] = { mask, noise };
+    const char* const imageNames[] = { "mask", "noise" };
+    for (int i = 0; i < ARRAYSIZE(images); ++i)
+    {
+        Mat blurred, edges, morph, closed;
+        double start = GetSeconds();
+        for (int n = 0; n < iterations; ++n)
+        {
+            blur(images[i], blurred, settings.blurSize);
+            Canny(blurred, edges, settings.minThreshold, settings.maxThreshold);
+            dilate(edges, morph, settings.edgeElement);
+            erode(morph, closed, settings.edgeElement);
+        }
+        double serialSeconds = GetSeconds() - start;
+
+        char name[32];
+        sprintf_s(name, "%s serial", imageNames[i]);
+        PrintResult(name, serialSeconds, iterations, size.area());
+
+        TiledEdgeChain edgeChain;
+        Mat tiled;
+        for (int threadCount = 1; threadCount <= maxThreadCount; ++threadCount)
+        {
+            edgeChain.SetThreadCount(threadCount);
+
+            start = GetSeconds();
+            for (int n = 0; n < iterations; ++n)
+            {
+                edgeChain.Run(images[i], settings, &tiled);
+            }
+            double seconds = GetSeconds() - start;
+
+            const bool isSame = countNonZero(tiled != closed) == 0;
+            sprintf_s(name, "%s %d thread%s%s", imageNames[i], threadCount, threadCount > 1 ? "s" : "", isSame ? "" : " MISMATCH");
+            PrintResult(name, seconds, iterations, size.area());
+            printf("  %-20s %9.2fx speedup\n", "", serialSeconds / seconds);
+        }
+    }
+}
+
+/// <summary>
+/// Times segmenting and learning the depth frames with the background model, for every code
+/// path, and checks the paths find the same foreground
+/// </summary>
+void Benchmark::RunDepthBackground()
+{
+    printf("\nDepth background subtraction\n");
+
+    for (int i = 0; i < RESOLUTION_COUNT; ++i)
+    {
+        DWORD width, height;
+        NuiImageResolutionToSize(RESOLUTIONS[i], width, height);
+
+        const int iterations = GetIterations(width * height);
+
+        // The scene learned as the table, then a block standing on it
+        Mat table(height, width, CV_16UC1);
+        FillDepthFrame(table.ptr<USHORT>(), width, height);
+        const Rect blockRect(width / 8, height / 8, width / 4, height / 4);
+        Mat scene = table.clone();
+        Mat block = scene(blockRect);
+        block -= Scalar(100 << NUI_IMAGE_PLAYER_INDEX_SHIFT);
+
+        printf("%lux%lu, %d frames\n", width, height, iterations);
+
+        DepthBackground background;
+        Mat foreground(height, width, CV_8UC1);
+        double start = GetSeconds();
+        for (int n = 0; n < iterations; ++n)
+        {
+            background.Segment(table, &foreground);
+            background.Learn(table, foreground);
+        }
+        PrintResult("learn", GetSeconds() - start, iterations, table.total() * table.elemSize());
+
+        Mat scalarForeground;
+        for (SimdPath path = PATH_SCALAR; path != PATH_AUTO; path = GetNextPath(path, DepthBackground::PATHS))
+        {
+            start = GetSeconds();
+            for (int n = 0; n < iterations; ++n)
+            {
+                background.Segment(scene, &foreground, path);
+            }
+            double seconds = GetSeconds() - start;
+
+            if (path == PATH_SCALAR)
+            {
+                scalarForeground = foreground.clone();
+            }
+
+            char name[32];
+            sprintf_s(name, "segment %s%s", PATH_NAMES[path], countNonZero(foreground != scalarForeground) == 0 ? "" : " MISMATCH");
+            PrintResult(name, seconds, iterations, scene.total() * scene.elemSize());
+        }
+
+        printf("%d of %d block pixels in the foreground\n", countNonZero(foreground(blockRect)), blockRect.area());
+    }
+}
+
+/// <summary>
+/// Times mapping the candidates to the table with the calibration's homography, for every
+/// code path, and checks the paths give the same positions
+/// </summary>
+void Benchmark::RunTableCalibration()
+{
+    printf("\nTable calibration\n");
+
+    // A slightly tilted table, and as many candidates as a busy frame has
+    const Point2f pixels[] = { Point2f(20, 20), Point2f(620, 20), Point2f(20, 460), Point2f(620, 460) };
+    const Point2f table[] = { Point2f(110, 300), Point2f(104, -296), Point2f(512, 303), Point2f(507, -301) };
+    TableCalibration calibration;
+    calibration.Fit(pixels, table, ARRAYSIZE(pixels));
+
+    const int candidateCount = 64;
+    std::vector<Point2f> candidates(candidateCount);
+    std::vector<BYTE> noise(candidateCount * 2);
+    FillFrame(&noise[0], noise.size());
+    for (int i = 0; i < candidateCount; ++i)
+    {
+        candidates[i] = Point2f(noise[2 * i] * 2.5f + 0.25f, noise[2 * i + 1] * 1.875f + 0.75f);
+    }
+
+    const int iterations = GetIterations(candidateCount);
+    printf("%d candidates, %d frames\n", candidateCount, iterations);
+
+    std::vector<Point2f> positions(candidateCount);
+    std::vector<Point2f> scalarPositions;
+    for (SimdPath path = PATH_SCALAR; path != PATH_AUTO; path = GetNextPath(path, TableCalibration::PATHS))
+    {
+        double start = GetSeconds();
+        for (int n = 0; n < iterations; ++n)
+        {
+            calibration.Transform(&candidates[0], &positions[0], candidateCount, path);
+        }
+        double seconds = GetSeconds() - start;
+
+        if (path == PATH_SCALAR)
+        {
+            scalarPositions = positions;
+        }
+
+        char name[32];
+        sprintf_s(name, "transform %s%s", PATH_NAMES[path], positions == scalarPositions ? "" : " MISMATCH");
+        PrintResult(name, seconds, iterations, candidateCount * sizeof(Point2f));
+    }
+}
+
+/// <summary>
+/// Gets the number of iterations to run for a frame size, so each measurement takes a similar time
+/// </summary>
+/// <param name="pixels">number of pixels in the frame</param>
+/// <returns>number of iterations</returns>
+int Benchmark::GetIterations(DWORD pixels)
+{
+    const DWORD totalPixels = 64 * 1024 * 1024;
+    const int minIterations = 10;
+
+    int iterations = static_cast<int>(totalPixels / pixels);
+    return iterations < minIterations ? minIterations : iterations;
+}
+
+/// <summary>
+/// Prints one result line
+/// </summary>
+/// <param name="name">name of the measured path</param>
+/// <param name="seconds">total time</param>
+/// <param name="iterations">number of frames processed</param>
+/// <param name="bytesPerFrame">bytes read per frame, for the throughput</param>
+void Benchmark::PrintResult(const char* name, double seconds, int iterations, size_t bytesPerFrame)
+{
+    double msPerFrame = seconds * 1000.0 / iterations;
+    double megabytesPerSecond = static_cast<double>(bytesPerFrame) * iterations / (seconds * 1024.0 * 1024.0);
+    printf("  %-20s %9.4f ms/frame %10.1f MB/s\n", name, msPerFrame, megabytesPerSecond);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <windows.h>
+#include <NuiApi.h>
+
+/// <summary>
+/// Micro-benchmarks for the per-frame processing paths, run with the /benchmark switch.
+/// Each benchmark runs on synthetic frames for every NUI_IMAGE_RESOLUTION and prints
+/// the time per frame and throughput to stdout. The pyramid benchmark runs on the depth
+/// frames of a recording when one is given.
+/// </summary>
+class Benchmark
+{
+public:
+    /// <summary>
+    /// Runs all benchmarks
+    /// </summary>
+    /// <param name="replayPath">path of a recording for the benchmarks that can use recorded frames, or NULL</param>
+    /// <returns>0</returns>
+    static int Run(LPCWSTR replayPath = NULL);
+
+    /// <summary>
+    /// Times the original per-pixel color copy against every color format and code path
+    /// </summary>
+    static void RunColorConversion();
+
+    /// <summary>
+    /// Times the original per-pixel depth colorization against the depth to color table
+    /// </summary>
+    static void RunDepthConversion();
+
+    /// <summary>
+    /// Times the colorize and convert to gray round trip the depth edge filter used against the band mask
+    /// </summary>
+    static void RunDepthMask();
+
+    /// <summary>
+    /// Times encoding and decoding depth frames with the lossless depth codec
+    /// </summary>
+    static void RunDepthCodec();
+
+    /// <summary>
+    /// Times the two chained perspective warps of the depth edge filter against one pass of the warp engine
+    /// </summary>
+    static void RunWarp();
+
+    /// <summary>
+    /// Times the latency of the color and depth edge filters run one after the other against run concurrently
+    /// </summary>
+    static void RunStreams();
+
+    /// <summary>
+    /// Times the depth edge filter on a still scene without and with the scene gate, and the gate's change count
+    /// </summary>
+    static void RunSceneGate();
+
+    /// <summary>
+    /// Times finding the target candidates with a contour tree against the component labeler
+    /// </summary>
+    static void RunLabeling();
+
+    /// <summary>
+    /// Times the edge detection at full resolution against the pyramid one stage by stage, and
+    /// compares the candidates they find
+    /// </summary>
+    /// <param name="replayPath">path of a recording whose depth frames to detect on, or NULL for synthetic frames</param>
+    static void RunPyramid(LPCWSTR replayPath);
+
+    /// <summary>
+    /// Times the blur, Canny and closing of the edge filter one after the other against the
+    /// tiled edge chain on 1 to N threads, and checks the edges are the same
+    /// </summary>
+    static void RunTiledEdges();
+
+    /// <summary>
+    /// Times segmenting and learning the depth frames with the background model, for every code
+    /// path, and checks the paths find the same foreground
+    /// </summary>
+    static void RunDepthBackground();
+
+    /// <summary>
+    /// Times mapping the candidates to the table with the calibration's homography, for every
+    /// code path, and checks the paths give the same positions
+    /// </summary>
+    static void RunTableCalibration();
+
+private:
+    /// <summary>
+    /// Gets the number of iterations to run for a frame size, so each measurement takes a similar time
+    /// </summary>
+    /// <param name="pixels">number of pixels in the frame</param>
+    /// <returns>number of iterations</returns>
+    static int GetIterations(DWORD pixels);
+
+    /// <summary>
+    /// Prints one result line
+    /// </summary>
+    /// <param name="name">name of the measured path</param>
+    /// <param name="seconds">total time</param>
+    /// <param name="iterations">number of frames processed</param>
+    /// <param name="bytesPerFrame">bytes read per frame, for the throughput</param>
+    static void PrintResult(const char* name, double seconds, int iterations, size_t bytesPerFrame);
+
+    // Resolutions the benchmarks run at, from smallest to largest
+    static const NUI_IMAGE_RESOLUTION RESOLUTIONS[];
+    static const int RESOLUTION_COUNT;
+};
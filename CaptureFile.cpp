@@ -0,0 +1,496 @@
+#include "CaptureFile.h"
+#include "DepthCodec.h"
+
+using namespace Microsoft::KinectBridge;
+
+/// <summary>
+/// Constructor
+/// </summary>
+CaptureWriter::CaptureWriter() :
+    m_hFile(INVALID_HANDLE_VALUE),
+    m_colorResolution(NUI_IMAGE_RESOLUTION_INVALID),
+    m_depthResolution(NUI_IMAGE_RESOLUTION_INVALID),
+    m_isCompressingDepth(false),
+    m_queueHead(0),
+    m_queueCount(0),
+    m_isClosing(false),
+    m_hWriterThread(NULL),
+    m_hQueueEvent(NULL),
+    m_writeBufferUsed(0),
+    m_fileOffset(0),
+    m_writeResult(S_OK),
+    m_writtenFrameCount(0),
+    m_droppedFrameCount(0)
+{
+    InitializeCriticalSection(&m_lock);
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+CaptureWriter::~CaptureWriter()
+{
+    Close();
+    DeleteCriticalSection(&m_lock);
+}
+
+/// <summary>
+/// Creates the capture file, replacing any existing one, and starts the writer thread
+/// </summary>
+/// <param name="path">path of the file to create</param>
+/// <param name="colorResolution">resolution of the recorded color frames</param>
+/// <param name="depthResolution">resolution of the recorded depth frames</param>
+/// <param name="compressDepth">true to encode depth frames with DepthCodec</param>
+/// <param name="queueLength">number of frames that can wait to be written</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT CaptureWriter::Open(LPCWSTR path, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution, bool compressDepth /* = true */, UINT queueLength /* = DEFAULT_QUEUE_LENGTH */)
+{
+    Close();
+
+    if (queueLength == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    HANDLE hFile = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Everything the writer thread needs is allocated up front, queueing a frame never allocates
+    m_hFile = hFile;
+    m_colorResolution = colorResolution;
+    m_depthResolution = depthResolution;
+    m_isCompressingDepth = compressDepth;
+    m_queue.resize(queueLength);
+    m_queueHead = 0;
+    m_queueCount = 0;
+    m_isClosing = false;
+    m_writeBuffer.resize(WRITE_BUFFER_SIZE);
+    if (compressDepth)
+    {
+        DWORD width, height;
+        NuiImageResolutionToSize(depthResolution, width, height);
+        m_encodeBuffer.resize(DepthCodec::GetMaxEncodedSize(width, height));
+    }
+    m_writeBufferUsed = 0;
+    m_fileOffset = 0;
+    m_index.clear();
+    m_writeResult = S_OK;
+    m_writtenFrameCount = 0;
+    m_droppedFrameCount = 0;
+
+    CaptureFileHeader header;
+    header.magic = CAPTURE_FILE_MAGIC;
+    header.version = CAPTURE_FILE_VERSION;
+    header.colorResolution = colorResolution;
+    header.depthResolution = depthResolution;
+
+    HRESULT hr = Append(&header, sizeof(header));
+    if (SUCCEEDED(hr))
+    {
+        hr = Append(NULL, static_cast<size_t>(AlignCaptureOffset(m_fileOffset) - m_fileOffset));
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_hQueueEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        m_hWriterThread = CreateThread(NULL, 0, WriterThread, this, 0, NULL);
+        if (!m_hWriterThread)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        // Closes the file without writing an index
+        m_writeResult = hr;
+        Close();
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Writes the queued frames and the frame index, then closes the capture file
+/// </summary>
+/// <returns>S_OK if successful, the first write error otherwise</returns>
+HRESULT CaptureWriter::Close()
+{
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return S_OK;
+    }
+
+    // Let the writer thread drain the queue
+    if (m_hWriterThread)
+    {
+        EnterCriticalSection(&m_lock);
+        m_isClosing = true;
+        LeaveCriticalSection(&m_lock);
+
+        SetEvent(m_hQueueEvent);
+        WaitForSingleObject(m_hWriterThread, INFINITE);
+        CloseHandle(m_hWriterThread);
+        m_hWriterThread = NULL;
+    }
+
+    if (m_hQueueEvent)
+    {
+        CloseHandle(m_hQueueEvent);
+        m_hQueueEvent = NULL;
+    }
+
+    // Append the index, a file without one is still readable by scanning its records
+    if (SUCCEEDED(m_writeResult))
+    {
+        CaptureFileFooter footer;
+        footer.indexOffset = m_fileOffset;
+        footer.recordCount = static_cast<DWORD>(m_index.size());
+        footer.magic = CAPTURE_INDEX_MAGIC;
+
+        HRESULT hr = m_index.empty() ? S_OK : Append(m_index.data(), m_index.size() * sizeof(CaptureIndexEntry));
+        if (SUCCEEDED(hr))
+        {
+            hr = Append(&footer, sizeof(footer));
+        }
+        if (SUCCEEDED(hr))
+        {
+            hr = Flush();
+        }
+        m_writeResult = hr;
+    }
+
+    CloseHandle(m_hFile);
+    m_hFile = INVALID_HANDLE_VALUE;
+
+    // Release the buffers, recordings can run for hours
+    std::vector<BYTE>().swap(m_writeBuffer);
+    std::vector<BYTE>().swap(m_encodeBuffer);
+    std::vector<CaptureIndexEntry>().swap(m_index);
+
+    return m_writeResult;
+}
+
+/// <summary>
+/// Returns whether a capture file is open
+/// </summary>
+/// <returns>true if a file is open, false otherwise</returns>
+bool CaptureWriter::IsOpen() const
+{
+    return m_hFile != INVALID_HANDLE_VALUE;
+}
+
+/// <summary>
+/// Queues an image frame. The writer holds a reference to the slot until the frame
+/// has been written. Frames whose resolution differs from the file's are rejected.
+/// </summary>
+/// <param name="stream">CAPTURE_STREAM_COLOR or CAPTURE_STREAM_DEPTH</param>
+/// <param name="resolution">resolution of the frame</param>
+/// <param name="frameNumber">frame number reported by the source</param>
+/// <param name="timestamp">capture time in milliseconds</param>
+/// <param name="pitch">row pitch of the frame data</param>
+/// <param name="pSlot">pooled slot holding the frame data</param>
+/// <param name="size">size of the frame data in bytes</param>
+/// <returns>S_OK if queued, S_FALSE if the queue was full and the frame dropped, an error code otherwise</returns>
+HRESULT CaptureWriter::WriteImageFrame(CaptureStream stream, NUI_IMAGE_RESOLUTION resolution, DWORD frameNumber, LONGLONG timestamp, INT pitch, FrameSlot* pSlot, INT size)
+{
+    NUI_IMAGE_RESOLUTION fileResolution = (stream == CAPTURE_STREAM_COLOR) ? m_colorResolution : m_depthResolution;
+    if (resolution != fileResolution || !pSlot || size > pSlot->capacity)
+    {
+        return E_INVALIDARG;
+    }
+
+    CaptureRecordHeader header;
+    header.stream = stream;
+    header.frameNumber = frameNumber;
+    header.timestamp = timestamp;
+    header.pitch = pitch;
+    header.size = size;
+    header.encoding = CAPTURE_ENCODING_RAW;
+    header.rawSize = size;
+
+    return Enqueue(header, pSlot, NULL);
+}
+
+/// <summary>
+/// Queues a skeleton frame
+/// </summary>
+/// <param name="pSkeletonFrame">skeleton frame to write</param>
+/// <returns>S_OK if queued, S_FALSE if the queue was full and the frame dropped, an error code otherwise</returns>
+HRESULT CaptureWriter::WriteSkeletonFrame(const NUI_SKELETON_FRAME* pSkeletonFrame)
+{
+    CaptureRecordHeader header;
+    header.stream = CAPTURE_STREAM_SKELETON;
+    header.frameNumber = pSkeletonFrame->dwFrameNumber;
+    header.timestamp = pSkeletonFrame->liTimeStamp.QuadPart;
+    header.pitch = 0;
+    header.size = sizeof(NUI_SKELETON_FRAME);
+    header.encoding = CAPTURE_ENCODING_RAW;
+    header.rawSize = header.size;
+
+    return Enqueue(header, NULL, pSkeletonFrame);
+}
+
+/// <summary>
+/// Gets the number of frames written since the file was opened
+/// </summary>
+/// <returns>number of written frames</returns>
+LONG CaptureWriter::GetWrittenFrameCount() const
+{
+    return m_writtenFrameCount;
+}
+
+/// <summary>
+/// Gets the number of frames dropped because the queue was full since the file was opened
+/// </summary>
+/// <returns>number of dropped frames</returns>
+LONG CaptureWriter::GetDroppedFrameCount() const
+{
+    return m_droppedFrameCount;
+}
+
+/// <summary>
+/// Adds a frame to the queue, or counts it as dropped if the queue is full
+/// </summary>
+/// <param name="header">record header</param>
+/// <param name="pSlot">image data to reference, or NULL</param>
+/// <param name="pSkeletonFrame">skeleton frame to copy, or NULL</param>
+/// <returns>S_OK if queued, S_FALSE if dropped, an error code otherwise</returns>
+HRESULT CaptureWriter::Enqueue(const CaptureRecordHeader& header, FrameSlot* pSlot, const NUI_SKELETON_FRAME* pSkeletonFrame)
+{
+    EnterCriticalSection(&m_lock);
+
+    HRESULT hr = S_OK;
+    if (!m_hWriterThread || m_isClosing)
+    {
+        hr = E_NOT_VALID_STATE;
+    }
+    else if (m_queueCount == m_queue.size() || FAILED(m_writeResult))
+    {
+        // Never wait for the disk, the caller is processing live frames
+        InterlockedIncrement(&m_droppedFrameCount);
+        hr = S_FALSE;
+    }
+    else
+    {
+        PendingRecord& record = m_queue[(m_queueHead + m_queueCount) % m_queue.size()];
+        record.header = header;
+        record.pSlot = pSlot;
+        if (pSlot)
+        {
+            FramePool::AddRef(pSlot);
+        }
+        if (pSkeletonFrame)
+        {
+            record.skeletonFrame = *pSkeletonFrame;
+        }
+        ++m_queueCount;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    if (hr == S_OK)
+    {
+        SetEvent(m_hQueueEvent);
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Thread that writes queued frames, calls class instance thread processor
+/// </summary>
+/// <param name="lpParam">instance pointer</param>
+/// <returns>0</returns>
+DWORD WINAPI CaptureWriter::WriterThread(LPVOID lpParam)
+{
+    CaptureWriter* pThis = reinterpret_cast<CaptureWriter*>(lpParam);
+    return pThis->WriterThread();
+}
+
+/// <summary>
+/// Thread that writes queued frames until the writer is closed and the queue is empty
+/// </summary>
+/// <returns>0</returns>
+DWORD WINAPI CaptureWriter::WriterThread()
+{
+    for (;;)
+    {
+        EnterCriticalSection(&m_lock);
+        bool isEmpty = (m_queueCount == 0);
+        bool isClosing = m_isClosing;
+        PendingRecord* pRecord = isEmpty ? NULL : &m_queue[m_queueHead];
+        LeaveCriticalSection(&m_lock);
+
+        if (isEmpty)
+        {
+            if (isClosing)
+            {
+                break;
+            }
+
+            WaitForSingleObject(m_hQueueEvent, INFINITE);
+            continue;
+        }
+
+        // The head record stays in the queue while it is written, so the producer cannot reuse it
+        if (SUCCEEDED(m_writeResult))
+        {
+            CaptureRecordHeader header = pRecord->header;
+            const void* pData = pRecord->pSlot ? static_cast<const void*>(pRecord->pSlot->pData) : &pRecord->skeletonFrame;
+            if (m_isCompressingDepth && header.stream == CAPTURE_STREAM_DEPTH)
+            {
+                pData = EncodeDepth(&header, pRecord->pSlot->pData);
+            }
+
+            m_writeResult = AppendRecord(header, pData);
+            if (SUCCEEDED(m_writeResult))
+            {
+                InterlockedIncrement(&m_writtenFrameCount);
+            }
+        }
+
+        if (pRecord->pSlot)
+        {
+            FramePool::Release(pRecord->pSlot);
+            pRecord->pSlot = NULL;
+        }
+
+        EnterCriticalSection(&m_lock);
+        m_queueHead = (m_queueHead + 1) % m_queue.size();
+        --m_queueCount;
+        LeaveCriticalSection(&m_lock);
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Encodes a depth frame into the encode buffer, unless encoding would not make it smaller
+/// </summary>
+/// <param name="pHeader">record header, updated with the encoding and payload size</param>
+/// <param name="pData">raw frame data</param>
+/// <returns>payload to write, the encode buffer or the raw frame data</returns>
+const void* CaptureWriter::EncodeDepth(CaptureRecordHeader* pHeader, const BYTE* pData)
+{
+    DWORD width, height;
+    NuiImageResolutionToSize(m_depthResolution, width, height);
+    if (pHeader->pitch <= 0 || static_cast<LONGLONG>(pHeader->pitch) * height != pHeader->rawSize)
+    {
+        return pData;
+    }
+
+    size_t encodedSize = DepthCodec::Encode(pData, pHeader->pitch, width, height, m_encodeBuffer.data());
+    if (encodedSize >= static_cast<size_t>(pHeader->rawSize))
+    {
+        return pData;
+    }
+
+    pHeader->encoding = CAPTURE_ENCODING_DEPTH_CODEC;
+    pHeader->size = static_cast<INT>(encodedSize);
+
+    return m_encodeBuffer.data();
+}
+
+/// <summary>
+/// Appends a record to the write buffer and adds it to the index
+/// </summary>
+/// <param name="header">record header</param>
+/// <param name="pData">payload</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT CaptureWriter::AppendRecord(const CaptureRecordHeader& header, const void* pData)
+{
+    CaptureIndexEntry entry;
+    entry.header = header;
+    entry.payloadOffset = m_fileOffset + CAPTURE_RECORD_ALIGNMENT;
+
+    // The header is padded to a full alignment unit and the payload to the next record
+    HRESULT hr = Append(&header, sizeof(header));
+    if (SUCCEEDED(hr))
+    {
+        hr = Append(NULL, CAPTURE_RECORD_ALIGNMENT - sizeof(header));
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = Append(pData, header.size);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = Append(NULL, static_cast<size_t>(AlignCaptureOffset(m_fileOffset) - m_fileOffset));
+    }
+    if (SUCCEEDED(hr))
+    {
+        m_index.push_back(entry);
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Appends bytes to the write buffer, writing the buffer out when it is full.
+/// Blocks larger than the buffer are written directly.
+/// </summary>
+/// <param name="pData">bytes to append, or NULL for zero padding</param>
+/// <param name="size">number of bytes</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT CaptureWriter::Append(const void* pData, size_t size)
+{
+    HRESULT hr = S_OK;
+    if (m_writeBufferUsed + size > m_writeBuffer.size())
+    {
+        hr = Flush();
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+    }
+
+    if (size > m_writeBuffer.size())
+    {
+        // Padding is never larger than an alignment unit, so only data ends up here
+        DWORD written;
+        if (!WriteFile(m_hFile, pData, static_cast<DWORD>(size), &written, NULL))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    else if (pData)
+    {
+        memcpy(m_writeBuffer.data() + m_writeBufferUsed, pData, size);
+        m_writeBufferUsed += size;
+    }
+    else
+    {
+        ZeroMemory(m_writeBuffer.data() + m_writeBufferUsed, size);
+        m_writeBufferUsed += size;
+    }
+
+    m_fileOffset += size;
+
+    return hr;
+}
+
+/// <summary>
+/// Writes out the write buffer
+/// </summary>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT CaptureWriter::Flush()
+{
+    if (m_writeBufferUsed == 0)
+    {
+        return S_OK;
+    }
+
+    DWORD written;
+    if (!WriteFile(m_hFile, m_writeBuffer.data(), static_cast<DWORD>(m_writeBufferUsed), &written, NULL))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_writeBufferUsed = 0;
+
+    return S_OK;
+}
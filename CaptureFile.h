@@ -0,0 +1,284 @@
+#pragma once
+
+#include "windows.h"
+#include <NuiApi.h>
+#include <vector>
+#include "FramePool.h"
+
+namespace Microsoft {
+    namespace KinectBridge {
+        // Capture file layout: a CaptureFileHeader followed by records, each a
+        // CaptureRecordHeader and its payload, in the order the frames were received.
+        // Image payloads are the frame buffers, raw or encoded, skeleton payloads a NUI_SKELETON_FRAME.
+        // Records and payloads start on CAPTURE_RECORD_ALIGNMENT boundaries so a mapped
+        // file can be handed out in place. A closed file ends with an array of
+        // CaptureIndexEntry, one per record, and a CaptureFileFooter locating it.
+        static const DWORD CAPTURE_FILE_MAGIC = 0x4342424B;    // "KBBC"
+        static const DWORD CAPTURE_INDEX_MAGIC = 0x5842424B;   // "KBBX"
+        static const DWORD CAPTURE_FILE_VERSION = 3;
+        static const INT CAPTURE_RECORD_ALIGNMENT = 64;
+
+        enum CaptureStream
+        {
+            CAPTURE_STREAM_COLOR = 0,
+            CAPTURE_STREAM_DEPTH,
+            CAPTURE_STREAM_SKELETON,
+            CAPTURE_STREAM_COUNT
+        };
+
+        enum CaptureEncoding
+        {
+            // Payload is the frame as received
+            CAPTURE_ENCODING_RAW = 0,
+
+            // Payload is a depth frame encoded with DepthCodec
+            CAPTURE_ENCODING_DEPTH_CODEC
+        };
+
+        /// <summary>
+        /// Rounds a file offset up to the record alignment
+        /// </summary>
+        /// <param name="offset">file offset</param>
+        /// <returns>aligned offset</returns>
+        inline LONGLONG AlignCaptureOffset(LONGLONG offset)
+        {
+            return (offset + CAPTURE_RECORD_ALIGNMENT - 1) & ~static_cast<LONGLONG>(CAPTURE_RECORD_ALIGNMENT - 1);
+        }
+
+        struct CaptureFileHeader
+        {
+            DWORD magic;
+            DWORD version;
+            NUI_IMAGE_RESOLUTION colorResolution;
+            NUI_IMAGE_RESOLUTION depthResolution;
+        };
+
+        struct CaptureRecordHeader
+        {
+            DWORD stream;
+            DWORD frameNumber;
+
+            // Capture time in milliseconds, as reported by the sensor
+            LONGLONG timestamp;
+
+            // Row pitch of image payloads, 0 for skeleton payloads
+            INT pitch;
+
+            // Payload size in bytes
+            INT size;
+
+            // CaptureEncoding of the payload
+            DWORD encoding;
+
+            // Size in bytes of the decoded frame, the payload size for raw payloads
+            INT rawSize;
+        };
+
+        struct CaptureIndexEntry
+        {
+            CaptureRecordHeader header;
+
+            // File offset of the payload
+            LONGLONG payloadOffset;
+        };
+
+        struct CaptureFileFooter
+        {
+            // File offset of the first index entry
+            LONGLONG indexOffset;
+
+            // Number of index entries
+            DWORD recordCount;
+
+            DWORD magic;
+        };
+
+        /// <summary>
+        /// Writes frames to a capture file for later replay with ReplayFrameSource. Frames are
+        /// queued and written by a background thread in large sequential writes, so recording
+        /// never blocks the caller. Frames arriving while the queue is full are dropped and counted.
+        /// </summary>
+        class CaptureWriter
+        {
+        public:
+            // Constants:
+            // Number of frames that can wait to be written
+            static const UINT DEFAULT_QUEUE_LENGTH = 16;
+
+            // Size of the buffer records are gathered in before being written
+            static const INT WRITE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+            // Functions:
+            /// <summary>
+            /// Constructor
+            /// </summary>
+            CaptureWriter();
+
+            /// <summary>
+            /// Destructor
+            /// </summary>
+            ~CaptureWriter();
+
+            /// <summary>
+            /// Creates the capture file, replacing any existing one, and starts the writer thread
+            /// </summary>
+            /// <param name="path">path of the file to create</param>
+            /// <param name="colorResolution">resolution of the recorded color frames</param>
+            /// <param name="depthResolution">resolution of the recorded depth frames</param>
+            /// <param name="compressDepth">true to encode depth frames with DepthCodec</param>
+            /// <param name="queueLength">number of frames that can wait to be written</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT Open(LPCWSTR path, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution, bool compressDepth = true, UINT queueLength = DEFAULT_QUEUE_LENGTH);
+
+            /// <summary>
+            /// Writes the queued frames and the frame index, then closes the capture file
+            /// </summary>
+            /// <returns>S_OK if successful, the first write error otherwise</returns>
+            HRESULT Close();
+
+            /// <summary>
+            /// Returns whether a capture file is open
+            /// </summary>
+            /// <returns>true if a file is open, false otherwise</returns>
+            bool IsOpen() const;
+
+            /// <summary>
+            /// Queues an image frame. The writer holds a reference to the slot until the frame
+            /// has been written. Frames whose resolution differs from the file's are rejected.
+            /// </summary>
+            /// <param name="stream">CAPTURE_STREAM_COLOR or CAPTURE_STREAM_DEPTH</param>
+            /// <param name="resolution">resolution of the frame</param>
+            /// <param name="frameNumber">frame number reported by the source</param>
+            /// <param name="timestamp">capture time in milliseconds</param>
+            /// <param name="pitch">row pitch of the frame data</param>
+            /// <param name="pSlot">pooled slot holding the frame data</param>
+            /// <param name="size">size of the frame data in bytes</param>
+            /// <returns>S_OK if queued, S_FALSE if the queue was full and the frame dropped, an error code otherwise</returns>
+            HRESULT WriteImageFrame(CaptureStream stream, NUI_IMAGE_RESOLUTION resolution, DWORD frameNumber, LONGLONG timestamp, INT pitch, FrameSlot* pSlot, INT size);
+
+            /// <summary>
+            /// Queues a skeleton frame
+            /// </summary>
+            /// <param name="pSkeletonFrame">skeleton frame to write</param>
+            /// <returns>S_OK if queued, S_FALSE if the queue was full and the frame dropped, an error code otherwise</returns>
+            HRESULT WriteSkeletonFrame(const NUI_SKELETON_FRAME* pSkeletonFrame);
+
+            /// <summary>
+            /// Gets the number of frames written since the file was opened
+            /// </summary>
+            /// <returns>number of written frames</returns>
+            LONG GetWrittenFrameCount() const;
+
+            /// <summary>
+            /// Gets the number of frames dropped because the queue was full since the file was opened
+            /// </summary>
+            /// <returns>number of dropped frames</returns>
+            LONG GetDroppedFrameCount() const;
+
+        private:
+            // Frame waiting to be written
+            struct PendingRecord
+            {
+                CaptureRecordHeader header;
+
+                // Image data, NULL for skeleton frames
+                FrameSlot* pSlot;
+
+                // Copy of the skeleton frame, which the caller overwrites
+                NUI_SKELETON_FRAME skeletonFrame;
+            };
+
+            // Functions:
+            /// <summary>
+            /// Adds a frame to the queue, or counts it as dropped if the queue is full
+            /// </summary>
+            /// <param name="header">record header</param>
+            /// <param name="pSlot">image data to reference, or NULL</param>
+            /// <param name="pSkeletonFrame">skeleton frame to copy, or NULL</param>
+            /// <returns>S_OK if queued, S_FALSE if dropped, an error code otherwise</returns>
+            HRESULT Enqueue(const CaptureRecordHeader& header, FrameSlot* pSlot, const NUI_SKELETON_FRAME* pSkeletonFrame);
+
+            /// <summary>
+            /// Thread that writes queued frames, calls class instance thread processor
+            /// </summary>
+            /// <param name="lpParam">instance pointer</param>
+            /// <returns>0</returns>
+            static DWORD WINAPI WriterThread(LPVOID lpParam);
+
+            /// <summary>
+            /// Thread that writes queued frames until the writer is closed and the queue is empty
+            /// </summary>
+            /// <returns>0</returns>
+            DWORD WINAPI WriterThread();
+
+            /// <summary>
+            /// Encodes a depth frame into the encode buffer, unless encoding would not make it smaller
+            /// </summary>
+            /// <param name="pHeader">record header, updated with the encoding and payload size</param>
+            /// <param name="pData">raw frame data</param>
+            /// <returns>payload to write, the encode buffer or the raw frame data</returns>
+            const void* EncodeDepth(CaptureRecordHeader* pHeader, const BYTE* pData);
+
+            /// <summary>
+            /// Appends a record to the write buffer and adds it to the index
+            /// </summary>
+            /// <param name="header">record header</param>
+            /// <param name="pData">payload</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT AppendRecord(const CaptureRecordHeader& header, const void* pData);
+
+            /// <summary>
+            /// Appends bytes to the write buffer, writing the buffer out when it is full.
+            /// Blocks larger than the buffer are written directly.
+            /// </summary>
+            /// <param name="pData">bytes to append, or NULL for zero padding</param>
+            /// <param name="size">number of bytes</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT Append(const void* pData, size_t size);
+
+            /// <summary>
+            /// Writes out the write buffer
+            /// </summary>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT Flush();
+
+            // Variables:
+            // Handle of the open file
+            HANDLE m_hFile;
+
+            // Resolutions recorded in the file header
+            NUI_IMAGE_RESOLUTION m_colorResolution;
+            NUI_IMAGE_RESOLUTION m_depthResolution;
+
+            // Whether depth frames are encoded, by the writer thread into the encode buffer
+            bool m_isCompressingDepth;
+            std::vector<BYTE> m_encodeBuffer;
+
+            // Ring of pending frames, guarded by the lock. The writer thread only
+            // removes the head frame once it has been written.
+            CRITICAL_SECTION m_lock;
+            std::vector<PendingRecord> m_queue;
+            UINT m_queueHead;
+            UINT m_queueCount;
+            bool m_isClosing;
+
+            // Writer thread handles, the event is signalled when frames are queued or on close
+            HANDLE m_hWriterThread;
+            HANDLE m_hQueueEvent;
+
+            // Used by the writer thread only: gathered records, offset of the
+            // next byte to append and the index of the written records
+            std::vector<BYTE> m_writeBuffer;
+            size_t m_writeBufferUsed;
+            LONGLONG m_fileOffset;
+            std::vector<CaptureIndexEntry> m_index;
+
+            // First write error, after which frames are no longer written
+            HRESULT m_writeResult;
+
+            // Frame counts
+            volatile LONG m_writtenFrameCount;
+            volatile LONG m_droppedFrameCount;
+        };
+    }
+}
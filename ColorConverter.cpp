@@ -0,0 +1,263 @@
+#include "ColorConverter.h"
+#include "SimdSupport.h"
+#include <string.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+
+using namespace Microsoft::KinectBridge;
+
+namespace
+{
+    // Fixed point BGR to gray weights, the ones cv::cvtColor uses for 8 bit images
+    const int GRAY_SHIFT = 15;
+    const int GRAY_WEIGHT_B = 3735;
+    const int GRAY_WEIGHT_G = 19235;
+    const int GRAY_WEIGHT_R = 9798;
+    const int GRAY_ROUND = 1 << (GRAY_SHIFT - 1);
+
+    // Row converters, all take a BGRA source row and a count of pixels
+    typedef void (*RowFunc)(const BYTE* pSrc, BYTE* pDst, UINT width);
+
+    void BgraToRgbaRowScalar(const BYTE* pSrc, BYTE* pDst, UINT width)
+    {
+        for (UINT x = 0; x < width; ++x, pSrc += 4, pDst += 4)
+        {
+            BYTE b = pSrc[0];
+            pDst[0] = pSrc[2];
+            pDst[1] = pSrc[1];
+            pDst[2] = b;
+            pDst[3] = pSrc[3];
+        }
+    }
+
+    void BgraToBgrRowScalar(const BYTE* pSrc, BYTE* pDst, UINT width)
+    {
+        for (UINT x = 0; x < width; ++x, pSrc += 4, pDst += 3)
+        {
+            pDst[0] = pSrc[0];
+            pDst[1] = pSrc[1];
+            pDst[2] = pSrc[2];
+        }
+    }
+
+    void BgraToGrayRowScalar(const BYTE* pSrc, BYTE* pDst, UINT width)
+    {
+        for (UINT x = 0; x < width; ++x, pSrc += 4)
+        {
+            pDst[x] = static_cast<BYTE>((pSrc[0] * GRAY_WEIGHT_B + pSrc[1] * GRAY_WEIGHT_G + pSrc[2] * GRAY_WEIGHT_R + GRAY_ROUND) >> GRAY_SHIFT);
+        }
+    }
+
+    void BgraToRgbaRowSsse3(const BYTE* pSrc, BYTE* pDst, UINT width)
+    {
+        const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+        UINT x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i bgra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + x * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + x * 4), _mm_shuffle_epi8(bgra, shuffle));
+        }
+
+        BgraToRgbaRowScalar(pSrc + x * 4, pDst + x * 4, width - x);
+    }
+
+    void BgraToBgrRowSsse3(const BYTE* pSrc, BYTE* pDst, UINT width)
+    {
+        // Packs four pixels into the low 12 bytes, the high 4 are overwritten by the next store
+        const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+        UINT x = 0;
+        for (; (x + 4) * 3 + 4 <= width * 3; x += 4)
+        {
+            __m128i bgra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + x * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + x * 3), _mm_shuffle_epi8(bgra, shuffle));
+        }
+
+        BgraToBgrRowScalar(pSrc + x * 4, pDst + x * 3, width - x);
+    }
+
+    /// <summary>
+    /// Computes the fixed point gray sums of four BGRA pixels
+    /// </summary>
+    inline __m128i GraySums4(const BYTE* pSrc, __m128i weights, __m128i zero)
+    {
+        __m128i bgra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc));
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(bgra, zero), weights);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(bgra, zero), weights);
+        return _mm_hadd_epi32(lo, hi);
+    }
+
+    void BgraToGrayRowSsse3(const BYTE* pSrc, BYTE* pDst, UINT width)
+    {
+        const __m128i weights = _mm_setr_epi16(GRAY_WEIGHT_B, GRAY_WEIGHT_G, GRAY_WEIGHT_R, 0, GRAY_WEIGHT_B, GRAY_WEIGHT_G, GRAY_WEIGHT_R, 0);
+        const __m128i round = _mm_set1_epi32(GRAY_ROUND);
+        const __m128i zero = _mm_setzero_si128();
+
+        UINT x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            const BYTE* pRun = pSrc + x * 4;
+            __m128i g0 = _mm_srai_epi32(_mm_add_epi32(GraySums4(pRun, weights, zero), round), GRAY_SHIFT);
+            __m128i g1 = _mm_srai_epi32(_mm_add_epi32(GraySums4(pRun + 16, weights, zero), round), GRAY_SHIFT);
+            __m128i g2 = _mm_srai_epi32(_mm_add_epi32(GraySums4(pRun + 32, weights, zero), round), GRAY_SHIFT);
+            __m128i g3 = _mm_srai_epi32(_mm_add_epi32(GraySums4(pRun + 48, weights, zero), round), GRAY_SHIFT);
+
+            __m128i gray = _mm_packus_epi16(_mm_packs_epi32(g0, g1), _mm_packs_epi32(g2, g3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + x), gray);
+        }
+
+        BgraToGrayRowScalar(pSrc + x * 4, pDst + x, width - x);
+    }
+
+    void BgraToRgbaRowAvx2(const BYTE* pSrc, BYTE* pDst, UINT width)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+        UINT x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256i bgra = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrc + x * 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + x * 4), _mm256_shuffle_epi8(bgra, shuffle));
+        }
+
+        BgraToRgbaRowSsse3(pSrc + x * 4, pDst + x * 4, width - x);
+    }
+
+    void BgraToBgrRowAvx2(const BYTE* pSrc, BYTE* pDst, UINT width)
+    {
+        // Packs each lane into its low 12 bytes, then moves the two 12 byte runs together
+        const __m256i shuffle = _mm256_setr_epi8(
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+        UINT x = 0;
+        for (; (x + 8) * 3 + 8 <= width * 3; x += 8)
+        {
+            __m256i bgra = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrc + x * 4));
+            __m256i bgr = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(bgra, shuffle), pack);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + x * 3), bgr);
+        }
+
+        BgraToBgrRowSsse3(pSrc + x * 4, pDst + x * 3, width - x);
+    }
+
+    /// <summary>
+    /// Computes the fixed point gray values of eight BGRA pixels, in pixel order
+    /// </summary>
+    inline __m256i Gray8(const BYTE* pSrc, __m256i weights, __m256i round, __m256i zero)
+    {
+        __m256i bgra = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrc));
+        __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(bgra, zero), weights);
+        __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(bgra, zero), weights);
+        return _mm256_srai_epi32(_mm256_add_epi32(_mm256_hadd_epi32(lo, hi), round), GRAY_SHIFT);
+    }
+
+    void BgraToGrayRowAvx2(const BYTE* pSrc, BYTE* pDst, UINT width)
+    {
+        const __m256i weights = _mm256_setr_epi16(
+            GRAY_WEIGHT_B, GRAY_WEIGHT_G, GRAY_WEIGHT_R, 0, GRAY_WEIGHT_B, GRAY_WEIGHT_G, GRAY_WEIGHT_R, 0,
+            GRAY_WEIGHT_B, GRAY_WEIGHT_G, GRAY_WEIGHT_R, 0, GRAY_WEIGHT_B, GRAY_WEIGHT_G, GRAY_WEIGHT_R, 0);
+        const __m256i round = _mm256_set1_epi32(GRAY_ROUND);
+        const __m256i zero = _mm256_setzero_si256();
+
+        // Both packs interleave the 128 bit lanes, the permute gathers the runs of four gray pixels back in row order
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+        UINT x = 0;
+        for (; x + 32 <= width; x += 32)
+        {
+            const BYTE* pRun = pSrc + x * 4;
+            __m256i g01 = _mm256_packs_epi32(Gray8(pRun, weights, round, zero), Gray8(pRun + 32, weights, round, zero));
+            __m256i g23 = _mm256_packs_epi32(Gray8(pRun + 64, weights, round, zero), Gray8(pRun + 96, weights, round, zero));
+
+            __m256i gray = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(g01, g23), order);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + x), gray);
+        }
+
+        BgraToGrayRowSsse3(pSrc + x * 4, pDst + x, width - x);
+    }
+
+    /// <summary>
+    /// Gets the row converter of a format and path, NULL for a plain copy
+    /// </summary>
+    RowFunc GetRowFunc(ColorFormat format, SimdPath path)
+    {
+        static const RowFunc rowFuncs[][3] =
+        {
+            { BgraToRgbaRowScalar, BgraToRgbaRowSsse3, BgraToRgbaRowAvx2 },
+            { BgraToBgrRowScalar, BgraToBgrRowSsse3, BgraToBgrRowAvx2 },
+            { BgraToGrayRowScalar, BgraToGrayRowSsse3, BgraToGrayRowAvx2 },
+        };
+
+        if (format == COLOR_FORMAT_BGRA)
+        {
+            return NULL;
+        }
+
+        return rowFuncs[format - COLOR_FORMAT_RGBA][path == PATH_AVX2 ? 2 : path == PATH_SSSE3 ? 1 : 0];
+    }
+}
+
+/// <summary>
+/// Gets the number of bytes per pixel of an output format
+/// </summary>
+/// <param name="format">output format</param>
+/// <returns>bytes per pixel</returns>
+int ColorConverter::GetChannels(ColorFormat format)
+{
+    switch (format)
+    {
+    case COLOR_FORMAT_BGR:
+        return 3;
+    case COLOR_FORMAT_GRAY:
+        return 1;
+    default:
+        return 4;
+    }
+}
+
+/// <summary>
+/// Converts a BGRA frame into the given format
+/// </summary>
+/// <param name="pSrc">BGRA source frame</param>
+/// <param name="srcPitch">bytes per source row</param>
+/// <param name="pDst">destination image</param>
+/// <param name="dstStep">bytes per destination row</param>
+/// <param name="width">width in pixels</param>
+/// <param name="height">height in pixels</param>
+/// <param name="format">output format</param>
+/// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+void ColorConverter::Convert(const BYTE* pSrc, size_t srcPitch, BYTE* pDst, size_t dstStep, UINT width, UINT height, ColorFormat format, SimdPath path /* = PATH_AUTO */)
+{
+    // Never run a path the processor does not support
+    path = GetSupportedPath(path, PATHS);
+
+    RowFunc rowFunc = GetRowFunc(format, path);
+    size_t rowBytes = static_cast<size_t>(width) * 4;
+
+    // Same layout, copy whole frame at once if the rows are packed, row by row otherwise
+    if (!rowFunc)
+    {
+        if (srcPitch == rowBytes && dstStep == rowBytes)
+        {
+            memcpy(pDst, pSrc, rowBytes * height);
+        }
+        else
+        {
+            for (UINT y = 0; y < height; ++y)
+            {
+                memcpy(pDst + y * dstStep, pSrc + y * srcPitch, rowBytes);
+            }
+        }
+        return;
+    }
+
+    for (UINT y = 0; y < height; ++y)
+    {
+        rowFunc(pSrc + y * srcPitch, pDst + y * dstStep, width);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "windows.h"
+#include "SimdSupport.h"
+
+namespace Microsoft {
+    namespace KinectBridge {
+        // Output layouts for Kinect color frames, which arrive as 32 bit BGRA
+        enum ColorFormat
+        {
+            COLOR_FORMAT_BGRA = 0,
+            COLOR_FORMAT_RGBA,
+            COLOR_FORMAT_BGR,
+            COLOR_FORMAT_GRAY
+        };
+
+        /// <summary>
+        /// Converts Kinect BGRA color frames into packed output images. Rows that only need
+        /// copying are copied with memcpy, swizzles use SSSE3 or AVX2 shuffles, and gray uses
+        /// the same fixed point weights as cv::cvtColor so the results are bit identical.
+        /// </summary>
+        class ColorConverter
+        {
+        public:
+            // Constants:
+            // Code paths of the conversion, a set of bits 1 << path
+            static const UINT PATHS = (1 << PATH_SCALAR) | (1 << PATH_SSSE3) | (1 << PATH_AVX2);
+
+            // Functions:
+            /// <summary>
+            /// Gets the number of bytes per pixel of an output format
+            /// </summary>
+            /// <param name="format">output format</param>
+            /// <returns>bytes per pixel</returns>
+            static int GetChannels(ColorFormat format);
+
+            /// <summary>
+            /// Converts a BGRA frame into the given format
+            /// </summary>
+            /// <param name="pSrc">BGRA source frame</param>
+            /// <param name="srcPitch">bytes per source row</param>
+            /// <param name="pDst">destination image</param>
+            /// <param name="dstStep">bytes per destination row</param>
+            /// <param name="width">width in pixels</param>
+            /// <param name="height">height in pixels</param>
+            /// <param name="format">output format</param>
+            /// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+            static void Convert(const BYTE* pSrc, size_t srcPitch, BYTE* pDst, size_t dstStep, UINT width, UINT height, ColorFormat format, SimdPath path = PATH_AUTO);
+        };
+    }
+}
@@ -0,0 +1,347 @@
+#include "ComponentLabeler.h"
+#include <limits.h>
+#include <math.h>
+
+/// <summary>
+/// Constructor
+/// </summary>
+ComponentLabeler::ComponentLabeler() :
+    m_setComponentCount(0)
+{
+}
+
+/// <summary>
+/// Labels a binary image and keeps the components in an area range
+/// </summary>
+/// <param name="binary">CV_8UC1 image, nonzero pixels are set</param>
+/// <param name="minArea">smallest area kept, holes included</param>
+/// <param name="maxArea">largest area kept, holes included</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the image is empty or not CV_8UC1</returns>
+HRESULT ComponentLabeler::Label(const Mat& binary, int minArea, int maxArea)
+{
+    if (binary.empty() || binary.type() != CV_8UC1)
+    {
+        return E_INVALIDARG;
+    }
+
+    const int width = binary.cols;
+    const int height = binary.rows;
+
+    // The buffers keep their memory between frames
+    m_labels.create(binary.size(), CV_32SC1);
+    m_parents.clear();
+    m_stats.clear();
+
+    for (int y = 0; y < height; ++y)
+    {
+        const uchar* pRow = binary.ptr<uchar>(y);
+        const uchar* pPrevRow = y > 0 ? binary.ptr<uchar>(y - 1) : NULL;
+        int* pLabels = m_labels.ptr<int>(y);
+        const int* pPrevLabels = y > 0 ? m_labels.ptr<int>(y - 1) : NULL;
+        const bool isBorderRow = y == 0 || y == height - 1;
+
+        int x = 0;
+        while (x < width)
+        {
+            // Run of pixels of the same value
+            const bool isSet = pRow[x] != 0;
+            const int x0 = x;
+            while (x < width && (pRow[x] != 0) == isSet)
+            {
+                ++x;
+            }
+            const int x1 = x;
+
+            // Joined with the runs above it, diagonally too for set pixels
+            int label = -1;
+            if (pPrevRow)
+            {
+                int first = isSet && x0 > 0 ? x0 - 1 : x0;
+                int last = isSet && x1 < width ? x1 : x1 - 1;
+                int previous = -1;
+                for (int px = first; px <= last; ++px)
+                {
+                    if ((pPrevRow[px] != 0) == isSet && pPrevLabels[px] != previous)
+                    {
+                        previous = pPrevLabels[px];
+                        label = label < 0 ? Find(previous) : Union(label, previous);
+                    }
+                }
+            }
+
+            if (label < 0)
+            {
+                label = NewLabel(isSet, pPrevLabels ? pPrevLabels[x0] : -1);
+            }
+
+            AddRun(label, y, x0, x1, isBorderRow || x0 == 0 || x1 == width);
+            for (int px = x0; px < x1; ++px)
+            {
+                pLabels[px] = label;
+            }
+        }
+    }
+
+    Resolve(minArea, maxArea);
+    return S_OK;
+}
+
+/// <summary>
+/// Gets the components of the last image kept by the area range, in the order their
+/// first pixels appear in the image
+/// </summary>
+/// <returns>kept components</returns>
+const std::vector<Component>& ComponentLabeler::GetComponents() const
+{
+    return m_components;
+}
+
+/// <summary>
+/// Gets the number of components of set pixels in the last image, whatever their area
+/// </summary>
+/// <returns>number of set components</returns>
+int ComponentLabeler::GetSetComponentCount() const
+{
+    return m_setComponentCount;
+}
+
+/// <summary>
+/// Traces the outer boundary of a kept component
+/// </summary>
+/// <param name="index">index of the component in GetComponents</param>
+/// <param name="pContour">pointer to the contour to fill, in image coordinates</param>
+/// <returns>S_OK if successful, E_INVALIDARG for an invalid index</returns>
+HRESULT ComponentLabeler::GetContour(size_t index, std::vector<Point>* pContour)
+{
+    if (!pContour)
+    {
+        return E_POINTER;
+    }
+
+    if (index >= m_components.size())
+    {
+        return E_INVALIDARG;
+    }
+
+    // Only the bounding box is scanned, with a clear border so the contour is closed
+    const Component& component = m_components[index];
+    const Rect& bounds = component.bounds;
+    m_mask.create(bounds.height + 2, bounds.width + 2, CV_8UC1);
+    m_mask.setTo(Scalar::all(0));
+
+    for (int y = 0; y < bounds.height; ++y)
+    {
+        const int* pLabels = m_labels.ptr<int>(bounds.y + y) + bounds.x;
+        uchar* pMask = m_mask.ptr<uchar>(y + 1) + 1;
+        for (int x = 0; x < bounds.width; ++x)
+        {
+            pMask[x] = m_parents[pLabels[x]] == component.label ? 255 : 0;
+        }
+    }
+
+    findContours(m_mask, m_contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, Point(bounds.x - 1, bounds.y - 1));
+
+    // A component is connected, its mask has a single outer boundary
+    pContour->clear();
+    if (!m_contours.empty())
+    {
+        pContour->swap(m_contours[0]);
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Gets the ellipse with the same area, center and second order moments as a component
+/// </summary>
+/// <param name="component">component</param>
+/// <returns>ellipse, with full axis lengths as fitEllipse returns them</returns>
+RotatedRect ComponentLabeler::GetEllipse(const Component& component)
+{
+    // Covariance of the pixel positions and its eigenvalues, the variances along the axes
+    const double a = component.mu20 / component.area;
+    const double b = component.mu11 / component.area;
+    const double c = component.mu02 / component.area;
+    const double mean = (a + c) * 0.5;
+    const double spread = sqrt((a - c) * (a - c) * 0.25 + b * b);
+    const double major = mean + spread;
+    const double minor = mean - spread > 0.0 ? mean - spread : 0.0;
+
+    // The variance of a filled ellipse along an axis is a quarter of its squared half axis
+    const double angle = 0.5 * atan2(2.0 * b, a - c) * 180.0 / CV_PI;
+    return RotatedRect(Point2f(static_cast<float>(component.centroid.x), static_cast<float>(component.centroid.y)),
+        Size2f(static_cast<float>(4.0 * sqrt(major)), static_cast<float>(4.0 * sqrt(minor))), static_cast<float>(angle));
+}
+
+/// <summary>
+/// Creates a label
+/// </summary>
+/// <param name="isSet">true for set pixels, false for clear ones</param>
+/// <param name="enclosing">label of the pixel above the first one, -1 on the top row</param>
+/// <returns>new label</returns>
+int ComponentLabeler::NewLabel(bool isSet, int enclosing)
+{
+    LabelStats stats = {};
+    stats.minX = INT_MAX;
+    stats.minY = INT_MAX;
+    stats.maxX = -1;
+    stats.maxY = -1;
+    stats.enclosing = enclosing;
+    stats.isSet = isSet;
+
+    int label = static_cast<int>(m_parents.size());
+    m_parents.push_back(label);
+    m_stats.push_back(stats);
+    return label;
+}
+
+/// <summary>
+/// Finds the root label of a label, halving the path to it
+/// </summary>
+/// <param name="label">label</param>
+/// <returns>root label</returns>
+int ComponentLabeler::Find(int label)
+{
+    while (m_parents[label] != label)
+    {
+        m_parents[label] = m_parents[m_parents[label]];
+        label = m_parents[label];
+    }
+    return label;
+}
+
+/// <summary>
+/// Joins the sets of two labels, the smaller root becoming the root of both
+/// </summary>
+/// <param name="a">first label</param>
+/// <param name="b">second label</param>
+/// <returns>root label of the joined set</returns>
+int ComponentLabeler::Union(int a, int b)
+{
+    int rootA = Find(a);
+    int rootB = Find(b);
+    if (rootA < rootB)
+    {
+        m_parents[rootB] = rootA;
+        return rootA;
+    }
+
+    m_parents[rootA] = rootB;
+    return rootB;
+}
+
+/// <summary>
+/// Adds a run of pixels to a label
+/// </summary>
+/// <param name="label">label</param>
+/// <param name="y">row of the run</param>
+/// <param name="x0">first column of the run</param>
+/// <param name="x1">column after the last one of the run</param>
+/// <param name="touchesBorder">true if the run is on the border of the image</param>
+void ComponentLabeler::AddRun(int label, int y, int x0, int x1, bool touchesBorder)
+{
+    // Sums of x and x squared over the run in closed form
+    const double count = x1 - x0;
+    const double sumX = (static_cast<double>(x0) + x1 - 1) * count * 0.5;
+    const double sumXX = ((x1 - 1.0) * x1 * (2.0 * x1 - 1.0) - (x0 - 1.0) * x0 * (2.0 * x0 - 1.0)) / 6.0;
+
+    LabelStats& stats = m_stats[label];
+    stats.area += count;
+    stats.sumX += sumX;
+    stats.sumY += count * y;
+    stats.sumXX += sumXX;
+    stats.sumXY += sumX * y;
+    stats.sumYY += count * y * y;
+    stats.minX = x0 < stats.minX ? x0 : stats.minX;
+    stats.maxX = x1 - 1 > stats.maxX ? x1 - 1 : stats.maxX;
+    stats.minY = y < stats.minY ? y : stats.minY;
+    stats.maxY = y > stats.maxY ? y : stats.maxY;
+    stats.touchesBorder = stats.touchesBorder || touchesBorder;
+}
+
+/// <summary>
+/// Merges the labels into their roots, fills in the holes and keeps the components in the area range
+/// </summary>
+/// <param name="minArea">smallest area kept</param>
+/// <param name="maxArea">largest area kept</param>
+void ComponentLabeler::Resolve(int minArea, int maxArea)
+{
+    const int labelCount = static_cast<int>(m_parents.size());
+
+    // A root is the label of the first run of its component, so it is smaller than its other labels
+    for (int label = 0; label < labelCount; ++label)
+    {
+        int root = Find(label);
+        m_parents[label] = root;
+        if (root == label)
+        {
+            continue;
+        }
+
+        const LabelStats& stats = m_stats[label];
+        LabelStats& rootStats = m_stats[root];
+        rootStats.area += stats.area;
+        rootStats.sumX += stats.sumX;
+        rootStats.sumY += stats.sumY;
+        rootStats.sumXX += stats.sumXX;
+        rootStats.sumXY += stats.sumXY;
+        rootStats.sumYY += stats.sumYY;
+        rootStats.minX = stats.minX < rootStats.minX ? stats.minX : rootStats.minX;
+        rootStats.minY = stats.minY < rootStats.minY ? stats.minY : rootStats.minY;
+        rootStats.maxX = stats.maxX > rootStats.maxX ? stats.maxX : rootStats.maxX;
+        rootStats.maxY = stats.maxY > rootStats.maxY ? stats.maxY : rootStats.maxY;
+        rootStats.touchesBorder = rootStats.touchesBorder || stats.touchesBorder;
+    }
+
+    // Each component away from the border fills in the region enclosing it. Enclosing regions
+    // start earlier in the image, so innermost components are added first.
+    for (int label = labelCount - 1; label >= 0; --label)
+    {
+        const LabelStats& stats = m_stats[label];
+        if (m_parents[label] != label || stats.touchesBorder || stats.enclosing < 0)
+        {
+            continue;
+        }
+
+        LabelStats& enclosingStats = m_stats[m_parents[stats.enclosing]];
+        enclosingStats.area += stats.area;
+        enclosingStats.sumX += stats.sumX;
+        enclosingStats.sumY += stats.sumY;
+        enclosingStats.sumXX += stats.sumXX;
+        enclosingStats.sumXY += stats.sumXY;
+        enclosingStats.sumYY += stats.sumYY;
+    }
+
+    // The clear region around everything is not a hole
+    m_components.clear();
+    m_setComponentCount = 0;
+    for (int label = 0; label < labelCount; ++label)
+    {
+        const LabelStats& stats = m_stats[label];
+        if (m_parents[label] != label)
+        {
+            continue;
+        }
+
+        if (stats.isSet)
+        {
+            ++m_setComponentCount;
+        }
+
+        if ((!stats.isSet && stats.touchesBorder) || stats.area < minArea || stats.area > maxArea)
+        {
+            continue;
+        }
+
+        Component component;
+        component.area = static_cast<int>(stats.area);
+        component.centroid = Point2d(stats.sumX / stats.area, stats.sumY / stats.area);
+        component.bounds = Rect(stats.minX, stats.minY, stats.maxX - stats.minX + 1, stats.maxY - stats.minY + 1);
+        component.mu20 = stats.sumXX - stats.sumX * component.centroid.x;
+        component.mu11 = stats.sumXY - stats.sumX * component.centroid.y;
+        component.mu02 = stats.sumYY - stats.sumY * component.centroid.y;
+        component.isHole = !stats.isSet;
+        component.label = label;
+        m_components.push_back(component);
+    }
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#pragma warning(pop)
+
+using namespace cv;
+
+/// <summary>
+/// Region of a binary image found by the component labeler, with its holes filled in
+/// </summary>
+struct Component
+{
+    // Number of pixels, including those of the holes
+    int area;
+
+    // Center of mass
+    Point2d centroid;
+
+    // Bounding box of the pixels of the component itself
+    Rect bounds;
+
+    // Central second order moments, as moments() computes them
+    double mu20;
+    double mu11;
+    double mu02;
+
+    // True for a hole enclosed by the edges, false for the edges themselves
+    bool isHole;
+
+    // Label of the component in the label image
+    int label;
+};
+
+/// <summary>
+/// Labels the connected components of a binary image in a single pass over its runs,
+/// accumulating the area, bounding box and moments of every component as it goes. The
+/// set pixels are 8-connected and the clear ones 4-connected, so both the edges and the
+/// holes they enclose are found, the way findContours finds outer and hole contours.
+/// Components out of the area range are dropped before any contour is traced.
+/// </summary>
+class ComponentLabeler
+{
+public:
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    ComponentLabeler();
+
+    /// <summary>
+    /// Labels a binary image and keeps the components in an area range
+    /// </summary>
+    /// <param name="binary">CV_8UC1 image, nonzero pixels are set</param>
+    /// <param name="minArea">smallest area kept, holes included</param>
+    /// <param name="maxArea">largest area kept, holes included</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the image is empty or not CV_8UC1</returns>
+    HRESULT Label(const Mat& binary, int minArea, int maxArea);
+
+    /// <summary>
+    /// Gets the components of the last image kept by the area range, in the order their
+    /// first pixels appear in the image
+    /// </summary>
+    /// <returns>kept components</returns>
+    const std::vector<Component>& GetComponents() const;
+
+    /// <summary>
+    /// Gets the number of components of set pixels in the last image, whatever their area
+    /// </summary>
+    /// <returns>number of set components</returns>
+    int GetSetComponentCount() const;
+
+    /// <summary>
+    /// Traces the outer boundary of a kept component
+    /// </summary>
+    /// <param name="index">index of the component in GetComponents</param>
+    /// <param name="pContour">pointer to the contour to fill, in image coordinates</param>
+    /// <returns>S_OK if successful, E_INVALIDARG for an invalid index</returns>
+    HRESULT GetContour(size_t index, std::vector<Point>* pContour);
+
+    /// <summary>
+    /// Gets the ellipse with the same area, center and second order moments as a component
+    /// </summary>
+    /// <param name="component">component</param>
+    /// <returns>ellipse, with full axis lengths as fitEllipse returns them</returns>
+    static RotatedRect GetEllipse(const Component& component);
+
+private:
+    // Types:
+    // Sums accumulated for each label
+    struct LabelStats
+    {
+        double area;
+        double sumX;
+        double sumY;
+        double sumXX;
+        double sumXY;
+        double sumYY;
+        int minX;
+        int minY;
+        int maxX;
+        int maxY;
+
+        // Label of the pixel above the first one, the region enclosing the label, -1 on the top row
+        int enclosing;
+        bool isSet;
+        bool touchesBorder;
+    };
+
+    // Functions:
+    /// <summary>
+    /// Creates a label
+    /// </summary>
+    /// <param name="isSet">true for set pixels, false for clear ones</param>
+    /// <param name="enclosing">label of the pixel above the first one, -1 on the top row</param>
+    /// <returns>new label</returns>
+    int NewLabel(bool isSet, int enclosing);
+
+    /// <summary>
+    /// Finds the root label of a label, halving the path to it
+    /// </summary>
+    /// <param name="label">label</param>
+    /// <returns>root label</returns>
+    int Find(int label);
+
+    /// <summary>
+    /// Joins the sets of two labels, the smaller root becoming the root of both
+    /// </summary>
+    /// <param name="a">first label</param>
+    /// <param name="b">second label</param>
+    /// <returns>root label of the joined set</returns>
+    int Union(int a, int b);
+
+    /// <summary>
+    /// Adds a run of pixels to a label
+    /// </summary>
+    /// <param name="label">label</param>
+    /// <param name="y">row of the run</param>
+    /// <param name="x0">first column of the run</param>
+    /// <param name="x1">column after the last one of the run</param>
+    /// <param name="touchesBorder">true if the run is on the border of the image</param>
+    void AddRun(int label, int y, int x0, int x1, bool touchesBorder);
+
+    /// <summary>
+    /// Merges the labels into their roots, fills in the holes and keeps the components in the area range
+    /// </summary>
+    /// <param name="minArea">smallest area kept</param>
+    /// <param name="maxArea">largest area kept</param>
+    void Resolve(int minArea, int maxArea);
+
+    // Variables:
+    // Provisional label of every pixel, and the root of every label once resolved
+    Mat m_labels;
+    std::vector<int> m_parents;
+    std::vector<LabelStats> m_stats;
+
+    std::vector<Component> m_components;
+    int m_setComponentCount;
+
+    // Mask and contours of the component being traced, reused between calls
+    Mat m_mask;
+    std::vector<std::vector<Point> > m_contours;
+};
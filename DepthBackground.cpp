@@ -0,0 +1,417 @@
+#include "DepthBackground.h"
+#include "SimdSupport.h"
+#include <NuiApi.h>
+#include <immintrin.h>
+#include <math.h>
+#include <limits.h>
+
+using namespace Microsoft::KinectBridge;
+
+namespace
+{
+    // Standard deviations nearer than the mean a pixel has to be to be foreground
+    const float SIGMA_COUNT = 3.0f;
+
+    // Raw value of the pixels the sensor could not measure, which would shift to 8191 mm
+    const USHORT UNKNOWN_DEPTH = USHRT_MAX;
+
+    /// <summary>
+    /// Computes the depth below which a pixel is foreground: nearer than the table by the noise
+    /// of the pixel, or by the minimum height on a quiet one
+    /// </summary>
+    /// <param name="mean">mean depth of the pixel in millimeters</param>
+    /// <param name="variance">variance of the pixel's depth</param>
+    /// <returns>threshold in millimeters, 0 if nothing can be nearer</returns>
+    inline short GetThreshold(float mean, float variance)
+    {
+        const float margin = SIGMA_COUNT * sqrtf(variance);
+        const float threshold = mean - (margin > DepthBackground::MIN_HEIGHT ? margin : DepthBackground::MIN_HEIGHT);
+        return threshold > 0.0f ? static_cast<short>(threshold) : 0;
+    }
+
+    void ToForegroundScalar(const USHORT* pDepth, const short* pThresholds, BYTE* pDst, UINT count)
+    {
+        for (UINT i = 0; i < count; ++i)
+        {
+            int depth = pDepth[i] >> NUI_IMAGE_PLAYER_INDEX_SHIFT;
+            pDst[i] = depth > 0 && pDepth[i] != UNKNOWN_DEPTH && depth < pThresholds[i] ? 255 : 0;
+        }
+    }
+
+    /// <summary>
+    /// Computes the foreground of eight depth values as 16 bit lanes of all ones or zeros.
+    /// The shifted depth is at most 8191, so the signed compares are exact. Unknown pixels
+    /// are all ones before the shift.
+    /// </summary>
+    inline __m128i Foreground8(const USHORT* pDepth, const short* pThresholds)
+    {
+        __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pDepth));
+        __m128i depth = _mm_srli_epi16(raw, NUI_IMAGE_PLAYER_INDEX_SHIFT);
+        __m128i thresholds = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pThresholds));
+        __m128i known = _mm_andnot_si128(_mm_cmpeq_epi16(raw, _mm_set1_epi16(-1)), _mm_cmpgt_epi16(depth, _mm_setzero_si128()));
+        return _mm_and_si128(_mm_cmpgt_epi16(thresholds, depth), known);
+    }
+
+    void ToForegroundSse2(const USHORT* pDepth, const short* pThresholds, BYTE* pDst, UINT count)
+    {
+        UINT i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i mask = _mm_packs_epi16(Foreground8(pDepth + i, pThresholds + i), Foreground8(pDepth + i + 8, pThresholds + i + 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + i), mask);
+        }
+
+        ToForegroundScalar(pDepth + i, pThresholds + i, pDst + i, count - i);
+    }
+
+    /// <summary>
+    /// Computes the foreground of sixteen depth values as 16 bit lanes of all ones or zeros
+    /// </summary>
+    inline __m256i Foreground16(const USHORT* pDepth, const short* pThresholds)
+    {
+        __m256i raw = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pDepth));
+        __m256i depth = _mm256_srli_epi16(raw, NUI_IMAGE_PLAYER_INDEX_SHIFT);
+        __m256i thresholds = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pThresholds));
+        __m256i known = _mm256_andnot_si256(_mm256_cmpeq_epi16(raw, _mm256_set1_epi16(-1)), _mm256_cmpgt_epi16(depth, _mm256_setzero_si256()));
+        return _mm256_and_si256(_mm256_cmpgt_epi16(thresholds, depth), known);
+    }
+
+    void ToForegroundAvx2(const USHORT* pDepth, const short* pThresholds, BYTE* pDst, UINT count)
+    {
+        UINT i = 0;
+        for (; i + 32 <= count; i += 32)
+        {
+            __m256i mask = PackMasksAvx2(Foreground16(pDepth + i, pThresholds + i), Foreground16(pDepth + i + 16, pThresholds + i + 16));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + i), mask);
+        }
+
+        ToForegroundSse2(pDepth + i, pThresholds + i, pDst + i, count - i);
+    }
+
+    /// <summary>
+    /// Writes the rows of a matrix to a file, packed
+    /// </summary>
+    /// <param name="hFile">file to write to</param>
+    /// <param name="matrix">matrix to write</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT WriteRows(HANDLE hFile, const Mat& matrix)
+    {
+        const DWORD rowSize = static_cast<DWORD>(matrix.cols * matrix.elemSize());
+        for (int y = 0; y < matrix.rows; ++y)
+        {
+            DWORD written;
+            if (!WriteFile(hFile, matrix.ptr(y), rowSize, &written, NULL))
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+        }
+        return S_OK;
+    }
+
+    /// <summary>
+    /// Reads the packed rows of a matrix from a file
+    /// </summary>
+    /// <param name="hFile">file to read from</param>
+    /// <param name="pMatrix">pointer to the allocated matrix to fill</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the file ends first, an error code otherwise</returns>
+    HRESULT ReadRows(HANDLE hFile, Mat* pMatrix)
+    {
+        const DWORD rowSize = static_cast<DWORD>(pMatrix->cols * pMatrix->elemSize());
+        for (int y = 0; y < pMatrix->rows; ++y)
+        {
+            DWORD read;
+            if (!ReadFile(hFile, pMatrix->ptr(y), rowSize, &read, NULL))
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+            if (read != rowSize)
+            {
+                return E_INVALIDARG;
+            }
+        }
+        return S_OK;
+    }
+}
+
+/// <summary>
+/// Constructor, nothing is foreground until a frame has been learned
+/// </summary>
+DepthBackground::DepthBackground() :
+    m_learnedFrameCount(0)
+{
+}
+
+/// <summary>
+/// Writes 255 for each pixel nearer than the table and 0 for the others. A frame of
+/// another size than the model's starts a new model.
+/// </summary>
+/// <param name="depth">CV_16UC1 depth frame, with the player index bits</param>
+/// <param name="pForeground">pointer to the CV_8UC1 foreground mask to fill</param>
+/// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the frame is empty or not CV_16UC1</returns>
+HRESULT DepthBackground::Segment(const Mat& depth, Mat* pForeground, SimdPath path /* = PATH_AUTO */)
+{
+    if (!pForeground)
+    {
+        return E_POINTER;
+    }
+
+    if (depth.empty() || depth.type() != CV_16UC1)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (depth.size() != m_thresholds.size())
+    {
+        Create(depth.size());
+    }
+
+    pForeground->create(depth.size(), CV_8UC1);
+    for (int y = 0; y < depth.rows; ++y)
+    {
+        ToForeground(depth.ptr<USHORT>(y), m_thresholds.ptr<short>(y), pForeground->ptr<BYTE>(y), static_cast<UINT>(depth.cols), path);
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Updates the model with the pixels of a frame that are neither foreground nor unknown
+/// </summary>
+/// <param name="depth">CV_16UC1 depth frame, with the player index bits</param>
+/// <param name="foreground">CV_8UC1 foreground mask of the frame</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the frame or the mask is not of the model's size and type</returns>
+HRESULT DepthBackground::Learn(const Mat& depth, const Mat& foreground)
+{
+    if (depth.type() != CV_16UC1 || foreground.type() != CV_8UC1 ||
+        depth.size() != m_means.size() || foreground.size() != m_means.size())
+    {
+        return E_INVALIDARG;
+    }
+
+    for (int y = 0; y < depth.rows; ++y)
+    {
+        const USHORT* pDepth = depth.ptr<USHORT>(y);
+        const BYTE* pForeground = foreground.ptr<BYTE>(y);
+        float* pMeans = m_means.ptr<float>(y);
+        float* pVariances = m_variances.ptr<float>(y);
+        USHORT* pCounts = m_counts.ptr<USHORT>(y);
+        short* pThresholds = m_thresholds.ptr<short>(y);
+
+        for (int x = 0; x < depth.cols; ++x)
+        {
+            const int value = pDepth[x] >> NUI_IMAGE_PLAYER_INDEX_SHIFT;
+            if (value == 0 || pDepth[x] == UNKNOWN_DEPTH || pForeground[x])
+            {
+                continue;
+            }
+
+            // West's update of the mean and variance, the plain average of the samples so far
+            // until the count reaches the warmup, which it then stays at
+            const int count = pCounts[x];
+            const float rate = 1.0f / (count + 1);
+            const float difference = value - pMeans[x];
+            pMeans[x] += rate * difference;
+            pVariances[x] = (1.0f - rate) * (pVariances[x] + rate * difference * difference);
+            if (count + 1 < WARMUP_FRAMES)
+            {
+                pCounts[x] = static_cast<USHORT>(count + 1);
+            }
+
+            pThresholds[x] = GetThreshold(pMeans[x], pVariances[x]);
+        }
+    }
+
+    ++m_learnedFrameCount;
+    return S_OK;
+}
+
+/// <summary>
+/// Forgets the model
+/// </summary>
+void DepthBackground::Reset()
+{
+    m_means.release();
+    m_variances.release();
+    m_counts.release();
+    m_thresholds.release();
+    m_learnedFrameCount = 0;
+}
+
+/// <summary>
+/// Gets the number of frames the model has learned
+/// </summary>
+/// <returns>number of frames</returns>
+UINT DepthBackground::GetLearnedFrameCount() const
+{
+    return m_learnedFrameCount;
+}
+
+/// <summary>
+/// Loads a model saved with Save
+/// </summary>
+/// <param name="path">path of the file</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the file is not a model, an error code otherwise</returns>
+HRESULT DepthBackground::Load(LPCWSTR path)
+{
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    DepthBackgroundHeader header;
+    DWORD read;
+    HRESULT hr = S_OK;
+    if (!ReadFile(hFile, &header, sizeof(header), &read, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (read != sizeof(header) || header.magic != DEPTH_BACKGROUND_MAGIC || header.version != DEPTH_BACKGROUND_VERSION ||
+        header.width <= 0 || header.height <= 0)
+    {
+        hr = E_INVALIDARG;
+    }
+
+    // The model is only replaced once the whole file has been read
+    Mat means, variances, counts;
+    if (SUCCEEDED(hr))
+    {
+        means.create(header.height, header.width, CV_32FC1);
+        variances.create(header.height, header.width, CV_32FC1);
+        counts.create(header.height, header.width, CV_16UC1);
+        hr = ReadRows(hFile, &means);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = ReadRows(hFile, &variances);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = ReadRows(hFile, &counts);
+    }
+
+    CloseHandle(hFile);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_means = means;
+    m_variances = variances;
+    m_counts = counts;
+    m_learnedFrameCount = header.learnedFrameCount;
+    UpdateThresholds();
+    return S_OK;
+}
+
+/// <summary>
+/// Saves the model
+/// </summary>
+/// <param name="path">path of the file to create</param>
+/// <returns>S_OK if successful, S_FALSE if nothing has been learned to save, an error code otherwise</returns>
+HRESULT DepthBackground::Save(LPCWSTR path) const
+{
+    // A model never learned would replace a saved one with nothing
+    if (m_learnedFrameCount == 0)
+    {
+        return S_FALSE;
+    }
+
+    HANDLE hFile = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    DepthBackgroundHeader header;
+    header.magic = DEPTH_BACKGROUND_MAGIC;
+    header.version = DEPTH_BACKGROUND_VERSION;
+    header.width = m_means.cols;
+    header.height = m_means.rows;
+    header.learnedFrameCount = m_learnedFrameCount;
+
+    HRESULT hr = S_OK;
+    DWORD written;
+    if (!WriteFile(hFile, &header, sizeof(header), &written, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteRows(hFile, m_means);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteRows(hFile, m_variances);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = WriteRows(hFile, m_counts);
+    }
+
+    CloseHandle(hFile);
+    return hr;
+}
+
+/// <summary>
+/// Writes 255 for each depth value that is known and nearer than its threshold, and 0 for the others
+/// </summary>
+/// <param name="pDepth">depth values, with the player index bits</param>
+/// <param name="pThresholds">thresholds in millimeters</param>
+/// <param name="pDst">destination mask</param>
+/// <param name="count">number of pixels</param>
+/// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+void DepthBackground::ToForeground(const USHORT* pDepth, const short* pThresholds, BYTE* pDst, UINT count, SimdPath path /* = PATH_AUTO */)
+{
+    switch (GetSupportedPath(path, PATHS))
+    {
+    case PATH_AVX2:
+        ToForegroundAvx2(pDepth, pThresholds, pDst, count);
+        break;
+
+    case PATH_SSE2:
+        ToForegroundSse2(pDepth, pThresholds, pDst, count);
+        break;
+
+    default:
+        ToForegroundScalar(pDepth, pThresholds, pDst, count);
+        break;
+    }
+}
+
+/// <summary>
+/// Allocates an empty model
+/// </summary>
+/// <param name="size">size of the depth frames</param>
+void DepthBackground::Create(Size size)
+{
+    m_means.create(size, CV_32FC1);
+    m_variances.create(size, CV_32FC1);
+    m_counts.create(size, CV_16UC1);
+    m_thresholds.create(size, CV_16SC1);
+    m_means.setTo(Scalar::all(0));
+    m_variances.setTo(Scalar::all(0));
+    m_counts.setTo(Scalar::all(0));
+    m_thresholds.setTo(Scalar::all(0));
+    m_learnedFrameCount = 0;
+}
+
+/// <summary>
+/// Computes the thresholds of the pixels from their means and variances
+/// </summary>
+void DepthBackground::UpdateThresholds()
+{
+    m_thresholds.create(m_means.size(), CV_16SC1);
+    for (int y = 0; y < m_means.rows; ++y)
+    {
+        const float* pMeans = m_means.ptr<float>(y);
+        const float* pVariances = m_variances.ptr<float>(y);
+        const USHORT* pCounts = m_counts.ptr<USHORT>(y);
+        short* pThresholds = m_thresholds.ptr<short>(y);
+        for (int x = 0; x < m_means.cols; ++x)
+        {
+            pThresholds[x] = pCounts[x] == 0 ? 0 : GetThreshold(pMeans[x], pVariances[x]);
+        }
+    }
+}
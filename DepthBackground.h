@@ -0,0 +1,135 @@
+#pragma once
+
+#include "windows.h"
+#include "SimdSupport.h"
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#pragma warning(pop)
+
+using namespace cv;
+
+namespace Microsoft {
+    namespace KinectBridge {
+        // Background file layout: a DepthBackgroundHeader followed by the model's rows, the
+        // means, the variances and the sample counts of every pixel, each row packed
+        static const DWORD DEPTH_BACKGROUND_MAGIC = 0x4242424B;    // "KBBB"
+        static const DWORD DEPTH_BACKGROUND_VERSION = 1;
+
+        struct DepthBackgroundHeader
+        {
+            DWORD magic;
+            DWORD version;
+            INT width;
+            INT height;
+            UINT learnedFrameCount;
+        };
+
+        /// <summary>
+        /// Learns the depth of the empty table per pixel and finds what stands on it. Each pixel
+        /// keeps a running mean and variance of its raw depth, a plain average over the first
+        /// frames and an exponential one after, updated only where the pixel is not foreground.
+        /// A pixel is foreground when it is nearer than its mean by a few standard deviations, or
+        /// by a minimum height, so the segmentation is a compare of each depth against a per-pixel
+        /// threshold, with SSE2 or AVX2. The model can be saved and loaded for a warm start.
+        /// </summary>
+        class DepthBackground
+        {
+        public:
+            // Constants:
+            // Code paths of the segmentation, a set of bits 1 << path
+            static const UINT PATHS = (1 << PATH_SCALAR) | (1 << PATH_SSE2) | (1 << PATH_AVX2);
+
+            // Frames averaged before the model becomes an exponential average of the same weight
+            static const int WARMUP_FRAMES = 64;
+
+            // Smallest height above the table, in millimeters, of a foreground pixel
+            static const int MIN_HEIGHT = 15;
+
+            // Functions:
+            /// <summary>
+            /// Constructor, nothing is foreground until a frame has been learned
+            /// </summary>
+            DepthBackground();
+
+            /// <summary>
+            /// Writes 255 for each pixel nearer than the table and 0 for the others. A frame of
+            /// another size than the model's starts a new model.
+            /// </summary>
+            /// <param name="depth">CV_16UC1 depth frame, with the player index bits</param>
+            /// <param name="pForeground">pointer to the CV_8UC1 foreground mask to fill</param>
+            /// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+            /// <returns>S_OK if successful, E_INVALIDARG if the frame is empty or not CV_16UC1</returns>
+            HRESULT Segment(const Mat& depth, Mat* pForeground, SimdPath path = PATH_AUTO);
+
+            /// <summary>
+            /// Updates the model with the pixels of a frame that are neither foreground nor unknown
+            /// </summary>
+            /// <param name="depth">CV_16UC1 depth frame, with the player index bits</param>
+            /// <param name="foreground">CV_8UC1 foreground mask of the frame</param>
+            /// <returns>S_OK if successful, E_INVALIDARG if the frame or the mask is not of the model's size and type</returns>
+            HRESULT Learn(const Mat& depth, const Mat& foreground);
+
+            /// <summary>
+            /// Forgets the model
+            /// </summary>
+            void Reset();
+
+            /// <summary>
+            /// Gets the number of frames the model has learned
+            /// </summary>
+            /// <returns>number of frames</returns>
+            UINT GetLearnedFrameCount() const;
+
+            /// <summary>
+            /// Loads a model saved with Save
+            /// </summary>
+            /// <param name="path">path of the file</param>
+            /// <returns>S_OK if successful, E_INVALIDARG if the file is not a model, an error code otherwise</returns>
+            HRESULT Load(LPCWSTR path);
+
+            /// <summary>
+            /// Saves the model
+            /// </summary>
+            /// <param name="path">path of the file to create</param>
+            /// <returns>S_OK if successful, S_FALSE if nothing has been learned to save, an error code otherwise</returns>
+            HRESULT Save(LPCWSTR path) const;
+
+            /// <summary>
+            /// Writes 255 for each depth value that is known and nearer than its threshold, and 0 for the others
+            /// </summary>
+            /// <param name="pDepth">depth values, with the player index bits</param>
+            /// <param name="pThresholds">thresholds in millimeters</param>
+            /// <param name="pDst">destination mask</param>
+            /// <param name="count">number of pixels</param>
+            /// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+            static void ToForeground(const USHORT* pDepth, const short* pThresholds, BYTE* pDst, UINT count, SimdPath path = PATH_AUTO);
+
+        private:
+            /// <summary>
+            /// Allocates an empty model
+            /// </summary>
+            /// <param name="size">size of the depth frames</param>
+            void Create(Size size);
+
+            /// <summary>
+            /// Computes the thresholds of the pixels from their means and variances
+            /// </summary>
+            void UpdateThresholds();
+
+            // Variables:
+            // Mean and variance of each pixel's depth in millimeters, and the number of frames
+            // averaged so far up to WARMUP_FRAMES
+            Mat m_means;
+            Mat m_variances;
+            Mat m_counts;
+
+            // Depth in millimeters below which each pixel is foreground, 0 until it has been learned
+            Mat m_thresholds;
+
+            UINT m_learnedFrameCount;
+        };
+    }
+}
@@ -0,0 +1,264 @@
+#include "DepthCodec.h"
+#include "SimdSupport.h"
+#include <emmintrin.h>
+#include <string.h>
+
+using namespace Microsoft::KinectBridge;
+
+namespace
+{
+    // Token bytes. Prediction errors are zigzag coded into 16 bits, small ones take one
+    // byte, larger ones two or three. Runs of zero errors take one or three bytes.
+    const BYTE TOKEN_SHORT_LIMIT = 0xC0;    // 0x00-0xBF: error 0-191
+    const BYTE TOKEN_MEDIUM = 0xC0;         // 0xC0-0xDF and one byte: error 192-8383
+    const BYTE TOKEN_LONG = 0xE0;           // two bytes: any error
+    const BYTE TOKEN_SHORT_RUN = 0xDF;      // 0xE1-0xFE: run of 2-31 zero errors
+    const BYTE TOKEN_LONG_RUN = 0xFF;       // two bytes: run of up to 65535 zero errors
+
+    const UINT MEDIUM_LIMIT = TOKEN_SHORT_LIMIT + 0x2000;
+    const UINT SHORT_RUN_LIMIT = 32;
+    const UINT LONG_RUN_LIMIT = 0xFFFF;
+
+    /// <summary>
+    /// Writes the tokens of a run of zero errors
+    /// </summary>
+    inline BYTE* WriteRun(BYTE* pDst, UINT run)
+    {
+        while (run >= SHORT_RUN_LIMIT)
+        {
+            UINT length = run < LONG_RUN_LIMIT ? run : LONG_RUN_LIMIT;
+            *pDst++ = TOKEN_LONG_RUN;
+            *pDst++ = static_cast<BYTE>(length);
+            *pDst++ = static_cast<BYTE>(length >> 8);
+            run -= length;
+        }
+
+        if (run == 1)
+        {
+            *pDst++ = 0;
+        }
+        else if (run > 1)
+        {
+            *pDst++ = static_cast<BYTE>(TOKEN_SHORT_RUN + run);
+        }
+
+        return pDst;
+    }
+
+    /// <summary>
+    /// Expands the tokens of one row into zigzag coded errors
+    /// </summary>
+    /// <returns>pointer past the row's tokens, or NULL if they are malformed</returns>
+    const BYTE* ExpandRow(const BYTE* pSrc, const BYTE* pEnd, USHORT* pRow, UINT width)
+    {
+        UINT x = 0;
+        while (x < width)
+        {
+            if (pSrc >= pEnd)
+            {
+                return NULL;
+            }
+
+            BYTE token = *pSrc++;
+            if (token < TOKEN_SHORT_LIMIT)
+            {
+                pRow[x++] = token;
+                continue;
+            }
+
+            if (token < TOKEN_LONG)
+            {
+                if (pSrc >= pEnd)
+                {
+                    return NULL;
+                }
+                pRow[x++] = static_cast<USHORT>(TOKEN_SHORT_LIMIT + (((token & 0x1F) << 8) | *pSrc++));
+                continue;
+            }
+
+            UINT run;
+            if (token == TOKEN_LONG || token == TOKEN_LONG_RUN)
+            {
+                if (pEnd - pSrc < 2)
+                {
+                    return NULL;
+                }
+                UINT value = pSrc[0] | (pSrc[1] << 8);
+                pSrc += 2;
+
+                if (token == TOKEN_LONG)
+                {
+                    pRow[x++] = static_cast<USHORT>(value);
+                    continue;
+                }
+                run = value;
+            }
+            else
+            {
+                run = token - TOKEN_SHORT_RUN;
+            }
+
+            if (run > width - x)
+            {
+                return NULL;
+            }
+            memset(pRow + x, 0, run * sizeof(USHORT));
+            x += run;
+        }
+
+        return pSrc;
+    }
+
+    // Row integrators, all turn a row of zigzag coded errors into depth values in place
+    typedef void (*IntegrateRowFunc)(USHORT* pRow, UINT width, USHORT first);
+
+    void IntegrateRowScalar(USHORT* pRow, UINT width, USHORT first)
+    {
+        USHORT value = first;
+        for (UINT x = 0; x < width; ++x)
+        {
+            USHORT zigzag = pRow[x];
+            value += static_cast<USHORT>((zigzag >> 1) ^ (0 - (zigzag & 1)));
+            pRow[x] = value;
+        }
+    }
+
+    void IntegrateRowSse2(USHORT* pRow, UINT width, USHORT first)
+    {
+        const __m128i one = _mm_set1_epi16(1);
+        __m128i running = _mm_set1_epi16(static_cast<short>(first));
+
+        UINT x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i zigzag = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow + x));
+            __m128i delta = _mm_xor_si128(_mm_srli_epi16(zigzag, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(zigzag, one)));
+
+            // Prefix sum of the eight errors in three shifted adds, then the value left of them
+            delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 2));
+            delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 4));
+            delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 8));
+            __m128i value = _mm_add_epi16(delta, running);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pRow + x), value);
+
+            // Broadcast the last value
+            running = _mm_shufflehi_epi16(value, 0xFF);
+            running = _mm_unpackhi_epi64(running, running);
+        }
+
+        IntegrateRowScalar(pRow + x, width - x, static_cast<USHORT>(_mm_cvtsi128_si32(running)));
+    }
+}
+
+/// <summary>
+/// Gets the size of the buffer Encode needs for a frame
+/// </summary>
+/// <param name="width">width in pixels</param>
+/// <param name="height">height in pixels</param>
+/// <returns>largest possible encoded size in bytes</returns>
+size_t DepthCodec::GetMaxEncodedSize(UINT width, UINT height)
+{
+    // No token takes more than three bytes per pixel
+    return static_cast<size_t>(width) * height * 3;
+}
+
+/// <summary>
+/// Encodes a depth frame
+/// </summary>
+/// <param name="pSrc">depth frame</param>
+/// <param name="srcPitch">bytes per source row</param>
+/// <param name="width">width in pixels</param>
+/// <param name="height">height in pixels</param>
+/// <param name="pDst">buffer of at least GetMaxEncodedSize bytes</param>
+/// <returns>encoded size in bytes</returns>
+size_t DepthCodec::Encode(const BYTE* pSrc, size_t srcPitch, UINT width, UINT height, BYTE* pDst)
+{
+    BYTE* pOut = pDst;
+    USHORT first = 0;
+
+    for (UINT y = 0; y < height; ++y)
+    {
+        const USHORT* pRow = reinterpret_cast<const USHORT*>(pSrc + y * srcPitch);
+        USHORT prediction = first;
+        UINT run = 0;
+
+        for (UINT x = 0; x < width; ++x)
+        {
+            // Errors wrap around in 16 bits, which the decoder undoes
+            USHORT delta = static_cast<USHORT>(pRow[x] - prediction);
+            UINT zigzag = static_cast<USHORT>((delta << 1) ^ (0 - (delta >> 15)));
+            prediction = pRow[x];
+
+            if (zigzag == 0)
+            {
+                ++run;
+                continue;
+            }
+
+            pOut = WriteRun(pOut, run);
+            run = 0;
+
+            if (zigzag < TOKEN_SHORT_LIMIT)
+            {
+                *pOut++ = static_cast<BYTE>(zigzag);
+            }
+            else if (zigzag < MEDIUM_LIMIT)
+            {
+                UINT value = zigzag - TOKEN_SHORT_LIMIT;
+                *pOut++ = static_cast<BYTE>(TOKEN_MEDIUM | (value >> 8));
+                *pOut++ = static_cast<BYTE>(value);
+            }
+            else
+            {
+                *pOut++ = TOKEN_LONG;
+                *pOut++ = static_cast<BYTE>(zigzag);
+                *pOut++ = static_cast<BYTE>(zigzag >> 8);
+            }
+        }
+
+        // Runs end with the row so rows decode independently of their length
+        pOut = WriteRun(pOut, run);
+        first = pRow[0];
+    }
+
+    return pOut - pDst;
+}
+
+/// <summary>
+/// Decodes a frame written by Encode
+/// </summary>
+/// <param name="pSrc">encoded frame</param>
+/// <param name="srcSize">encoded size in bytes</param>
+/// <param name="pDst">destination depth frame</param>
+/// <param name="dstPitch">bytes per destination row</param>
+/// <param name="width">width in pixels</param>
+/// <param name="height">height in pixels</param>
+/// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the data does not decode to a frame of the given size</returns>
+HRESULT DepthCodec::Decode(const BYTE* pSrc, size_t srcSize, BYTE* pDst, size_t dstPitch, UINT width, UINT height, SimdPath path /* = PATH_AUTO */)
+{
+    IntegrateRowFunc integrateRow = GetSupportedPath(path, PATHS) == PATH_SSE2 ? IntegrateRowSse2 : IntegrateRowScalar;
+
+    const BYTE* pEnd = pSrc + srcSize;
+    USHORT first = 0;
+
+    // Each row is expanded and integrated while it is in the cache
+    for (UINT y = 0; y < height; ++y)
+    {
+        USHORT* pRow = reinterpret_cast<USHORT*>(pDst + y * dstPitch);
+
+        pSrc = ExpandRow(pSrc, pEnd, pRow, width);
+        if (!pSrc)
+        {
+            return E_INVALIDARG;
+        }
+
+        integrateRow(pRow, width, first);
+        if (width > 0)
+        {
+            first = pRow[0];
+        }
+    }
+
+    return pSrc == pEnd ? S_OK : E_INVALIDARG;
+}
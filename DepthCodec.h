@@ -0,0 +1,58 @@
+#pragma once
+
+#include "windows.h"
+#include "SimdSupport.h"
+
+namespace Microsoft {
+    namespace KinectBridge {
+        /// <summary>
+        /// Lossless codec for raw Kinect depth frames, 16 bits per pixel. Each pixel is predicted
+        /// from its left neighbor, the first pixel of a row from the first pixel of the row above.
+        /// The prediction errors are zigzag coded into byte aligned tokens of one to three bytes,
+        /// and runs of unchanged pixels, such as the 0 and 65535 runs of invalid depth, into one token.
+        /// Decoding expands the tokens of a row and then integrates it, with SSE2 prefix sums.
+        /// </summary>
+        class DepthCodec
+        {
+        public:
+            // Constants:
+            // Code paths of the decoding, a set of bits 1 << path
+            static const UINT PATHS = (1 << PATH_SCALAR) | (1 << PATH_SSE2);
+
+            // Functions:
+            /// <summary>
+            /// Gets the size of the buffer Encode needs for a frame
+            /// </summary>
+            /// <param name="width">width in pixels</param>
+            /// <param name="height">height in pixels</param>
+            /// <returns>largest possible encoded size in bytes</returns>
+            static size_t GetMaxEncodedSize(UINT width, UINT height);
+
+            /// <summary>
+            /// Encodes a depth frame
+            /// </summary>
+            /// <param name="pSrc">depth frame</param>
+            /// <param name="srcPitch">bytes per source row</param>
+            /// <param name="width">width in pixels</param>
+            /// <param name="height">height in pixels</param>
+            /// <param name="pDst">buffer of at least GetMaxEncodedSize bytes</param>
+            /// <returns>encoded size in bytes</returns>
+            static size_t Encode(const BYTE* pSrc, size_t srcPitch, UINT width, UINT height, BYTE* pDst);
+
+            /// <summary>
+            /// Decodes a frame written by Encode
+            /// </summary>
+            /// <param name="pSrc">encoded frame</param>
+            /// <param name="srcSize">encoded size in bytes</param>
+            /// <param name="pDst">destination depth frame</param>
+            /// <param name="dstPitch">bytes per destination row</param>
+            /// <param name="width">width in pixels</param>
+            /// <param name="height">height in pixels</param>
+            /// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+            /// <returns>S_OK if successful, E_INVALIDARG if the data does not decode to a frame of the given size</returns>
+            static HRESULT Decode(const BYTE* pSrc, size_t srcSize, BYTE* pDst, size_t dstPitch, UINT width, UINT height, SimdPath path = PATH_AUTO);
+
+        private:
+        };
+    }
+}
@@ -0,0 +1,145 @@
+#include "DepthConverter.h"
+#include "SimdSupport.h"
+#include <NuiApi.h>
+#include <immintrin.h>
+
+using namespace Microsoft::KinectBridge;
+
+namespace
+{
+    // Row converters, all take a depth row, a count of pixels and the table
+    typedef void (*RowFunc)(const USHORT* pSrc, UINT* pDst, UINT width, const UINT* pTable);
+
+    void ApplyTableRowScalar(const USHORT* pSrc, UINT* pDst, UINT width, const UINT* pTable)
+    {
+        for (UINT x = 0; x < width; ++x)
+        {
+            pDst[x] = pTable[pSrc[x]];
+        }
+    }
+
+    void ApplyTableRowAvx2(const USHORT* pSrc, UINT* pDst, UINT width, const UINT* pTable)
+    {
+        const int* pEntries = reinterpret_cast<const int*>(pTable);
+
+        UINT x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m256i depth = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrc + x));
+            __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(depth));
+            __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(depth, 1));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + x), _mm256_i32gather_epi32(pEntries, lo, 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + x + 8), _mm256_i32gather_epi32(pEntries, hi, 4));
+        }
+
+        ApplyTableRowScalar(pSrc + x, pDst + x, width - x, pTable);
+    }
+
+    // Mask converters, all take a depth row, a count of pixels and the band
+    typedef void (*MaskRowFunc)(const USHORT* pSrc, BYTE* pDst, UINT width, USHORT minDepth, USHORT maxDepth);
+
+    void ToBandMaskRowScalar(const USHORT* pSrc, BYTE* pDst, UINT width, USHORT minDepth, USHORT maxDepth)
+    {
+        for (UINT x = 0; x < width; ++x)
+        {
+            USHORT depth = pSrc[x] >> NUI_IMAGE_PLAYER_INDEX_SHIFT;
+            pDst[x] = depth >= minDepth && depth <= maxDepth ? 255 : 0;
+        }
+    }
+
+    /// <summary>
+    /// Computes the band mask of eight depth values as 16 bit lanes of all ones or zeros.
+    /// The shifted depth is at most 8191, so the signed compares are exact.
+    /// </summary>
+    inline __m128i BandMask8(const USHORT* pSrc, __m128i belowMin, __m128i aboveMax)
+    {
+        __m128i depth = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc)), NUI_IMAGE_PLAYER_INDEX_SHIFT);
+        return _mm_and_si128(_mm_cmpgt_epi16(depth, belowMin), _mm_cmpgt_epi16(aboveMax, depth));
+    }
+
+    void ToBandMaskRowSse2(const USHORT* pSrc, BYTE* pDst, UINT width, USHORT minDepth, USHORT maxDepth)
+    {
+        const __m128i belowMin = _mm_set1_epi16(static_cast<short>(minDepth - 1));
+        const __m128i aboveMax = _mm_set1_epi16(static_cast<short>(maxDepth + 1));
+
+        UINT x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i mask = _mm_packs_epi16(BandMask8(pSrc + x, belowMin, aboveMax), BandMask8(pSrc + x + 8, belowMin, aboveMax));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + x), mask);
+        }
+
+        ToBandMaskRowScalar(pSrc + x, pDst + x, width - x, minDepth, maxDepth);
+    }
+
+    /// <summary>
+    /// Computes the band mask of sixteen depth values as 16 bit lanes of all ones or zeros
+    /// </summary>
+    inline __m256i BandMask16(const USHORT* pSrc, __m256i belowMin, __m256i aboveMax)
+    {
+        __m256i depth = _mm256_srli_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrc)), NUI_IMAGE_PLAYER_INDEX_SHIFT);
+        return _mm256_and_si256(_mm256_cmpgt_epi16(depth, belowMin), _mm256_cmpgt_epi16(aboveMax, depth));
+    }
+
+    void ToBandMaskRowAvx2(const USHORT* pSrc, BYTE* pDst, UINT width, USHORT minDepth, USHORT maxDepth)
+    {
+        const __m256i belowMin = _mm256_set1_epi16(static_cast<short>(minDepth - 1));
+        const __m256i aboveMax = _mm256_set1_epi16(static_cast<short>(maxDepth + 1));
+
+        UINT x = 0;
+        for (; x + 32 <= width; x += 32)
+        {
+            __m256i mask = PackMasksAvx2(BandMask16(pSrc + x, belowMin, aboveMax), BandMask16(pSrc + x + 16, belowMin, aboveMax));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + x), mask);
+        }
+
+        ToBandMaskRowSse2(pSrc + x, pDst + x, width - x, minDepth, maxDepth);
+    }
+}
+
+/// <summary>
+/// Replaces each depth value with its 32 bit table entry
+/// </summary>
+/// <param name="pSrc">depth frame</param>
+/// <param name="srcPitch">bytes per source row</param>
+/// <param name="pDst">destination image with 4 bytes per pixel</param>
+/// <param name="dstStep">bytes per destination row</param>
+/// <param name="width">width in pixels</param>
+/// <param name="height">height in pixels</param>
+/// <param name="pTable">table of 65536 entries indexed by depth value</param>
+/// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+void DepthConverter::ApplyTable(const BYTE* pSrc, size_t srcPitch, BYTE* pDst, size_t dstStep, UINT width, UINT height, const UINT* pTable, SimdPath path /* = PATH_AUTO */)
+{
+    // There is no gather before AVX2, the other paths look up one entry at a time
+    RowFunc rowFunc = GetSupportedPath(path, PATHS) == PATH_AVX2 ? ApplyTableRowAvx2 : ApplyTableRowScalar;
+
+    for (UINT y = 0; y < height; ++y)
+    {
+        rowFunc(reinterpret_cast<const USHORT*>(pSrc + y * srcPitch), reinterpret_cast<UINT*>(pDst + y * dstStep), width, pTable);
+    }
+}
+
+/// <summary>
+/// Writes 255 for each pixel whose depth is within the band and 0 for the others.
+/// The player index bits are ignored.
+/// </summary>
+/// <param name="pSrc">depth frame</param>
+/// <param name="srcPitch">bytes per source row</param>
+/// <param name="pDst">destination image with 1 byte per pixel</param>
+/// <param name="dstStep">bytes per destination row</param>
+/// <param name="width">width in pixels</param>
+/// <param name="height">height in pixels</param>
+/// <param name="minDepth">nearest depth in the band, in millimeters</param>
+/// <param name="maxDepth">farthest depth in the band, in millimeters, at most 8191</param>
+/// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+void DepthConverter::ToBandMask(const BYTE* pSrc, size_t srcPitch, BYTE* pDst, size_t dstStep, UINT width, UINT height, USHORT minDepth, USHORT maxDepth, SimdPath path /* = PATH_AUTO */)
+{
+    SimdPath supportedPath = GetSupportedPath(path, PATHS);
+    MaskRowFunc rowFunc = supportedPath == PATH_AVX2 ? ToBandMaskRowAvx2 : supportedPath == PATH_SSE2 ? ToBandMaskRowSse2 : ToBandMaskRowScalar;
+
+    for (UINT y = 0; y < height; ++y)
+    {
+        rowFunc(reinterpret_cast<const USHORT*>(pSrc + y * srcPitch), pDst + y * dstStep, width, minDepth, maxDepth);
+    }
+}
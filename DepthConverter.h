@@ -0,0 +1,52 @@
+#pragma once
+
+#include "windows.h"
+#include "SimdSupport.h"
+
+namespace Microsoft {
+    namespace KinectBridge {
+        /// <summary>
+        /// Converts raw Kinect depth frames, 16 bits per pixel, through per-value lookup tables
+        /// or into 8 bit masks of a depth band. The AVX2 path gathers eight table entries at a time,
+        /// the masks use SSE2 or AVX2 compares.
+        /// </summary>
+        class DepthConverter
+        {
+        public:
+            // Constants:
+            // Code paths of the conversions, a set of bits 1 << path
+            static const UINT PATHS = (1 << PATH_SCALAR) | (1 << PATH_SSE2) | (1 << PATH_AVX2);
+
+            // Functions:
+            /// <summary>
+            /// Replaces each depth value with its 32 bit table entry
+            /// </summary>
+            /// <param name="pSrc">depth frame</param>
+            /// <param name="srcPitch">bytes per source row</param>
+            /// <param name="pDst">destination image with 4 bytes per pixel</param>
+            /// <param name="dstStep">bytes per destination row</param>
+            /// <param name="width">width in pixels</param>
+            /// <param name="height">height in pixels</param>
+            /// <param name="pTable">table of 65536 entries indexed by depth value</param>
+            /// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+            static void ApplyTable(const BYTE* pSrc, size_t srcPitch, BYTE* pDst, size_t dstStep, UINT width, UINT height, const UINT* pTable, SimdPath path = PATH_AUTO);
+
+            /// <summary>
+            /// Writes 255 for each pixel whose depth is within the band and 0 for the others.
+            /// The player index bits are ignored.
+            /// </summary>
+            /// <param name="pSrc">depth frame</param>
+            /// <param name="srcPitch">bytes per source row</param>
+            /// <param name="pDst">destination image with 1 byte per pixel</param>
+            /// <param name="dstStep">bytes per destination row</param>
+            /// <param name="width">width in pixels</param>
+            /// <param name="height">height in pixels</param>
+            /// <param name="minDepth">nearest depth in the band, in millimeters</param>
+            /// <param name="maxDepth">farthest depth in the band, in millimeters, at most 8191</param>
+            /// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+            static void ToBandMask(const BYTE* pSrc, size_t srcPitch, BYTE* pDst, size_t dstStep, UINT width, UINT height, USHORT minDepth, USHORT maxDepth, SimdPath path = PATH_AUTO);
+
+        private:
+        };
+    }
+}
@@ -0,0 +1,171 @@
+#include "DepthSampler.h"
+#include <NuiApi.h>
+#include <algorithm>
+
+/// <summary>
+/// Constructor, maps every position to itself until a transform is set
+/// </summary>
+DepthSampler::DepthSampler() :
+    m_inverse(Matx33d::eye())
+{
+}
+
+/// <summary>
+/// Sets the warp the positions are in
+/// </summary>
+/// <param name="homography">3x3 matrix mapping depth pixels to the warped image</param>
+/// <param name="depthSize">size of the depth frames the homography is for, others are scaled to it</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the matrix is not 3x3 or is singular</returns>
+HRESULT DepthSampler::SetTransform(const Mat& homography, Size depthSize)
+{
+    if (homography.rows != 3 || homography.cols != 3 || (homography.type() != CV_64FC1 && homography.type() != CV_32FC1) || depthSize.area() == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    Mat converted;
+    homography.convertTo(converted, CV_64F);
+    Matx33d forward = converted;
+    if (determinant(forward) == 0.0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_inverse = forward.inv();
+    m_depthSize = depthSize;
+    return S_OK;
+}
+
+/// <summary>
+/// Maps a position in the warped image to the depth frame
+/// </summary>
+/// <param name="position">position in the warped image</param>
+/// <param name="depthSize">size of the depth frame</param>
+/// <returns>position in the depth frame</returns>
+Point2f DepthSampler::ToDepth(Point2f position, Size depthSize) const
+{
+    Vec3d mapped = m_inverse * Vec3d(position.x, position.y, 1.0);
+
+    // The homography is for one depth resolution, the others see the same field of view
+    double scaleX = m_depthSize.width > 0 ? static_cast<double>(depthSize.width) / m_depthSize.width : 1.0;
+    double scaleY = m_depthSize.height > 0 ? static_cast<double>(depthSize.height) / m_depthSize.height : 1.0;
+    return Point2f(static_cast<float>(mapped[0] / mapped[2] * scaleX), static_cast<float>(mapped[1] / mapped[2] * scaleY));
+}
+
+/// <summary>
+/// Samples the depth under a position of the warped image
+/// </summary>
+/// <param name="depth">CV_16UC1 depth frame, with the player index bits</param>
+/// <param name="position">position in the warped image</param>
+/// <param name="mode">how the depth around the position is sampled</param>
+/// <param name="pMillimeters">pointer in which to return the depth in millimeters, 0 if unknown</param>
+/// <returns>S_OK if successful, S_FALSE if the position falls outside the frame or its depth is unknown, E_INVALIDARG if the frame is not CV_16UC1</returns>
+HRESULT DepthSampler::Sample(const Mat& depth, Point2f position, SampleMode mode, float* pMillimeters) const
+{
+    if (!pMillimeters)
+    {
+        return E_POINTER;
+    }
+
+    *pMillimeters = 0.0f;
+
+    if (depth.empty() || depth.type() != CV_16UC1)
+    {
+        return E_INVALIDARG;
+    }
+
+    Point2f mapped = ToDepth(position, depth.size());
+    if (mode == SAMPLE_BILINEAR)
+    {
+        // The four pixels around the position have to be inside the frame
+        if (!(mapped.x >= 0.0f && mapped.y >= 0.0f && mapped.x < depth.cols - 1 && mapped.y < depth.rows - 1))
+        {
+            return S_FALSE;
+        }
+        *pMillimeters = SampleBilinear(depth, mapped);
+    }
+    else
+    {
+        Point pixel(cvRound(mapped.x), cvRound(mapped.y));
+        if (!Rect(0, 0, depth.cols, depth.rows).contains(pixel))
+        {
+            return S_FALSE;
+        }
+        *pMillimeters = SampleMedian(depth, pixel);
+    }
+
+    return *pMillimeters > 0.0f ? S_OK : S_FALSE;
+}
+
+/// <summary>
+/// Interpolates the known depths of the four pixels around a position
+/// </summary>
+/// <param name="depth">depth frame</param>
+/// <param name="position">position in the depth frame, with its four pixels inside it</param>
+/// <returns>depth in millimeters, 0 if none of the pixels is known</returns>
+float DepthSampler::SampleBilinear(const Mat& depth, Point2f position)
+{
+    int x = static_cast<int>(position.x);
+    int y = static_cast<int>(position.y);
+    float fx = position.x - x;
+    float fy = position.y - y;
+
+    const USHORT* pTop = depth.ptr<USHORT>(y) + x;
+    const USHORT* pBottom = depth.ptr<USHORT>(y + 1) + x;
+    const USHORT taps[4] = { pTop[0], pTop[1], pBottom[0], pBottom[1] };
+    const float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+
+    // The weights of the unknown pixels go to the known ones
+    float sum = 0.0f;
+    float weightSum = 0.0f;
+    for (int i = 0; i < 4; ++i)
+    {
+        USHORT millimeters = taps[i] >> NUI_IMAGE_PLAYER_INDEX_SHIFT;
+        if (millimeters > 0 && taps[i] != UNKNOWN_DEPTH)
+        {
+            sum += weights[i] * millimeters;
+            weightSum += weights[i];
+        }
+    }
+
+    return weightSum > 0.0f ? sum / weightSum : 0.0f;
+}
+
+/// <summary>
+/// Takes the median of the known depths within MEDIAN_RADIUS of a pixel
+/// </summary>
+/// <param name="depth">depth frame</param>
+/// <param name="pixel">pixel in the depth frame</param>
+/// <returns>depth in millimeters, 0 if none of the pixels is known</returns>
+float DepthSampler::SampleMedian(const Mat& depth, Point pixel)
+{
+    const int side = 2 * MEDIAN_RADIUS + 1;
+    USHORT values[side * side];
+    int count = 0;
+
+    // The window is clipped at the borders of the frame
+    int y0 = pixel.y > MEDIAN_RADIUS ? pixel.y - MEDIAN_RADIUS : 0;
+    int y1 = pixel.y + MEDIAN_RADIUS < depth.rows ? pixel.y + MEDIAN_RADIUS + 1 : depth.rows;
+    int x0 = pixel.x > MEDIAN_RADIUS ? pixel.x - MEDIAN_RADIUS : 0;
+    int x1 = pixel.x + MEDIAN_RADIUS < depth.cols ? pixel.x + MEDIAN_RADIUS + 1 : depth.cols;
+    for (int y = y0; y < y1; ++y)
+    {
+        const USHORT* pRow = depth.ptr<USHORT>(y);
+        for (int x = x0; x < x1; ++x)
+        {
+            USHORT millimeters = pRow[x] >> NUI_IMAGE_PLAYER_INDEX_SHIFT;
+            if (millimeters > 0 && pRow[x] != UNKNOWN_DEPTH)
+            {
+                values[count++] = millimeters;
+            }
+        }
+    }
+
+    if (count == 0)
+    {
+        return 0.0f;
+    }
+
+    std::nth_element(values, values + count / 2, values + count);
+    return values[count / 2];
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <windows.h>
+#include <limits.h>
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#pragma warning(pop)
+
+using namespace cv;
+
+/// <summary>
+/// Reads the depth in millimeters under a position of a warped image, such as the rectified
+/// workspace or its work resolution ROI, from the raw 16 bit depth frame the image was warped
+/// from. The position is mapped back through the inverse of the warp's homography, so nothing
+/// is copied or converted, and the depth keeps the full range and precision of the sensor.
+/// Pixels of unknown depth are left out of every sample.
+/// </summary>
+class DepthSampler
+{
+public:
+    // How the depth around a position is sampled
+    enum SampleMode
+    {
+        // Bilinear interpolation of the four pixels around the position, for a smooth surface
+        SAMPLE_BILINEAR = 0,
+
+        // Median of the pixels within MEDIAN_RADIUS of the position, robust to the noise along edges
+        SAMPLE_MEDIAN
+    };
+
+    // Constants:
+    // Half the side of the median window, in depth pixels
+    static const int MEDIAN_RADIUS = 2;
+
+    // Raw value of the pixels the sensor could not measure, which would shift to 8191 mm
+    static const USHORT UNKNOWN_DEPTH = USHRT_MAX;
+
+    // Functions:
+    /// <summary>
+    /// Constructor, maps every position to itself until a transform is set
+    /// </summary>
+    DepthSampler();
+
+    /// <summary>
+    /// Sets the warp the positions are in
+    /// </summary>
+    /// <param name="homography">3x3 matrix mapping depth pixels to the warped image</param>
+    /// <param name="depthSize">size of the depth frames the homography is for, others are scaled to it</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the matrix is not 3x3 or is singular</returns>
+    HRESULT SetTransform(const Mat& homography, Size depthSize);
+
+    /// <summary>
+    /// Maps a position in the warped image to the depth frame
+    /// </summary>
+    /// <param name="position">position in the warped image</param>
+    /// <param name="depthSize">size of the depth frame</param>
+    /// <returns>position in the depth frame</returns>
+    Point2f ToDepth(Point2f position, Size depthSize) const;
+
+    /// <summary>
+    /// Samples the depth under a position of the warped image
+    /// </summary>
+    /// <param name="depth">CV_16UC1 depth frame, with the player index bits</param>
+    /// <param name="position">position in the warped image</param>
+    /// <param name="mode">how the depth around the position is sampled</param>
+    /// <param name="pMillimeters">pointer in which to return the depth in millimeters, 0 if unknown</param>
+    /// <returns>S_OK if successful, S_FALSE if the position falls outside the frame or its depth is unknown, E_INVALIDARG if the frame is not CV_16UC1</returns>
+    HRESULT Sample(const Mat& depth, Point2f position, SampleMode mode, float* pMillimeters) const;
+
+private:
+    /// <summary>
+    /// Interpolates the known depths of the four pixels around a position
+    /// </summary>
+    /// <param name="depth">depth frame</param>
+    /// <param name="position">position in the depth frame, with its four pixels inside it</param>
+    /// <returns>depth in millimeters, 0 if none of the pixels is known</returns>
+    static float SampleBilinear(const Mat& depth, Point2f position);
+
+    /// <summary>
+    /// Takes the median of the known depths within MEDIAN_RADIUS of a pixel
+    /// </summary>
+    /// <param name="depth">depth frame</param>
+    /// <param name="pixel">pixel in the depth frame</param>
+    /// <returns>depth in millimeters, 0 if none of the pixels is known</returns>
+    static float SampleMedian(const Mat& depth, Point pixel);
+
+    // Variables:
+    // Inverse of the warp, mapping the warped image to the depth frames of m_depthSize
+    Matx33d m_inverse;
+    Size m_depthSize;
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <windows.h>
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#pragma warning(pop)
+
+#include "ScratchArena.h"
+
+using namespace cv;
+
+/// <summary>
+/// Image flowing through the stages of a filter pipeline. Pipelines may extend it with
+/// whatever their stages share, the stages get the derived type.
+/// </summary>
+struct FilterFrame
+{
+    // Current image, a header of the input or of a scratch buffer
+    Mat image;
+
+    // Buffers the stages write into
+    ScratchArena* pScratch;
+};
+
+/// <summary>
+/// Runs stages in order, stopping at the first one that fails. Each stage is a type with
+/// a static HRESULT Run(Frame*), so the calls are resolved and can be inlined at compile time.
+/// </summary>
+/// <param name="pFrame">frame to filter</param>
+/// <returns>S_OK if successful, the error code of the failed stage otherwise</returns>
+template <typename Frame, typename... Stages>
+inline HRESULT RunStages(Frame* pFrame)
+{
+    HRESULT hr = S_OK;
+
+    // Expands to one call per stage, in order, the leading 0 allows no stages
+    int expansion[] = { 0, (SUCCEEDED(hr) ? (hr = Stages::Run(pFrame), 0) : 0)... };
+    (void)expansion;
+
+    return FAILED(hr) ? hr : S_OK;
+}
+
+/// <summary>
+/// Filter pipeline as selected at run time. Running a pipeline costs one virtual call
+/// per frame, the stages themselves are bound at compile time.
+/// </summary>
+template <typename Frame>
+class FilterPipelineBase
+{
+public:
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    virtual ~FilterPipelineBase() {}
+
+    /// <summary>
+    /// Runs the stages of the pipeline in order, stopping at the first one that fails
+    /// </summary>
+    /// <param name="pFrame">frame to filter, its image is replaced by the result</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    virtual HRESULT Run(Frame* pFrame) const = 0;
+};
+
+/// <summary>
+/// Pipeline of typed stages, see RunStages
+/// </summary>
+template <typename Frame, typename... Stages>
+class FilterPipeline : public FilterPipelineBase<Frame>
+{
+public:
+    /// <summary>
+    /// Runs the stages of the pipeline in order, stopping at the first one that fails
+    /// </summary>
+    /// <param name="pFrame">frame to filter, its image is replaced by the result</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT Run(Frame* pFrame) const override
+    {
+        return RunStages<Frame, Stages...>(pFrame);
+    }
+};
+
+/// <summary>
+/// Stage running its inner stages only when the condition stage returns S_OK, and
+/// skipping them when it returns S_FALSE
+/// </summary>
+template <typename Condition, typename... Stages>
+struct ConditionalStage
+{
+    /// <summary>
+    /// Runs the condition and, if it holds, the inner stages
+    /// </summary>
+    /// <param name="pFrame">frame to filter</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    template <typename Frame>
+    static HRESULT Run(Frame* pFrame)
+    {
+        HRESULT hr = Condition::Run(pFrame);
+        if (hr != S_OK)
+        {
+            return FAILED(hr) ? hr : S_OK;
+        }
+
+        return RunStages<Frame, Stages...>(pFrame);
+    }
+};
+
+/// <summary>
+/// Composes point-wise operations into one. Each operation is a type with InPixel and
+/// OutPixel types and a static OutPixel Apply(const InPixel&), the output of one being
+/// the input of the next.
+/// </summary>
+template <typename... Ops>
+struct PointChain;
+
+template <typename Op>
+struct PointChain<Op>
+{
+    typedef typename Op::InPixel InPixel;
+    typedef typename Op::OutPixel OutPixel;
+
+    static OutPixel Apply(const InPixel& pixel)
+    {
+        return Op::Apply(pixel);
+    }
+};
+
+template <typename Op, typename Next, typename... Rest>
+struct PointChain<Op, Next, Rest...>
+{
+    typedef typename Op::InPixel InPixel;
+    typedef typename PointChain<Next, Rest...>::OutPixel OutPixel;
+
+    static OutPixel Apply(const InPixel& pixel)
+    {
+        return PointChain<Next, Rest...>::Apply(Op::Apply(pixel));
+    }
+};
+
+/// <summary>
+/// Stage running adjacent point-wise operations fused into a single pass over the image,
+/// writing the result into a scratch buffer
+/// </summary>
+template <int Buffer, typename... Ops>
+struct PointStage
+{
+    typedef PointChain<Ops...> Chain;
+    typedef typename Chain::InPixel InPixel;
+    typedef typename Chain::OutPixel OutPixel;
+
+    /// <summary>
+    /// Applies the operations to every pixel of the frame
+    /// </summary>
+    /// <param name="pFrame">frame to filter</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the image does not have the input pixel type</returns>
+    template <typename Frame>
+    static HRESULT Run(Frame* pFrame)
+    {
+        const Mat src = pFrame->image;
+        if (src.type() != DataType<InPixel>::type)
+        {
+            return E_INVALIDARG;
+        }
+
+        Mat& dst = pFrame->pScratch->Get(Buffer, src.size(), DataType<OutPixel>::type);
+
+        // Continuous images are walked as a single row
+        int rows = src.rows;
+        int cols = src.cols;
+        if (src.isContinuous() && dst.isContinuous())
+        {
+            cols *= rows;
+            rows = 1;
+        }
+
+        for (int y = 0; y < rows; ++y)
+        {
+            const InPixel* pSrc = src.ptr<InPixel>(y);
+            OutPixel* pDst = dst.ptr<OutPixel>(y);
+
+            for (int x = 0; x < cols; ++x)
+            {
+                pDst[x] = Chain::Apply(pSrc[x]);
+            }
+        }
+
+        pFrame->image = dst;
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Point-wise conversion of RGBA pixels to gray, with the fixed-point weights of cvtColor
+/// so the result is the same as CV_RGBA2GRAY
+/// </summary>
+struct RgbaToGrayOp
+{
+    typedef Vec4b InPixel;
+    typedef uchar OutPixel;
+
+    static uchar Apply(const Vec4b& pixel)
+    {
+        return static_cast<uchar>((pixel[0] * 9798 + pixel[1] * 19235 + pixel[2] * 3735 + (1 << 14)) >> 15);
+    }
+};
@@ -0,0 +1,176 @@
+#include "FrameInput.h"
+
+using namespace Microsoft::KinectBridge;
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="pFrameHelper">frame helper to take the frames from</param>
+/// <param name="pOpenCVHelper">helper whose filters get the images and whose workspace is calibrated</param>
+FrameInput::FrameInput(OpenCVFrameHelper* pFrameHelper, OpenCVHelper* pOpenCVHelper) :
+    m_pFrameHelper(pFrameHelper),
+    m_pOpenCVHelper(pOpenCVHelper),
+    m_isCalibrating(false)
+{
+}
+
+/// <summary>
+/// Allocates the color image at the color stream resolution
+/// </summary>
+void FrameInput::CreateColorImage()
+{
+    DWORD width, height;
+    m_pFrameHelper->GetColorFrameSize(&width, &height);
+    m_colorMat.create(Size(width, height), m_pFrameHelper->COLOR_TYPE);
+}
+
+/// <summary>
+/// Allocates the depth images at the depth stream resolution
+/// </summary>
+void FrameInput::CreateDepthImages()
+{
+    DWORD width, height;
+    m_pFrameHelper->GetDepthFrameSize(&width, &height);
+    m_depthMat.create(Size(width, height), m_pFrameHelper->DEPTH_RGB_TYPE);
+    m_depthRawMat.create(Size(width, height), m_pFrameHelper->DEPTH_TYPE);
+}
+
+/// <summary>
+/// Loads the trapezoid of the workspace found in an earlier run, or finds it in the
+/// first frames and saves it if there is none to load or calibration is asked for
+/// </summary>
+/// <param name="path">path of the file, empty not to load or save the workspace</param>
+/// <param name="isCalibrating">true to find the workspace even if it can be loaded</param>
+/// <param name="name">name of the workspace in the console messages</param>
+void FrameInput::InitializeWorkspace(const std::wstring& path, bool isCalibrating, const std::string& name)
+{
+    m_workspacePath = path;
+    m_workspaceName = name;
+    m_isCalibrating = isCalibrating || (!path.empty() && FAILED(m_pOpenCVHelper->LoadWorkspace(path.c_str())));
+}
+
+/// <summary>
+/// Gets whether the workspace is still being looked for
+/// </summary>
+/// <returns>true while calibrating</returns>
+bool FrameInput::IsCalibrating() const
+{
+    return m_isCalibrating;
+}
+
+/// <summary>
+/// Adds the current color and depth frames to the workspace calibration, and moves the
+/// trapezoid to the workspace once it is found. Only called between frames, while no filter uses it.
+/// </summary>
+/// <returns>S_OK if successful, S_FALSE while more frames are needed, an error code otherwise</returns>
+HRESULT FrameInput::CalibrateWorkspace()
+{
+    HRESULT hr = m_pFrameHelper->GetColorImage(&m_colorMat);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hr = m_pFrameHelper->GetDepthImage(&m_depthRawMat);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hr = m_pOpenCVHelper->CalibrateWorkspace(m_colorMat, m_depthRawMat,
+        m_pFrameHelper->GetColorFrameResolution(), m_pFrameHelper->GetDepthFrameResolution());
+    if (hr == E_FAIL)
+    {
+        printf("%s not found, retrying.\n", m_workspaceName.c_str());
+        return hr;
+    }
+    else if (hr != S_OK)
+    {
+        return hr;
+    }
+
+    m_isCalibrating = false;
+    Workspace workspace = m_pOpenCVHelper->GetWorkspace();
+    printf("%s found: (%.1f, %.1f) (%.1f, %.1f) (%.1f, %.1f) (%.1f, %.1f).\n", m_workspaceName.c_str(),
+        workspace.corners[0].x, workspace.corners[0].y, workspace.corners[1].x, workspace.corners[1].y,
+        workspace.corners[2].x, workspace.corners[2].y, workspace.corners[3].x, workspace.corners[3].y);
+
+    if (!m_workspacePath.empty())
+    {
+        hr = WorkspaceCalibrator::Save(m_workspacePath.c_str(), workspace);
+        if (FAILED(hr))
+        {
+            printf("%s could not be saved.\n", m_workspaceName.c_str());
+        }
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Converts the current color frame for the color filter
+/// </summary>
+/// <param name="pImage">pointer in which to return a header of the color image</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT FrameInput::GetColorImage(Mat* pImage)
+{
+    HRESULT hr = m_pFrameHelper->GetColorImage(&m_colorMat);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Filter a header of the frame, the filters may point it at their own buffers
+    *pImage = m_colorMat;
+    return S_OK;
+}
+
+/// <summary>
+/// Converts the current depth frame into the image the depth filter works on, and the raw
+/// depth frame for the filters that sample the depth
+/// </summary>
+/// <param name="pImage">pointer in which to return a header of the depth image</param>
+/// <param name="pDepth">pointer in which to return a header of the raw depth frame, empty if the filter does not sample the depth</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT FrameInput::GetDepthImages(Mat* pImage, Mat* pDepth)
+{
+    // The filters that sample the depth get the raw depth frame besides their image, the background filter works on it alone
+    HRESULT hr = S_OK;
+    Mat depth;
+    if (m_pOpenCVHelper->UsesDepthSamples())
+    {
+        hr = m_pFrameHelper->GetDepthImage(&m_depthRawMat);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        depth = m_depthRawMat;
+    }
+
+    // The edge filter works on the depth band mask, straight from the depth frame
+    Mat* pDepthMat;
+    if (m_pOpenCVHelper->UsesRawDepth())
+    {
+        pDepthMat = &m_depthRawMat;
+    }
+    else if (m_pOpenCVHelper->UsesDepthMask())
+    {
+        pDepthMat = &m_depthMaskMat;
+        hr = m_pFrameHelper->GetDepthImageAsMask(pDepthMat);
+    }
+    else
+    {
+        pDepthMat = &m_depthMat;
+        hr = m_pFrameHelper->GetDepthImageAsArgb(pDepthMat);
+    }
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Filter a header of the frame, the filters may point it at their own buffers
+    *pImage = *pDepthMat;
+    *pDepth = depth;
+    return S_OK;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+#include <string>
+
+#include "OpenCVHelper.h"
+
+/// <summary>
+/// Converts the frames of a frame helper into the images the filters of an OpenCV helper work on,
+/// and finds the workspace in them while calibrating. The processing thread of the window and each
+/// sensor pipeline have their own, used from their processing thread only.
+/// </summary>
+class FrameInput
+{
+public:
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="pFrameHelper">frame helper to take the frames from</param>
+    /// <param name="pOpenCVHelper">helper whose filters get the images and whose workspace is calibrated</param>
+    FrameInput(Microsoft::KinectBridge::OpenCVFrameHelper* pFrameHelper, OpenCVHelper* pOpenCVHelper);
+
+    /// <summary>
+    /// Allocates the color image at the color stream resolution
+    /// </summary>
+    void CreateColorImage();
+
+    /// <summary>
+    /// Allocates the depth images at the depth stream resolution
+    /// </summary>
+    void CreateDepthImages();
+
+    /// <summary>
+    /// Loads the trapezoid of the workspace found in an earlier run, or finds it in the
+    /// first frames and saves it if there is none to load or calibration is asked for
+    /// </summary>
+    /// <param name="path">path of the file, empty not to load or save the workspace</param>
+    /// <param name="isCalibrating">true to find the workspace even if it can be loaded</param>
+    /// <param name="name">name of the workspace in the console messages</param>
+    void InitializeWorkspace(const std::wstring& path, bool isCalibrating, const std::string& name);
+
+    /// <summary>
+    /// Gets whether the workspace is still being looked for
+    /// </summary>
+    /// <returns>true while calibrating</returns>
+    bool IsCalibrating() const;
+
+    /// <summary>
+    /// Adds the current color and depth frames to the workspace calibration, and moves the
+    /// trapezoid to the workspace once it is found. Only called between frames, while no filter uses it.
+    /// </summary>
+    /// <returns>S_OK if successful, S_FALSE while more frames are needed, an error code otherwise</returns>
+    HRESULT CalibrateWorkspace();
+
+    /// <summary>
+    /// Converts the current color frame for the color filter
+    /// </summary>
+    /// <param name="pImage">pointer in which to return a header of the color image</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT GetColorImage(Mat* pImage);
+
+    /// <summary>
+    /// Converts the current depth frame into the image the depth filter works on, and the raw
+    /// depth frame for the filters that sample the depth
+    /// </summary>
+    /// <param name="pImage">pointer in which to return a header of the depth image</param>
+    /// <param name="pDepth">pointer in which to return a header of the raw depth frame, empty if the filter does not sample the depth</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT GetDepthImages(Mat* pImage, Mat* pDepth);
+
+private:
+    // Variables:
+    // Helpers
+    Microsoft::KinectBridge::OpenCVFrameHelper* m_pFrameHelper;
+    OpenCVHelper* m_pOpenCVHelper;
+
+    // Finds the workspace in the first frames, the file to save it to and its name in the console messages
+    bool m_isCalibrating;
+    std::wstring m_workspacePath;
+    std::string m_workspaceName;
+
+    // OpenCV matrices, the filters get headers of them
+    Mat m_colorMat;
+    Mat m_depthMat;
+    Mat m_depthMaskMat;
+    Mat m_depthRawMat;
+};
@@ -0,0 +1,264 @@
+#include "FramePool.h"
+#include <malloc.h>
+#include <algorithm>
+
+using namespace Microsoft::KinectBridge;
+
+namespace Microsoft {
+    namespace KinectBridge {
+        /// <summary>
+        /// Lock of a pool and the pool itself, referenced by the pool and by each of its slots. A slot
+        /// released on another thread while the pool is being destroyed checks the pool under the lock,
+        /// which stays alive until the last slot is freed.
+        /// </summary>
+        struct FramePoolLink
+        {
+            // Guards the pool's free list and slot bookkeeping, and pPool
+            CRITICAL_SECTION lock;
+
+            // Owning pool, or NULL once the pool has been destroyed
+            FramePool* pPool;
+
+            // References held by the pool and by its slots
+            volatile LONG refCount;
+        };
+    }
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+FramePool::FramePool() :
+    m_pLink(new FramePoolLink),
+    m_slotSize(0),
+    m_generation(0),
+    m_allocationCount(0)
+{
+    InitializeCriticalSection(&m_pLink->lock);
+    m_pLink->pPool = this;
+    m_pLink->refCount = 1;
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+FramePool::~FramePool()
+{
+    EnterCriticalSection(&m_pLink->lock);
+
+    // Free the idle slots, the ones consumers still hold free themselves once the pool is unlinked
+    for (size_t i = 0; i < m_allSlots.size(); ++i)
+    {
+        FrameSlot* pSlot = m_allSlots[i];
+        if (std::find(m_freeSlots.begin(), m_freeSlots.end(), pSlot) != m_freeSlots.end())
+        {
+            FreeSlot(pSlot);
+        }
+    }
+    m_allSlots.clear();
+    m_freeSlots.clear();
+    m_pLink->pPool = NULL;
+
+    LeaveCriticalSection(&m_pLink->lock);
+
+    // The slots still held keep the link alive until they are released
+    ReleaseLink(m_pLink);
+}
+
+/// <summary>
+/// Preallocates slots of the given size. Does nothing if the size is unchanged.
+/// Slots of the previous size still held by consumers are freed when released.
+/// </summary>
+/// <param name="slotSize">size in bytes of each slot</param>
+/// <param name="slotCount">number of slots to preallocate</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT FramePool::Reset(INT slotSize, UINT slotCount /* = DEFAULT_SLOT_COUNT */)
+{
+    if (slotSize <= 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    EnterCriticalSection(&m_pLink->lock);
+
+    HRESULT hr = S_OK;
+    if (slotSize != m_slotSize)
+    {
+        // Free idle slots of the old size, outstanding ones are freed when released
+        for (size_t i = 0; i < m_freeSlots.size(); ++i)
+        {
+            m_allSlots.erase(std::find(m_allSlots.begin(), m_allSlots.end(), m_freeSlots[i]));
+            FreeSlot(m_freeSlots[i]);
+        }
+        m_freeSlots.clear();
+
+        m_slotSize = slotSize;
+        ++m_generation;
+
+        for (UINT i = 0; i < slotCount; ++i)
+        {
+            FrameSlot* pSlot = AllocateSlot();
+            if (!pSlot)
+            {
+                hr = E_OUTOFMEMORY;
+                break;
+            }
+            m_freeSlots.push_back(pSlot);
+        }
+    }
+
+    LeaveCriticalSection(&m_pLink->lock);
+
+    return hr;
+}
+
+/// <summary>
+/// Gets the size in bytes of the slots handed out by the pool
+/// </summary>
+/// <returns>slot size, or 0 if the pool has not been reset yet</returns>
+INT FramePool::GetSlotSize() const
+{
+    return m_slotSize;
+}
+
+/// <summary>
+/// Gets the number of slots allocated since construction
+/// </summary>
+/// <returns>number of slot allocations</returns>
+LONG FramePool::GetAllocationCount() const
+{
+    return m_allocationCount;
+}
+
+/// <summary>
+/// Takes a free slot from the pool, allocating a new one if none is free
+/// </summary>
+/// <returns>slot with a reference count of one, or NULL if out of memory</returns>
+FrameSlot* FramePool::Acquire()
+{
+    EnterCriticalSection(&m_pLink->lock);
+
+    FrameSlot* pSlot = NULL;
+    if (!m_freeSlots.empty())
+    {
+        pSlot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    }
+    else if (m_slotSize > 0)
+    {
+        pSlot = AllocateSlot();
+    }
+
+    LeaveCriticalSection(&m_pLink->lock);
+
+    if (pSlot)
+    {
+        pSlot->refCount = 1;
+    }
+
+    return pSlot;
+}
+
+/// <summary>
+/// Adds a reference to the slot
+/// </summary>
+/// <param name="pSlot">slot to reference</param>
+void FramePool::AddRef(FrameSlot* pSlot)
+{
+    InterlockedIncrement(&pSlot->refCount);
+}
+
+/// <summary>
+/// Releases a reference to the slot, returning it to its pool when it was the last one
+/// </summary>
+/// <param name="pSlot">slot to release</param>
+void FramePool::Release(FrameSlot* pSlot)
+{
+    if (InterlockedDecrement(&pSlot->refCount) != 0)
+    {
+        return;
+    }
+
+    // The pool may be destroyed on another thread, so it is only looked at under the link's lock
+    FramePoolLink* pLink = pSlot->pLink;
+    EnterCriticalSection(&pLink->lock);
+    bool isRecycled = pLink->pPool && pLink->pPool->Recycle(pSlot);
+    LeaveCriticalSection(&pLink->lock);
+
+    if (!isRecycled)
+    {
+        FreeSlot(pSlot);
+    }
+}
+
+/// <summary>
+/// Allocates a new slot of the current slot size. Must be called with the lock held.
+/// </summary>
+/// <returns>new slot, or NULL if out of memory</returns>
+FrameSlot* FramePool::AllocateSlot()
+{
+    // Round up to whole cache lines so neighbouring allocations never share a line
+    INT capacity = (m_slotSize + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+
+    BYTE* pData = static_cast<BYTE*>(_aligned_malloc(capacity, PAGE_SIZE));
+    if (!pData)
+    {
+        return NULL;
+    }
+
+    FrameSlot* pSlot = new FrameSlot;
+    pSlot->pData = pData;
+    pSlot->capacity = capacity;
+    pSlot->refCount = 0;
+    pSlot->generation = m_generation;
+    pSlot->pLink = m_pLink;
+    InterlockedIncrement(&m_pLink->refCount);
+
+    m_allSlots.push_back(pSlot);
+    InterlockedIncrement(&m_allocationCount);
+
+    return pSlot;
+}
+
+/// <summary>
+/// Frees the slot and its data, and releases its reference to the pool link
+/// </summary>
+/// <param name="pSlot">slot to free</param>
+void FramePool::FreeSlot(FrameSlot* pSlot)
+{
+    FramePoolLink* pLink = pSlot->pLink;
+    _aligned_free(pSlot->pData);
+    delete pSlot;
+
+    ReleaseLink(pLink);
+}
+
+/// <summary>
+/// Releases a reference to a pool link, deleting it when it was the last one
+/// </summary>
+/// <param name="pLink">link to release</param>
+void FramePool::ReleaseLink(FramePoolLink* pLink)
+{
+    if (InterlockedDecrement(&pLink->refCount) == 0)
+    {
+        DeleteCriticalSection(&pLink->lock);
+        delete pLink;
+    }
+}
+
+/// <summary>
+/// Puts a released slot back in the free list, or forgets it if it is stale. Must be called with the lock held.
+/// </summary>
+/// <param name="pSlot">slot to recycle</param>
+/// <returns>true if the slot was put back, false if it has to be freed</returns>
+bool FramePool::Recycle(FrameSlot* pSlot)
+{
+    if (pSlot->generation == m_generation)
+    {
+        m_freeSlots.push_back(pSlot);
+        return true;
+    }
+
+    m_allSlots.erase(std::find(m_allSlots.begin(), m_allSlots.end(), pSlot));
+    return false;
+}
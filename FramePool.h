@@ -0,0 +1,144 @@
+#pragma once
+
+#include "windows.h"
+#include <vector>
+
+namespace Microsoft {
+    namespace KinectBridge {
+        class FramePool;
+        struct FramePoolLink;
+
+        /// <summary>
+        /// Page-aligned frame buffer handed out by a FramePool. The slot goes back
+        /// to its pool when the last reference to it is released.
+        /// </summary>
+        struct FrameSlot
+        {
+            // Page-aligned frame data
+            BYTE* pData;
+
+            // Allocated size in bytes, a multiple of the cache line size
+            INT capacity;
+
+            // Number of outstanding references
+            volatile LONG refCount;
+
+            // Pool generation the slot was allocated for
+            UINT generation;
+
+            // Link to the owning pool, kept alive by every slot until it is freed
+            FramePoolLink* pLink;
+        };
+
+        class FramePool
+        {
+        public:
+            // Constants:
+            // Alignment of the slot sizes and of the slot data
+            static const INT CACHE_LINE_SIZE = 64;
+            static const INT PAGE_SIZE = 4096;
+
+            // Number of slots preallocated on Reset. The helper holds the latest frame while
+            // the processing thread or the depth worker filters the previous one, and the frame
+            // synchronizer and the capture writer queue hold more while they are used. The pool
+            // grows past these when all of them are held.
+            static const UINT DEFAULT_SLOT_COUNT = 4;
+
+            // Functions:
+            /// <summary>
+            /// Constructor
+            /// </summary>
+            FramePool();
+
+            /// <summary>
+            /// Destructor
+            /// </summary>
+            ~FramePool();
+
+            /// <summary>
+            /// Preallocates slots of the given size. Does nothing if the size is unchanged.
+            /// Slots of the previous size still held by consumers are freed when released.
+            /// </summary>
+            /// <param name="slotSize">size in bytes of each slot</param>
+            /// <param name="slotCount">number of slots to preallocate</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT Reset(INT slotSize, UINT slotCount = DEFAULT_SLOT_COUNT);
+
+            /// <summary>
+            /// Gets the size in bytes of the slots handed out by the pool
+            /// </summary>
+            /// <returns>slot size, or 0 if the pool has not been reset yet</returns>
+            INT GetSlotSize() const;
+
+            /// <summary>
+            /// Gets the number of slots allocated since construction, including growth
+            /// beyond the preallocated slots when consumers hold on to frames
+            /// </summary>
+            /// <returns>number of slot allocations</returns>
+            LONG GetAllocationCount() const;
+
+            /// <summary>
+            /// Takes a free slot from the pool, allocating a new one if none is free
+            /// </summary>
+            /// <returns>slot with a reference count of one, or NULL if out of memory</returns>
+            FrameSlot* Acquire();
+
+            /// <summary>
+            /// Adds a reference to the slot
+            /// </summary>
+            /// <param name="pSlot">slot to reference</param>
+            static void AddRef(FrameSlot* pSlot);
+
+            /// <summary>
+            /// Releases a reference to the slot, returning it to its pool when it was the last one
+            /// </summary>
+            /// <param name="pSlot">slot to release</param>
+            static void Release(FrameSlot* pSlot);
+
+        private:
+            // Functions:
+            /// <summary>
+            /// Allocates a new slot of the current slot size
+            /// </summary>
+            /// <returns>new slot, or NULL if out of memory</returns>
+            FrameSlot* AllocateSlot();
+
+            /// <summary>
+            /// Frees the slot and its data, and releases its reference to the pool link
+            /// </summary>
+            /// <param name="pSlot">slot to free</param>
+            static void FreeSlot(FrameSlot* pSlot);
+
+            /// <summary>
+            /// Releases a reference to a pool link, deleting it when it was the last one
+            /// </summary>
+            /// <param name="pLink">link to release</param>
+            static void ReleaseLink(FramePoolLink* pLink);
+
+            /// <summary>
+            /// Puts a released slot back in the free list, or forgets it if it is stale
+            /// </summary>
+            /// <param name="pSlot">slot to recycle</param>
+            /// <returns>true if the slot was put back, false if it has to be freed</returns>
+            bool Recycle(FrameSlot* pSlot);
+
+            // Variables:
+            // Lock guarding the free list and the slot bookkeeping, shared with the slots
+            // so a slot released after the pool is destroyed can tell it has no pool
+            FramePoolLink* m_pLink;
+
+            // Slots ready to be handed out
+            std::vector<FrameSlot*> m_freeSlots;
+
+            // Every live slot, used to detach outstanding slots on destruction
+            std::vector<FrameSlot*> m_allSlots;
+
+            // Size in bytes of the current generation of slots
+            INT m_slotSize;
+            UINT m_generation;
+
+            // Number of slot allocations
+            volatile LONG m_allocationCount;
+        };
+    }
+}
@@ -0,0 +1,135 @@
+#include "FrameSource.h"
+
+using namespace Microsoft::KinectBridge;
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="pNuiSensor">sensor to read frames from</param>
+NuiFrameSource::NuiFrameSource(INuiSensor* pNuiSensor) :
+    m_pNuiSensor(pNuiSensor)
+{
+}
+
+/// <summary>
+/// Initializes the sensor with the given NUI_INITIALIZE_FLAG_* flags
+/// </summary>
+/// <param name="nuiInitFlags">streams to initialize</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT NuiFrameSource::Initialize(DWORD nuiInitFlags)
+{
+    return m_pNuiSensor->NuiInitialize(nuiInitFlags);
+}
+
+/// <summary>
+/// Shuts the sensor down
+/// </summary>
+void NuiFrameSource::Shutdown()
+{
+    m_pNuiSensor->NuiShutdown();
+}
+
+/// <summary>
+/// Opens or reopens an image stream on the sensor
+/// </summary>
+/// <param name="imageType">type of the stream to open</param>
+/// <param name="resolution">resolution of the stream</param>
+/// <param name="imageFlags">NUI_IMAGE_STREAM_FLAG_* flags</param>
+/// <param name="hNextFrameEvent">manual reset event signalled when a frame is ready</param>
+/// <param name="phStreamHandle">pointer in which to return the stream handle</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT NuiFrameSource::OpenImageStream(NUI_IMAGE_TYPE imageType, NUI_IMAGE_RESOLUTION resolution, DWORD imageFlags, HANDLE hNextFrameEvent, HANDLE* phStreamHandle)
+{
+    return m_pNuiSensor->NuiImageStreamOpen(imageType, resolution, imageFlags, 2, hNextFrameEvent, phStreamHandle);
+}
+
+/// <summary>
+/// Sets the NUI_IMAGE_STREAM_FLAG_* flags of an open image stream
+/// </summary>
+/// <param name="hStreamHandle">stream to update</param>
+/// <param name="imageFlags">new flags</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT NuiFrameSource::SetImageStreamFlags(HANDLE hStreamHandle, DWORD imageFlags)
+{
+    return m_pNuiSensor->NuiImageStreamSetImageFrameFlags(hStreamHandle, imageFlags);
+}
+
+/// <summary>
+/// Enables skeleton tracking on the sensor
+/// </summary>
+/// <param name="hNextFrameEvent">manual reset event signalled when a frame is ready</param>
+/// <param name="trackingFlags">NUI_SKELETON_TRACKING_FLAG_* flags</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT NuiFrameSource::EnableSkeletonTracking(HANDLE hNextFrameEvent, DWORD trackingFlags)
+{
+    return m_pNuiSensor->NuiSkeletonTrackingEnable(hNextFrameEvent, trackingFlags);
+}
+
+/// <summary>
+/// Gets the next frame of an image stream and locks its texture
+/// </summary>
+/// <param name="hStreamHandle">stream to read</param>
+/// <param name="waitMillis">number of milliseconds to wait</param>
+/// <param name="pFrame">pointer in which to return the frame</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT NuiFrameSource::GetNextImageFrame(HANDLE hStreamHandle, DWORD waitMillis, SourceFrame* pFrame)
+{
+    HRESULT hr = m_pNuiSensor->NuiImageStreamGetNextFrame(hStreamHandle, waitMillis, &pFrame->imageFrame);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Lock frame texture to allow for copy
+    NUI_LOCKED_RECT lockedRect;
+    pFrame->imageFrame.pFrameTexture->LockRect(0, &lockedRect, NULL, 0);
+
+    pFrame->pBits = lockedRect.pBits;
+    pFrame->size = lockedRect.size;
+    pFrame->pitch = lockedRect.Pitch;
+    pFrame->timestamp = pFrame->imageFrame.liTimeStamp;
+    pFrame->frameNumber = pFrame->imageFrame.dwFrameNumber;
+
+    return S_OK;
+}
+
+/// <summary>
+/// Unlocks the frame texture and releases the frame to the sensor
+/// </summary>
+/// <param name="hStreamHandle">stream the frame came from</param>
+/// <param name="pFrame">frame to release</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT NuiFrameSource::ReleaseImageFrame(HANDLE hStreamHandle, SourceFrame* pFrame)
+{
+    pFrame->imageFrame.pFrameTexture->UnlockRect(0);
+    pFrame->pBits = NULL;
+
+    return m_pNuiSensor->NuiImageStreamReleaseFrame(hStreamHandle, &pFrame->imageFrame);
+}
+
+/// <summary>
+/// Gets the next skeleton frame and smooths it
+/// </summary>
+/// <param name="waitMillis">number of milliseconds to wait</param>
+/// <param name="pSkeletonFrame">pointer in which to return the frame</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT NuiFrameSource::GetNextSkeletonFrame(DWORD waitMillis, NUI_SKELETON_FRAME* pSkeletonFrame)
+{
+    HRESULT hr = m_pNuiSensor->NuiSkeletonGetNextFrame(waitMillis, pSkeletonFrame);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Smooth skeletons
+    return m_pNuiSensor->NuiTransformSmooth(pSkeletonFrame, NULL);
+}
+
+/// <summary>
+/// Returns the device connection id of the sensor
+/// </summary>
+/// <returns>device connection id of Kinect sensor</returns>
+BSTR NuiFrameSource::GetDeviceConnectionId() const
+{
+    return m_pNuiSensor->NuiDeviceConnectionId();
+}
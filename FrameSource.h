@@ -0,0 +1,134 @@
+#pragma once
+
+#include "windows.h"
+#include <NuiApi.h>
+
+namespace Microsoft {
+    namespace KinectBridge {
+        /// <summary>
+        /// Image frame handed out by a frame source. The data stays valid until the
+        /// frame is released back to the source.
+        /// </summary>
+        struct SourceFrame
+        {
+            // Frame data, or NULL if the frame carries no image
+            BYTE* pBits;
+            INT size;
+            INT pitch;
+
+            // Capture time in milliseconds and running frame number
+            LARGE_INTEGER timestamp;
+            DWORD frameNumber;
+
+            // Native frame, used by the source to release it
+            NUI_IMAGE_FRAME imageFrame;
+        };
+
+        /// <summary>
+        /// Provider of color, depth and skeleton frames for KinectHelper. Mirrors the subset
+        /// of INuiSensor the helper uses so that recorded sessions can stand in for a sensor.
+        /// </summary>
+        class IFrameSource
+        {
+        public:
+            virtual ~IFrameSource() {}
+
+            /// <summary>
+            /// Initializes the source with the given NUI_INITIALIZE_FLAG_* flags
+            /// </summary>
+            /// <param name="nuiInitFlags">streams to initialize</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            virtual HRESULT Initialize(DWORD nuiInitFlags) = 0;
+
+            /// <summary>
+            /// Shuts the source down
+            /// </summary>
+            virtual void Shutdown() = 0;
+
+            /// <summary>
+            /// Opens or reopens an image stream
+            /// </summary>
+            /// <param name="imageType">type of the stream to open</param>
+            /// <param name="resolution">resolution of the stream</param>
+            /// <param name="imageFlags">NUI_IMAGE_STREAM_FLAG_* flags</param>
+            /// <param name="hNextFrameEvent">manual reset event signalled when a frame is ready</param>
+            /// <param name="phStreamHandle">pointer in which to return the stream handle</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            virtual HRESULT OpenImageStream(NUI_IMAGE_TYPE imageType, NUI_IMAGE_RESOLUTION resolution, DWORD imageFlags, HANDLE hNextFrameEvent, HANDLE* phStreamHandle) = 0;
+
+            /// <summary>
+            /// Sets the NUI_IMAGE_STREAM_FLAG_* flags of an open image stream
+            /// </summary>
+            /// <param name="hStreamHandle">stream to update</param>
+            /// <param name="imageFlags">new flags</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            virtual HRESULT SetImageStreamFlags(HANDLE hStreamHandle, DWORD imageFlags) = 0;
+
+            /// <summary>
+            /// Enables skeleton tracking
+            /// </summary>
+            /// <param name="hNextFrameEvent">manual reset event signalled when a frame is ready</param>
+            /// <param name="trackingFlags">NUI_SKELETON_TRACKING_FLAG_* flags</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            virtual HRESULT EnableSkeletonTracking(HANDLE hNextFrameEvent, DWORD trackingFlags) = 0;
+
+            /// <summary>
+            /// Gets the next frame of an image stream. The frame must be released with ReleaseImageFrame.
+            /// </summary>
+            /// <param name="hStreamHandle">stream to read</param>
+            /// <param name="waitMillis">number of milliseconds to wait</param>
+            /// <param name="pFrame">pointer in which to return the frame</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            virtual HRESULT GetNextImageFrame(HANDLE hStreamHandle, DWORD waitMillis, SourceFrame* pFrame) = 0;
+
+            /// <summary>
+            /// Releases a frame returned by GetNextImageFrame
+            /// </summary>
+            /// <param name="hStreamHandle">stream the frame came from</param>
+            /// <param name="pFrame">frame to release</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            virtual HRESULT ReleaseImageFrame(HANDLE hStreamHandle, SourceFrame* pFrame) = 0;
+
+            /// <summary>
+            /// Gets the next smoothed skeleton frame
+            /// </summary>
+            /// <param name="waitMillis">number of milliseconds to wait</param>
+            /// <param name="pSkeletonFrame">pointer in which to return the frame</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            virtual HRESULT GetNextSkeletonFrame(DWORD waitMillis, NUI_SKELETON_FRAME* pSkeletonFrame) = 0;
+
+            /// <summary>
+            /// Returns the device connection id of the sensor behind the source
+            /// </summary>
+            /// <returns>device connection id, or NULL if there is no sensor</returns>
+            virtual BSTR GetDeviceConnectionId() const = 0;
+        };
+
+        /// <summary>
+        /// Frame source backed by a Kinect sensor
+        /// </summary>
+        class NuiFrameSource : public IFrameSource
+        {
+        public:
+            /// <summary>
+            /// Constructor
+            /// </summary>
+            /// <param name="pNuiSensor">sensor to read frames from</param>
+            explicit NuiFrameSource(INuiSensor* pNuiSensor);
+
+            HRESULT Initialize(DWORD nuiInitFlags) override;
+            void Shutdown() override;
+            HRESULT OpenImageStream(NUI_IMAGE_TYPE imageType, NUI_IMAGE_RESOLUTION resolution, DWORD imageFlags, HANDLE hNextFrameEvent, HANDLE* phStreamHandle) override;
+            HRESULT SetImageStreamFlags(HANDLE hStreamHandle, DWORD imageFlags) override;
+            HRESULT EnableSkeletonTracking(HANDLE hNextFrameEvent, DWORD trackingFlags) override;
+            HRESULT GetNextImageFrame(HANDLE hStreamHandle, DWORD waitMillis, SourceFrame* pFrame) override;
+            HRESULT ReleaseImageFrame(HANDLE hStreamHandle, SourceFrame* pFrame) override;
+            HRESULT GetNextSkeletonFrame(DWORD waitMillis, NUI_SKELETON_FRAME* pSkeletonFrame) override;
+            BSTR GetDeviceConnectionId() const override;
+
+        private:
+            // Pointer to Kinect sensor
+            INuiSensor* m_pNuiSensor;
+        };
+    }
+}
@@ -0,0 +1,272 @@
+#include "FrameSynchronizer.h"
+
+using namespace Microsoft::KinectBridge;
+
+namespace
+{
+    /// <summary>
+    /// Gets the absolute time difference between two timestamps
+    /// </summary>
+    inline LONGLONG TimeDistance(LONGLONG a, LONGLONG b)
+    {
+        return a > b ? a - b : b - a;
+    }
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+FrameSynchronizer::FrameSynchronizer() :
+    m_tolerance(DEFAULT_TOLERANCE),
+    m_matchedCount(0),
+    m_droppedCount(0)
+{
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+FrameSynchronizer::~FrameSynchronizer()
+{
+    Reset();
+}
+
+/// <summary>
+/// Sets the largest time difference between matched frames
+/// </summary>
+/// <param name="toleranceMillis">tolerance in milliseconds</param>
+void FrameSynchronizer::SetTolerance(LONGLONG toleranceMillis)
+{
+    m_tolerance = toleranceMillis < 0 ? 0 : toleranceMillis;
+}
+
+/// <summary>
+/// Gets the largest time difference between matched frames
+/// </summary>
+/// <returns>tolerance in milliseconds</returns>
+LONGLONG FrameSynchronizer::GetTolerance() const
+{
+    return m_tolerance;
+}
+
+/// <summary>
+/// Adds a color frame. The synchronizer keeps its own reference to the slot.
+/// </summary>
+/// <param name="frame">color frame</param>
+void FrameSynchronizer::AddColorFrame(const FrameRef& frame)
+{
+    AddFrame(&m_colorFrames, frame);
+}
+
+/// <summary>
+/// Adds a depth frame. The synchronizer keeps its own reference to the slot.
+/// </summary>
+/// <param name="frame">depth frame</param>
+void FrameSynchronizer::AddDepthFrame(const FrameRef& frame)
+{
+    AddFrame(&m_depthFrames, frame);
+}
+
+/// <summary>
+/// Adds a skeleton frame
+/// </summary>
+/// <param name="pSkeletonFrame">skeleton frame to copy</param>
+void FrameSynchronizer::AddSkeletonFrame(const NUI_SKELETON_FRAME* pSkeletonFrame)
+{
+    if (m_skeletonFrames.size() == MAX_PENDING_FRAMES)
+    {
+        m_skeletonFrames.pop_front();
+    }
+
+    m_skeletonFrames.push_back(*pSkeletonFrame);
+}
+
+/// <summary>
+/// Takes the oldest matched tuple. The tuple holds references to its slots,
+/// which must be released with ReleaseTuple.
+/// </summary>
+/// <param name="pTuple">pointer in which to return the tuple</param>
+/// <returns>true if a tuple was matched, false otherwise</returns>
+bool FrameSynchronizer::GetNextTuple(FrameTuple* pTuple)
+{
+    while (!m_colorFrames.empty() && !m_depthFrames.empty())
+    {
+        const FrameRef& color = m_colorFrames.front();
+        const FrameRef& depth = m_depthFrames.front();
+
+        // The older frame is too old for any frame of the other stream still to come
+        if (color.timestamp + m_tolerance < depth.timestamp)
+        {
+            DropFrame(&m_colorFrames);
+            continue;
+        }
+        if (depth.timestamp + m_tolerance < color.timestamp)
+        {
+            DropFrame(&m_depthFrames);
+            continue;
+        }
+
+        // With a wide tolerance the next frame of the older stream may be a closer match
+        LONGLONG distance = TimeDistance(color.timestamp, depth.timestamp);
+        if (color.timestamp < depth.timestamp && m_colorFrames.size() > 1 && TimeDistance(m_colorFrames[1].timestamp, depth.timestamp) < distance)
+        {
+            DropFrame(&m_colorFrames);
+            continue;
+        }
+        if (depth.timestamp < color.timestamp && m_depthFrames.size() > 1 && TimeDistance(m_depthFrames[1].timestamp, color.timestamp) < distance)
+        {
+            DropFrame(&m_depthFrames);
+            continue;
+        }
+
+        // The references move to the tuple
+        pTuple->color = color;
+        pTuple->depth = depth;
+        m_colorFrames.pop_front();
+        m_depthFrames.pop_front();
+
+        // Skeletons are tracked on the depth frames
+        MatchSkeleton(pTuple->depth.timestamp, pTuple);
+
+        ++m_matchedCount;
+        return true;
+    }
+
+    return false;
+}
+
+/// <summary>
+/// Takes the newest matched tuple, dropping older ones, so a slow consumer keeps up
+/// </summary>
+/// <param name="pTuple">pointer in which to return the tuple</param>
+/// <returns>true if a tuple was matched, false otherwise</returns>
+bool FrameSynchronizer::GetLatestTuple(FrameTuple* pTuple)
+{
+    if (!GetNextTuple(pTuple))
+    {
+        return false;
+    }
+
+    FrameTuple newer;
+    while (GetNextTuple(&newer))
+    {
+        ReleaseTuple(pTuple);
+        m_droppedCount += 2;
+        *pTuple = newer;
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Releases the slot references of a tuple
+/// </summary>
+/// <param name="pTuple">tuple to release</param>
+void FrameSynchronizer::ReleaseTuple(FrameTuple* pTuple)
+{
+    if (pTuple->color.pSlot)
+    {
+        FramePool::Release(pTuple->color.pSlot);
+        pTuple->color.pSlot = NULL;
+    }
+
+    if (pTuple->depth.pSlot)
+    {
+        FramePool::Release(pTuple->depth.pSlot);
+        pTuple->depth.pSlot = NULL;
+    }
+}
+
+/// <summary>
+/// Drops all pending frames, for example after a resolution change
+/// </summary>
+void FrameSynchronizer::Reset()
+{
+    while (!m_colorFrames.empty())
+    {
+        DropFrame(&m_colorFrames);
+    }
+
+    while (!m_depthFrames.empty())
+    {
+        DropFrame(&m_depthFrames);
+    }
+
+    m_skeletonFrames.clear();
+}
+
+/// <summary>
+/// Gets the number of tuples matched since construction
+/// </summary>
+/// <returns>number of matched tuples</returns>
+LONG FrameSynchronizer::GetMatchedCount() const
+{
+    return m_matchedCount;
+}
+
+/// <summary>
+/// Gets the number of color and depth frames dropped without a match since construction
+/// </summary>
+/// <returns>number of dropped frames</returns>
+LONG FrameSynchronizer::GetDroppedCount() const
+{
+    return m_droppedCount;
+}
+
+/// <summary>
+/// Adds a frame to a stream's queue, dropping the oldest one if the queue is full
+/// </summary>
+/// <param name="pQueue">queue of the stream</param>
+/// <param name="frame">frame to add</param>
+void FrameSynchronizer::AddFrame(std::deque<FrameRef>* pQueue, const FrameRef& frame)
+{
+    if (!frame.pSlot)
+    {
+        return;
+    }
+
+    if (pQueue->size() == MAX_PENDING_FRAMES)
+    {
+        DropFrame(pQueue);
+    }
+
+    FramePool::AddRef(frame.pSlot);
+    pQueue->push_back(frame);
+}
+
+/// <summary>
+/// Drops the oldest frame of a stream's queue
+/// </summary>
+/// <param name="pQueue">queue of the stream</param>
+void FrameSynchronizer::DropFrame(std::deque<FrameRef>* pQueue)
+{
+    FramePool::Release(pQueue->front().pSlot);
+    pQueue->pop_front();
+    ++m_droppedCount;
+}
+
+/// <summary>
+/// Finds the skeleton frame closest to a time, discarding the ones too old to match later frames
+/// </summary>
+/// <param name="timestamp">time to match in milliseconds</param>
+/// <param name="pTuple">tuple in which to return the skeleton frame</param>
+void FrameSynchronizer::MatchSkeleton(LONGLONG timestamp, FrameTuple* pTuple)
+{
+    while (!m_skeletonFrames.empty() && m_skeletonFrames.front().liTimeStamp.QuadPart + m_tolerance < timestamp)
+    {
+        m_skeletonFrames.pop_front();
+    }
+
+    pTuple->hasSkeleton = false;
+    LONGLONG bestDistance = m_tolerance;
+    for (size_t i = 0; i < m_skeletonFrames.size(); ++i)
+    {
+        LONGLONG distance = TimeDistance(m_skeletonFrames[i].liTimeStamp.QuadPart, timestamp);
+        if (distance <= bestDistance)
+        {
+            bestDistance = distance;
+            pTuple->skeletonFrame = m_skeletonFrames[i];
+            pTuple->hasSkeleton = true;
+        }
+    }
+}
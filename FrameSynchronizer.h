@@ -0,0 +1,168 @@
+#pragma once
+
+#include "windows.h"
+#include <NuiApi.h>
+#include <deque>
+#include "FramePool.h"
+
+namespace Microsoft {
+    namespace KinectBridge {
+        /// <summary>
+        /// Reference to a stored image frame and its capture time
+        /// </summary>
+        struct FrameRef
+        {
+            // Pooled slot holding the frame data, NULL if there is no frame
+            FrameSlot* pSlot;
+            INT size;
+            INT pitch;
+
+            // Capture time in milliseconds and frame number reported by the source
+            LONGLONG timestamp;
+            DWORD frameNumber;
+        };
+
+        /// <summary>
+        /// Color and depth frames captured at the same time, with the skeleton frame closest to them
+        /// </summary>
+        struct FrameTuple
+        {
+            FrameRef color;
+            FrameRef depth;
+
+            // Whether a skeleton frame was within the tolerance of the depth frame
+            bool hasSkeleton;
+            NUI_SKELETON_FRAME skeletonFrame;
+        };
+
+        /// <summary>
+        /// Pairs color and depth frames by their timestamps. Frames are added as they arrive and
+        /// matched tuples are taken out in capture order. A frame that can no longer be matched
+        /// within the tolerance, because the other stream has moved past it, is dropped.
+        /// Not thread safe, frames are added and taken from the processing thread.
+        /// </summary>
+        class FrameSynchronizer
+        {
+        public:
+            // Constants:
+            // Largest time difference between matched frames, under half the 30 fps frame interval
+            static const LONGLONG DEFAULT_TOLERANCE = 15;
+
+            // Number of frames kept per stream while waiting for the other stream
+            static const size_t MAX_PENDING_FRAMES = 4;
+
+            // Functions:
+            /// <summary>
+            /// Constructor
+            /// </summary>
+            FrameSynchronizer();
+
+            /// <summary>
+            /// Destructor
+            /// </summary>
+            ~FrameSynchronizer();
+
+            /// <summary>
+            /// Sets the largest time difference between matched frames
+            /// </summary>
+            /// <param name="toleranceMillis">tolerance in milliseconds</param>
+            void SetTolerance(LONGLONG toleranceMillis);
+
+            /// <summary>
+            /// Gets the largest time difference between matched frames
+            /// </summary>
+            /// <returns>tolerance in milliseconds</returns>
+            LONGLONG GetTolerance() const;
+
+            /// <summary>
+            /// Adds a color frame. The synchronizer keeps its own reference to the slot.
+            /// </summary>
+            /// <param name="frame">color frame</param>
+            void AddColorFrame(const FrameRef& frame);
+
+            /// <summary>
+            /// Adds a depth frame. The synchronizer keeps its own reference to the slot.
+            /// </summary>
+            /// <param name="frame">depth frame</param>
+            void AddDepthFrame(const FrameRef& frame);
+
+            /// <summary>
+            /// Adds a skeleton frame
+            /// </summary>
+            /// <param name="pSkeletonFrame">skeleton frame to copy</param>
+            void AddSkeletonFrame(const NUI_SKELETON_FRAME* pSkeletonFrame);
+
+            /// <summary>
+            /// Takes the oldest matched tuple. The tuple holds references to its slots,
+            /// which must be released with ReleaseTuple.
+            /// </summary>
+            /// <param name="pTuple">pointer in which to return the tuple</param>
+            /// <returns>true if a tuple was matched, false otherwise</returns>
+            bool GetNextTuple(FrameTuple* pTuple);
+
+            /// <summary>
+            /// Takes the newest matched tuple, dropping older ones, so a slow consumer keeps up
+            /// </summary>
+            /// <param name="pTuple">pointer in which to return the tuple</param>
+            /// <returns>true if a tuple was matched, false otherwise</returns>
+            bool GetLatestTuple(FrameTuple* pTuple);
+
+            /// <summary>
+            /// Releases the slot references of a tuple
+            /// </summary>
+            /// <param name="pTuple">tuple to release</param>
+            static void ReleaseTuple(FrameTuple* pTuple);
+
+            /// <summary>
+            /// Drops all pending frames, for example after a resolution change
+            /// </summary>
+            void Reset();
+
+            /// <summary>
+            /// Gets the number of tuples matched since construction
+            /// </summary>
+            /// <returns>number of matched tuples</returns>
+            LONG GetMatchedCount() const;
+
+            /// <summary>
+            /// Gets the number of color and depth frames dropped without a match since construction
+            /// </summary>
+            /// <returns>number of dropped frames</returns>
+            LONG GetDroppedCount() const;
+
+        private:
+            // Functions:
+            /// <summary>
+            /// Adds a frame to a stream's queue, dropping the oldest one if the queue is full
+            /// </summary>
+            /// <param name="pQueue">queue of the stream</param>
+            /// <param name="frame">frame to add</param>
+            void AddFrame(std::deque<FrameRef>* pQueue, const FrameRef& frame);
+
+            /// <summary>
+            /// Drops the oldest frame of a stream's queue
+            /// </summary>
+            /// <param name="pQueue">queue of the stream</param>
+            void DropFrame(std::deque<FrameRef>* pQueue);
+
+            /// <summary>
+            /// Finds the skeleton frame closest to a time, discarding the ones too old to match later frames
+            /// </summary>
+            /// <param name="timestamp">time to match in milliseconds</param>
+            /// <param name="pTuple">tuple in which to return the skeleton frame</param>
+            void MatchSkeleton(LONGLONG timestamp, FrameTuple* pTuple);
+
+            // Variables:
+            LONGLONG m_tolerance;
+
+            // Frames waiting for a match, oldest first
+            std::deque<FrameRef> m_colorFrames;
+            std::deque<FrameRef> m_depthFrames;
+            std::deque<NUI_SKELETON_FRAME> m_skeletonFrames;
+
+            // Statistics
+            LONG m_matchedCount;
+            LONG m_droppedCount;
+        };
+    }
+}
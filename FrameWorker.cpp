@@ -0,0 +1,160 @@
+#include "FrameWorker.h"
+
+/// <summary>
+/// Constructor
+/// </summary>
+FrameWorker::FrameWorker() :
+    m_job(NULL),
+    m_pContext(NULL),
+    m_hWorkerThread(NULL),
+    m_hStopEvent(NULL),
+    m_hPostEvent(NULL),
+    m_hDoneEvent(NULL),
+    m_result(S_OK),
+    m_isPosted(false)
+{
+}
+
+/// <summary>
+/// Destructor, stops the worker thread
+/// </summary>
+FrameWorker::~FrameWorker()
+{
+    Stop();
+}
+
+/// <summary>
+/// Starts the worker thread
+/// </summary>
+/// <param name="job">job to run on every post</param>
+/// <param name="pContext">context passed to the job</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT FrameWorker::Start(Job job, LPVOID pContext)
+{
+    if (!job)
+    {
+        return E_POINTER;
+    }
+
+    if (m_hWorkerThread)
+    {
+        return E_UNEXPECTED;
+    }
+
+    m_job = job;
+    m_pContext = pContext;
+    m_isPosted = false;
+
+    m_hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_hPostEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    m_hDoneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (m_hStopEvent && m_hPostEvent && m_hDoneEvent)
+    {
+        m_hWorkerThread = CreateThread(NULL, 0, WorkerThread, this, 0, NULL);
+    }
+
+    if (!m_hWorkerThread)
+    {
+        DWORD error = GetLastError();
+        Stop();
+        return HRESULT_FROM_WIN32(error);
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Stops the worker thread and waits for it to exit, after the job in flight if any
+/// </summary>
+void FrameWorker::Stop()
+{
+    if (m_hWorkerThread)
+    {
+        SetEvent(m_hStopEvent);
+        WaitForSingleObject(m_hWorkerThread, INFINITE);
+        CloseHandle(m_hWorkerThread);
+        m_hWorkerThread = NULL;
+    }
+
+    HANDLE* handles[] = { &m_hStopEvent, &m_hPostEvent, &m_hDoneEvent };
+    for (int i = 0; i < ARRAYSIZE(handles); ++i)
+    {
+        if (*handles[i])
+        {
+            CloseHandle(*handles[i]);
+            *handles[i] = NULL;
+        }
+    }
+
+    m_isPosted = false;
+}
+
+/// <summary>
+/// Returns whether the worker thread is running
+/// </summary>
+/// <returns>true if the worker has been started, false otherwise</returns>
+bool FrameWorker::IsRunning() const
+{
+    return m_hWorkerThread != NULL;
+}
+
+/// <summary>
+/// Runs the job once on the worker thread. The previous run must have been waited for.
+/// </summary>
+void FrameWorker::Post()
+{
+    if (!m_hWorkerThread || m_isPosted)
+    {
+        return;
+    }
+
+    m_isPosted = true;
+    SetEvent(m_hPostEvent);
+}
+
+/// <summary>
+/// Waits for the posted run of the job to finish
+/// </summary>
+/// <returns>result of the job, E_UNEXPECTED if nothing was posted</returns>
+HRESULT FrameWorker::Wait()
+{
+    if (!m_isPosted)
+    {
+        return E_UNEXPECTED;
+    }
+
+    // The worker finishes the job in flight before it checks for a stop
+    WaitForSingleObject(m_hDoneEvent, INFINITE);
+    m_isPosted = false;
+
+    return m_result;
+}
+
+/// <summary>
+/// Thread that runs the posted jobs, calls class instance thread processor
+/// </summary>
+/// <param name="lpParam">instance pointer</param>
+/// <returns>0</returns>
+DWORD WINAPI FrameWorker::WorkerThread(LPVOID lpParam)
+{
+    // Use class instance thread processor
+    FrameWorker* pThis = reinterpret_cast<FrameWorker*>(lpParam);
+    return pThis->WorkerThread();
+}
+
+/// <summary>
+/// Thread that runs the posted jobs until the worker is stopped
+/// </summary>
+/// <returns>0</returns>
+DWORD WINAPI FrameWorker::WorkerThread()
+{
+    HANDLE hEvents[2] = { m_hStopEvent, m_hPostEvent };
+
+    while (WaitForMultipleObjects(ARRAYSIZE(hEvents), hEvents, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+    {
+        m_result = m_job(m_pContext);
+        SetEvent(m_hDoneEvent);
+    }
+
+    return 0;
+}
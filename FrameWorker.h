@@ -0,0 +1,86 @@
+#pragma once
+
+#include <windows.h>
+
+/// <summary>
+/// Runs a job on its own thread once per post, so a stream can be processed while the
+/// posting thread processes another. The owner posts the job and waits for it each
+/// frame, so the job's data is never shared with a frame still in flight.
+/// </summary>
+class FrameWorker
+{
+public:
+    // Types:
+    // Job run on the worker thread, given the context passed to Start
+    typedef HRESULT (*Job)(LPVOID pContext);
+
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    FrameWorker();
+
+    /// <summary>
+    /// Destructor, stops the worker thread
+    /// </summary>
+    ~FrameWorker();
+
+    /// <summary>
+    /// Starts the worker thread
+    /// </summary>
+    /// <param name="job">job to run on every post</param>
+    /// <param name="pContext">context passed to the job</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT Start(Job job, LPVOID pContext);
+
+    /// <summary>
+    /// Stops the worker thread and waits for it to exit, after the job in flight if any
+    /// </summary>
+    void Stop();
+
+    /// <summary>
+    /// Returns whether the worker thread is running
+    /// </summary>
+    /// <returns>true if the worker has been started, false otherwise</returns>
+    bool IsRunning() const;
+
+    /// <summary>
+    /// Runs the job once on the worker thread. The previous run must have been waited for.
+    /// </summary>
+    void Post();
+
+    /// <summary>
+    /// Waits for the posted run of the job to finish
+    /// </summary>
+    /// <returns>result of the job, E_UNEXPECTED if nothing was posted</returns>
+    HRESULT Wait();
+
+private:
+    // Functions:
+    /// <summary>
+    /// Thread that runs the posted jobs, calls class instance thread processor
+    /// </summary>
+    /// <param name="lpParam">instance pointer</param>
+    /// <returns>0</returns>
+    static DWORD WINAPI WorkerThread(LPVOID lpParam);
+
+    /// <summary>
+    /// Thread that runs the posted jobs until the worker is stopped
+    /// </summary>
+    /// <returns>0</returns>
+    DWORD WINAPI WorkerThread();
+
+    // Variables:
+    Job m_job;
+    LPVOID m_pContext;
+
+    // Worker thread handles, the post and done events are auto reset
+    HANDLE m_hWorkerThread;
+    HANDLE m_hStopEvent;
+    HANDLE m_hPostEvent;
+    HANDLE m_hDoneEvent;
+
+    // Result of the last run, written by the worker before it signals done
+    HRESULT m_result;
+    bool m_isPosted;
+};
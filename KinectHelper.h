@@ -9,11 +9,18 @@
 #include "windows.h"
 #include <NuiApi.h>
 #include <stdlib.h>
+#include <malloc.h>
+#include <limits.h>
+#include "FramePool.h"
+#include "FrameSource.h"
+#include "CaptureFile.h"
+#include "FrameSynchronizer.h"
 #include <algorithm>
 #include <iterator>
 
 // FIND ME
 // Distancias minima y maxima
+// Default depth band, it can be changed at run time with SetDepthBand
 #define MIN_RDIS 900
 #define MAX_RDIS 1100
 #define DIF_RDIS 200
@@ -89,6 +96,14 @@ namespace Microsoft {
             /// <returns>S_OK if successful, an error code otherwise</returns>
             HRESULT Initialize(INuiSensor* pNuiSensor);
 
+            /// <summary>
+            /// Initializes the helper with the given frame source, which it takes ownership of.
+            /// The depth stream and color stream, if they are opened, will be set to the current resolutions.
+            /// </summary>
+            /// <param name="pFrameSource">frame source to initialize</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT Initialize(IFrameSource* pFrameSource);
+
             /// <summary>
             /// Uninitializes the Kinect
             /// </summary>
@@ -127,6 +142,45 @@ namespace Microsoft {
             /// <returns>S_OK if successful, an error code otherwise</returns>
             HRESULT UpdateSkeletonFrame(DWORD waitMillis = 0);
 
+            /// <summary>
+            /// Sets the writer that received frames are recorded to
+            /// </summary>
+            /// <param name="pCaptureWriter">writer to record to, or NULL to stop recording</param>
+            void SetCaptureWriter(CaptureWriter* pCaptureWriter);
+
+            /// <summary>
+            /// Gets the current color frame with its capture time. The slot reference is
+            /// borrowed, AddRef it to keep the frame past the next update.
+            /// </summary>
+            /// <param name="pFrame">pointer in which to return the frame</param>
+            void GetColorFrameRef(FrameRef* pFrame) const;
+
+            /// <summary>
+            /// Gets the current depth frame with its capture time. The slot reference is
+            /// borrowed, AddRef it to keep the frame past the next update.
+            /// </summary>
+            /// <param name="pFrame">pointer in which to return the frame</param>
+            void GetDepthFrameRef(FrameRef* pFrame) const;
+
+            /// <summary>
+            /// Makes the frames of a synchronized tuple the current color, depth and skeleton
+            /// frames, so the images are converted from matching data
+            /// </summary>
+            /// <param name="tuple">tuple from a FrameSynchronizer</param>
+            /// <returns>S_OK if successful, E_INVALIDARG if a frame does not fit the current resolution</returns>
+            HRESULT SelectFrames(const FrameTuple& tuple);
+
+            /// <summary>
+            /// Adds the frames just updated to a synchronizer and selects its newest matched tuple,
+            /// skipping older ones rather than falling behind the source
+            /// </summary>
+            /// <param name="pSynchronizer">synchronizer pairing the frames</param>
+            /// <param name="hasColorFrame">whether the color frame was just updated</param>
+            /// <param name="hasDepthFrame">whether the depth frame was just updated</param>
+            /// <param name="hasSkeletonFrame">whether the skeleton frame was just updated</param>
+            /// <returns>true if a matched tuple was selected, false otherwise</returns>
+            bool SynchronizeFrames(FrameSynchronizer* pSynchronizer, bool hasColorFrame, bool hasDepthFrame, bool hasSkeletonFrame);
+
             /// <summary>
             /// Gets the color stream resolution
             /// </summary>
@@ -143,6 +197,18 @@ namespace Microsoft {
             /// <returns>S_OK if successful, an error code otherwise</returns>
             HRESULT GetDepthFrameSize(DWORD* width, DWORD* height) const;
 
+            /// <summary>
+            /// Gets the color stream resolution setting
+            /// </summary>
+            /// <returns>resolution of the color frames</returns>
+            NUI_IMAGE_RESOLUTION GetColorFrameResolution() const;
+
+            /// <summary>
+            /// Gets the depth stream resolution setting
+            /// </summary>
+            /// <returns>resolution of the depth frames</returns>
+            NUI_IMAGE_RESOLUTION GetDepthFrameResolution() const;
+
             /// <summary>
             /// Gets the color frame event handle
             /// </summary>
@@ -192,6 +258,30 @@ namespace Microsoft {
             /// <returns>S_OK if successful, an error code otherwise</returns>
             HRESULT GetDepthImageAsArgb(Image* pDepthArgbImage) const;
 
+            /// <summary>
+            /// Sets the depth band that is colorized and masked. The depth to color table is
+            /// rebuilt if the band changes, so call this from the thread that gets the frames.
+            /// </summary>
+            /// <param name="minDepth">nearest depth in the band, in millimeters</param>
+            /// <param name="maxDepth">farthest depth in the band, in millimeters</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT SetDepthBand(USHORT minDepth, USHORT maxDepth);
+
+            /// <summary>
+            /// Gets the depth band that is colorized and masked
+            /// </summary>
+            /// <param name="pMinDepth">pointer in which to return the nearest depth, in millimeters</param>
+            /// <param name="pMaxDepth">pointer in which to return the farthest depth, in millimeters</param>
+            void GetDepthBand(USHORT* pMinDepth, USHORT* pMaxDepth) const;
+
+            /// <summary>
+            /// Gets the depth to color table for the current depth band. It is indexed by the raw
+            /// depth value and holds the packed red, green, blue and alpha bytes DepthShortToRgb gives,
+            /// or 0 for unknown depth.
+            /// </summary>
+            /// <returns>table of 65536 packed colors</returns>
+            const UINT* GetDepthArgbTable() const;
+
         protected:
             // Functions:
             /// <summary>
@@ -234,12 +324,21 @@ namespace Microsoft {
             HRESULT DepthShortToRgb(USHORT depth, UINT8* pRedPixel, UINT8* pGreenPixel, UINT8* pBluePixel) const;
 
             // Image stream data
+            // The buffers point into the current slots, which stay valid while referenced
             BYTE* m_pColorBuffer;
             INT m_colorBufferSize;
             INT m_colorBufferPitch;
+            FrameSlot* m_pColorSlot;
             BYTE* m_pDepthBuffer;
             INT m_depthBufferSize;
             INT m_depthBufferPitch;
+            FrameSlot* m_pDepthSlot;
+
+            // Capture time in milliseconds and frame number of the current frames
+            LONGLONG m_colorTimestamp;
+            DWORD m_colorFrameNumber;
+            LONGLONG m_depthTimestamp;
+            DWORD m_depthFrameNumber;
 
             // Image stream resolution information
             NUI_IMAGE_RESOLUTION m_colorResolution;
@@ -247,6 +346,53 @@ namespace Microsoft {
 
         private:
             // Functions:
+            /// <summary>
+            /// Copies a source frame into a fresh pooled slot and makes it the current frame
+            /// </summary>
+            /// <param name="frame">frame from the frame source</param>
+            /// <param name="pPool">pool to take the slot from</param>
+            /// <param name="ppSlot">current slot, released and replaced</param>
+            /// <param name="ppBuffer">current buffer, pointed at the new slot data</param>
+            /// <param name="pBufferSize">size of the current buffer</param>
+            /// <param name="pBufferPitch">pitch of the current buffer</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT StoreFrame(const SourceFrame& frame, FramePool* pPool, FrameSlot** ppSlot, BYTE** ppBuffer, INT* pBufferSize, INT* pBufferPitch);
+
+            /// <summary>
+            /// Copies a source frame into a pooled slot of its own and queues it on the capture writer
+            /// </summary>
+            /// <param name="stream">CAPTURE_STREAM_COLOR or CAPTURE_STREAM_DEPTH</param>
+            /// <param name="resolution">resolution of the stream</param>
+            /// <param name="frame">frame from the frame source</param>
+            /// <param name="pPool">pool to take the slot from, already reset to the frame size</param>
+            /// <returns>S_OK if queued, S_FALSE if the queue was full and the frame dropped, an error code otherwise</returns>
+            HRESULT RecordFrame(CaptureStream stream, NUI_IMAGE_RESOLUTION resolution, const SourceFrame& frame, FramePool* pPool);
+
+            /// <summary>
+            /// Releases the current color and depth slots
+            /// </summary>
+            void ReleaseFrames();
+
+            /// <summary>
+            /// Makes a referenced frame the current frame of a stream
+            /// </summary>
+            /// <param name="frame">frame to select</param>
+            /// <param name="resolution">resolution of the stream</param>
+            /// <param name="bytesPerPixel">bytes per pixel of the stream</param>
+            /// <param name="ppSlot">current slot of the stream, released and replaced</param>
+            /// <param name="ppBuffer">pointer in which to return the slot data</param>
+            /// <param name="pBufferSize">pointer in which to return the data size</param>
+            /// <param name="pBufferPitch">pointer in which to return the row pitch</param>
+            /// <param name="pTimestamp">pointer in which to return the capture time</param>
+            /// <param name="pFrameNumber">pointer in which to return the frame number</param>
+            /// <returns>S_OK if successful, E_INVALIDARG if the frame does not fit the resolution</returns>
+            static HRESULT SelectFrame(const FrameRef& frame, NUI_IMAGE_RESOLUTION resolution, INT bytesPerPixel, FrameSlot** ppSlot, BYTE** ppBuffer, INT* pBufferSize, INT* pBufferPitch, LONGLONG* pTimestamp, DWORD* pFrameNumber);
+
+            /// <summary>
+            /// Rebuilds the depth to color table for the current depth band
+            /// </summary>
+            void UpdateDepthArgbTable();
+
             // Variables:
             // Image stream handles
             HANDLE m_hColorStreamHandle;
@@ -274,9 +420,22 @@ namespace Microsoft {
             // Internal skeleton frame
             NUI_SKELETON_FRAME m_skeletonFrame;
 
-            // Pointer to Kinect sensor
-            INuiSensor* m_pNuiSensor;
+            // Source of the frames, a Kinect sensor or a recording
+            IFrameSource* m_pFrameSource;
+
+            // Writer that received frames are recorded to, if any
+            CaptureWriter* m_pCaptureWriter;
 
+            // Pools backing the color and depth buffers
+            FramePool m_colorPool;
+            FramePool m_depthPool;
+
+            // Depth band that is colorized, in millimeters
+            USHORT m_depthBandMin;
+            USHORT m_depthBandMax;
+
+            // Depth to color table for the current band, one entry per raw depth value
+            UINT* m_pDepthArgbTable;
         };
 
         /// <summary>
@@ -291,18 +450,30 @@ namespace Microsoft {
             m_hNextSkeletonFrameEvent(NULL),
             m_depthFlags(0),
             m_skeletonFlags(NUI_SKELETON_TRACKING_FLAG_ENABLE_IN_NEAR_RANGE),
-            m_pNuiSensor(NULL),
+            m_pFrameSource(NULL),
+            m_pCaptureWriter(NULL),
             m_pColorBuffer(NULL),
             m_colorBufferSize(0),
             m_colorBufferPitch(0),
+            m_pColorSlot(NULL),
             m_pDepthBuffer(NULL),
             m_depthBufferSize(0),
             m_depthBufferPitch(0),
+            m_pDepthSlot(NULL),
+            m_colorTimestamp(0),
+            m_colorFrameNumber(0),
+            m_depthTimestamp(0),
+            m_depthFrameNumber(0),
             m_colorResolution(COLOR_DEFAULT_RESOLUTION),
-            m_depthResolution(DEPTH_DEFAULT_RESOLUTION)
+            m_depthResolution(DEPTH_DEFAULT_RESOLUTION),
+            m_depthBandMin(MIN_RDIS),
+            m_depthBandMax(MAX_RDIS),
+            m_pDepthArgbTable(NULL)
         {
             // Default to all streams enabled
             SetNuiInitFlags(true, true, true);
+
+            UpdateDepthArgbTable();
         }
 
         /// <summary>
@@ -312,6 +483,9 @@ namespace Microsoft {
         KinectHelper<Image>::~KinectHelper()
         {
             UnInitialize();
+            ReleaseFrames();
+
+            _aligned_free(m_pDepthArgbTable);
         }
 
         /// <summary>
@@ -326,7 +500,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::SetNuiInitFlags(bool useColor, bool useDepth, bool useSkeleton, bool usePlayerIndex /* = true */)
         {
             // Fail if Kinect is already initialized
-            if (m_pNuiSensor) 
+            if (m_pFrameSource) 
             {
                 return E_NUI_ALREADY_INITIALIZED;
             }
@@ -400,13 +574,12 @@ namespace Microsoft {
             HRESULT hr = S_OK;
 
             // If color stream is already opened, update its resolution
-            if (m_pNuiSensor)
+            if (m_pFrameSource)
             {
-                hr = m_pNuiSensor->NuiImageStreamOpen(
+                hr = m_pFrameSource->OpenImageStream(
                     NUI_IMAGE_TYPE_COLOR,
                     resolution,
                     0,
-                    2,
                     m_hNextColorFrameEvent,
                     &m_hColorStreamHandle);
             }
@@ -443,13 +616,12 @@ namespace Microsoft {
             HRESULT hr = S_OK;
 
             // If depth stream is already open, update its resolution
-            if (m_pNuiSensor)
+            if (m_pFrameSource)
             {
-                hr = m_pNuiSensor->NuiImageStreamOpen(
+                hr = m_pFrameSource->OpenImageStream(
                     m_isUsingPlayerIndex ? NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX : NUI_IMAGE_TYPE_DEPTH,
                     resolution,
                     m_depthFlags,
-                    2,
                     m_hNextDepthFrameEvent,
                     &m_hDepthStreamHandle);
             }
@@ -486,9 +658,9 @@ namespace Microsoft {
             // Apply new flags to depth stream
             if (newFlags != m_depthFlags) 
             {
-                if (m_pNuiSensor)
+                if (m_pFrameSource)
                 {
-                    HRESULT hr = m_pNuiSensor->NuiImageStreamSetImageFrameFlags(m_hDepthStreamHandle, newFlags);
+                    HRESULT hr = m_pFrameSource->SetImageStreamFlags(m_hDepthStreamHandle, newFlags);
 
                     if (FAILED(hr))
                     {
@@ -531,9 +703,9 @@ namespace Microsoft {
             // Apply new flags to skeleton tracking
             if (newFlags != m_skeletonFlags) 
             {
-                if (m_pNuiSensor)
+                if (m_pFrameSource)
                 {
-                    HRESULT hr = m_pNuiSensor->NuiSkeletonTrackingEnable(m_hNextSkeletonFrameEvent, newFlags);
+                    HRESULT hr = m_pFrameSource->EnableSkeletonTracking(m_hNextSkeletonFrameEvent, newFlags);
 
                     if (FAILED(hr))
                     {
@@ -556,24 +728,50 @@ namespace Microsoft {
         /// <returns>S_OK if successful, an error code otherwise</returns>
         template <typename Image>
         HRESULT KinectHelper<Image>::Initialize(INuiSensor* pNuiSensor)
+        {
+            // If already initialized, keep the current source
+            if (m_pFrameSource)
+            {
+                return Initialize(m_pFrameSource);
+            }
+
+            if (!pNuiSensor)
+            {
+                return E_POINTER;
+            }
+
+            return Initialize(new NuiFrameSource(pNuiSensor));
+        }
+
+        /// <summary>
+        /// Initializes the helper with the given frame source, which it takes ownership of.
+        /// The depth stream and color stream, if they are opened, will be set to the current resolutions.
+        /// </summary>
+        /// <param name="pFrameSource">frame source to initialize</param>
+        /// <returns>S_OK if successful, an error code otherwise</returns>
+        template <typename Image>
+        HRESULT KinectHelper<Image>::Initialize(IFrameSource* pFrameSource)
         {
             HRESULT hr;
 
-            // If there is no sensor, initialize one
-            if (!m_pNuiSensor)
+            // If there is no source, initialize this one
+            if (!m_pFrameSource)
             {
-                if (!pNuiSensor)
+                if (!pFrameSource)
                 {
                     return E_POINTER;
                 }
-                m_pNuiSensor = pNuiSensor;
+                m_pFrameSource = pFrameSource;
 
-                hr = m_pNuiSensor->NuiInitialize(m_nuiInitFlags);
+                hr = m_pFrameSource->Initialize(m_nuiInitFlags);
                 if (FAILED(hr))
                 {
                     return hr;
                 }
-
+            }
+            else if (pFrameSource != m_pFrameSource)
+            {
+                delete pFrameSource;
             }
 
             // Create events based on usage settings
@@ -607,11 +805,10 @@ namespace Microsoft {
             // Open image stream
             if (m_isUsingColor) 
             {
-                hr = m_pNuiSensor->NuiImageStreamOpen(
+                hr = m_pFrameSource->OpenImageStream(
                     NUI_IMAGE_TYPE_COLOR,
                     m_colorResolution,
                     0,
-                    2,
                     m_hNextColorFrameEvent,
                     &m_hColorStreamHandle);
                 if (FAILED(hr))
@@ -623,11 +820,10 @@ namespace Microsoft {
             // Open depth stream
             if (m_isUsingDepth) 
             {
-                hr = m_pNuiSensor->NuiImageStreamOpen(
+                hr = m_pFrameSource->OpenImageStream(
                     m_isUsingPlayerIndex ? NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX : NUI_IMAGE_TYPE_DEPTH,
                     m_depthResolution,
                     m_depthFlags,
-                    2,
                     m_hNextDepthFrameEvent,
                     &m_hDepthStreamHandle);
                 if (FAILED(hr))
@@ -639,7 +835,7 @@ namespace Microsoft {
             // Enable skeleton tracking
             if (m_isUsingSkeleton)
             {
-                hr = m_pNuiSensor->NuiSkeletonTrackingEnable(m_hNextSkeletonFrameEvent, m_skeletonFlags);
+                hr = m_pFrameSource->EnableSkeletonTracking(m_hNextSkeletonFrameEvent, m_skeletonFlags);
                 if (FAILED(hr))
                 {
                     return hr;
@@ -655,11 +851,12 @@ namespace Microsoft {
         template <typename Image>
         void KinectHelper<Image>::UnInitialize()
         {
-            // Close Kinect
-            if (m_pNuiSensor)
+            // Close Kinect or recording
+            if (m_pFrameSource)
             {
-                m_pNuiSensor->NuiShutdown();
-                m_pNuiSensor = NULL;
+                m_pFrameSource->Shutdown();
+                delete m_pFrameSource;
+                m_pFrameSource = NULL;
             }
 
             // Close handles for created events
@@ -689,7 +886,7 @@ namespace Microsoft {
         template <typename Image>
         bool KinectHelper<Image>::IsInitialized() const
         {
-            return m_pNuiSensor != NULL;
+            return m_pFrameSource != NULL;
         }
 
         /// <summary>
@@ -699,7 +896,7 @@ namespace Microsoft {
         template <typename Image>
         BSTR KinectHelper<Image>::GetKinectDeviceConnectionId() const
         {
-            return m_pNuiSensor->NuiDeviceConnectionId();
+            return m_pFrameSource->GetDeviceConnectionId();
         }
 
         /// <summary>
@@ -711,7 +908,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::UpdateColorFrame(DWORD waitMillis /* = 0 */)
         {
             // Fail if Kinect is not initialized
-            if (!m_pNuiSensor)
+            if (!m_pFrameSource)
             {
                 return E_NUI_DEVICE_NOT_READY;
             }
@@ -723,50 +920,39 @@ namespace Microsoft {
             }
 
             // Get next image stream frame
-            NUI_IMAGE_FRAME imageFrame;
+            SourceFrame frame;
 
-            HRESULT hr = m_pNuiSensor->NuiImageStreamGetNextFrame(
+            HRESULT hr = m_pFrameSource->GetNextImageFrame(
                 m_hColorStreamHandle,
                 waitMillis,
-                &imageFrame);
+                &frame);
             if (FAILED(hr))
             {
                 return hr;
             }
 
-            // Lock frame texture to allow for copy
-            INuiFrameTexture* pTexture = imageFrame.pFrameTexture;
-            NUI_LOCKED_RECT lockedRect;
-            pTexture->LockRect(0, &lockedRect, NULL, 0);
-
             // Check if image is valid
-            if (lockedRect.Pitch != 0)
+            if (frame.pitch != 0)
             {
-                // Copy image information into buffer so it doesn't get overwritten later
-                BYTE* pBuffer = lockedRect.pBits;
-                INT size =  lockedRect.size;
-                INT pitch = lockedRect.Pitch;
-
-                // Only reallocate memory if the buffer size has changed
-                if (size != m_colorBufferSize)
+                // Copy image information into a pooled slot so it doesn't get overwritten later
+                hr = StoreFrame(frame, &m_colorPool, &m_pColorSlot, &m_pColorBuffer, &m_colorBufferSize, &m_colorBufferPitch);
+                if (SUCCEEDED(hr))
                 {
-                    delete [] m_pColorBuffer;
-                    m_pColorBuffer = new BYTE[size];
-                    m_colorBufferSize = size;
+                    m_colorTimestamp = frame.timestamp.QuadPart;
+                    m_colorFrameNumber = frame.frameNumber;
                 }
-                memcpy_s(m_pColorBuffer, size, pBuffer, size);
 
-
-                m_colorBufferPitch = pitch;
+                if (SUCCEEDED(hr) && m_pCaptureWriter)
+                {
+                    // A full queue drops the frame
+                    RecordFrame(CAPTURE_STREAM_COLOR, m_colorResolution, frame, &m_colorPool);
+                }
             }
 
-            // Unlock texture
-            pTexture->UnlockRect(0);
-
             // Release image stream frame
-            hr = m_pNuiSensor->NuiImageStreamReleaseFrame(m_hColorStreamHandle, &imageFrame);
+            HRESULT hrRelease = m_pFrameSource->ReleaseImageFrame(m_hColorStreamHandle, &frame);
 
-            return hr;
+            return FAILED(hr) ? hr : hrRelease;
         }
 
         /// <summary>
@@ -778,7 +964,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::UpdateDepthFrame(DWORD waitMillis /* = 0 */)
         {
             // Fail if Kinect is not initialized
-            if (!m_pNuiSensor)
+            if (!m_pFrameSource)
             {
                 return E_NUI_DEVICE_NOT_READY;
             }
@@ -790,51 +976,262 @@ namespace Microsoft {
             }
 
             // Get next image stream frame
-            NUI_IMAGE_FRAME imageFrame;
+            SourceFrame frame;
 
-            HRESULT hr = m_pNuiSensor->NuiImageStreamGetNextFrame(
+            HRESULT hr = m_pFrameSource->GetNextImageFrame(
                 m_hDepthStreamHandle,
                 waitMillis,
-                &imageFrame);
+                &frame);
             if (FAILED(hr))
             {
                 return hr;
             }
 
-            // Lock frame texture to allow for copy
-            INuiFrameTexture* pTexture = imageFrame.pFrameTexture;
-            NUI_LOCKED_RECT lockedRect;
-            pTexture->LockRect(0, &lockedRect, NULL, 0);
-
             // Check if image is valid
-            if (lockedRect.Pitch != 0)
+            if (frame.pitch != 0)
             {
-                // Copy image information into buffer
-                BYTE* pBuffer = lockedRect.pBits;
-                INT size =  lockedRect.size;
-                INT pitch = lockedRect.Pitch;
+                // Copy image information into a pooled slot
+                hr = StoreFrame(frame, &m_depthPool, &m_pDepthSlot, &m_pDepthBuffer, &m_depthBufferSize, &m_depthBufferPitch);
+                if (SUCCEEDED(hr))
+                {
+                    m_depthTimestamp = frame.timestamp.QuadPart;
+                    m_depthFrameNumber = frame.frameNumber;
+                }
 
-                // Only reallocate memory if the buffer size has changed
-                if (size != m_depthBufferSize)
+                if (SUCCEEDED(hr) && m_pCaptureWriter)
                 {
-                    delete [] m_pDepthBuffer;
-                    m_pDepthBuffer = new BYTE[size];
-                    m_depthBufferSize = size;
+                    // A full queue drops the frame
+                    RecordFrame(CAPTURE_STREAM_DEPTH, m_depthResolution, frame, &m_depthPool);
                 }
-                memcpy_s(m_pDepthBuffer, size, pBuffer, size);
+            }
+
+            // Release image stream frame
+            HRESULT hrRelease = m_pFrameSource->ReleaseImageFrame(m_hDepthStreamHandle, &frame);
+
+            return FAILED(hr) ? hr : hrRelease;
+        }
+
+        /// <summary>
+        /// Copies a source frame into a fresh pooled slot and makes it the current frame.
+        /// This is the only copy of the frame unless it is recorded: the frame has to go back
+        /// to the source, but the slot is handed to consumers by reference instead of being
+        /// copied again.
+        /// </summary>
+        /// <param name="frame">frame from the frame source</param>
+        /// <param name="pPool">pool to take the slot from</param>
+        /// <param name="ppSlot">current slot, released and replaced</param>
+        /// <param name="ppBuffer">current buffer, pointed at the new slot data</param>
+        /// <param name="pBufferSize">size of the current buffer</param>
+        /// <param name="pBufferPitch">pitch of the current buffer</param>
+        /// <returns>S_OK if successful, an error code otherwise</returns>
+        template <typename Image>
+        HRESULT KinectHelper<Image>::StoreFrame(const SourceFrame& frame, FramePool* pPool, FrameSlot** ppSlot, BYTE** ppBuffer, INT* pBufferSize, INT* pBufferPitch)
+        {
+            INT size = frame.size;
 
-                m_depthBufferPitch = pitch;
+            // Only reallocate the pool if the frame size has changed
+            HRESULT hr = pPool->Reset(size);
+            if (FAILED(hr))
+            {
+                return hr;
             }
 
-            // Unlock texture
-            pTexture->UnlockRect(0);
+            // Consumers may still hold the previous slot, so always write into a free one
+            FrameSlot* pSlot = pPool->Acquire();
+            if (!pSlot)
+            {
+                return E_OUTOFMEMORY;
+            }
 
-            // Release image stream frame
-            hr = m_pNuiSensor->NuiImageStreamReleaseFrame(m_hDepthStreamHandle, &imageFrame);
+            memcpy_s(pSlot->pData, pSlot->capacity, frame.pBits, size);
+
+            if (*ppSlot)
+            {
+                FramePool::Release(*ppSlot);
+            }
+
+            *ppSlot = pSlot;
+            *ppBuffer = pSlot->pData;
+            *pBufferSize = size;
+            *pBufferPitch = frame.pitch;
+
+            return S_OK;
+        }
+
+        /// <summary>
+        /// Copies a source frame into a pooled slot of its own and queues it on the capture writer.
+        /// The stored slot is handed to the filters, which draw into it in place while the writer
+        /// thread would still be reading it, so recording gives up the zero-copy path: each
+        /// recorded frame is copied a second time, straight from the source frame.
+        /// </summary>
+        /// <param name="stream">CAPTURE_STREAM_COLOR or CAPTURE_STREAM_DEPTH</param>
+        /// <param name="resolution">resolution of the stream</param>
+        /// <param name="frame">frame from the frame source</param>
+        /// <param name="pPool">pool to take the slot from, already reset to the frame size</param>
+        /// <returns>S_OK if queued, S_FALSE if the queue was full and the frame dropped, an error code otherwise</returns>
+        template <typename Image>
+        HRESULT KinectHelper<Image>::RecordFrame(CaptureStream stream, NUI_IMAGE_RESOLUTION resolution, const SourceFrame& frame, FramePool* pPool)
+        {
+            FrameSlot* pSlot = pPool->Acquire();
+            if (!pSlot)
+            {
+                return E_OUTOFMEMORY;
+            }
+
+            memcpy_s(pSlot->pData, pSlot->capacity, frame.pBits, frame.size);
+
+            // The writer holds its own reference until the frame has been written
+            HRESULT hr = m_pCaptureWriter->WriteImageFrame(stream, resolution, frame.frameNumber, frame.timestamp.QuadPart, frame.pitch, pSlot, frame.size);
+            FramePool::Release(pSlot);
 
             return hr;
         }
 
+        /// <summary>
+        /// Makes a referenced frame the current frame of a stream
+        /// </summary>
+        /// <param name="frame">frame to select</param>
+        /// <param name="resolution">resolution of the stream</param>
+        /// <param name="bytesPerPixel">bytes per pixel of the stream</param>
+        /// <param name="ppSlot">current slot of the stream, released and replaced</param>
+        /// <param name="ppBuffer">pointer in which to return the slot data</param>
+        /// <param name="pBufferSize">pointer in which to return the data size</param>
+        /// <param name="pBufferPitch">pointer in which to return the row pitch</param>
+        /// <param name="pTimestamp">pointer in which to return the capture time</param>
+        /// <param name="pFrameNumber">pointer in which to return the frame number</param>
+        /// <returns>S_OK if successful, E_INVALIDARG if the frame does not fit the resolution</returns>
+        template <typename Image>
+        HRESULT KinectHelper<Image>::SelectFrame(const FrameRef& frame, NUI_IMAGE_RESOLUTION resolution, INT bytesPerPixel, FrameSlot** ppSlot, BYTE** ppBuffer, INT* pBufferSize, INT* pBufferPitch, LONGLONG* pTimestamp, DWORD* pFrameNumber)
+        {
+            // Frames queued before a resolution change no longer fit the images
+            DWORD width, height;
+            NuiImageResolutionToSize(resolution, width, height);
+            if (!frame.pSlot || frame.pitch < static_cast<INT>(width) * bytesPerPixel || frame.size < frame.pitch * static_cast<INT>(height))
+            {
+                return E_INVALIDARG;
+            }
+
+            FramePool::AddRef(frame.pSlot);
+            if (*ppSlot)
+            {
+                FramePool::Release(*ppSlot);
+            }
+
+            *ppSlot = frame.pSlot;
+            *ppBuffer = frame.pSlot->pData;
+            *pBufferSize = frame.size;
+            *pBufferPitch = frame.pitch;
+            *pTimestamp = frame.timestamp;
+            *pFrameNumber = frame.frameNumber;
+
+            return S_OK;
+        }
+
+        /// <summary>
+        /// Releases the current color and depth slots
+        /// </summary>
+        template <typename Image>
+        void KinectHelper<Image>::ReleaseFrames()
+        {
+            if (m_pColorSlot)
+            {
+                FramePool::Release(m_pColorSlot);
+                m_pColorSlot = NULL;
+            }
+
+            if (m_pDepthSlot)
+            {
+                FramePool::Release(m_pDepthSlot);
+                m_pDepthSlot = NULL;
+            }
+
+            m_pColorBuffer = NULL;
+            m_colorBufferSize = 0;
+            m_colorBufferPitch = 0;
+            m_pDepthBuffer = NULL;
+            m_depthBufferSize = 0;
+            m_depthBufferPitch = 0;
+        }
+
+        /// <summary>
+        /// Sets the depth band that is colorized and masked. The depth to color table is
+        /// rebuilt if the band changes, so call this from the thread that gets the frames.
+        /// </summary>
+        /// <param name="minDepth">nearest depth in the band, in millimeters</param>
+        /// <param name="maxDepth">farthest depth in the band, in millimeters</param>
+        /// <returns>S_OK if successful, an error code otherwise</returns>
+        template <typename Image>
+        HRESULT KinectHelper<Image>::SetDepthBand(USHORT minDepth, USHORT maxDepth)
+        {
+            // Fail if the band is empty or beyond the depth range
+            if (minDepth >= maxDepth || maxDepth > (USHRT_MAX >> NUI_IMAGE_PLAYER_INDEX_SHIFT))
+            {
+                return E_INVALIDARG;
+            }
+
+            if (minDepth != m_depthBandMin || maxDepth != m_depthBandMax)
+            {
+                m_depthBandMin = minDepth;
+                m_depthBandMax = maxDepth;
+                UpdateDepthArgbTable();
+            }
+
+            return S_OK;
+        }
+
+        /// <summary>
+        /// Gets the depth band that is colorized and masked
+        /// </summary>
+        /// <param name="pMinDepth">pointer in which to return the nearest depth, in millimeters</param>
+        /// <param name="pMaxDepth">pointer in which to return the farthest depth, in millimeters</param>
+        template <typename Image>
+        void KinectHelper<Image>::GetDepthBand(USHORT* pMinDepth, USHORT* pMaxDepth) const
+        {
+            *pMinDepth = m_depthBandMin;
+            *pMaxDepth = m_depthBandMax;
+        }
+
+        /// <summary>
+        /// Gets the depth to color table for the current depth band. It is indexed by the raw
+        /// depth value and holds the packed red, green, blue and alpha bytes DepthShortToRgb gives,
+        /// or 0 for unknown depth.
+        /// </summary>
+        /// <returns>table of 65536 packed colors</returns>
+        template <typename Image>
+        const UINT* KinectHelper<Image>::GetDepthArgbTable() const
+        {
+            return m_pDepthArgbTable;
+        }
+
+        /// <summary>
+        /// Rebuilds the depth to color table for the current depth band
+        /// </summary>
+        template <typename Image>
+        void KinectHelper<Image>::UpdateDepthArgbTable()
+        {
+            const UINT tableSize = USHRT_MAX + 1;
+
+            // Aligned to a cache line, the table is read at random by depth value
+            if (!m_pDepthArgbTable)
+            {
+                m_pDepthArgbTable = static_cast<UINT*>(_aligned_malloc(tableSize * sizeof(UINT), 64));
+                if (!m_pDepthArgbTable)
+                {
+                    return;
+                }
+            }
+
+            BYTE* pEntry = reinterpret_cast<BYTE*>(m_pDepthArgbTable);
+            for (UINT depth = 0; depth < tableSize; ++depth, pEntry += 4)
+            {
+                DepthShortToRgb(static_cast<USHORT>(depth), &pEntry[0], &pEntry[1], &pEntry[2]);
+                pEntry[3] = 1;
+            }
+
+            // Unknown depth is not colorized
+            m_pDepthArgbTable[USHRT_MAX] = 0;
+        }
+
         /// <summary>
         /// Updates the internal skeleton frame
         /// </summary>
@@ -844,7 +1241,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::UpdateSkeletonFrame(DWORD waitMillis /* = 0 */)
         {
             // Fail if Kinect is not initialized
-            if (!m_pNuiSensor)
+            if (!m_pFrameSource)
             {
                 return E_NUI_DEVICE_NOT_READY;
             }
@@ -855,19 +1252,132 @@ namespace Microsoft {
                 return E_NUI_STREAM_NOT_ENABLED;
             }
 
-            // Get next skeleton frame
-            HRESULT hr = m_pNuiSensor->NuiSkeletonGetNextFrame(waitMillis, &m_skeletonFrame);
+            // Get next smoothed skeleton frame
+            HRESULT hr = m_pFrameSource->GetNextSkeletonFrame(waitMillis, &m_skeletonFrame);
             if (FAILED(hr))
             {
                 return hr;
             }
 
-            // Smooth skeletons
-            hr = m_pNuiSensor->NuiTransformSmooth(&m_skeletonFrame,NULL);
+            if (m_pCaptureWriter)
+            {
+                m_pCaptureWriter->WriteSkeletonFrame(&m_skeletonFrame);
+            }
 
             return hr;
         }
 
+        /// <summary>
+        /// Sets the writer that received frames are recorded to
+        /// </summary>
+        /// <param name="pCaptureWriter">writer to record to, or NULL to stop recording</param>
+        template <typename Image>
+        void KinectHelper<Image>::SetCaptureWriter(CaptureWriter* pCaptureWriter)
+        {
+            m_pCaptureWriter = pCaptureWriter;
+        }
+
+        /// <summary>
+        /// Gets the current color frame with its capture time. The slot reference is
+        /// borrowed, AddRef it to keep the frame past the next update.
+        /// </summary>
+        /// <param name="pFrame">pointer in which to return the frame</param>
+        template <typename Image>
+        void KinectHelper<Image>::GetColorFrameRef(FrameRef* pFrame) const
+        {
+            pFrame->pSlot = m_pColorSlot;
+            pFrame->size = m_colorBufferSize;
+            pFrame->pitch = m_colorBufferPitch;
+            pFrame->timestamp = m_colorTimestamp;
+            pFrame->frameNumber = m_colorFrameNumber;
+        }
+
+        /// <summary>
+        /// Gets the current depth frame with its capture time. The slot reference is
+        /// borrowed, AddRef it to keep the frame past the next update.
+        /// </summary>
+        /// <param name="pFrame">pointer in which to return the frame</param>
+        template <typename Image>
+        void KinectHelper<Image>::GetDepthFrameRef(FrameRef* pFrame) const
+        {
+            pFrame->pSlot = m_pDepthSlot;
+            pFrame->size = m_depthBufferSize;
+            pFrame->pitch = m_depthBufferPitch;
+            pFrame->timestamp = m_depthTimestamp;
+            pFrame->frameNumber = m_depthFrameNumber;
+        }
+
+        /// <summary>
+        /// Makes the frames of a synchronized tuple the current color, depth and skeleton
+        /// frames, so the images are converted from matching data
+        /// </summary>
+        /// <param name="tuple">tuple from a FrameSynchronizer</param>
+        /// <returns>S_OK if successful, E_INVALIDARG if a frame does not fit the current resolution</returns>
+        template <typename Image>
+        HRESULT KinectHelper<Image>::SelectFrames(const FrameTuple& tuple)
+        {
+            HRESULT hr = SelectFrame(tuple.color, m_colorResolution, 4, &m_pColorSlot, &m_pColorBuffer, &m_colorBufferSize, &m_colorBufferPitch, &m_colorTimestamp, &m_colorFrameNumber);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+
+            hr = SelectFrame(tuple.depth, m_depthResolution, sizeof(USHORT), &m_pDepthSlot, &m_pDepthBuffer, &m_depthBufferSize, &m_depthBufferPitch, &m_depthTimestamp, &m_depthFrameNumber);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+
+            if (tuple.hasSkeleton)
+            {
+                m_skeletonFrame = tuple.skeletonFrame;
+            }
+
+            return S_OK;
+        }
+
+        /// <summary>
+        /// Adds the frames just updated to a synchronizer and selects its newest matched tuple,
+        /// skipping older ones rather than falling behind the source
+        /// </summary>
+        /// <param name="pSynchronizer">synchronizer pairing the frames</param>
+        /// <param name="hasColorFrame">whether the color frame was just updated</param>
+        /// <param name="hasDepthFrame">whether the depth frame was just updated</param>
+        /// <param name="hasSkeletonFrame">whether the skeleton frame was just updated</param>
+        /// <returns>true if a matched tuple was selected, false otherwise</returns>
+        template <typename Image>
+        bool KinectHelper<Image>::SynchronizeFrames(FrameSynchronizer* pSynchronizer, bool hasColorFrame, bool hasDepthFrame, bool hasSkeletonFrame)
+        {
+            FrameRef frame;
+            if (hasColorFrame)
+            {
+                GetColorFrameRef(&frame);
+                pSynchronizer->AddColorFrame(frame);
+            }
+
+            if (hasDepthFrame)
+            {
+                GetDepthFrameRef(&frame);
+                pSynchronizer->AddDepthFrame(frame);
+            }
+
+            if (hasSkeletonFrame)
+            {
+                pSynchronizer->AddSkeletonFrame(&m_skeletonFrame);
+            }
+
+            FrameTuple tuple;
+            if (!pSynchronizer->GetLatestTuple(&tuple))
+            {
+                return false;
+            }
+
+            HRESULT hr = SelectFrames(tuple);
+            FrameSynchronizer::ReleaseTuple(&tuple);
+
+            return SUCCEEDED(hr);
+        }
+
         /// <summary>
         /// Gets the color stream resolution
         /// </summary>
@@ -908,6 +1418,26 @@ namespace Microsoft {
             return S_OK;
         }
 
+        /// <summary>
+        /// Gets the color stream resolution setting
+        /// </summary>
+        /// <returns>resolution of the color frames</returns>
+        template <typename Image>
+        NUI_IMAGE_RESOLUTION KinectHelper<Image>::GetColorFrameResolution() const
+        {
+            return m_colorResolution;
+        }
+
+        /// <summary>
+        /// Gets the depth stream resolution setting
+        /// </summary>
+        /// <returns>resolution of the depth frames</returns>
+        template <typename Image>
+        NUI_IMAGE_RESOLUTION KinectHelper<Image>::GetDepthFrameResolution() const
+        {
+            return m_depthResolution;
+        }
+
         /// <summary>
         /// Gets the color frame event handle
         /// </summary>
@@ -917,7 +1447,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::GetColorHandle(HANDLE* phColorEvent) const
         {
             // Fail if Kinect is not initialized
-            if (!m_pNuiSensor) 
+            if (!m_pFrameSource) 
             {
                 return E_NUI_DEVICE_NOT_READY;
             }
@@ -948,7 +1478,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::GetDepthHandle(HANDLE* phDepthEvent) const
         {
             // Fail if Kinect is not initialized
-            if (!m_pNuiSensor) 
+            if (!m_pFrameSource) 
             {
                 return E_NUI_DEVICE_NOT_READY;
             }
@@ -979,7 +1509,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::GetSkeletonHandle(HANDLE* phSkeletonEvent) const
         {
             // Fail if Kinect is not initialized
-            if (!m_pNuiSensor) 
+            if (!m_pFrameSource) 
             {
                 return E_NUI_DEVICE_NOT_READY;
             }
@@ -1010,7 +1540,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::GetColorImage(Image* pColorImage) const
         {
             // Fail if Kinect is not initialized
-            if (!m_pNuiSensor) 
+            if (!m_pFrameSource) 
             {
                 return E_NUI_DEVICE_NOT_READY;
             }
@@ -1048,7 +1578,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::GetDepthImage(Image* pDepthImage) const
         {
             // Fail if Kinect is not initialized
-            if (!m_pNuiSensor) 
+            if (!m_pFrameSource) 
             {
                 return E_NUI_DEVICE_NOT_READY;
             }
@@ -1066,7 +1596,7 @@ namespace Microsoft {
             }
 
             // Fail if pDepthImage is not the correct size
-            HRESULT hr = VerifySize(pDepthImage, m_depthWidth, m_depthHeight);
+            HRESULT hr = VerifySize(pDepthImage, m_depthResolution);
             if (FAILED(hr))
             {
                 return hr;
@@ -1086,7 +1616,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::GetSkeletonFrame(NUI_SKELETON_FRAME* pSkeletonFrame) const
         {
             // Fail if Kinect is not initialized
-            if (!m_pNuiSensor) 
+            if (!m_pFrameSource) 
             {
                 return E_NUI_DEVICE_NOT_READY;
             }
@@ -1117,7 +1647,7 @@ namespace Microsoft {
         HRESULT KinectHelper<Image>::GetDepthImageAsArgb(Image* pDepthArgbImage) const
         {
             // Fail if Kinect is not initialized
-            if (!m_pNuiSensor) 
+            if (!m_pFrameSource) 
             {
                 return E_NUI_DEVICE_NOT_READY;
             }
@@ -1168,10 +1698,11 @@ namespace Microsoft {
 
 			// FIND ME
 			// Colorear en azul el area de deteccion y con rojo distinguir la profundidad
-			BYTE r = static_cast<BYTE>(realDepth >= MIN_RDIS && realDepth <= MAX_RDIS ? 255 - (realDepth - MIN_RDIS) * 255 / DIF_RDIS : 0);
-			BYTE b = static_cast<BYTE>(realDepth >= MIN_RDIS && realDepth <= MAX_RDIS ? 0 : 100);
+			bool isInBand = realDepth >= m_depthBandMin && realDepth <= m_depthBandMax;
+			BYTE r = static_cast<BYTE>(isInBand ? 255 - (realDepth - m_depthBandMin) * 255 / (m_depthBandMax - m_depthBandMin) : 0);
+			BYTE b = static_cast<BYTE>(isInBand ? 0 : 100);
 
-			BYTE g = static_cast<BYTE>(realDepth >= MIN_RDIS && realDepth <= MAX_RDIS ? realDepth / 10 : 0);
+			BYTE g = static_cast<BYTE>(isInBand ? realDepth / 10 : 0);
 
             *redPixel = r;
             *greenPixel = g;
@@ -6,6 +6,7 @@
 
 #include "MainWindow.h"
 #include <time.h>
+#include <shellapi.h>
 
 using namespace cv;
 using namespace Microsoft::KinectBridge;
@@ -18,6 +19,7 @@ int APIENTRY _tWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPTSTR lpCm
     UNREFERENCED_PARAMETER(lpCmdLine);
 
     CMainWindow application;
+    application.ParseCommandLine();
     return application.Run(hInstance, nCmdShow);
 }
 
@@ -30,6 +32,7 @@ CMainWindow::CMainWindow() :
     m_hWndMain(NULL),
     m_hWndStatus(NULL),
     m_hStreamInfoFont(NULL),
+    m_frameInput(&m_frameHelper, &m_openCVHelper),
     m_bIsColorPaused(false),
     m_colorResolution(NUI_IMAGE_RESOLUTION_INVALID),
     m_bIsDepthPaused(false),
@@ -38,6 +41,28 @@ CMainWindow::CMainWindow() :
     m_bIsSkeletonSeatedMode(false),
     m_bIsSkeletonDrawColor(false),
     m_bIsSkeletonDrawDepth(false),
+    m_bIsReplayFast(false),
+    m_bIsReplayLoop(false),
+    m_bIsRecordingRawDepth(false),
+    m_bIsHeadless(false),
+    m_bUseSocket(true),
+    m_bRunBenchmark(false),
+    m_depthBandMin(MIN_RDIS),
+    m_depthBandMax(MAX_RDIS),
+    m_bIsSyncingFrames(false),
+    m_instanceCount(1),
+    m_roiPixelsPerCm(0),
+    m_bIsSerial(false),
+    m_sceneGateFraction(0.0),
+    m_pausePolicy(OpenCVHelper::PAUSE_SKIP),
+    m_edgeThreadCount(1),
+    m_bIsCalibrating(false),
+    m_latencyTime(0),
+    m_maxLatencyTime(0),
+    m_latencyCount(0),
+    m_hReplayFinishedEvent(NULL),
+    m_colorFrameCount(0),
+    m_depthFrameCount(0),
     m_depthFilterID(IDM_DEPTH_FILTER_CANNYEDGE),
     m_colorFilterID(IDM_COLOR_FILTER_NOFILTER),
     m_pColorBitmapBits(NULL),
@@ -48,6 +73,7 @@ CMainWindow::CMainWindow() :
     m_hProcessThread(NULL),
     m_hColorResolutionMutex(NULL),
     m_hDepthResolutionMutex(NULL),
+    m_hFilterMutex(NULL),
     m_hColorBitmapMutex(NULL),
     m_hDepthBitmapMutex(NULL),
     m_hPaintWindowMutex(NULL)
@@ -60,6 +86,11 @@ CMainWindow::CMainWindow() :
 /// </summary>
 CMainWindow::~CMainWindow()
 {
+    for (size_t i = 0; i < m_sensorPipelines.size(); ++i)
+    {
+        delete m_sensorPipelines[i];
+    }
+
     if (m_hProcessStopEvent)
     {
         // Signal processing thread to stop
@@ -74,7 +105,18 @@ CMainWindow::~CMainWindow()
         CloseHandle(m_hProcessStopEvent);
     }
 
+    // Keep the learned depth of the table for the next run, the processing thread is done with it
+    if (!m_backgroundPath.empty())
+    {
+        m_openCVHelper.SaveDepthBackground(m_backgroundPath.c_str());
+    }
+
     // Delete created handles and allocated data
+    if (m_hFilterMutex)
+    {
+        CloseHandle(m_hFilterMutex);
+    }
+
     if (m_hDepthResolutionMutex)
     {
         CloseHandle(m_hDepthResolutionMutex);
@@ -122,6 +164,18 @@ CMainWindow::~CMainWindow()
 /// <returns>WPARAM of final message as int</returns>
 int CMainWindow::Run(HINSTANCE hInstance, int nCmdShow)
 {
+    if (m_bRunBenchmark)
+    {
+        AttachParentConsole();
+        return Benchmark::Run(m_replayPath.empty() ? NULL : m_replayPath.c_str());
+    }
+
+    if (m_bIsHeadless)
+    {
+        m_hInstance = hInstance;
+        return RunHeadless();
+    }
+
     // Create application window
     if (FAILED(CreateMainWindow(hInstance)))
     {
@@ -131,6 +185,7 @@ int CMainWindow::Run(HINSTANCE hInstance, int nCmdShow)
     // Create mutexes
     m_hColorResolutionMutex = CreateMutex(NULL, FALSE, NULL);
     m_hDepthResolutionMutex = CreateMutex(NULL, FALSE, NULL);
+    m_hFilterMutex = CreateMutex(NULL, FALSE, NULL);
     m_hColorBitmapMutex = CreateMutex(NULL, FALSE, NULL);
     m_hDepthBitmapMutex = CreateMutex(NULL, FALSE, NULL);
     m_hPaintWindowMutex = CreateMutex(NULL, FALSE, NULL);
@@ -143,16 +198,27 @@ int CMainWindow::Run(HINSTANCE hInstance, int nCmdShow)
     CreateColorImage();
     CreateDepthImage();
 
-    // Perform Kinect initialization
-    // If Kinect initialization succeeded, start the event processing thread
+    // Perform Kinect or replay initialization
+    // If initialization succeeded, start the event processing thread
     // that will update the screen with depth and color images
-    if (SUCCEEDED(CreateFirstConnected()))
+    if (SUCCEEDED(m_replayPath.empty() ? CreateFirstConnected() : CreateReplay()))
     {
+        StartRecording();
+
+        // Filter the depth frames on their own thread, unless comparing with serial processing
+        if (!m_bIsSerial)
+        {
+            m_depthWorker.Start(ProcessDepthJob, this);
+        }
+
         // Create window processing thread
         m_hProcessStopEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
         m_hProcessThread = CreateThread(NULL, 0, ProcessThread, this, 0, NULL);
 
-        NuiSetDeviceStatusCallback( &CMainWindow::StatusProc, this );
+        if (m_replayPath.empty())
+        {
+            NuiSetDeviceStatusCallback( &CMainWindow::StatusProc, this );
+        }
     }
     // If Kinect initialization failed, disable the menus
     else
@@ -181,6 +247,459 @@ int CMainWindow::Run(HINSTANCE hInstance, int nCmdShow)
     return static_cast<int>(msg.wParam);
 }
 
+/// <summary>
+/// Reads the command line switches
+/// </summary>
+void CMainWindow::ParseCommandLine()
+{
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    if (!argv)
+    {
+        return;
+    }
+
+    // Skip the executable path
+    for (int i = 1; i < argc; ++i)
+    {
+        LPCWSTR arg = argv[i];
+
+        if (_wcsnicmp(arg, L"/replay:", 8) == 0)
+        {
+            m_replayPath = arg + 8;
+        }
+        else if (_wcsicmp(arg, L"/fast") == 0)
+        {
+            m_bIsReplayFast = true;
+        }
+        else if (_wcsicmp(arg, L"/loop") == 0)
+        {
+            m_bIsReplayLoop = true;
+        }
+        else if (_wcsnicmp(arg, L"/record:", 8) == 0)
+        {
+            m_recordPath = arg + 8;
+        }
+        else if (_wcsicmp(arg, L"/rawdepth") == 0)
+        {
+            m_bIsRecordingRawDepth = true;
+        }
+        else if (_wcsicmp(arg, L"/headless") == 0)
+        {
+            m_bIsHeadless = true;
+        }
+        else if (_wcsicmp(arg, L"/nosocket") == 0)
+        {
+            m_bUseSocket = false;
+        }
+        else if (_wcsicmp(arg, L"/serial") == 0)
+        {
+            m_bIsSerial = true;
+        }
+        else if (_wcsicmp(arg, L"/benchmark") == 0)
+        {
+            m_bRunBenchmark = true;
+        }
+        else if (_wcsnicmp(arg, L"/band:", 6) == 0)
+        {
+            // Keep the default band unless both ends are given, within the depth the frames can hold
+            UINT minDepth, maxDepth;
+            if (swscanf_s(arg + 6, L"%u-%u", &minDepth, &maxDepth) == 2 && minDepth < maxDepth &&
+                maxDepth <= (USHRT_MAX >> NUI_IMAGE_PLAYER_INDEX_SHIFT))
+            {
+                m_depthBandMin = static_cast<USHORT>(minDepth);
+                m_depthBandMax = static_cast<USHORT>(maxDepth);
+            }
+        }
+        else if (_wcsnicmp(arg, L"/sync", 5) == 0)
+        {
+            // Keep the default tolerance unless one is given
+            m_bIsSyncingFrames = true;
+
+            UINT toleranceMillis;
+            if (swscanf_s(arg + 5, L":%u", &toleranceMillis) == 1)
+            {
+                m_frameSynchronizer.SetTolerance(toleranceMillis);
+            }
+        }
+        else if (_wcsnicmp(arg, L"/roi", 4) == 0)
+        {
+            // Use the default resolution unless one is given
+            int pixelsPerCm;
+            m_roiPixelsPerCm = swscanf_s(arg + 4, L":%d", &pixelsPerCm) == 1 ? pixelsPerCm : DEFAULT_ROI_PIXELS_PER_CM;
+            m_openCVHelper.SetRoiResolution(m_roiPixelsPerCm);
+        }
+        else if (_wcsnicmp(arg, L"/gate", 5) == 0)
+        {
+            // Use the default threshold unless one is given
+            int permille;
+            m_sceneGateFraction = (swscanf_s(arg + 5, L":%d", &permille) == 1 ? permille : DEFAULT_GATE_PERMILLE) / 1000.0;
+            m_openCVHelper.SetSceneGate(m_sceneGateFraction);
+        }
+        else if (_wcsnicmp(arg, L"/pause:", 7) == 0)
+        {
+            // Keep the current policy for an unknown name
+            const LPCWSTR policyNames[] = { L"detect", L"decimate", L"skip" };
+            for (int policy = 0; policy < ARRAYSIZE(policyNames); ++policy)
+            {
+                if (_wcsicmp(arg + 7, policyNames[policy]) == 0)
+                {
+                    m_pausePolicy = static_cast<OpenCVHelper::PausePolicy>(policy);
+                    m_openCVHelper.SetPausePolicy(m_pausePolicy);
+                }
+            }
+        }
+        else if (_wcsnicmp(arg, L"/threads:", 9) == 0)
+        {
+            // Keep the serial edge chain unless the count is in range
+            int threadCount;
+            if (swscanf_s(arg + 9, L"%d", &threadCount) == 1 && threadCount >= 1 && threadCount <= TiledEdgeChain::MAX_THREAD_COUNT)
+            {
+                m_edgeThreadCount = threadCount;
+                m_openCVHelper.SetEdgeThreads(m_edgeThreadCount);
+            }
+        }
+        else if (_wcsnicmp(arg, L"/background:", 12) == 0)
+        {
+            // Learn from scratch if there is no model to load yet
+            m_backgroundPath = arg + 12;
+            m_openCVHelper.LoadDepthBackground(m_backgroundPath.c_str());
+        }
+        else if (_wcsnicmp(arg, L"/calibration:", 13) == 0)
+        {
+            // Keep the default mapping if the file does not fix one
+            m_calibrationPath = arg + 13;
+            if (FAILED(m_openCVHelper.LoadTableCalibration(m_calibrationPath.c_str())))
+            {
+                m_calibrationPath.clear();
+            }
+        }
+        else if (_wcsnicmp(arg, L"/workspace:", 11) == 0)
+        {
+            // Loaded once the number of instances is known, each sensor has its own
+            m_workspacePath = arg + 11;
+        }
+        else if (_wcsicmp(arg, L"/calibrate") == 0)
+        {
+            m_bIsCalibrating = true;
+        }
+        else if (_wcsnicmp(arg, L"/instances:", 11) == 0)
+        {
+            // Keep a single instance unless the count is in range
+            UINT instanceCount;
+            if (swscanf_s(arg + 11, L"%u", &instanceCount) == 1 && instanceCount >= 1 && instanceCount <= MAX_INSTANCE_COUNT)
+            {
+                m_instanceCount = instanceCount;
+                m_bIsHeadless = m_bIsHeadless || instanceCount > 1;
+            }
+        }
+    }
+
+    LocalFree(argv);
+}
+
+/// <summary>
+/// Runs the processing thread without a window, until the replay ends or forever for a sensor
+/// </summary>
+/// <returns>0 if successful, 1 otherwise</returns>
+int CMainWindow::RunHeadless()
+{
+    // Report to the console that started us, if any
+    AttachParentConsole();
+
+    if (m_instanceCount > 1)
+    {
+        return RunSensorPipelines();
+    }
+
+    // Create mutexes
+    m_hColorResolutionMutex = CreateMutex(NULL, FALSE, NULL);
+    m_hDepthResolutionMutex = CreateMutex(NULL, FALSE, NULL);
+    m_hFilterMutex = CreateMutex(NULL, FALSE, NULL);
+    m_hColorBitmapMutex = CreateMutex(NULL, FALSE, NULL);
+    m_hDepthBitmapMutex = CreateMutex(NULL, FALSE, NULL);
+    m_hPaintWindowMutex = CreateMutex(NULL, FALSE, NULL);
+
+    // Initialize default resolutions and matrices, there is no menu or bitmap
+    InitSettings(NULL);
+    CreateColorImage();
+    CreateDepthImage();
+
+    if (FAILED(m_replayPath.empty() ? CreateFirstConnected() : CreateReplay()))
+    {
+        printf("Failed to initialize the frame source.\n");
+        return 1;
+    }
+
+    StartRecording();
+
+    // Count every Mat allocation while processing
+    CountingMatAllocator matAllocator;
+    MatAllocator* pDefaultAllocator = Mat::getDefaultAllocator();
+    Mat::setDefaultAllocator(&matAllocator);
+
+    LARGE_INTEGER frequency, start, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    if (!m_bIsSerial)
+    {
+        m_depthWorker.Start(ProcessDepthJob, this);
+    }
+
+    m_hProcessStopEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    m_hProcessThread = CreateThread(NULL, 0, ProcessThread, this, 0, NULL);
+
+    // Run until the replay has been read to the end
+    WaitForSingleObject(m_hReplayFinishedEvent ? m_hReplayFinishedEvent : m_hProcessThread, INFINITE);
+
+    SetEvent(m_hProcessStopEvent);
+    WaitForSingleObject(m_hProcessThread, INFINITE);
+    QueryPerformanceCounter(&end);
+
+    // Write the queued frames and the index of the recording
+    if (m_captureWriter.IsOpen())
+    {
+        m_frameHelper.SetCaptureWriter(NULL);
+        HRESULT hr = m_captureWriter.Close();
+        printf("Recorded %ld frames, dropped %ld%s.\n", m_captureWriter.GetWrittenFrameCount(),
+            m_captureWriter.GetDroppedFrameCount(), FAILED(hr) ? ", recording failed" : "");
+    }
+
+    if (m_bIsSyncingFrames)
+    {
+        printf("Matched %ld color and depth pairs within %lld ms, dropped %ld unmatched frames.\n",
+            m_frameSynchronizer.GetMatchedCount(), m_frameSynchronizer.GetTolerance(), m_frameSynchronizer.GetDroppedCount());
+    }
+
+    double seconds = static_cast<double>(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+    printf("Processed %ld color and %ld depth frames in %.2f s (%.1f and %.1f fps).\n",
+        m_colorFrameCount, m_depthFrameCount, seconds, m_colorFrameCount / seconds, m_depthFrameCount / seconds);
+
+    // From the frame events to both streams filtered, to compare with /serial
+    if (m_latencyCount > 0)
+    {
+        double msPerCount = 1000.0 / frequency.QuadPart;
+        printf("Latency %.2f ms on average, %.2f ms at most, over %ld frames with %s color and depth filters.\n",
+            m_latencyTime * msPerCount / m_latencyCount, m_maxLatencyTime * msPerCount, m_latencyCount,
+            m_depthWorker.IsRunning() ? "concurrent" : "serial");
+    }
+
+    if (m_sceneGateFraction > 0.0)
+    {
+        LONG hitCount, missCount;
+        m_openCVHelper.GetSceneGateCounts(&hitCount, &missCount);
+        printf("Scene gate skipped the edge detection on %ld frames and ran it on %ld.\n", hitCount, missCount);
+    }
+
+    // The scratch buffers should only have been allocated for the first frames
+    Mat::setDefaultAllocator(pDefaultAllocator);
+    LONG frameCount = max(m_colorFrameCount + m_depthFrameCount, 1L);
+    printf("Filter scratch buffers allocated %ld times, %ld Mat allocations in total (%.1f per frame).\n",
+        m_openCVHelper.GetScratchAllocationCount(), matAllocator.GetAllocationCount(),
+        static_cast<double>(matAllocator.GetAllocationCount()) / frameCount);
+
+    return 0;
+}
+
+/// <summary>
+/// Runs one pipeline per sensor or replay without a window, until the replays end or forever for sensors,
+/// then reports the throughput of each
+/// </summary>
+/// <returns>0 if successful, 1 otherwise</returns>
+int CMainWindow::RunSensorPipelines()
+{
+    if (FAILED(CreateSensorPipelines()))
+    {
+        printf("Failed to initialize the frame sources.\n");
+        return 1;
+    }
+
+    if (m_sensorPipelines.size() < m_instanceCount)
+    {
+        printf("Found %u of %u sensors.\n", static_cast<UINT>(m_sensorPipelines.size()), m_instanceCount);
+    }
+
+    if (!m_recordPath.empty())
+    {
+        printf("Recording is only supported with a single instance.\n");
+    }
+
+    // Each pipeline serves its own client, on the ports following the default one
+    HANDLE hFinishedEvents[MAX_INSTANCE_COUNT];
+    for (size_t i = 0; i < m_sensorPipelines.size(); ++i)
+    {
+        if (FAILED(m_sensorPipelines[i]->Start(m_bUseSocket)))
+        {
+            printf("Failed to start pipeline %u.\n", m_sensorPipelines[i]->GetIndex());
+            return 1;
+        }
+        hFinishedEvents[i] = m_sensorPipelines[i]->GetFinishedHandle();
+    }
+
+    // Run until every replay has been read to the end
+    WaitForMultipleObjects(static_cast<DWORD>(m_sensorPipelines.size()), hFinishedEvents, TRUE, INFINITE);
+
+    LONG colorFrameCount = 0;
+    LONG depthFrameCount = 0;
+    double runSeconds = 0.0;
+    for (size_t i = 0; i < m_sensorPipelines.size(); ++i)
+    {
+        m_sensorPipelines[i]->Stop();
+
+        if (!m_backgroundPath.empty())
+        {
+            m_sensorPipelines[i]->SaveDepthBackground(GetInstancePath(m_backgroundPath, m_sensorPipelines[i]->GetIndex()).c_str());
+        }
+
+        SensorPipelineStats stats;
+        m_sensorPipelines[i]->GetStats(&stats);
+
+        LONG frameCount = max(stats.colorFrameCount + stats.depthFrameCount, 1L);
+        printf("Sensor %u: %ld color and %ld depth frames in %.2f s (%.1f and %.1f fps), %.2f ms per frame, %.0f%% busy.\n",
+            m_sensorPipelines[i]->GetIndex(), stats.colorFrameCount, stats.depthFrameCount, stats.runSeconds,
+            stats.colorFrameCount / stats.runSeconds, stats.depthFrameCount / stats.runSeconds,
+            stats.busySeconds * 1000.0 / frameCount, stats.busySeconds * 100.0 / stats.runSeconds);
+
+        if (m_bIsSyncingFrames)
+        {
+            printf("Sensor %u: matched %ld color and depth pairs, dropped %ld unmatched frames.\n",
+                m_sensorPipelines[i]->GetIndex(), stats.matchedCount, stats.unmatchedCount);
+        }
+
+        colorFrameCount += stats.colorFrameCount;
+        depthFrameCount += stats.depthFrameCount;
+        runSeconds = max(runSeconds, stats.runSeconds);
+    }
+
+    printf("All %u sensors: %ld color and %ld depth frames in %.2f s (%.1f and %.1f fps).\n",
+        static_cast<UINT>(m_sensorPipelines.size()), colorFrameCount, depthFrameCount, runSeconds,
+        colorFrameCount / runSeconds, depthFrameCount / runSeconds);
+
+    return 0;
+}
+
+/// <summary>
+/// Creates and initializes the pipelines, one per connected sensor up to the instance count,
+/// or the instance count of replays of the recording given on the command line
+/// </summary>
+/// <returns>S_OK if at least one pipeline was initialized, an error code otherwise</returns>
+HRESULT CMainWindow::CreateSensorPipelines()
+{
+    HRESULT hr;
+
+    // Every pipeline maps the recording on its own, the pages are shared
+    if (!m_replayPath.empty())
+    {
+        for (UINT i = 0; i < m_instanceCount; ++i)
+        {
+            SensorPipeline* pPipeline = new SensorPipeline(i);
+            hr = pPipeline->InitializeReplay(m_replayPath.c_str(), !m_bIsReplayFast, m_bIsReplayLoop);
+            if (FAILED(hr))
+            {
+                delete pPipeline;
+                return hr;
+            }
+            m_sensorPipelines.push_back(pPipeline);
+        }
+    }
+    else
+    {
+        int sensorCount = 0;
+        hr = NuiGetSensorCount(&sensorCount);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        // Take the sensors that initialize, in order, until there are enough
+        for (int i = 0; i < sensorCount && m_sensorPipelines.size() < m_instanceCount; ++i)
+        {
+            INuiSensor* sensor = NULL;
+            if (FAILED(NuiCreateSensorByIndex(i, &sensor)))
+            {
+                continue;
+            }
+
+            SensorPipeline* pPipeline = new SensorPipeline(static_cast<UINT>(m_sensorPipelines.size()));
+            if (FAILED(pPipeline->InitializeSensor(sensor)))
+            {
+                delete pPipeline;
+                continue;
+            }
+            m_sensorPipelines.push_back(pPipeline);
+        }
+
+        if (m_sensorPipelines.empty())
+        {
+            return E_NUI_NOTCONNECTED;
+        }
+    }
+
+    for (size_t i = 0; i < m_sensorPipelines.size(); ++i)
+    {
+        if (FAILED(m_sensorPipelines[i]->SetDepthBand(m_depthBandMin, m_depthBandMax)))
+        {
+            printf("Sensor %u: depth band %u-%u out of range, using the default one.\n",
+                m_sensorPipelines[i]->GetIndex(), m_depthBandMin, m_depthBandMax);
+        }
+        m_sensorPipelines[i]->SetFilters(m_colorFilterID, m_depthFilterID);
+        m_sensorPipelines[i]->SetRoiResolution(m_roiPixelsPerCm);
+        m_sensorPipelines[i]->SetSceneGate(m_sceneGateFraction);
+        m_sensorPipelines[i]->SetPausePolicy(m_pausePolicy);
+        m_sensorPipelines[i]->SetSynchronization(m_bIsSyncingFrames, m_frameSynchronizer.GetTolerance());
+
+        hr = m_sensorPipelines[i]->SetEdgeThreads(m_edgeThreadCount);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        // Every sensor rectifies the same cardboard from its own workspace, so the rectified images map to the table alike
+        if (!m_calibrationPath.empty())
+        {
+            m_sensorPipelines[i]->LoadTableCalibration(m_calibrationPath.c_str());
+        }
+
+        // Learn from scratch if there is no model to load yet
+        if (!m_backgroundPath.empty())
+        {
+            m_sensorPipelines[i]->LoadDepthBackground(GetInstancePath(m_backgroundPath, m_sensorPipelines[i]->GetIndex()).c_str());
+        }
+
+        // Find the workspace of the sensor and save it if there is none to load yet
+        std::wstring workspacePath = m_workspacePath.empty() ? m_workspacePath : GetInstancePath(m_workspacePath, m_sensorPipelines[i]->GetIndex());
+        m_sensorPipelines[i]->InitializeWorkspace(workspacePath, m_bIsCalibrating);
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Gets the file of a pipeline for a per sensor file given on the command line, each sensor sees its own table
+/// </summary>
+/// <param name="path">path given on the command line</param>
+/// <param name="index">index of the pipeline</param>
+/// <returns>path followed by the index</returns>
+std::wstring CMainWindow::GetInstancePath(const std::wstring& path, UINT index)
+{
+    WCHAR suffix[16];
+    swprintf_s(suffix, L".%u", index);
+    return path + suffix;
+}
+
+/// <summary>
+/// Sends stdout to the console the application was started from, if any
+/// </summary>
+void CMainWindow::AttachParentConsole()
+{
+    if (AttachConsole(ATTACH_PARENT_PROCESS))
+    {
+        FILE* pConsole;
+        freopen_s(&pConsole, "CONOUT$", "w", stdout);
+    }
+}
+
 /// <summary>
 /// Handles window messages, passes most to the class instance to handle
 /// </summary>
@@ -273,9 +792,12 @@ LRESULT CALLBACK CMainWindow::WndProc(HWND hWnd, UINT message, WPARAM wParam, LP
             case IDM_COLOR_FILTER_DILATE:
             case IDM_COLOR_FILTER_ERODE:
             case IDM_COLOR_FILTER_CANNYEDGE:
+            case IDM_COLOR_FILTER_PYRAMID:
                 {
+                    // Update instance variable for processing thread to apply between frames, using mutex for synchronization
+                    WaitForSingleObject(m_hFilterMutex, INFINITE);
                     m_colorFilterID = wmID;
-                    m_openCVHelper.SetColorFilter(wmID);
+                    ReleaseMutex(m_hFilterMutex);
                     CheckMenuRadioItem(hMenu, COLOR_FILTER_FIRST, COLOR_FILTER_LAST, wmID, MF_BYCOMMAND);
                 }
                 break;
@@ -327,10 +849,14 @@ LRESULT CALLBACK CMainWindow::WndProc(HWND hWnd, UINT message, WPARAM wParam, LP
             case IDM_DEPTH_FILTER_DILATE:
             case IDM_DEPTH_FILTER_ERODE:
             case IDM_DEPTH_FILTER_CANNYEDGE:
+            case IDM_DEPTH_FILTER_PYRAMID:
+            case IDM_DEPTH_FILTER_BACKGROUND:
                 {
+                    // Update instance variable for processing thread to apply between frames, using mutex for synchronization
+                    WaitForSingleObject(m_hFilterMutex, INFINITE);
                     m_depthFilterID = wmID;
+                    ReleaseMutex(m_hFilterMutex);
                     CheckMenuRadioItem(hMenu, DEPTH_FILTER_FIRST, DEPTH_FILTER_LAST, wmID, MF_BYCOMMAND);
-                    m_openCVHelper.SetDepthFilter(wmID);
                 }
                 break;
             case IDM_SKELETON_SEATEDMODE:
@@ -429,6 +955,13 @@ DWORD WINAPI CMainWindow::ProcessThread()
     NUI_IMAGE_RESOLUTION colorResolution = m_colorResolution;
     NUI_IMAGE_RESOLUTION depthResolution = m_depthResolution;
 
+    // Store local copies of the filters to check for changes
+    int colorFilterID = m_colorFilterID;
+    int depthFilterID = m_depthFilterID;
+
+    // Find the workspace and save it if there is none to load yet
+    m_frameInput.InitializeWorkspace(m_workspacePath, m_bIsCalibrating, "Workspace");
+
     // Initialize array of events to wait for
     HANDLE hEvents[4] = {m_hProcessStopEvent, NULL, NULL, NULL};
     int numEvents;
@@ -446,7 +979,10 @@ DWORD WINAPI CMainWindow::ProcessThread()
 
     // FIND ME
     // CREAR SOCKET
-    socketHelper.createSocket(8888);
+    if (m_bUseSocket)
+    {
+        socketHelper.createSocket(8888);
+    }
 
     // Main update loop
     bool continueProcessing = true;
@@ -476,6 +1012,9 @@ DWORD WINAPI CMainWindow::ProcessThread()
 
             ResizeWindow();
             CreateColorImage();
+
+            // Frames waiting for a match have the old resolution
+            m_frameSynchronizer.Reset();
         }
 
         // Use a mutex to check for update to depth resolution
@@ -502,6 +1041,26 @@ DWORD WINAPI CMainWindow::ProcessThread()
 
             ResizeWindow();
             CreateDepthImage();
+
+            m_frameSynchronizer.Reset();
+        }
+
+        // Switch filters between frames only, the depth worker is idle and the depth input is chosen for the new filter
+        WaitForSingleObject(m_hFilterMutex, INFINITE);
+        int newColorFilterID = m_colorFilterID;
+        int newDepthFilterID = m_depthFilterID;
+        ReleaseMutex(m_hFilterMutex);
+
+        if (colorFilterID != newColorFilterID)
+        {
+            colorFilterID = newColorFilterID;
+            m_openCVHelper.SetColorFilter(colorFilterID);
+        }
+
+        if (depthFilterID != newDepthFilterID)
+        {
+            depthFilterID = newDepthFilterID;
+            m_openCVHelper.SetDepthFilter(depthFilterID);
         }
 
         // Wait for any event to be signalled
@@ -520,98 +1079,217 @@ DWORD WINAPI CMainWindow::ProcessThread()
             break;
         }
 
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+
         // Update image outputs
         if (m_frameHelper.IsInitialized()) 
         {
             // Update skeleton frame
             NUI_SKELETON_FRAME skeletonFrame;
+            bool hasSkeletonFrame = false;
             if (((m_bIsSkeletonDrawDepth && !m_bIsDepthPaused) || (m_bIsSkeletonDrawColor && !m_bIsColorPaused))
                 && SUCCEEDED(m_frameHelper.UpdateSkeletonFrame())) 
             {
                 m_frameHelper.GetSkeletonFrame(&skeletonFrame);
+                hasSkeletonFrame = true;
             }
 
-            // Update color frame
-            if (!m_bIsColorPaused && SUCCEEDED(m_frameHelper.UpdateColorFrame())) 
-            {
-                HRESULT hr = m_frameHelper.GetColorImage(&m_colorMat);
-                if (FAILED(hr))
-                {
-                    continue;
-                }
+            // Update color and depth frames
+            bool hasColorFrame = !m_bIsColorPaused && SUCCEEDED(m_frameHelper.UpdateColorFrame());
+            bool hasDepthFrame = !m_bIsDepthPaused && SUCCEEDED(m_frameHelper.UpdateDepthFrame());
 
-                // Apply filter to color stream
-                hr = m_openCVHelper.ApplyColorFilter(&m_colorMat, &socketHelper);
-                if (FAILED(hr))
-                {
-                    continue;
-                }
+            // Only process color and depth captured together, while both streams are running
+            if (m_bIsSyncingFrames && !m_bIsColorPaused && !m_bIsDepthPaused)
+            {
+                hasColorFrame = hasDepthFrame = m_frameHelper.SynchronizeFrames(&m_frameSynchronizer, hasColorFrame, hasDepthFrame, hasSkeletonFrame);
 
-                // Draw skeleton onto color stream
-                if (m_bIsSkeletonDrawColor) 
+                // Draw the skeletons matched with the depth frame
+                if (hasSkeletonFrame && hasDepthFrame)
                 {
-                    hr = m_openCVHelper.DrawSkeletonsInColorImage(&m_colorMat, &skeletonFrame, colorResolution, depthResolution);
-                    if (FAILED(hr))
-                    {
-                        continue;
-                    }
+                    m_frameHelper.GetSkeletonFrame(&skeletonFrame);
                 }
+            }
 
-                // Update bitmap for drawing
-                WaitForSingleObject(m_hColorBitmapMutex, INFINITE);
-                UpdateBitmap(&m_colorMat, &m_hColorBitmap, &m_bmiColor);
-                ReleaseMutex(m_hColorBitmapMutex);
-
-                // Notify frame rate tracker that new frame has been rendered
-                m_colorFrameRateTracker.Tick();
+            // The workspace is moved before any filter sees the frames, the depth worker is idle here
+            if (m_frameInput.IsCalibrating() && hasColorFrame && hasDepthFrame)
+            {
+                m_frameInput.CalibrateWorkspace();
             }
 
-            // Update depth frame
-            if (!m_bIsDepthPaused && SUCCEEDED(m_frameHelper.UpdateDepthFrame())) 
+            // Convert the depth frame here, the frame helper is only used by this thread
+            if (hasDepthFrame)
             {
-                HRESULT hr = m_frameHelper.GetDepthImageAsArgb(&m_depthMat);
-                if (FAILED(hr))
-                {
-                    continue;
-                }
+                hasDepthFrame = SUCCEEDED(PrepareDepthFrame(&skeletonFrame, depthResolution));
+            }
 
-                // Apply filter to depth stream
-                hr = m_openCVHelper.ApplyDepthFilter(&m_depthMat, &socketHelper);
+            // The depth frame is filtered on its worker while the color frame is filtered here
+            bool isDepthPosted = hasDepthFrame && m_depthWorker.IsRunning();
+            if (isDepthPosted)
+            {
+                m_depthWorker.Post();
+            }
 
-                if (FAILED(hr))
-                {
-                    continue;
-                }
+            // Process color frame
+            if (hasColorFrame)
+            {
+                ProcessColorFrame(&skeletonFrame, colorResolution, depthResolution);
+            }
 
-                // Draw skeleton onto depth stream
-                if (m_bIsSkeletonDrawDepth)
-                {
-                    hr = m_openCVHelper.DrawSkeletonsInDepthImage(&m_depthMat, &skeletonFrame, depthResolution);
-                    if (FAILED(hr))
-                    {
-                        continue;
-                    }
-                }
+            // Process depth frame
+            if (isDepthPosted)
+            {
+                m_depthWorker.Wait();
+            }
+            else if (hasDepthFrame)
+            {
+                ProcessDepthFrame();
+            }
 
-                // Update bitmap for drawing
-                WaitForSingleObject(m_hDepthBitmapMutex, INFINITE);
-                UpdateBitmap(&m_depthMat, &m_hDepthBitmap, &m_bmiDepth);
-                ReleaseMutex(m_hDepthBitmapMutex);
+            // Time from the frame events to both streams being drawn
+            if (hasColorFrame || hasDepthFrame)
+            {
+                LARGE_INTEGER end;
+                QueryPerformanceCounter(&end);
 
-                // Notify frame rate tracker that new frame has been rendered
-                m_depthFrameRateTracker.Tick();
+                LONGLONG latency = end.QuadPart - start.QuadPart;
+                m_latencyTime += latency;
+                m_maxLatencyTime = latency > m_maxLatencyTime ? latency : m_maxLatencyTime;
+                ++m_latencyCount;
             }
 
             // Tell the window to paint the new bitmap
-            WaitForSingleObject(m_hPaintWindowMutex, INFINITE);
-            InvalidateRect(m_hWndMain, NULL, false);
-            ReleaseMutex(m_hPaintWindowMutex);
+            if (!m_bIsHeadless)
+            {
+                WaitForSingleObject(m_hPaintWindowMutex, INFINITE);
+                InvalidateRect(m_hWndMain, NULL, false);
+                ReleaseMutex(m_hPaintWindowMutex);
+            }
         }
     }
 
     return 0;
 }
 
+/// <summary>
+/// Converts, filters and draws the current color frame
+/// </summary>
+/// <param name="pSkeletonFrame">skeleton frame to draw</param>
+/// <param name="colorResolution">resolution of color image stream</param>
+/// <param name="depthResolution">resolution of depth image stream</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT CMainWindow::ProcessColorFrame(NUI_SKELETON_FRAME* pSkeletonFrame, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution)
+{
+    Mat colorImage;
+    HRESULT hr = m_frameInput.GetColorImage(&colorImage);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Apply filter to color stream
+    hr = m_openCVHelper.ApplyColorFilter(&colorImage, &socketHelper);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Draw skeleton onto color stream
+    if (m_bIsSkeletonDrawColor) 
+    {
+        hr = m_openCVHelper.DrawSkeletonsInColorImage(&colorImage, pSkeletonFrame, colorResolution, depthResolution);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+    }
+
+    // Update bitmap for drawing
+    if (!m_bIsHeadless)
+    {
+        WaitForSingleObject(m_hColorBitmapMutex, INFINITE);
+        UpdateBitmap(&colorImage, &m_hColorBitmap, &m_bmiColor);
+        ReleaseMutex(m_hColorBitmapMutex);
+    }
+
+    // Notify frame rate tracker that new frame has been rendered
+    m_colorFrameRateTracker.Tick();
+    InterlockedIncrement(&m_colorFrameCount);
+
+    return S_OK;
+}
+
+/// <summary>
+/// Converts the current depth frame into the depth job, for the depth worker or ProcessDepthFrame
+/// </summary>
+/// <param name="pSkeletonFrame">skeleton frame to draw, which has to outlive the job</param>
+/// <param name="depthResolution">resolution of depth image stream</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT CMainWindow::PrepareDepthFrame(NUI_SKELETON_FRAME* pSkeletonFrame, NUI_IMAGE_RESOLUTION depthResolution)
+{
+    HRESULT hr = m_frameInput.GetDepthImages(&m_depthJob.image, &m_depthJob.depth);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    m_depthJob.pSkeletonFrame = pSkeletonFrame;
+    m_depthJob.depthResolution = depthResolution;
+
+    return S_OK;
+}
+
+/// <summary>
+/// Filters and draws the depth frame of the depth job, runs on the depth worker, calls class instance processor
+/// </summary>
+/// <param name="pContext">instance pointer</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT CMainWindow::ProcessDepthJob(LPVOID pContext)
+{
+    CMainWindow* pThis = reinterpret_cast<CMainWindow*>(pContext);
+    return pThis->ProcessDepthFrame();
+}
+
+/// <summary>
+/// Filters and draws the depth frame of the depth job
+/// </summary>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT CMainWindow::ProcessDepthFrame()
+{
+    Mat* pDepthImage = &m_depthJob.image;
+
+    // Apply filter to depth stream
+    HRESULT hr = m_openCVHelper.ApplyDepthFilter(pDepthImage, &socketHelper, m_depthJob.depth);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Draw skeleton onto depth stream
+    if (m_bIsSkeletonDrawDepth)
+    {
+        hr = m_openCVHelper.DrawSkeletonsInDepthImage(pDepthImage, m_depthJob.pSkeletonFrame, m_depthJob.depthResolution);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+    }
+
+    // Update bitmap for drawing
+    if (!m_bIsHeadless)
+    {
+        WaitForSingleObject(m_hDepthBitmapMutex, INFINITE);
+        UpdateBitmap(pDepthImage, &m_hDepthBitmap, &m_bmiDepth);
+        ReleaseMutex(m_hDepthBitmapMutex);
+    }
+
+    // Notify frame rate tracker that new frame has been rendered
+    m_depthFrameRateTracker.Tick();
+    InterlockedIncrement(&m_depthFrameCount);
+
+    return S_OK;
+}
+
 /// <summary>
 /// Creates the main and status bar windows
 /// </summary>
@@ -798,6 +1476,19 @@ void CMainWindow::InitSettings(HMENU hMenu)
     m_frameHelper.SetDepthFrameResolution(m_depthResolution);
     CheckMenuRadioItem(hMenu, DEPTH_RESOLUTION_FIRST, DEPTH_RESOLUTION_LAST, IDM_DEPTH_RESOLUTION_640x480, MF_BYCOMMAND);
 
+    // Set the depth band from the command line, the default one if it is out of range
+    if (FAILED(m_frameHelper.SetDepthBand(m_depthBandMin, m_depthBandMax)))
+    {
+        if (hMenu)
+        {
+            SetStatusMessage(IDS_ERROR_DEPTH_BAND);
+        }
+        else
+        {
+            printf("Depth band %u-%u out of range, using the default one.\n", m_depthBandMin, m_depthBandMax);
+        }
+    }
+
     // Check default filter radio buttons
     CheckMenuRadioItem(hMenu, COLOR_FILTER_FIRST, COLOR_FILTER_LAST, IDM_COLOR_FILTER_NOFILTER, MF_BYCOMMAND);
     CheckMenuRadioItem(hMenu, DEPTH_FILTER_FIRST, DEPTH_FILTER_LAST, IDM_DEPTH_FILTER_CANNYEDGE, MF_BYCOMMAND);
@@ -859,6 +1550,77 @@ HRESULT CMainWindow::CreateFirstConnected()
     return E_FAIL;
 }
 
+/// <summary>
+/// Initializes the replay of the recording given on the command line
+/// </summary>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT CMainWindow::CreateReplay()
+{
+    // If replay is already initialized, return
+    if (m_frameHelper.IsInitialized())
+    {
+        return S_OK;
+    }
+
+    ReplayFrameSource* pReplaySource = new ReplayFrameSource();
+    HRESULT hr = pReplaySource->Open(m_replayPath.c_str(), !m_bIsReplayFast, m_bIsReplayLoop);
+    if (FAILED(hr))
+    {
+        delete pReplaySource;
+        SetStatusMessage(IDS_ERROR_REPLAY);
+        return hr;
+    }
+
+    // Streams have to be opened at the recorded resolutions
+    m_colorResolution = pReplaySource->GetColorResolution();
+    m_depthResolution = pReplaySource->GetDepthResolution();
+    m_frameHelper.SetColorFrameResolution(m_colorResolution);
+    m_frameHelper.SetDepthFrameResolution(m_depthResolution);
+
+    HMENU hMenu = GetMenu(m_hWndMain);
+    CheckMenuRadioItem(hMenu, COLOR_RESOLUTION_FIRST, COLOR_RESOLUTION_LAST,
+        m_colorResolution == NUI_IMAGE_RESOLUTION_1280x960 ? IDM_COLOR_RESOLUTION_1280x960 : IDM_COLOR_RESOLUTION_640x480, MF_BYCOMMAND);
+    CheckMenuRadioItem(hMenu, DEPTH_RESOLUTION_FIRST, DEPTH_RESOLUTION_LAST,
+        m_depthResolution == NUI_IMAGE_RESOLUTION_320x240 ? IDM_DEPTH_RESOLUTION_320x240 : IDM_DEPTH_RESOLUTION_640x480, MF_BYCOMMAND);
+
+    CreateColorImage();
+    CreateDepthImage();
+
+    // The helper owns the replay source from here on
+    m_hReplayFinishedEvent = pReplaySource->GetFinishedHandle();
+    hr = m_frameHelper.Initialize(pReplaySource);
+    if (FAILED(hr))
+    {
+        m_frameHelper.UnInitialize();
+        m_hReplayFinishedEvent = NULL;
+        SetStatusMessage(IDS_ERROR_REPLAY);
+        return hr;
+    }
+
+    SetStatusMessage(IDS_STATUS_REPLAYSUCCESS);
+    return S_OK;
+}
+
+/// <summary>
+/// Starts recording to the file given on the command line
+/// </summary>
+void CMainWindow::StartRecording()
+{
+    if (m_recordPath.empty())
+    {
+        return;
+    }
+
+    // Frames received after a resolution change are not recorded
+    if (FAILED(m_captureWriter.Open(m_recordPath.c_str(), m_colorResolution, m_depthResolution, !m_bIsRecordingRawDepth)))
+    {
+        SetStatusMessage(IDS_ERROR_RECORD);
+        return;
+    }
+
+    m_frameHelper.SetCaptureWriter(&m_captureWriter);
+}
+
 /// <summary>
 /// Initializes the color bitmap
 /// </summary>
@@ -874,7 +1636,7 @@ HRESULT CMainWindow::CreateColorImage()
     m_frameHelper.GetColorFrameSize(&width, &height);
 
     Size size(width, height);
-    m_colorMat.create(size, m_frameHelper.COLOR_TYPE);
+    m_frameInput.CreateColorImage();
 
     // Create the bitmap
     WaitForSingleObject(m_hColorBitmapMutex, INFINITE);
@@ -899,7 +1661,7 @@ HRESULT CMainWindow::CreateDepthImage()
     m_frameHelper.GetDepthFrameSize(&width, &height);
 
     Size size(width, height);
-    m_depthMat.create(size, m_frameHelper.DEPTH_RGB_TYPE);
+    m_frameInput.CreateDepthImages();
 
     // Create the bitmap
     WaitForSingleObject(m_hDepthBitmapMutex, INFINITE);
@@ -1126,6 +1888,15 @@ wstring CMainWindow::FilterIDToString(int filterID)
         text += _TEXT("Canny Edge");
         break;
 
+    case IDM_COLOR_FILTER_PYRAMID:
+    case IDM_DEPTH_FILTER_PYRAMID:
+        text += _TEXT("Pyramid Edge");
+        break;
+
+    case IDM_DEPTH_FILTER_BACKGROUND:
+        text += _TEXT("Background");
+        break;
+
     default:
         text += _TEXT("Unknown");
         break;
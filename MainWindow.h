@@ -12,6 +12,7 @@
 #include <CommCtrl.h>
 #include <string>
 #include <sstream>
+#include <vector>
 #include "time.h"
 #include "math.h"
 
@@ -19,7 +20,14 @@
 
 #include "Socket.h"
 #include "OpenCVHelper.h"
+#include "FrameInput.h"
 #include "FrameRateTracker.h"
+#include "ReplayFrameSource.h"
+#include "CaptureFile.h"
+#include "FrameSynchronizer.h"
+#include "SensorPipeline.h"
+#include "FrameWorker.h"
+#include "Benchmark.h"
 
 
 class CMainWindow
@@ -34,10 +42,10 @@ class CMainWindow
 
     // First and last menu item identifiers for filter radio buttons
     static const int COLOR_FILTER_FIRST = IDM_COLOR_FILTER_NOFILTER;
-    static const int COLOR_FILTER_LAST = IDM_COLOR_FILTER_CANNYEDGE;
+    static const int COLOR_FILTER_LAST = IDM_COLOR_FILTER_PYRAMID;
 
     static const int DEPTH_FILTER_FIRST = IDM_DEPTH_FILTER_NOFILTER;
-    static const int DEPTH_FILTER_LAST = IDM_DEPTH_FILTER_CANNYEDGE;
+    static const int DEPTH_FILTER_LAST = IDM_DEPTH_FILTER_BACKGROUND;
 
 	// Font size in points of the stream information
 	static const int STREAM_INFO_TEXT_POINT_SIZE = 10;
@@ -46,6 +54,15 @@ class CMainWindow
 	static const int BITMAP_VERTICAL_BORDER_PADDING = 10;
 	static const int MENU_BAR_HORIZONTAL_BORDER_PADDING = 5;
 
+    // Work resolution of the edge detection with /roi, a quarter of the rectified pixels
+    static const int DEFAULT_ROI_PIXELS_PER_CM = 5;
+
+    // Thousandths of the workspace that have to change for the edge detection to run again with /gate
+    static const int DEFAULT_GATE_PERMILLE = 5;
+
+    // Largest number of sensor pipelines, all are waited on at once
+    static const UINT MAX_INSTANCE_COUNT = MAXIMUM_WAIT_OBJECTS;
+
 public:
     // Functions:
     /// <summary>
@@ -66,6 +83,31 @@ public:
     /// <returns>WPARAM of final message as int</returns>
     int Run(HINSTANCE hInstance, int nCmdShow);
 
+    /// <summary>
+    /// Reads the command line switches:
+    /// /replay:file replays a recording instead of using a sensor,
+    /// /fast replays as fast as frames are processed instead of in real time,
+    /// /loop restarts the replay at the end of the recording,
+    /// /record:file records the received frames,
+    /// /rawdepth records depth frames without compressing them,
+    /// /headless processes frames without creating a window, until the replay ends,
+    /// /nosocket does not wait for a client on the command socket
+    /// /benchmark runs the processing micro-benchmarks and exits, with /replay:file the pyramid one runs on the recording,
+    /// /band:min-max sets the depth band in millimeters, up to 8191,
+    /// /sync[:ms] only processes color and depth frames captured within ms of each other,
+    /// /instances:N runs headless with N independent pipelines, one per sensor or each replaying the recording,
+    /// /roi[:px] runs the edge detection on the workspace only, at px pixels per cm of table,
+    /// /serial filters the color and then the depth frame on the processing thread instead of both at once,
+    /// /gate[:permille] skips the edge detection until permille thousandths of the workspace have changed,
+    /// /pause:detect|decimate|skip sets what the edge filters do while the tracker is paused after sending a target,
+    /// /threads:N runs the blur, Canny and closing of the edge filters in bands on N threads per stream,
+    /// /background:file loads the depth of the empty table the background filter learns at start and saves it at exit, followed by the index with several instances,
+    /// /calibration:file maps the targets to the arm's coordinates with the homography fitted to the pixel and table millimeter pairs of the file,
+    /// /workspace:file loads the trapezoid of the workspace found in an earlier run, finding it and saving it to the file if it cannot be loaded, followed by the index with several instances,
+    /// /calibrate finds the trapezoid of the workspace in the first frames, and the alignment of the depth image with a sensor
+    /// </summary>
+    void ParseCommandLine();
+
     /// <summary>
     /// Handles window messages, passes most to the class instance to handle
     /// </summary>
@@ -119,6 +161,69 @@ private:
     /// <returns>0</returns>
     DWORD WINAPI ProcessThread();
 
+    /// <summary>
+    /// Converts, filters and draws the current color frame
+    /// </summary>
+    /// <param name="pSkeletonFrame">skeleton frame to draw</param>
+    /// <param name="colorResolution">resolution of color image stream</param>
+    /// <param name="depthResolution">resolution of depth image stream</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT ProcessColorFrame(NUI_SKELETON_FRAME* pSkeletonFrame, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution);
+
+    /// <summary>
+    /// Converts the current depth frame into the depth job, for the depth worker or ProcessDepthFrame
+    /// </summary>
+    /// <param name="pSkeletonFrame">skeleton frame to draw, which has to outlive the job</param>
+    /// <param name="depthResolution">resolution of depth image stream</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT PrepareDepthFrame(NUI_SKELETON_FRAME* pSkeletonFrame, NUI_IMAGE_RESOLUTION depthResolution);
+
+    /// <summary>
+    /// Filters and draws the depth frame of the depth job, runs on the depth worker, calls class instance processor
+    /// </summary>
+    /// <param name="pContext">instance pointer</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    static HRESULT ProcessDepthJob(LPVOID pContext);
+
+    /// <summary>
+    /// Filters and draws the depth frame of the depth job
+    /// </summary>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT ProcessDepthFrame();
+
+    /// <summary>
+    /// Runs the processing thread without a window, until the replay ends or forever for a sensor
+    /// </summary>
+    /// <returns>0 if successful, 1 otherwise</returns>
+    int RunHeadless();
+
+    /// <summary>
+    /// Runs one pipeline per sensor or replay without a window, until the replays end or forever for sensors,
+    /// then reports the throughput of each
+    /// </summary>
+    /// <returns>0 if successful, 1 otherwise</returns>
+    int RunSensorPipelines();
+
+    /// <summary>
+    /// Creates and initializes the pipelines, one per connected sensor up to the instance count,
+    /// or the instance count of replays of the recording given on the command line
+    /// </summary>
+    /// <returns>S_OK if at least one pipeline was initialized, an error code otherwise</returns>
+    HRESULT CreateSensorPipelines();
+
+    /// <summary>
+    /// Gets the file of a pipeline for a per sensor file given on the command line, each sensor sees its own table
+    /// </summary>
+    /// <param name="path">path given on the command line</param>
+    /// <param name="index">index of the pipeline</param>
+    /// <returns>path followed by the index</returns>
+    static std::wstring GetInstancePath(const std::wstring& path, UINT index);
+
+    /// <summary>
+    /// Sends stdout to the console the application was started from, if any
+    /// </summary>
+    void AttachParentConsole();
+
     /// <summary>
     /// Creates the main and status bar windows
     /// </summary>
@@ -148,6 +253,17 @@ private:
     /// <returns>S_OK if successful, E_FAIL otherwise</returns>
     HRESULT CreateFirstConnected();
 
+    /// <summary>
+    /// Initializes the replay of the recording given on the command line
+    /// </summary>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT CreateReplay();
+
+    /// <summary>
+    /// Starts recording to the file given on the command line
+    /// </summary>
+    void StartRecording();
+
     /// <summary>
     /// Initializes the color bitmap and OpenCV matrix
     /// </summary>
@@ -252,6 +368,7 @@ private:
     // Helpers
     Microsoft::KinectBridge::OpenCVFrameHelper m_frameHelper;
     OpenCVHelper m_openCVHelper;
+    FrameInput m_frameInput;
 
     // App settings
     bool m_bIsColorPaused;
@@ -267,14 +384,67 @@ private:
     bool m_bIsSkeletonDrawColor;
     bool m_bIsSkeletonDrawDepth;
 
+    // Command line settings
+    std::wstring m_replayPath;
+    bool m_bIsReplayFast;
+    bool m_bIsReplayLoop;
+    std::wstring m_recordPath;
+    bool m_bIsRecordingRawDepth;
+    bool m_bIsHeadless;
+    bool m_bUseSocket;
+    bool m_bRunBenchmark;
+    USHORT m_depthBandMin;
+    USHORT m_depthBandMax;
+    bool m_bIsSyncingFrames;
+    UINT m_instanceCount;
+    int m_roiPixelsPerCm;
+    bool m_bIsSerial;
+    double m_sceneGateFraction;
+    OpenCVHelper::PausePolicy m_pausePolicy;
+    int m_edgeThreadCount;
+    std::wstring m_backgroundPath;
+    std::wstring m_calibrationPath;
+    std::wstring m_workspacePath;
+    bool m_bIsCalibrating;
+
+    // Pairs color and depth frames by capture time when syncing
+    Microsoft::KinectBridge::FrameSynchronizer m_frameSynchronizer;
+
+    // Independent pipelines when running several instances
+    std::vector<SensorPipeline*> m_sensorPipelines;
+
+    // Recording of the received frames
+    Microsoft::KinectBridge::CaptureWriter m_captureWriter;
+
+    // Signalled when the replay has been read to the end, owned by the replay source
+    HANDLE m_hReplayFinishedEvent;
+
+    // Number of frames processed, reported when running headless
+    volatile LONG m_colorFrameCount;
+    volatile LONG m_depthFrameCount;
+
+    // Performance counts from the frame events to both streams drawn, written by the processing thread
+    LONGLONG m_latencyTime;
+    LONGLONG m_maxLatencyTime;
+    LONG m_latencyCount;
+
+    // Depth frame handed from the processing thread to the depth worker
+    struct DepthJob
+    {
+        Mat image;
+        Mat depth;
+        NUI_SKELETON_FRAME* pSkeletonFrame;
+        NUI_IMAGE_RESOLUTION depthResolution;
+    };
+
+    // Filters the depth frames while the processing thread filters the color frames
+    FrameWorker m_depthWorker;
+    DepthJob m_depthJob;
+
 	// Frame rate tracking
 	FrameRateTracker m_colorFrameRateTracker;
 	FrameRateTracker m_depthFrameRateTracker;
 
-	// OpenCV matrices
-	Mat m_colorMat;
-	Mat m_depthMat;
-
     // Bitmaps
     BITMAPINFO m_bmiColor;
     void* m_pColorBitmapBits;
@@ -292,6 +462,9 @@ private:
     HANDLE m_hColorResolutionMutex;
     HANDLE m_hDepthResolutionMutex;
 
+    // Mutex that controls access to m_colorFilterID and m_depthFilterID
+    HANDLE m_hFilterMutex;
+
 	// Mutexes that control access to m_hColorBitmap and m_hDepthBitmap
 	HANDLE m_hColorBitmapMutex;
 	HANDLE m_hDepthBitmapMutex;
@@ -8,9 +8,45 @@
 
 using namespace Microsoft::KinectBridge;
 
+namespace
+{
+    /// <summary>
+    /// Allocator for Mat headers over pooled frame slots. Releasing the Mat releases
+    /// the slot reference instead of freeing the data.
+    /// </summary>
+    class FrameSlotMatAllocator : public MatAllocator
+    {
+    public:
+        UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, UMatUsageFlags usageFlags) const override
+        {
+            // Mats created from a wrapped Mat get ordinary memory
+            return Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+        }
+
+        bool allocate(UMatData* u, AccessFlag /*accessFlags*/, UMatUsageFlags /*usageFlags*/) const override
+        {
+            return u != NULL;
+        }
+
+        void deallocate(UMatData* u) const override
+        {
+            if (!u)
+            {
+                return;
+            }
+
+            FramePool::Release(static_cast<FrameSlot*>(u->userdata));
+            delete u;
+        }
+    };
+
+    FrameSlotMatAllocator g_frameSlotAllocator;
+}
+
 /// <summary>
 /// Converts from Kinect color frame data into a RGB OpenCV image matrix. 
-/// User must pre-allocate space for matrix.
+/// The matrix is pointed at the pooled frame data when the rows are packed,
+/// otherwise the user must pre-allocate space for matrix.
 /// </summary>
 /// <param name="pImage">pointer in which to return the OpenCV image matrix</param>
 /// <returns>S_OK if successful, an error code otherwise</returns>
@@ -25,34 +61,121 @@ HRESULT OpenCVFrameHelper::GetColorData(Mat* pImage) const
     DWORD colorHeight, colorWidth;
     NuiImageResolutionToSize(m_colorResolution, colorWidth, colorHeight);
 
-    // Copy image information into Mat
-    for (UINT y = 0; y < colorHeight; ++y)
+    // Share the slot with the Mat if the layout matches
+    if (m_pColorSlot && m_colorBufferPitch == static_cast<INT>(colorWidth * 4) && m_colorBufferSize >= m_colorBufferPitch * static_cast<INT>(colorHeight))
     {
-        // Get row pointer for color Mat
-        Vec4b* pColorRow = pImage->ptr<Vec4b>(y);
+        WrapSlot(m_pColorSlot, colorHeight, colorWidth, COLOR_TYPE, m_colorBufferPitch, pImage);
+        return S_OK;
+    }
 
-        for (UINT x = 0; x < colorWidth; ++x)
-        {
-            pColorRow[x] = Vec4b(m_pColorBuffer[y * m_colorBufferPitch + x * 4 + 0],
-                m_pColorBuffer[y * m_colorBufferPitch + x * 4 + 1],
-                m_pColorBuffer[y * m_colorBufferPitch + x * 4 + 2],
-                m_pColorBuffer[y * m_colorBufferPitch + x * 4 + 3]);
-        }
+    // Copy image information into Mat, row by row since the pitches differ
+    ColorConverter::Convert(m_pColorBuffer, m_colorBufferPitch, pImage->data, pImage->step, colorWidth, colorHeight, COLOR_FORMAT_BGRA);
+
+    return S_OK;
+}
+
+/// <summary>
+/// Converts the current color frame into the given format. The matrix is
+/// (re)allocated to the color resolution and a matching type.
+/// </summary>
+/// <param name="pImage">pointer in which to return the OpenCV image matrix</param>
+/// <param name="format">output format</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT OpenCVFrameHelper::GetColorImageAs(Mat* pImage, ColorFormat format) const
+{
+    // Fail if Kinect is not initialized
+    if (!IsInitialized())
+    {
+        return E_NUI_DEVICE_NOT_READY;
+    }
+
+    // Fail if pointer is invalid
+    if (!pImage)
+    {
+        return E_POINTER;
+    }
+
+    // Check if image is valid
+    if (m_colorBufferPitch == 0)
+    {
+        return E_NUI_FRAME_NO_DATA;
+    }
+
+    DWORD colorHeight, colorWidth;
+    NuiImageResolutionToSize(m_colorResolution, colorWidth, colorHeight);
+
+    pImage->create(colorHeight, colorWidth, GetColorFormatType(format));
+
+    // BGRA frames are shared with the pool when possible instead of copied
+    if (format == COLOR_FORMAT_BGRA)
+    {
+        return GetColorData(pImage);
+    }
+
+    ColorConverter::Convert(m_pColorBuffer, m_colorBufferPitch, pImage->data, pImage->step, colorWidth, colorHeight, format);
+
+    return S_OK;
+}
+
+/// <summary>
+/// Gets the mask of the pixels within the depth band, straight from the depth frame.
+/// The matrix is (re)allocated to the depth resolution and CV_8UC1.
+/// </summary>
+/// <param name="pImage">pointer in which to return the OpenCV mask matrix</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT OpenCVFrameHelper::GetDepthImageAsMask(Mat* pImage) const
+{
+    // Fail if Kinect is not initialized
+    if (!IsInitialized())
+    {
+        return E_NUI_DEVICE_NOT_READY;
+    }
+
+    // Fail if pointer is invalid
+    if (!pImage)
+    {
+        return E_POINTER;
     }
 
+    // Check if image is valid
+    if (m_depthBufferPitch == 0)
+    {
+        return E_NUI_FRAME_NO_DATA;
+    }
+
+    DWORD depthWidth, depthHeight;
+    NuiImageResolutionToSize(m_depthResolution, depthWidth, depthHeight);
+
+    USHORT minDepth, maxDepth;
+    GetDepthBand(&minDepth, &maxDepth);
+
+    pImage->create(depthHeight, depthWidth, DEPTH_MASK_TYPE);
+    DepthConverter::ToBandMask(m_pDepthBuffer, m_depthBufferPitch, pImage->data, pImage->step, depthWidth, depthHeight, minDepth, maxDepth);
+
     return S_OK;
 }
 
+/// <summary>
+/// Gets the Mat type for a color output format
+/// </summary>
+/// <param name="format">output format</param>
+/// <returns>CV_8UC4, CV_8UC3 or CV_8UC1</returns>
+int OpenCVFrameHelper::GetColorFormatType(ColorFormat format)
+{
+    return CV_8UC(ColorConverter::GetChannels(format));
+}
+
 /// <summary>
 /// Converts from Kinect depth frame data into a OpenCV matrix
-/// User must pre-allocate space for matrix.
+/// The matrix is pointed at the pooled frame data when the rows are packed,
+/// otherwise the user must pre-allocate space for matrix.
 /// </summary>
 /// <param name="pImage">pointer in which to return the OpenCV matrix</param>
 /// <returns>S_OK if successful, an error code otherwise</returns>
 HRESULT OpenCVFrameHelper::GetDepthData(Mat* pImage) const
 {
     // Check if image is valid
-    if (m_colorBufferPitch == 0)
+    if (m_depthBufferPitch == 0)
     {
         return E_NUI_FRAME_NO_DATA;
     }
@@ -60,6 +183,13 @@ HRESULT OpenCVFrameHelper::GetDepthData(Mat* pImage) const
     DWORD depthHeight, depthWidth;
     NuiImageResolutionToSize(m_depthResolution, depthWidth, depthHeight);
 
+    // Share the slot with the Mat if the layout matches
+    if (m_pDepthSlot && m_depthBufferPitch == static_cast<INT>(depthWidth * sizeof(USHORT)) && m_depthBufferSize >= m_depthBufferPitch * static_cast<INT>(depthHeight))
+    {
+        WrapSlot(m_pDepthSlot, depthHeight, depthWidth, DEPTH_TYPE, m_depthBufferPitch, pImage);
+        return S_OK;
+    }
+
     // Copy image information into Mat
     USHORT* pBufferRun = reinterpret_cast<USHORT*>(m_pDepthBuffer);
 
@@ -85,45 +215,24 @@ HRESULT OpenCVFrameHelper::GetDepthData(Mat* pImage) const
 /// <returns>S_OK if successful, an error code otherwise</returns>
 HRESULT OpenCVFrameHelper::GetDepthDataAsArgb(Mat* pImage) const
 {
+    // Check if image is valid
+    if (m_depthBufferPitch == 0)
+    {
+        return E_NUI_FRAME_NO_DATA;
+    }
+
     DWORD depthWidth, depthHeight;
     NuiImageResolutionToSize(m_depthResolution, depthWidth, depthHeight);
 
-    // Get the depth image
-    Mat depthImage;
-    depthImage.create(depthHeight, depthWidth, DEPTH_TYPE);
-    HRESULT hr = GetDepthData(&depthImage);
-    if (!SUCCEEDED(hr)) {
-        return hr;
-    }
-
-    for (UINT y = 0; y < depthHeight; ++y)
+    // Colorize through the table for the current band rather than per pixel
+    const UINT* pTable = GetDepthArgbTable();
+    if (!pTable)
     {
-        // Get row pointers for Mats
-        const USHORT* pDepthRow = depthImage.ptr<USHORT>(y);
-        Vec4b* pDepthRgbRow = pImage->ptr<Vec4b>(y);
-
-        for (UINT x = 0; x < depthWidth; ++x)
-        {
-            USHORT raw_depth = pDepthRow[x];
-
-            // If depth value is valid, convert and copy it
-            if (raw_depth != 65535)				// != -1, short
-            {
-                UINT8 redPixel, greenPixel, bluePixel;
-
-				// FIND ME
-				// DepthShortToRgb mira el player index, conjunto de bits que automagicamente indican el jugador
-
-                DepthShortToRgb(raw_depth, &redPixel, &greenPixel, &bluePixel);
-                pDepthRgbRow[x] = Vec4b(redPixel, greenPixel, bluePixel, 1);
-            }
-            else
-            {
-                pDepthRgbRow[x] = 0;
-            }
-        }
+        return E_OUTOFMEMORY;
     }
 
+    DepthConverter::ApplyTable(m_pDepthBuffer, m_depthBufferPitch, pImage->data, pImage->step, depthWidth, depthHeight, pTable);
+
     return S_OK;
 }
 
@@ -147,3 +256,28 @@ HRESULT OpenCVFrameHelper::VerifySize(const Mat* pImage, NUI_IMAGE_RESOLUTION re
     return S_OK;
 }
 
+/// <summary>
+/// Points the matrix at the slot data without copying. The matrix and its copies
+/// hold a reference to the slot, which goes back to its pool when the last one is released.
+/// </summary>
+/// <param name="pSlot">slot holding the frame data</param>
+/// <param name="rows">number of rows</param>
+/// <param name="cols">number of columns</param>
+/// <param name="type">Mat type of the data</param>
+/// <param name="step">bytes per row</param>
+/// <param name="pImage">pointer in which to return the OpenCV matrix</param>
+void OpenCVFrameHelper::WrapSlot(FrameSlot* pSlot, int rows, int cols, int type, size_t step, Mat* pImage)
+{
+    Mat wrapped(rows, cols, type, pSlot->pData, step);
+
+    // Hand the Mat its own slot reference, released through the allocator
+    FramePool::AddRef(pSlot);
+    UMatData* u = new UMatData(&g_frameSlotAllocator);
+    u->data = u->origdata = pSlot->pData;
+    u->size = step * rows;
+    u->userdata = pSlot;
+    u->refcount = 1;
+    wrapped.u = u;
+
+    *pImage = wrapped;
+}
@@ -6,6 +6,8 @@
 
 #pragma once
 #include "KinectHelper.h"
+#include "ColorConverter.h"
+#include "DepthConverter.h"
 
 // Suppress warnings that come from compiling OpenCV code since we have no control over it
 #pragma warning(push)
@@ -34,6 +36,31 @@ namespace Microsoft {
             static const int COLOR_TYPE = CV_8UC4;
             static const int DEPTH_TYPE = CV_16U;
             static const int DEPTH_RGB_TYPE = CV_8UC4;
+            static const int DEPTH_MASK_TYPE = CV_8UC1;
+
+            /// <summary>
+            /// Converts the current color frame into the given format. The matrix is
+            /// (re)allocated to the color resolution and a matching type.
+            /// </summary>
+            /// <param name="pImage">pointer in which to return the OpenCV image matrix</param>
+            /// <param name="format">output format</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT GetColorImageAs(Mat* pImage, ColorFormat format) const;
+
+            /// <summary>
+            /// Gets the mask of the pixels within the depth band, straight from the depth frame.
+            /// The matrix is (re)allocated to the depth resolution and CV_8UC1.
+            /// </summary>
+            /// <param name="pImage">pointer in which to return the OpenCV mask matrix</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT GetDepthImageAsMask(Mat* pImage) const;
+
+            /// <summary>
+            /// Gets the Mat type for a color output format
+            /// </summary>
+            /// <param name="format">output format</param>
+            /// <returns>CV_8UC4, CV_8UC3 or CV_8UC1</returns>
+            static int GetColorFormatType(ColorFormat format);
 
         protected:
             // Functions:
@@ -65,6 +92,18 @@ namespace Microsoft {
             /// <param name="resolution">resolution of image</param>
             /// <returns>S_OK if image matches given width and height, an error code otherwise</returns>
             HRESULT VerifySize(const Mat* pImage, NUI_IMAGE_RESOLUTION resolution) const override;
+
+            /// <summary>
+            /// Points the matrix at the slot data without copying. The matrix and its copies
+            /// hold a reference to the slot, which goes back to its pool when the last one is released.
+            /// </summary>
+            /// <param name="pSlot">slot holding the frame data</param>
+            /// <param name="rows">number of rows</param>
+            /// <param name="cols">number of columns</param>
+            /// <param name="type">Mat type of the data</param>
+            /// <param name="step">bytes per row</param>
+            /// <param name="pImage">pointer in which to return the OpenCV matrix</param>
+            static void WrapSlot(FrameSlot* pSlot, int rows, int cols, int type, size_t step, Mat* pImage);
         };
     }
 }
\ No newline at end of file
@@ -9,17 +9,17 @@
 
 #ifdef DEBUG
 #define DRAW_DEBUG_TRAPEZOID    Scalar gr = SKELETON_COLORS[1];\
-                                circle(*pImg, c1, 4, SKELETON_COLORS[0], 2);\
-                                circle(*pImg, c2, 4, SKELETON_COLORS[0], 2);\
-                                circle(*pImg, c3, 4, SKELETON_COLORS[0], 2);\
-                                circle(*pImg, c4, 4, SKELETON_COLORS[0], 2);\
-                                line(*pImg, c1, c2, gr, 1);\
-                                line(*pImg, c1, c3, gr, 1);\
-                                line(*pImg, c2, c4, gr, 1);\
-                                line(*pImg, c3, c4, gr, 1);
-#define DEBUG_TRAPEZOID_CALC    yCalc = (latestY - top) * 40 / difY;\
-                                leftLimit = leftTop + (yCalc * leftDif / 40);\
-                                rightLimit = rightTop + (yCalc * rightDif / 40);\
+                                circle(*pImg, m_corners[0], 4, SKELETON_COLORS[0], 2);\
+                                circle(*pImg, m_corners[1], 4, SKELETON_COLORS[0], 2);\
+                                circle(*pImg, m_corners[2], 4, SKELETON_COLORS[0], 2);\
+                                circle(*pImg, m_corners[3], 4, SKELETON_COLORS[0], 2);\
+                                line(*pImg, m_corners[0], m_corners[1], gr, 1);\
+                                line(*pImg, m_corners[0], m_corners[2], gr, 1);\
+                                line(*pImg, m_corners[1], m_corners[3], gr, 1);\
+                                line(*pImg, m_corners[2], m_corners[3], gr, 1);
+#define DEBUG_TRAPEZOID_CALC    yCalc = (latestY - m_corners[0].y) * 40 / (m_corners[2].y - m_corners[0].y);\
+                                leftLimit = m_corners[0].x + (yCalc * (m_corners[2].x - m_corners[0].x) / 40);\
+                                rightLimit = m_corners[1].x + (yCalc * (m_corners[3].x - m_corners[1].x) / 40);\
                                 xCalc = (latestX - leftLimit) * 60 / (rightLimit - leftLimit);
 #else
 #define DRAW_DEBUG_TRAPEZOID
@@ -34,70 +34,48 @@ using namespace std;
 const double minThreshold = 5.0;
 const double maxThreshold = 20.0;
 
-// Posiciones del trapecio de recorte
+// Posiciones del trapecio de recorte por defecto
 // Este trapecio es el rea a observar, se dibuja en la imagen a color
-int top = 138;
-int bottom = 340;
-int difY = bottom - top;
-
-int leftTop = 156;
-int leftBot = 163;
-int leftDif = leftBot - leftTop;        // negativo
-
-int rightTop = 468;
-int rightBot = 463;
-int rightDif = rightBot - rightTop;     // positivo
-
-// FIND ME: trapecio
-// Esquinas del trapecio
-Point c1 = Point(leftTop, top);
-Point c2 = Point(rightTop, top);
-Point c3 = Point(leftBot, bottom);
-Point c4 = Point(rightBot, bottom);
-
-// Esquinas con un pequeno desfase
+// Each helper starts from it until it loads or finds its own workspace
+const int top = 138;
+const int bottom = 340;
+
+const int leftTop = 156;
+const int leftBot = 163;
+
+const int rightTop = 468;
+const int rightBot = 463;
+
+// Desfase de las esquinas del trapecio
 // Desfase usado para que linea de color de la cartulina no sea incluida
 // Para usar imagen de color, en lugar de depth
-Point c11 = Point(leftTop + 3, top + 3);
-Point c22 = Point(rightTop - 3, top + 3);
-Point c33 = Point(leftBot + 3, bottom - 3);
-Point c44 = Point(rightBot - 3, bottom - 3);
+const int COLOR_INSET = 3;
 
 // FIND ME: warp
 // Warp para equivalencia entre color y depth
 // Imagen completa
-Point2f sourceC[4] = { Point2f(0, 0), Point2f(639, 0), Point(0, 479), Point(639, 479) };
+const Point2f sourceC[4] = { Point2f(0, 0), Point2f(639, 0), Point(0, 479), Point(639, 479) };
 // Imagen desfasada    
     // 80 %
     // + 12 y + 6 extra fin y
     // + 6 x + 8 extra fin x
-Point2f destinC[4] = { Point2f(38, 36), Point2f(621, 36), Point2f(38, 473), Point2f(621, 473) };
-Mat warp = getPerspectiveTransform(sourceC, destinC);
+const Point2f destinC[4] = { Point2f(38, 36), Point2f(621, 36), Point2f(38, 473), Point2f(621, 473) };
 
 // FIND ME: warp
 // Warp para convertir trapecio a rectangulo
-// Puntos del trapecio que se coloco arriba
-Point2f sourceRe[4] = { c1, c2, c3, c4 };
 // 20 px de margen al hacer el rectangulo
-Point2f destinRe[4] = { Point2f(20,20), Point2f(619, 20), Point2f(20, 459), Point2f(619, 459) };
-Mat warpRe = getPerspectiveTransform(sourceRe, destinRe);
+const Point2f destinRe[4] = { Point2f(20,20), Point2f(619, 20), Point2f(20, 459), Point2f(619, 459) };
 
 // FIND ME: warp
-// Warp para convertir trapecio a rectangulo
-// Puntos del trapecio cuando se usara imagen de color
-Point2f sourceReColor[4] = { c11, c22, c33, c44 };
-// 20 px de margen
-Point2f destinReColor[4] = { Point2f(0, 0), Point2f(639, 0), Point2f(0, 479), Point2f(639, 479) };
-Mat warpReColor = getPerspectiveTransform(sourceReColor, destinReColor);
+// Warp para convertir trapecio a rectangulo cuando se usara imagen de color
+const Point2f destinReColor[4] = { Point2f(0, 0), Point2f(639, 0), Point2f(0, 479), Point2f(639, 479) };
 
-// Cuantas veces fallo el lock target
-// Cuando aumenta demasiado, se cambia el target
-int noFue = 0;
-int siFue = 0;
-
-// Tiempo de referencia para saber si ya podemos seguir leyendo
-time_t refTime = time(0);
-bool paused = false;
+// Default mapping of the rectified image to the arm's coordinates on the table, in millimeters.
+// The rectangle of destinRe spans 60 x 40 cm, the arm's x runs down the image from 11 cm above
+// its top edge and its y runs left from 30 cm right of its left edge.
+Point2f pixelsTable[4] = { Point2f(20, 20), Point2f(620, 20), Point2f(20, 460), Point2f(620, 460) };
+Point2f armTable[4] = { Point2f(110, 300), Point2f(110, -300), Point2f(510, 300), Point2f(510, -300) };
+Mat tableHomography = getPerspectiveTransform(pixelsTable, armTable);
 
 const Scalar OpenCVHelper::SKELETON_COLORS[NUI_SKELETON_COUNT] =
 {
@@ -114,8 +92,30 @@ const Scalar OpenCVHelper::SKELETON_COLORS[NUI_SKELETON_COUNT] =
 /// </summary>
 OpenCVHelper::OpenCVHelper() :
     m_depthFilterID(IDM_DEPTH_FILTER_CANNYEDGE),
-    m_colorFilterID(-1)
+    m_colorFilterID(-1),
+    m_pausePolicy(PAUSE_SKIP)
 {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    m_pauseDuration = frequency.QuadPart * PAUSE_MILLISECONDS / 1000;
+    m_secondsPerCount = 1.0 / frequency.QuadPart;
+
+    m_pColorPipeline = GetPipeline(m_colorFilterID);
+    m_pDepthPipeline = GetPipeline(m_depthFilterID);
+    SetRoiResolution(0);
+    m_tableCalibration.SetHomography(tableHomography);
+
+    // The trapezoid set by hand, until the helper loads or finds its own
+    Workspace workspace;
+    workspace.corners[0] = Point2f(leftTop, top);
+    workspace.corners[1] = Point2f(rightTop, top);
+    workspace.corners[2] = Point2f(leftBot, bottom);
+    workspace.corners[3] = Point2f(rightBot, bottom);
+    for (int i = 0; i < 4; ++i)
+    {
+        workspace.alignment[i] = destinC[i];
+    }
+    SetWorkspace(workspace);
 }
 
 /// <summary>
@@ -125,6 +125,8 @@ OpenCVHelper::OpenCVHelper() :
 void OpenCVHelper::SetColorFilter(int filterID)
 {
     m_colorFilterID = filterID;
+    m_pColorPipeline = GetPipeline(filterID);
+    m_colorStream.gate.Reset();
 }
 
 /// <summary>
@@ -134,6 +136,160 @@ void OpenCVHelper::SetColorFilter(int filterID)
 void OpenCVHelper::SetDepthFilter(int filterID)
 {
     m_depthFilterID = filterID;
+    m_pDepthPipeline = GetPipeline(filterID);
+    m_depthStream.gate.Reset();
+}
+
+/// <summary>
+/// Sets what the edge filters do while the tracker is paused after sending a target
+/// </summary>
+/// <param name="policy">pause policy</param>
+void OpenCVHelper::SetPausePolicy(PausePolicy policy)
+{
+    m_pausePolicy = policy;
+}
+
+/// <summary>
+/// Returns whether the active depth filter works on the depth band mask instead of the ARGB depth image
+/// </summary>
+/// <returns>true if the filter takes the depth band mask, false otherwise</returns>
+bool OpenCVHelper::UsesDepthMask() const
+{
+    return m_depthFilterID == IDM_DEPTH_FILTER_CANNYEDGE || m_depthFilterID == IDM_DEPTH_FILTER_PYRAMID;
+}
+
+/// <summary>
+/// Fits the mapping of the rectified image to the arm's coordinates on the table to the pairs of a
+/// file, keeping the default mapping if the file does not fix one
+/// </summary>
+/// <param name="path">path of a text file with a pixel's x and y and the table's x and y in millimeters per line</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT OpenCVHelper::LoadTableCalibration(LPCWSTR path)
+{
+    return m_tableCalibration.Load(path);
+}
+
+/// <summary>
+/// Moves the trapezoid of the workspace and the alignment of the depth image to a workspace
+/// found by WorkspaceCalibrator. Only called while this helper is not filtering a frame.
+/// </summary>
+/// <param name="workspace">workspace to use</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the corners or the alignment do not form a convex quadrilateral</returns>
+HRESULT OpenCVHelper::SetWorkspace(const Workspace& workspace)
+{
+    // The outlines go around the quadrilaterals, which are stored as rows of two corners
+    Point2f outline[4] = { workspace.corners[0], workspace.corners[1], workspace.corners[3], workspace.corners[2] };
+    Point2f alignmentOutline[4] = { workspace.alignment[0], workspace.alignment[1], workspace.alignment[3], workspace.alignment[2] };
+    if (!isContourConvex(std::vector<Point2f>(outline, outline + 4)) || !isContourConvex(std::vector<Point2f>(alignmentOutline, alignmentOutline + 4)))
+    {
+        return E_INVALIDARG;
+    }
+
+    m_workspace = workspace;
+
+    // Esquinas del trapecio, y con un pequeno desfase hacia adentro para la imagen de color
+    const Point inset[4] = { Point(COLOR_INSET, COLOR_INSET), Point(-COLOR_INSET, COLOR_INSET), Point(COLOR_INSET, -COLOR_INSET), Point(-COLOR_INSET, -COLOR_INSET) };
+    Point2f colorCorners[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        m_corners[i] = workspace.corners[i];
+        m_colorCorners[i] = m_corners[i] + inset[i];
+        colorCorners[i] = m_colorCorners[i];
+    }
+
+    // The rectification keeps the corners to a fraction of a pixel, the color one stays inside the border
+    m_warp = getPerspectiveTransform(sourceC, workspace.alignment);
+    m_warpRe = getPerspectiveTransform(workspace.corners, destinRe);
+    m_warpReColor = getPerspectiveTransform(colorCorners, destinReColor);
+
+    UpdateWorkspace();
+    return S_OK;
+}
+
+/// <summary>
+/// Returns the workspace in use
+/// </summary>
+/// <returns>corners of the trapezoid and alignment of the depth image</returns>
+Workspace OpenCVHelper::GetWorkspace() const
+{
+    return m_workspace;
+}
+
+/// <summary>
+/// Adds a pair of frames to the workspace calibration, and moves the trapezoid to the workspace
+/// once it is found. The current alignment is kept if the sensor's calibration cannot be read.
+/// </summary>
+/// <param name="color">color frame</param>
+/// <param name="depth">raw depth frame captured with it</param>
+/// <param name="colorResolution">resolution of the color frames</param>
+/// <param name="depthResolution">resolution of the depth frames</param>
+/// <returns>S_OK once the workspace is found and used, S_FALSE while frames are still needed, E_FAIL if it was not found and the frames start over, an error code otherwise</returns>
+HRESULT OpenCVHelper::CalibrateWorkspace(const Mat& color, const Mat& depth, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution)
+{
+    Workspace workspace = m_workspace;
+    HRESULT hr = m_workspaceCalibrator.AddFrame(color, depth, colorResolution, depthResolution, &workspace);
+    if (hr != S_OK)
+    {
+        return hr;
+    }
+
+    // A quadrilateral that cannot be rectified counts as not found
+    return FAILED(SetWorkspace(workspace)) ? E_FAIL : S_OK;
+}
+
+/// <summary>
+/// Loads a workspace saved by WorkspaceCalibrator and moves the trapezoid to it
+/// </summary>
+/// <param name="path">path of the file</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT OpenCVHelper::LoadWorkspace(LPCWSTR path)
+{
+    Workspace workspace;
+    HRESULT hr = WorkspaceCalibrator::Load(path, &workspace);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    return SetWorkspace(workspace);
+}
+
+/// <summary>
+/// Returns whether the active depth filter works on the raw 16 bit depth frame
+/// </summary>
+/// <returns>true if the filter takes the raw depth, false otherwise</returns>
+bool OpenCVHelper::UsesRawDepth() const
+{
+    return m_depthFilterID == IDM_DEPTH_FILTER_BACKGROUND;
+}
+
+/// <summary>
+/// Returns whether the active depth filter samples the raw 16 bit depth frame besides its image
+/// </summary>
+/// <returns>true if the filter needs the raw depth passed to ApplyDepthFilter, false otherwise</returns>
+bool OpenCVHelper::UsesDepthSamples() const
+{
+    return m_depthFilterID == IDM_DEPTH_FILTER_GAUSSIANBLUR || UsesDepthMask() || UsesRawDepth();
+}
+
+/// <summary>
+/// Loads the background model of the depth stream saved with SaveDepthBackground, for a warm start
+/// </summary>
+/// <param name="path">path of the file</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT OpenCVHelper::LoadDepthBackground(LPCWSTR path)
+{
+    return m_depthStream.background.Load(path);
+}
+
+/// <summary>
+/// Saves the background model of the depth stream
+/// </summary>
+/// <param name="path">path of the file to create</param>
+/// <returns>S_OK if successful, S_FALSE if nothing has been learned to save, an error code otherwise</returns>
+HRESULT OpenCVHelper::SaveDepthBackground(LPCWSTR path) const
+{
+    return m_depthStream.background.Save(path);
 }
 
 /// <summary>
@@ -155,476 +311,1009 @@ HRESULT OpenCVHelper::ApplyColorFilter(Mat* pImg, Socket* out)
         return E_INVALIDARG;
     }
 
-    // Solucion sucia, obligar a entrar al caso de NOFILTER
-    //m_colorFilterID = IDM_COLOR_FILTER_NOFILTER;
+    return RunPipeline(m_pColorPipeline, &m_colorStream, pImg, Mat(), out);
+}
+
+/// <summary>
+/// Applies the depth image filter to the given Mat
+/// </summary>
+/// <param name="pImg">pointer to Mat to filter</param>
+/// <param name="depth">raw CV_16UC1 depth frame the image comes from, for the filters that sample the depth, may be empty</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT OpenCVHelper::ApplyDepthFilter(Mat* pImg, Socket* out, const Mat& depth /* = Mat() */)
+{
+    // Fail if pointer is invalid
+    if (!pImg) 
+    {
+        return E_POINTER;
+    }
+
+    // Fail if Mat contains no data
+    if (pImg->empty()) 
+    {
+        return E_INVALIDARG;
+    }
+
+    return RunPipeline(m_pDepthPipeline, &m_depthStream, pImg, depth, out);
+}
+
+/// <summary>
+/// Runs a filter pipeline on the given Mat
+/// </summary>
+/// <param name="pPipeline">pipeline to run</param>
+/// <param name="pStream">state of the stream the image belongs to</param>
+/// <param name="pImg">pointer to Mat to filter, pointed at the result if successful</param>
+/// <param name="depth">raw depth frame the image comes from, may be empty</param>
+/// <param name="out">socket to send the target to</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT OpenCVHelper::RunPipeline(const Pipeline* pPipeline, StreamState* pStream, Mat* pImg, const Mat& depth, Socket* out)
+{
+    StageFrame frame;
+    frame.image = *pImg;
+    frame.depth = depth;
+    frame.pScratch = &pStream->scratch;
+    frame.pHelper = this;
+    frame.pStream = pStream;
+    frame.pSocket = out;
+    frame.time = GetSeconds();
+    frame.level = 0;
+
+    HRESULT hr = pPipeline->Run(&frame);
+    if (SUCCEEDED(hr))
+    {
+        *pImg = frame.image;
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Draws the trapezoid of the workspace over the image
+/// </summary>
+struct OpenCVHelper::TrapezoidStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        // NOFILTER
+        // Dibujar trapecio
+        Mat* pImg = &pFrame->image;
+        Scalar bl = SKELETON_COLORS[0];         // Blue
+        Scalar gr = SKELETON_COLORS[1];     // Green
+
+        const Point* c = pFrame->pHelper->m_corners;
+        circle(*pImg, c[0], 4, bl, 2);
+        circle(*pImg, c[1], 4, bl, 2);
+        circle(*pImg, c[2], 4, bl, 2);
+        circle(*pImg, c[3], 4, bl, 2);
+
+        line(*pImg, c[0], c[1], gr, 1);
+        line(*pImg, c[0], c[2], gr, 1);
+        line(*pImg, c[1], c[3], gr, 1);
+        line(*pImg, c[2], c[3], gr, 1);
+
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Blurs the image in place with a 7x7 Gaussian
+/// </summary>
+struct OpenCVHelper::GaussianBlurStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        GaussianBlur(pFrame->image, pFrame->image, Size(7,7), 0);
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Dilates the image in place with a 3x3 square
+/// </summary>
+struct OpenCVHelper::DilateStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        dilate(pFrame->image, pFrame->image, Mat());
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Erodes the image in place with a 3x3 square
+/// </summary>
+struct OpenCVHelper::ErodeStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        erode(pFrame->image, pFrame->image, Mat());
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Rectifies the depth image and prints the distances at the corners and edges of the trapezoid,
+/// sampled from the raw depth frame
+/// </summary>
+struct OpenCVHelper::DepthProbeStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        // DEBUG SUMAMENTE SUCIO
+        // Se imprimen seis puntos y sus distancias en la orilla del trapecio
+
+        Mat& dst = pFrame->pScratch->Get(SCRATCH_WARPED, Size(640, 480), pFrame->image.type());
+        HRESULT hr = pFrame->pHelper->ApplyDepthWarp(pFrame->image, &dst, false);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        pFrame->image = dst;
+        Mat* pImg = &pFrame->image;
+
+        char buffer[20];
+        Scalar colorGreen = SKELETON_COLORS[1];
+
+        const Point* c = pFrame->pHelper->m_corners;
+        Point m1 = Point((c[0].x + c[1].x) / 2 + 10, (c[0].y + c[1].y) / 2);
+        Point m2 = Point((c[2].x + c[3].x) / 2 + 10, (c[2].y + c[3].y) / 2);
+
+        // Points sampled and where their labels go, the distance is 0 where it is unknown
+        const Point points[] = { c[0], Point(c[1].x - 10, c[1].y), Point(c[2].x + 10, c[2].y), c[3], m1, m2 };
+        const Point labels[] = { c[0], c[1], c[2], c[3], m1, m2 };
+        for (int i = 0; i < ARRAYSIZE(points); ++i)
+        {
+            float dis;
+            pFrame->pHelper->m_depthSampler.Sample(pFrame->depth, points[i], DepthSampler::SAMPLE_MEDIAN, &dis);
+            sprintf_s(buffer, "%c %d", 'A' + i, cvRound(dis));
+            putText(*pImg, buffer, labels[i], FONT_HERSHEY_COMPLEX_SMALL, 1.0, colorGreen, 2);
+        }
+
+        circle(*pImg, m1, 2, SKELETON_COLORS[2], 2);
+        circle(*pImg, m2, 2, SKELETON_COLORS[2], 2);
+
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Rectifies the trapezoid of the color image at the work resolution
+/// </summary>
+struct OpenCVHelper::ColorWarpStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        OpenCVHelper* pHelper = pFrame->pHelper;
+
+        // Hacer el warp
+        // De trapecio a rectangulo con margen de 20px, a la resolucion de trabajo
+        pHelper->ScaleToWork(pHelper->m_warpReColor, &pHelper->m_colorWorkWarp);
+        Mat& warped = pFrame->pScratch->Get(SCRATCH_WARPED, pHelper->m_workSize, pFrame->image.type());
+        HRESULT hr = pHelper->m_colorWarp.SetTransform(&pHelper->m_colorWorkWarp, 1, pFrame->image.size(), pHelper->m_workSize);
+        if (SUCCEEDED(hr))
+        {
+            hr = pHelper->m_colorWarp.Apply(pFrame->image, &warped);
+        }
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        pFrame->image = warped;
+        return S_OK;
+    }
+};
 
-    // Apply an effect based on the active filter
-    switch(m_colorFilterID)
+/// <summary>
+/// Aligns the depth band mask with the color image and rectifies the trapezoid at the work resolution
+/// </summary>
+struct OpenCVHelper::DepthWarpStage
+{
+    static HRESULT Run(StageFrame* pFrame)
     {
-    case IDM_COLOR_FILTER_NOFILTER:
+        Mat& rectified = pFrame->pScratch->Get(SCRATCH_RECTIFIED, pFrame->pHelper->m_workSize, pFrame->image.type());
+        HRESULT hr = pFrame->pHelper->ApplyDepthWarp(pFrame->image, &rectified, true);
+        if (FAILED(hr))
         {
-            // NOFILTER
-            // Dibujar trapecio
-            Scalar bl = SKELETON_COLORS[0];         // Blue
-            Scalar gr = SKELETON_COLORS[1];     // Green
-
-            circle(*pImg, c1, 4, bl, 2);
-            circle(*pImg, c2, 4, bl, 2);
-            circle(*pImg, c3, 4, bl, 2);
-            circle(*pImg, c4, 4, bl, 2);
-
-            line(*pImg, c1, c2, gr, 1);
-            line(*pImg, c1, c3, gr, 1);
-            line(*pImg, c2, c4, gr, 1);
-            line(*pImg, c3, c4, gr, 1);
+            return hr;
         }
-        break;
-    case IDM_COLOR_FILTER_GAUSSIANBLUR:
+
+        pFrame->image = rectified;
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Converts an ARGB depth image to gray, the depth band mask is gray already
+/// </summary>
+struct OpenCVHelper::DepthGrayStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        if (pFrame->image.channels() != 4)
         {
-            GaussianBlur(*pImg, *pImg, Size(7,7), 0);
+            return S_OK;
         }
-        break;
-    case IDM_COLOR_FILTER_DILATE:
+
+        return PointStage<SCRATCH_GRAY, RgbaToGrayOp>::Run(pFrame);
+    }
+};
+
+/// <summary>
+/// Segments the raw depth frame against the learned depth of the empty table, then learns the
+/// frame where nothing stands on the table. Nothing is learned during a pause, while the arm
+/// reaches over the table for the target just sent.
+/// </summary>
+struct OpenCVHelper::BackgroundStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        Microsoft::KinectBridge::DepthBackground& background = pFrame->pStream->background;
+        Mat& foreground = pFrame->pScratch->Get(SCRATCH_FOREGROUND, pFrame->image.size(), CV_8UC1);
+        HRESULT hr = background.Segment(pFrame->image, &foreground);
+        if (FAILED(hr))
         {
-            dilate(*pImg, *pImg, Mat());
+            return hr;
         }
-        break;
-    case IDM_COLOR_FILTER_ERODE:
+
+        if (!pFrame->pStream->paused)
         {
-            erode(*pImg, *pImg, Mat());
+            hr = background.Learn(pFrame->image, foreground);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
         }
-        break;
-    case IDM_COLOR_FILTER_CANNYEDGE:
+
+        pFrame->image = foreground;
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Thresholds the rectified foreground mask, whose warp blends the pixels along its outlines,
+/// into the edges buffer so it is labeled and drawn like the edges
+/// </summary>
+struct OpenCVHelper::BinarizeStage
+{
+    static HRESULT Run(StageFrame* pFrame)
     {
-        // Buffer para textos
-        char buffer[50];
+        Mat& mask = pFrame->pScratch->Get(SCRATCH_EDGES, pFrame->image.size(), CV_8UC1);
+        threshold(pFrame->image, mask, 127, 255, THRESH_BINARY);
 
-        // Hacer el warp
-        // De trapecio a rectangulo con margen de 20px
-        Mat dst;
-        warpPerspective(*pImg, dst, warpReColor, Size(640, 480));
-        *pImg = dst;
+        pFrame->image = mask;
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Goes down to the half resolution level of the pyramid, keeping the work resolution image for the refinement
+/// </summary>
+struct OpenCVHelper::PyramidDownStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        Mat& coarse = pFrame->pScratch->Get(SCRATCH_PYRAMID, pFrame->pHelper->m_coarseSize, CV_8UC1);
+        pyrDown(pFrame->image, coarse, coarse.size());
+
+        pFrame->fine = pFrame->image;
+        pFrame->image = coarse;
+        pFrame->level = 1;
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Runs the blur, Canny and closing in bands on the stream's edge chain threads, then skips the
+/// serial stages; lets them run when the chain is set to a single thread
+/// </summary>
+struct OpenCVHelper::TiledEdgesStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        TiledEdgeChain& edgeChain = pFrame->pStream->edgeChain;
+        if (edgeChain.GetThreadCount() <= 1)
+        {
+            return S_OK;
+        }
 
-        // Escala de gris para edge detection
-        cvtColor(*pImg, *pImg, CV_RGBA2GRAY);
+        TiledEdgeChain::Settings settings;
+        settings.blurSize = pFrame->pHelper->m_blurSizes[pFrame->level];
+        settings.edgeElement = pFrame->pHelper->m_edgeElements[pFrame->level];
+        settings.minThreshold = minThreshold;
+        settings.maxThreshold = maxThreshold;
+
+        Mat& closed = pFrame->pScratch->Get(SCRATCH_EDGES, pFrame->image.size(), CV_8UC1);
+        HRESULT hr = edgeChain.Run(pFrame->image, settings, &closed);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        pFrame->image = closed;
+        return S_FALSE;
+    }
+};
+
+/// <summary>
+/// Removes the noise before the edge detection, with a box blur of the kernel size of the image's pyramid level
+/// </summary>
+struct OpenCVHelper::BlurStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
         // Ruido
-        blur(*pImg, *pImg, Size(7, 7));
+        Mat& blurred = pFrame->pScratch->Get(SCRATCH_BLURRED, pFrame->image.size(), CV_8UC1);
+        blur(pFrame->image, blurred, pFrame->pHelper->m_blurSizes[pFrame->level]);
+
+        pFrame->image = blurred;
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Finds the edges of the gray image
+/// </summary>
+struct OpenCVHelper::CannyStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
         // Canny Edge Detection
-        Canny(*pImg, *pImg, minThreshold, maxThreshold);
+        Mat& edges = pFrame->pScratch->Get(SCRATCH_EDGES, pFrame->image.size(), CV_8UC1);
+        Canny(pFrame->image, edges, minThreshold, maxThreshold);
 
-        // Tamano para el dilate y erode
-        // En C++ es mas comodo construir la matriz y luego usarla
-        int erosion_size = 2;
-        Mat element = getStructuringElement(MORPH_ELLIPSE,
-            Size(2 * erosion_size + 1, 2 * erosion_size + 1),
-            Point(erosion_size, erosion_size));
+        pFrame->image = edges;
+        return S_OK;
+    }
+};
 
+/// <summary>
+/// Closes the gaps between the edges with a dilate followed by an erode
+/// </summary>
+struct OpenCVHelper::CloseStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
         // Dilate y erode son operaciones destructivas en OpenCV 2
         // Todo funciona bien en OpenCV 4
-        dilate(*pImg, *pImg, element);
-        erode(*pImg, *pImg, element);
+        const Size size = pFrame->image.size();
+        Mat& morph = pFrame->pScratch->Get(SCRATCH_MORPH, size, CV_8UC1);
+        Mat& closed = pFrame->pScratch->Get(SCRATCH_EDGES, size, CV_8UC1);
+        const Mat& element = pFrame->pHelper->m_edgeElements[pFrame->level];
+        dilate(pFrame->image, morph, element);
+        erode(morph, closed, element);
+
+        pFrame->image = closed;
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Lets the edge detection run unless the tracker is paused and the pause policy skips the frame,
+/// in which case the overlay of the last detection is shown instead
+/// </summary>
+template <int OutputBuffer>
+struct OpenCVHelper::PauseStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        OpenCVHelper* pHelper = pFrame->pHelper;
+        StreamState* pStream = pFrame->pStream;
+        if (!pStream->paused)
+        {
+            return S_OK;
+        }
+
+        // Pasaron mas de tres segundos
+        // Se puede aumentar el tiempo para tener mejor desempeno durante la ejecucion continua
+        // a cambio de un menor desempeno al iniciar
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        if (now.QuadPart >= pStream->resumeTime)
+        {
+            // Quito pausa
+            pStream->paused = false;
+
+            // Obligo a elegir nuevo target
+            pStream->tracker.Reset();
+            return S_OK;
+        }
+
+        // The first paused frame is always detected, it draws the overlay shown afterwards
+        bool isDetecting = pStream->pausedFrameCount == 0 || pHelper->m_pausePolicy == PAUSE_DETECT ||
+            (pHelper->m_pausePolicy == PAUSE_DECIMATE && pStream->pausedFrameCount % PAUSED_DETECTION_INTERVAL == 0);
+        ++pStream->pausedFrameCount;
+        if (isDetecting)
+        {
+            return S_OK;
+        }
+
+        // Copied so nothing drawn over the output afterwards builds up on the overlay
+        Mat& overlay = pFrame->pScratch->Get(SCRATCH_PAUSED_OVERLAY, Size(RECTIFIED_WIDTH, RECTIFIED_HEIGHT), CV_8UC4);
+        Mat& output = pFrame->pScratch->Get(OutputBuffer, overlay.size(), CV_8UC4);
+        overlay.copyTo(output);
+
+        pFrame->image = output;
+        return S_FALSE;
+    }
+};
+
+/// <summary>
+/// Lets the edge detection run only when the workspace has changed since the last frame it ran on
+/// </summary>
+struct OpenCVHelper::SceneGateStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        return pFrame->pStream->gate.HasChanged(pFrame->image) ? S_OK : S_FALSE;
+    }
+};
+
+/// <summary>
+/// Labels the regions of the edges and their holes, and traces the contours of those of a target's area
+/// </summary>
+struct OpenCVHelper::LabelStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        StreamState* pStream = pFrame->pStream;
 
-        // Hallar contornos
-        vector<vector<Point> > contours;
-        vector<Vec4i> hierarchy;
-        findContours(*pImg, contours, hierarchy, RETR_TREE, CHAIN_APPROX_SIMPLE);
+        // The area range is widened to whole pixels at the work resolution, the tracker applies the exact one
+        const double workArea = pFrame->pHelper->m_workScale * pFrame->pHelper->m_workScale;
+        HRESULT hr = pStream->labeler.Label(pFrame->image, cvFloor(MIN_TARGET_AREA * workArea),
+            cvCeil(MAX_TARGET_AREA * workArea));
+        if (FAILED(hr))
+        {
+            return hr;
+        }
 
-        // Es el primer contorno de este frame?
-        boolean first = true;
+        // Hallar contornos, solo de las regiones de tamano valido
+        pStream->components = pStream->labeler.GetComponents();
+        const size_t componentCount = pStream->components.size();
+        pStream->contours.resize(componentCount);
+        for (size_t i = 0; i < componentCount && SUCCEEDED(hr); ++i)
+        {
+            hr = pStream->labeler.GetContour(i, &pStream->contours[i]);
+        }
+
+        return hr;
+    }
+};
+
+/// <summary>
+/// Labels the regions of the edges and their holes on the half resolution level, keeping those
+/// that may be of a target's area once refined
+/// </summary>
+struct OpenCVHelper::CoarseLabelStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        // The outlines are thicker relative to the objects at half the resolution, so the
+        // area range is widened to half its low end and twice its high end
+        const double coarseScale = pFrame->pHelper->m_workScale * 0.5;
+        const double coarseArea = coarseScale * coarseScale;
+        return pFrame->pStream->labeler.Label(pFrame->image, cvFloor(MIN_TARGET_AREA * coarseArea * 0.5),
+            cvCeil(MAX_TARGET_AREA * coarseArea * 2.0));
+    }
+};
+
+/// <summary>
+/// Runs the edge detection at the work resolution around the components of the half resolution
+/// level only, for their exact areas, sub-pixel centroids and contours
+/// </summary>
+struct OpenCVHelper::RefineStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        OpenCVHelper* pHelper = pFrame->pHelper;
+        StreamState* pStream = pFrame->pStream;
+
+        const double workArea = pHelper->m_workScale * pHelper->m_workScale;
+        PyramidRefiner::Settings settings;
+        settings.blurSize = pHelper->m_blurSizes[0];
+        settings.edgeElement = pHelper->m_edgeElements[0];
+        settings.minThreshold = minThreshold;
+        settings.maxThreshold = maxThreshold;
+        settings.minArea = cvFloor(MIN_TARGET_AREA * workArea);
+        settings.maxArea = cvCeil(MAX_TARGET_AREA * workArea);
+
+        return pStream->refiner.Refine(pFrame->fine, pStream->labeler.GetComponents(), settings,
+            &pStream->components, &pStream->contours);
+    }
+};
+
+/// <summary>
+/// Draws the edges of the last detection, found on the given pyramid level, into a 640x480 output image
+/// </summary>
+template <int OutputBuffer, int Level>
+struct OpenCVHelper::DrawEdgesStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        // The edges stay in their buffer while the scene gate skips the detection
+        const Size edgesSize = Level == 0 ? pFrame->pHelper->m_workSize : pFrame->pHelper->m_coarseSize;
+        const Mat edges = pFrame->pScratch->Get(SCRATCH_EDGES, edgesSize, CV_8UC1);
+        const Size displaySize(RECTIFIED_WIDTH, RECTIFIED_HEIGHT);
 
         // Convertir imagen de regreso a color
-        cvtColor(*pImg, *pImg, CV_GRAY2RGBA);
-
-        Scalar color = SKELETON_COLORS[0];          // blue
-        Scalar colorGreen = SKELETON_COLORS[1];     // green
-        Scalar colorYellow = SKELETON_COLORS[2];    // yellow
-        Scalar colorPinpoint = color;               // color trae blue
-
-        // FIND ME: no hay contornos
-        // Limpiar todo cuando no hay contornos
-        // Por ejemplo, cuando recien esta iniciando
-        if (contours.size() == 0) {
-            firstObj = true;
-            noFue = 0;
-            siFue = 0;
+        Mat& output = pFrame->pScratch->Get(OutputBuffer, displaySize, CV_8UC4);
+        if (edges.size() == displaySize)
+        {
+            cvtColor(edges, output, CV_GRAY2RGBA);
+        }
+        else
+        {
+            Mat& displayEdges = pFrame->pScratch->Get(SCRATCH_DISPLAY_EDGES, displaySize, CV_8UC1);
+            resize(edges, displayEdges, displaySize, 0, 0, INTER_NEAREST);
+            cvtColor(displayEdges, output, CV_GRAY2RGBA);
         }
 
-        // Enviamos un mensaje por socket, entonces estamos en pausa
-        if (paused) {
-            // Dibujar todos los contornos
-            drawContours(*pImg, contours, -1, colorYellow, 1, LINE_8);
-            // Marcar el objeto target
-            circle(*pImg, Point(latestX, latestY), 5, colorGreen, 2);
-
-            // Pasaron mas de tres segundos
-            // Se puede aumentar el tiempo para tener mejor desempeno durante la ejecucion continua
-            // a cambio de un menor desempeno al iniciar
-            if (difftime(time(0), refTime) > 3.0) {
-                // Quito pausa
-                paused = false;
-
-                // Obligo a elegir nuevo target
-                firstObj = true;
-                noFue = 0;
-                siFue = 0;
-            }
+        pFrame->image = output;
+        return S_OK;
+    }
+};
+
+/// <summary>
+/// Tracks the targets among the components and sends one once it has been followed closely for LockFrames frames
+/// </summary>
+template <int LockFrames>
+struct OpenCVHelper::TrackStage
+{
+    static HRESULT Run(StageFrame* pFrame)
+    {
+        return pFrame->pHelper->TrackTarget(pFrame->pStream, &pFrame->image, pFrame->depth, LockFrames, pFrame->time, pFrame->pSocket);
+    }
+};
 
-            // No hay que analizar nada mas, solo gastar tiempo en lo que se quita la pausa
-            break;
+/// <summary>
+/// Gets the prebuilt pipeline of a filter
+/// </summary>
+/// <param name="filterID">resource ID of the filter</param>
+/// <returns>pipeline of the filter, an empty one for an unknown ID</returns>
+const OpenCVHelper::Pipeline* OpenCVHelper::GetPipeline(int filterID)
+{
+    // Shared by every helper, the pipelines keep no state of their own
+    static const FilterPipeline<StageFrame> noFilter;
+    static const FilterPipeline<StageFrame, TrapezoidStage> trapezoid;
+    static const FilterPipeline<StageFrame, GaussianBlurStage> gaussianBlur;
+    static const FilterPipeline<StageFrame, DilateStage> dilate;
+    static const FilterPipeline<StageFrame, ErodeStage> erode;
+    static const FilterPipeline<StageFrame, DepthProbeStage> depthProbe;
+
+    // Both edge pipelines share their stages, only the frames a target has to be followed for differ.
+    // The detection is skipped on a still scene, the tracker then runs on the last components.
+    // While the tracker is paused the pause policy may skip the whole frame. The blur, Canny
+    // and closing run in bands on several threads when the stream's edge chain is set to.
+    static const FilterPipeline<StageFrame,
+        ConditionalStage<PauseStage<SCRATCH_COLOR_OUTPUT>,
+            ConditionalStage<SceneGateStage, ColorWarpStage, PointStage<SCRATCH_GRAY, RgbaToGrayOp>,
+                ConditionalStage<TiledEdgesStage, BlurStage, CannyStage, CloseStage>, LabelStage>,
+            DrawEdgesStage<SCRATCH_COLOR_OUTPUT, 0>, TrackStage<4> > > colorCanny;
+    static const FilterPipeline<StageFrame,
+        ConditionalStage<PauseStage<SCRATCH_DEPTH_OUTPUT>,
+            ConditionalStage<SceneGateStage, DepthWarpStage, DepthGrayStage,
+                ConditionalStage<TiledEdgesStage, BlurStage, CannyStage, CloseStage>, LabelStage>,
+            DrawEdgesStage<SCRATCH_DEPTH_OUTPUT, 0>, TrackStage<3> > > depthCanny;
+
+    // The pyramid pipelines find the candidates on the half resolution level and refine only
+    // the windows around them at the work resolution, the tracker runs on the refined ones
+    static const FilterPipeline<StageFrame,
+        ConditionalStage<PauseStage<SCRATCH_COLOR_OUTPUT>,
+            ConditionalStage<SceneGateStage, ColorWarpStage, PointStage<SCRATCH_GRAY, RgbaToGrayOp>, PyramidDownStage,
+                ConditionalStage<TiledEdgesStage, BlurStage, CannyStage, CloseStage>, CoarseLabelStage, RefineStage>,
+            DrawEdgesStage<SCRATCH_COLOR_OUTPUT, 1>, TrackStage<4> > > colorPyramid;
+    static const FilterPipeline<StageFrame,
+        ConditionalStage<PauseStage<SCRATCH_DEPTH_OUTPUT>,
+            ConditionalStage<SceneGateStage, DepthWarpStage, DepthGrayStage, PyramidDownStage,
+                ConditionalStage<TiledEdgesStage, BlurStage, CannyStage, CloseStage>, CoarseLabelStage, RefineStage>,
+            DrawEdgesStage<SCRATCH_DEPTH_OUTPUT, 1>, TrackStage<3> > > depthPyramid;
+
+    // The background pipeline finds what stands on the table against the learned depth of the
+    // empty table instead of by its edges, the foreground is labeled straight away
+    static const FilterPipeline<StageFrame,
+        ConditionalStage<PauseStage<SCRATCH_DEPTH_OUTPUT>,
+            BackgroundStage,
+            ConditionalStage<SceneGateStage, DepthWarpStage, BinarizeStage, LabelStage>,
+            DrawEdgesStage<SCRATCH_DEPTH_OUTPUT, 0>, TrackStage<3> > > depthBackground;
+
+    static const struct
+    {
+        int filterID;
+        const Pipeline* pPipeline;
+    } pipelines[] =
+    {
+        { IDM_COLOR_FILTER_NOFILTER, &trapezoid },
+        { IDM_COLOR_FILTER_GAUSSIANBLUR, &gaussianBlur },
+        { IDM_COLOR_FILTER_DILATE, &dilate },
+        { IDM_COLOR_FILTER_ERODE, &erode },
+        { IDM_COLOR_FILTER_CANNYEDGE, &colorCanny },
+        { IDM_COLOR_FILTER_PYRAMID, &colorPyramid },
+        { IDM_DEPTH_FILTER_NOFILTER, &noFilter },
+        { IDM_DEPTH_FILTER_GAUSSIANBLUR, &depthProbe },
+        { IDM_DEPTH_FILTER_DILATE, &dilate },
+        { IDM_DEPTH_FILTER_ERODE, &erode },
+        { IDM_DEPTH_FILTER_CANNYEDGE, &depthCanny },
+        { IDM_DEPTH_FILTER_PYRAMID, &depthPyramid },
+        { IDM_DEPTH_FILTER_BACKGROUND, &depthBackground }
+    };
+
+    for (int i = 0; i < ARRAYSIZE(pipelines); ++i)
+    {
+        if (pipelines[i].filterID == filterID)
+        {
+            return pipelines[i].pPipeline;
         }
+    }
+
+    return &noFilter;
+}
 
-        for (size_t i = 0; i < contours.size(); i++)
+/// <summary>
+/// Points the depth sampler and the scene change gates at the current trapezoid
+/// </summary>
+void OpenCVHelper::UpdateWorkspace()
+{
+    // The depth is sampled under positions of the rectified workspace, as the depth warp maps it
+    m_depthSampler.SetTransform(m_warpRe * m_warp, Size(RECTIFIED_WIDTH, RECTIFIED_HEIGHT));
+
+    // The gates watch the trapezoid of the workspace, mapped back into the depth image for the depth stream
+    m_colorStream.gate.SetRegion(boundingRect(std::vector<Point>(m_colorCorners, m_colorCorners + 4)));
+
+    std::vector<Point2f> depthCorners;
+    perspectiveTransform(std::vector<Point2f>(m_workspace.corners, m_workspace.corners + 4), depthCorners, m_warp.inv());
+    m_depthStream.gate.SetRegion(boundingRect(depthCorners));
+}
+
+/// <summary>
+/// Sets the resolution the edge detection runs at. The rectified workspace is 640x480, about
+/// 10 pixels per cm of table; a coarser resolution warps the workspace straight into a smaller
+/// work buffer and scales the detection back for display.
+/// </summary>
+/// <param name="pixelsPerCm">pixels per cm of table, 0 for the full rectified resolution</param>
+void OpenCVHelper::SetRoiResolution(int pixelsPerCm)
+{
+    if (pixelsPerCm <= 0 || pixelsPerCm >= RECTIFIED_PIXELS_PER_CM)
+    {
+        m_workScale = 1.0;
+    }
+    else
+    {
+        m_workScale = static_cast<double>(pixelsPerCm < MIN_ROI_PIXELS_PER_CM ? MIN_ROI_PIXELS_PER_CM : pixelsPerCm) / RECTIFIED_PIXELS_PER_CM;
+    }
+    m_workSize = Size(cvRound(RECTIFIED_WIDTH * m_workScale), cvRound(RECTIFIED_HEIGHT * m_workScale));
+    m_coarseSize = Size((m_workSize.width + 1) / 2, (m_workSize.height + 1) / 2);
+
+    // The kernels keep their size on the table at every pyramid level
+    for (int level = 0; level < PYRAMID_LEVEL_COUNT; ++level)
+    {
+        const double scale = m_workScale / (1 << level);
+
+        int blurSize = cvRound(7 * scale) | 1;
+        m_blurSizes[level] = blurSize < 3 ? Size(3, 3) : Size(blurSize, blurSize);
+
+        // Tamano para el dilate y erode
+        // En C++ es mas comodo construir la matriz y luego usarla
+        int erosion_size = cvRound(2 * scale);
+        if (erosion_size < 1)
         {
-            int area = contourArea(contours[i]);
-
-            if (area > 200 && area < 700) {
-                // El contorno tiene tamano suficiente
-
-                // Contorno ajustado
-                // Visualizar cuales si se estan considerando de tamano valido
-                drawContours(*pImg, contours, (int)i, colorYellow, 1, LINE_8);
-
-                // Elipse minimo
-                if (first) {
-                    ellipse(*pImg, fitEllipse(contours[i]), color, 1);
-
-                    // Calcular los momentos, es decir los ejes
-                    Moments m = moments(contours[i]);
-                    int cx = m.m10 / m.m00;
-                    int cy = m.m01 / m.m00;
-
-                    // Si es el primer objeto detectado fijarlo como target
-                    if (firstObj) {
-                        latestX = cx;
-                        latestY = cy;
-                        firstObj = false;
-                    }
-                    else {
-                        // Si no es el primero, ver si esta cerca
-                        // Determinar que es el mismo
-                        if (abs(cx - latestX) < 12 && abs(cy - latestY) < 12) {
-                            colorPinpoint = colorGreen;     // antes era azul
-
-                            // Se tiene certeza de que se esta viendo el mismo objeto
-                            // es decir, no fue ruido accidental
-                            // Aumentar para tener mayor certeza, a cambio de un lock ms lento
-                            if (siFue++ > 5) {
-                                
-                                // FIND ME: coordenadas
-                                int yCalc, xCalc;
-
-                                // 20, 20 tamano del margen
-                                // 40, 60 cantidad de centimetros
-                                // 440, 600 cantidad de pixeles
-                                yCalc = (latestY - 20) * 40 / 440;
-                                xCalc = (latestX - 20) * 60 / 600;
-                            
-                                // Compensar posicion del brazo fuera del rectangulo
-                                int yyyy = (xCalc - 30) * -10;
-                                int xxxx = (yCalc + 11) * 10;
-
-                                // Enviar dato por socket
-                                sprintf(buffer, "x %d y %d z 30", xxxx, yyyy);
-                                out->setMessage(buffer);
-                                out->sendMessage();
-
-                                // Pausa para evitar enviar demasiados mensajes
-                                refTime = time(0);
-                                paused = true;
-                            }
-                        }
-                        else {
-                            colorPinpoint = colorYellow;    // antes era azul
-
-                            // Si se ha fallado muchas veces, limpiar todo para fijar nuevo target
-                            if (noFue++ > 20) {
-                                firstObj = true;
-                                noFue = 0;
-                                siFue = 0;
-                            }
-                        }
-                        // Elipse azul rodeandolo
-                        ellipse(*pImg, fitEllipse(contours[i]), color, 2);
-                    }
-
-                    // Dibujar en verde el punto fijado
-                    circle(*pImg, Point(latestX, latestY), 10, colorGreen, 2);
-                    // Dibujar en verde el punto actual si es el mismo
-                    // Si es otro dibujarlo en amarillo
-                    circle(*pImg, Point(cx, cy), 10, colorPinpoint, 2);
-
-                    first = false;
-                    continue;
-                }
-            } // end if - areas de tamano mediano
-        } // end for - contornos de la imagen
-    } // end case - canny edge
-        break;
+            erosion_size = 1;
+        }
+        m_edgeElements[level] = getStructuringElement(MORPH_ELLIPSE,
+            Size(2 * erosion_size + 1, 2 * erosion_size + 1),
+            Point(erosion_size, erosion_size));
     }
 
-    return S_OK;
+    // The cached edges are at the previous resolution
+    m_colorStream.gate.Reset();
+    m_depthStream.gate.Reset();
 }
 
 /// <summary>
-/// Applies the depth image filter to the given Mat
+/// Sets how much of the workspace has to change for the edge detection to run again. Frames
+/// below the threshold reuse the edges and contours of the last frame the detection ran on.
 /// </summary>
-/// <param name="pImg">pointer to Mat to filter</param>
+/// <param name="changedFraction">fraction of the workspace from 0 to 1, 0 or less to run the detection on every frame</param>
+void OpenCVHelper::SetSceneGate(double changedFraction)
+{
+    m_colorStream.gate.SetThreshold(changedFraction);
+    m_depthStream.gate.SetThreshold(changedFraction);
+}
+
+/// <summary>
+/// Sets the number of threads the blur, Canny and closing of the edge filters run on, in
+/// horizontal bands of the image, for each stream
+/// </summary>
+/// <param name="threadCount">number of threads, 1 to run the filters one after the other on the whole image</param>
+/// <returns>S_OK if successful, an error code if a thread could not be started</returns>
+HRESULT OpenCVHelper::SetEdgeThreads(int threadCount)
+{
+    HRESULT hr = m_colorStream.edgeChain.SetThreadCount(threadCount);
+    if (SUCCEEDED(hr))
+    {
+        hr = m_depthStream.edgeChain.SetThreadCount(threadCount);
+    }
+    return hr;
+}
+
+/// <summary>
+/// Aligns a depth image with the color image and rectifies the trapezoid, composing
+/// warp and warpRe into one pass
+/// </summary>
+/// <param name="src">depth image</param>
+/// <param name="pDst">pointer to the destination</param>
+/// <param name="atWorkResolution">true to rectify at the work resolution, false at 640x480</param>
 /// <returns>S_OK if successful, an error code otherwise</returns>
-HRESULT OpenCVHelper::ApplyDepthFilter(Mat* pImg, Socket* out)
+HRESULT OpenCVHelper::ApplyDepthWarp(const Mat& src, Mat* pDst, bool atWorkResolution)
 {
-    // Fail if pointer is invalid
-    if (!pImg) 
+    // Only the rectification is scaled, the alignment stays at 640x480
+    Mat chain[] = { m_warp, m_warpRe };
+    Size dstSize(RECTIFIED_WIDTH, RECTIFIED_HEIGHT);
+    if (atWorkResolution)
     {
-        return E_POINTER;
+        ScaleToWork(m_warpRe, &m_depthWorkWarp);
+        chain[1] = m_depthWorkWarp;
+        dstSize = m_workSize;
     }
 
-    // Fail if Mat contains no data
-    if (pImg->empty()) 
+    // Only rebuilds the remap tables when the calibration or the resolution changes
+    HRESULT hr = m_depthWarp.SetTransform(chain, ARRAYSIZE(chain), src.size(), dstSize, Size(RECTIFIED_WIDTH, RECTIFIED_HEIGHT));
+    if (FAILED(hr))
     {
-        return E_INVALIDARG;
+        return hr;
     }
 
-    // Apply an effect based on the active filter
-    switch(m_depthFilterID)
+    return m_depthWarp.Apply(src, pDst);
+}
+
+/// <summary>
+/// Aligns a depth band mask with the color image and rectifies the workspace at 640x480,
+/// as the depth edge filters see it
+/// </summary>
+/// <param name="src">depth band mask</param>
+/// <param name="pDst">pointer to the destination</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT OpenCVHelper::RectifyDepth(const Mat& src, Mat* pDst)
+{
+    if (!pDst)
     {
-    case IDM_DEPTH_FILTER_GAUSSIANBLUR:
-        {
-            // DEBUG SUMAMENTE SUCIO
-            // Se trae la informacion de color en el canal verde
-            // Se imprimen seis puntos y sus distancias en la orilla del trapecio
+        return E_POINTER;
+    }
 
-            Mat dst;
-            warpPerspective(*pImg, dst, warp, Size(640, 480));
-            warpPerspective(dst, *pImg, warpRe, Size(640, 480));
+    pDst->create(Size(RECTIFIED_WIDTH, RECTIFIED_HEIGHT), src.type());
+    return ApplyDepthWarp(src, pDst, false);
+}
 
-            Mat clonada = (*pImg).clone();
+/// <summary>
+/// Scales a homography onto the rectified workspace down to the work resolution
+/// </summary>
+/// <param name="homography">homography onto the 640x480 rectified workspace</param>
+/// <param name="pScaled">pointer in which to return the scaled homography, reused between frames</param>
+void OpenCVHelper::ScaleToWork(const Mat& homography, Mat* pScaled) const
+{
+    homography.copyTo(*pScaled);
 
-            char buffer[20];
-            Scalar colorGreen = SKELETON_COLORS[1];
+    Mat rows = pScaled->rowRange(0, 2);
+    rows.convertTo(rows, -1, m_workScale);
+}
 
-            int dis;
+/// <summary>
+/// Tracks the targets among the components of the edge detection, sends the one followed
+/// most closely once it is confirmed and draws the result into the 640x480 output image
+/// </summary>
+/// <param name="pStream">state of the stream, with the components and the tracked targets</param>
+/// <param name="pImg">pointer to the output image to draw in</param>
+/// <param name="depth">raw depth frame to read the target's distance from, may be empty</param>
+/// <param name="lockFrames">fewest frames a target has to be seen in before it is sent</param>
+/// <param name="frameTime">time the frame was received at, in seconds</param>
+/// <param name="out">socket to send the target to</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT OpenCVHelper::TrackTarget(StreamState* pStream, Mat* pImg, const Mat& depth, int lockFrames, double frameTime, Socket* out)
+{
+    // Buffer para textos
+    char buffer[50];
+
+    // Positions found at the work resolution are tracked and drawn at the rectified one
+    const vector<Component>& components = pStream->components;
+    const double toDisplay = 1.0 / m_workScale;
+
+    Scalar color = SKELETON_COLORS[0];          // blue
+    Scalar colorGreen = SKELETON_COLORS[1];     // green
+    Scalar colorYellow = SKELETON_COLORS[2];    // yellow
+
+    // FIND ME: no hay contornos
+    // Limpiar todo cuando no hay contornos
+    // Por ejemplo, cuando recien esta iniciando
+    if (pStream->labeler.GetSetComponentCount() == 0) {
+        pStream->tracker.Reset();
+    }
 
-            dis = clonada.at<Vec4b>(c1)[1];
-            sprintf_s(buffer, "A %d", dis);
-            putText(*pImg, buffer, c1, FONT_HERSHEY_COMPLEX_SMALL, 1.0, colorGreen, 2);
+    // Enviamos un mensaje por socket, entonces estamos en pausa
+    if (pStream->paused) {
+        // Dibujar todos los contornos
+        DrawWorkContours(pStream, pImg, -1, colorYellow);
+        // Marcar el objeto target
+        Point latest(pStream->latestX, pStream->latestY);
+        circle(*pImg, latest, 5, colorGreen, 2);
+        if (pStream->latestDepth > 0.0f)
+        {
+            sprintf(buffer, "%d mm", cvRound(pStream->latestDepth));
+            putText(*pImg, buffer, latest + Point(8, 16), FONT_HERSHEY_SIMPLEX, 0.4, colorGreen, 1);
+        }
 
-            dis = clonada.at<Vec4b>(Point(rightTop - 10, top))[1];
-            sprintf_s(buffer, "B %d", dis);
-            putText(*pImg, buffer, c2, FONT_HERSHEY_COMPLEX_SMALL, 1.0, colorGreen, 2);
+        // Shown on the paused frames the pause policy skips, the pause stage ends the pause
+        if (m_pausePolicy != PAUSE_DETECT)
+        {
+            pImg->copyTo(pStream->scratch.Get(SCRATCH_PAUSED_OVERLAY, pImg->size(), pImg->type()));
+        }
 
-            dis = clonada.at<Vec4b>(Point(leftBot + 10, bottom))[1];
-            sprintf_s(buffer, "C %d", dis);
-            putText(*pImg, buffer, c3, FONT_HERSHEY_COMPLEX_SMALL, 1.0, colorGreen, 2);
+        // No hay que analizar nada mas, solo gastar tiempo en lo que se quita la pausa
+        return S_OK;
+    }
 
-            dis = clonada.at<Vec4b>(c4)[1];
-            sprintf_s(buffer, "D %d", dis);
-            putText(*pImg, buffer, c4, FONT_HERSHEY_COMPLEX_SMALL, 1.0, colorGreen, 2);
+    // Every component of a target's size is a candidate
+    pStream->candidates.clear();
+    pStream->candidateComponents.clear();
+    for (size_t i = 0; i < components.size(); i++)
+    {
+        // Area at the rectified resolution, which the limits are for
+        int area = static_cast<int>(components[i].area * toDisplay * toDisplay);
 
-            Point m1 = Point((leftTop + rightTop)/2 + 10, top);
-            dis = clonada.at<Vec4b>(m1)[1];
-            sprintf_s(buffer, "E %d", dis);
-            putText(*pImg, buffer, m1, FONT_HERSHEY_COMPLEX_SMALL, 1.0, colorGreen, 2);
+        if (area > MIN_TARGET_AREA && area < MAX_TARGET_AREA) {
+            // El contorno tiene tamano suficiente
 
-            Point m2 = Point((leftBot + rightBot) / 2 + 10, bottom);
-            dis = clonada.at<Vec4b>(m2)[1];
-            sprintf_s(buffer, "F %d", dis);
-            putText(*pImg, buffer, m2, FONT_HERSHEY_COMPLEX_SMALL, 1.0, colorGreen, 2);
+            // Contorno ajustado
+            // Visualizar cuales si se estan considerando de tamano valido
+            DrawWorkContours(pStream, pImg, (int)i, colorYellow);
 
-            circle(*pImg, m1, 2, SKELETON_COLORS[2], 2);
-            circle(*pImg, m2, 2, SKELETON_COLORS[2], 2);
+            pStream->candidates.push_back(Point2f(static_cast<float>(components[i].centroid.x * toDisplay),
+                static_cast<float>(components[i].centroid.y * toDisplay)));
+            pStream->candidateComponents.push_back(static_cast<int>(i));
         }
-        break;
-    case IDM_DEPTH_FILTER_DILATE:
+    }
+
+    // Where every candidate is on the table, at once
+    pStream->tableCandidates.resize(pStream->candidates.size());
+    if (!pStream->candidates.empty())
+    {
+        m_tableCalibration.Transform(&pStream->candidates[0], &pStream->tableCandidates[0], pStream->candidates.size());
+    }
+
+    // Un candidato es el mismo objeto si esta a menos de 12 px
+    TargetTracker& tracker = pStream->tracker;
+    tracker.Update(pStream->candidates, static_cast<float>(TARGET_GATE), frameTime);
+
+    for (size_t t = 0; t < tracker.GetTrackCount(); ++t)
+    {
+        int candidate = tracker.GetCandidate(t);
+        if (candidate < 0)
         {
-            dilate(*pImg, *pImg, Mat());
+            continue;
         }
-        break;
-    case IDM_DEPTH_FILTER_ERODE:
+
+        // Elipse azul rodeandolo, mas gruesa si ya se habia visto
+        const Component& component = components[pStream->candidateComponents[candidate]];
+        RotatedRect box = ComponentLabeler::GetEllipse(component);
+        box.center *= toDisplay;
+        box.size.width *= static_cast<float>(toDisplay);
+        box.size.height *= static_cast<float>(toDisplay);
+        bool isConfirming = tracker.GetHitCount(t) > 1;
+        ellipse(*pImg, box, color, isConfirming ? 2 : 1);
+
+        // En verde los que se han visto en varios frames, en amarillo los nuevos
+        Point position = tracker.GetPosition(t);
+        circle(*pImg, position, 10, isConfirming ? colorGreen : colorYellow, 2);
+        const Point2f& onTable = pStream->tableCandidates[candidate];
+        sprintf(buffer, "%d (%d, %d)", tracker.GetId(t), cvRound(onTable.x), cvRound(onTable.y));
+        putText(*pImg, buffer, position + Point(12, -12), FONT_HERSHEY_SIMPLEX, 0.4, colorGreen, 1);
+    }
+
+    // Se tiene certeza de que se esta viendo el mismo objeto
+    // es decir, no fue ruido accidental: sus posiciones siguen lo que predice el filtro
+    int target = tracker.FindConfirmed(lockFrames, static_cast<float>(MAX_LOCK_INNOVATION));
+    if (target >= 0) {
+        // Where the target is by the time the command is sent, not when the frame was received
+        Point2f predicted = tracker.PredictPosition(target, GetSeconds());
+        Point position = predicted;
+        pStream->latestX = position.x;
+        pStream->latestY = position.y;
+
+        // FIND ME: coordenadas
+        // Position on the table in millimeters, from the sub-pixel prediction
+        Point2f onTable = m_tableCalibration.Transform(predicted);
+
+        // Distance to the target from the raw depth, robust to the edges of the target around it
+        pStream->latestDepth = 0.0f;
+        if (!depth.empty())
         {
-            erode(*pImg, *pImg, Mat());
+            m_depthSampler.Sample(depth, predicted, DepthSampler::SAMPLE_MEDIAN, &pStream->latestDepth);
         }
-        break;
-    case IDM_DEPTH_FILTER_CANNYEDGE:
-        {
-            // Buffer para textos
-			char buffer[50];
-
-            Mat dst;
-            warpPerspective(*pImg, dst, warp, Size(640, 480));
-            warpPerspective(dst, *pImg, warpRe, Size(640, 480));
-
-            // Clon para poder obtener las distancias
-            // El canal green trae la distancia
-            // Sucio pero funcional
-            Mat clonada = (*pImg).clone();
-
-            // Escala de gris para edge detection
-            cvtColor(*pImg, *pImg, CV_RGBA2GRAY);
-            // Ruido
-            blur(*pImg, *pImg, Size(7, 7));
-            // Canny Edge Detection
-            Canny(*pImg, *pImg, minThreshold, maxThreshold);
-
-            // Tamano para el dilate y erode
-        // En C++ es mas comodo construir la matriz y luego usarla
-            int erosion_size = 2;
-            Mat element = getStructuringElement(MORPH_ELLIPSE,
-                Size(2 * erosion_size + 1, 2 * erosion_size + 1),
-                Point(erosion_size, erosion_size));
-
-            // Dilate y erode son operaciones destructivas en OpenCV 2
-            // Todo funciona bien en OpenCV 4
-            dilate(*pImg, *pImg, element);
-            erode(*pImg, *pImg, element);
-
-            // Hallar contornos
-            vector<vector<Point> > contours;
-            vector<Vec4i> hierarchy;
-            findContours(*pImg, contours, hierarchy, RETR_TREE, CHAIN_APPROX_SIMPLE);
-
-            // Es el primer contorno de este frame?
-            boolean first = true;
-
-            // Convertir imagen de regreso a color
-            cvtColor(*pImg, *pImg, CV_GRAY2RGBA);
-
-            Scalar color = SKELETON_COLORS[0];          // blue
-            Scalar colorGreen = SKELETON_COLORS[1];     // green
-            Scalar colorYellow = SKELETON_COLORS[2];    // yellow
-            Scalar colorPinpoint = color;               // color trae blue
-
-            // FIND ME: no hay contornos
-            // Limpiar todo cuando no hay contornos
-            // Por ejemplo, cuando recien esta iniciando
-            if (contours.size() == 0) {
-                firstObj = true;
-                noFue = 0;
-                siFue = 0;
-            }
 
-            // Enviamos un mensaje por socket, entonces estamos en pausa
-            if (paused) {
-                // Dibujar todos los contornos
-                drawContours(*pImg, contours, -1, colorYellow, 1, LINE_8);
-                // Marcar el objeto target
-                circle(*pImg, Point(latestX, latestY), 5, colorGreen, 2);
-
-                // Pasaron mas de tres segundos
-                // Se puede aumentar el tiempo para tener mejor desempeno durante la ejecucion continua
-                // a cambio de un menor desempeno al iniciar
-                if (difftime(time(0), refTime) > 3.0) {
-                    // Quito pausa
-                    paused = false;
-
-                    // Obligo a elegir nuevo target
-                    firstObj = true;
-                    noFue = 0;
-                    siFue = 0;
-                }
-
-                // No hay que analizar nada mas, solo gastar tiempo en lo que se quita la pausa
-                break;
-            }
+        // Enviar dato por socket
+        sprintf(buffer, "x %d y %d z 30", cvRound(onTable.x), cvRound(onTable.y));
+        out->sendMessage(buffer);
 
-            for (size_t i = 0; i < contours.size(); i++)
-            {
-                int area = contourArea(contours[i]);
-
-                if (area > 200 && area < 700) {
-                    // El contorno tiene tamano suficiente
-
-                    // Contorno ajustado
-                    // Visualizar cuales si se estan considerando de tamano valido
-                    drawContours(*pImg, contours, (int)i, colorYellow, 1, LINE_8);
-
-                    // Elipse minimo
-                    if (first) {
-                        ellipse(*pImg, fitEllipse(contours[i]), color, 1);
-
-                        // Calcular los momentos, es decir los ejes
-                        Moments m = moments(contours[i]);
-                        int cx = m.m10 / m.m00;
-                        int cy = m.m01 / m.m00;
-
-                        // Si es el primer objeto detectado fijarlo como target
-                        if (firstObj) {
-                            latestX = cx;
-                            latestY = cy;
-                            firstObj = false;
-                        }
-                        else {
-                            // Si no es el primero, ver si esta cerca
-                            // Determinar que es el mismo
-                            if (abs(cx - latestX) < 12 && abs(cy - latestY) < 12) {
-                                colorPinpoint = colorGreen;     // antes era azul
-
-                                // Se tiene certeza de que se esta viendo el mismo objeto
-                                // es decir, no fue ruido accidental
-                                // Aumentar para tener mayor certeza, a cambio de un lock ms lento
-                                if (siFue++ > 3) {
-
-                                    // FIND ME: coordenadas
-                                    int yCalc, xCalc;
-
-                                    // 20, 20 tamano del margen
-                                    // 40, 60 cantidad de centimetros
-                                    // 440, 600 cantidad de pixeles
-                                    yCalc = (latestY - 20) * 40 / 440;
-                                    xCalc = (latestX - 20) * 60 / 600;
-
-                                    // Compensar posicion del brazo fuera del rectangulo
-                                    int yyyy = (xCalc - 30) * -10;
-                                    int xxxx = (yCalc + 11) * 10;
-
-                                    // Enviar dato por socket
-                                    sprintf(buffer, "x %d y %d z 30", xxxx, yyyy);
-                                    out->setMessage(buffer);
-                                    out->sendMessage();
-
-                                    // Pausa para evitar enviar demasiados mensajes
-                                    refTime = time(0);
-                                    paused = true;
-                                }
-                            }
-                            else {
-                                colorPinpoint = colorYellow;    // antes era azul
-
-                                // Si se ha fallado muchas veces, limpiar todo para fijar nuevo target
-                                if (noFue++ > 20) {
-                                    firstObj = true;
-                                    noFue = 0;
-                                    siFue = 0;
-                                }
-                            }
-                            // Elipse azul rodeandolo
-                            ellipse(*pImg, fitEllipse(contours[i]), color, 2);
-                        }
-
-                        // FIND ME
-                        // x,y dado en pixeles
-                        //itoa(latestX, buffer, 10);
-                        //putText(*pImg, buffer, Point(10, 250), FONT_HERSHEY_COMPLEX_SMALL, 1.0, colorGreen, 2);
-                        //itoa(latestY, buffer, 10);
-                        //putText(*pImg, buffer, Point(10, 270), FONT_HERSHEY_COMPLEX_SMALL, 1.0, colorGreen, 2);
-
-                        // Dibujar en verde el punto fijado
-                        circle(*pImg, Point(latestX, latestY), 10, colorGreen, 2);
-                        // Dibujar en verde el punto actual si es el mismo
-                        // Si es otro dibujarlo en amarillo
-                        circle(*pImg, Point(cx, cy), 10, colorPinpoint, 2);
-
-                        first = false;
-                        continue;
-                    }
-                } // end if - areas de tamano mediano
-            } // end for - contornos de la imagen
-    } // end case - canny edge
-        break;
+        // Dibujar en verde el punto fijado
+        circle(*pImg, position, 5, colorGreen, 2);
+
+        // Pausa para evitar enviar demasiados mensajes
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        pStream->resumeTime = now.QuadPart + m_pauseDuration;
+        pStream->pausedFrameCount = 0;
+        pStream->paused = true;
     }
 
     return S_OK;
 }
 
+/// <summary>
+/// Reads the performance counter in seconds
+/// </summary>
+/// <returns>current time in seconds</returns>
+double OpenCVHelper::GetSeconds() const
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart * m_secondsPerCount;
+}
+
+/// <summary>
+/// Draws contours found at the work resolution into a 640x480 image
+/// </summary>
+/// <param name="pStream">state of the stream, whose contours are drawn</param>
+/// <param name="pImg">pointer to the image to draw in</param>
+/// <param name="index">index of the contour to draw, -1 for all of them</param>
+/// <param name="color">color to draw with</param>
+void OpenCVHelper::DrawWorkContours(StreamState* pStream, Mat* pImg, int index, Scalar color)
+{
+    const vector<vector<Point> >& contours = pStream->contours;
+
+    if (m_workScale == 1.0)
+    {
+        drawContours(*pImg, contours, index, color, 1, LINE_8);
+        return;
+    }
+
+    size_t first = index < 0 ? 0 : index;
+    size_t last = index < 0 ? contours.size() : index + 1;
+    const double toDisplay = 1.0 / m_workScale;
+
+    // The scaled copies keep their memory between frames
+    pStream->displayContours.resize(last - first);
+    for (size_t i = first; i < last; ++i)
+    {
+        vector<Point>& scaled = pStream->displayContours[i - first];
+        scaled.resize(contours[i].size());
+        for (size_t j = 0; j < scaled.size(); ++j)
+        {
+            scaled[j] = Point(cvRound(contours[i][j].x * toDisplay), cvRound(contours[i][j].y * toDisplay));
+        }
+    }
+
+    drawContours(*pImg, pStream->displayContours, -1, color, 1, LINE_8);
+}
+
+/// <summary>
+/// Gets the number of times the filters have had to (re)allocate a scratch buffer,
+/// which only grows when the resolution or the filter changes
+/// </summary>
+/// <returns>number of scratch buffer allocations</returns>
+LONG OpenCVHelper::GetScratchAllocationCount() const
+{
+    return m_colorStream.scratch.GetAllocationCount() + m_depthStream.scratch.GetAllocationCount();
+}
+
+/// <summary>
+/// Gets the number of frames of both streams the scene gate skipped the detection of and ran it on
+/// </summary>
+/// <param name="pHits">pointer in which to return the number of frames skipped</param>
+/// <param name="pMisses">pointer in which to return the number of frames the detection ran on</param>
+void OpenCVHelper::GetSceneGateCounts(LONG* pHits, LONG* pMisses) const
+{
+    *pHits = m_colorStream.gate.GetHitCount() + m_depthStream.gate.GetHitCount();
+    *pMisses = m_colorStream.gate.GetMissCount() + m_depthStream.gate.GetMissCount();
+}
+
 /// <summary>
 /// Draws the skeletons from the skeleton frame in the given color image Mat
 /// </summary>
@@ -19,6 +19,18 @@
 #pragma warning(pop)
 
 #include "OpenCVFrameHelper.h"
+#include "ScratchArena.h"
+#include "WarpEngine.h"
+#include "FilterPipeline.h"
+#include "SceneChangeGate.h"
+#include "DepthBackground.h"
+#include "TableCalibration.h"
+#include "DepthSampler.h"
+#include "WorkspaceCalibrator.h"
+#include "ComponentLabeler.h"
+#include "PyramidRefiner.h"
+#include "TiledEdgeChain.h"
+#include "TargetTracker.h"
 #include "Socket.h"
 
 using namespace cv;
@@ -29,7 +41,66 @@ class OpenCVHelper
     // Skeleton colors for each player index
     static const Scalar SKELETON_COLORS[NUI_SKELETON_COUNT];
 
+    // Scratch buffers of the filters, the stages are shared by the color and depth filters
+    enum ScratchBuffer
+    {
+        SCRATCH_WARPED = 0,
+        SCRATCH_RECTIFIED,
+        SCRATCH_GRAY,
+        SCRATCH_BLURRED,
+        SCRATCH_EDGES,
+        SCRATCH_MORPH,
+        SCRATCH_COLOR_OUTPUT,
+        SCRATCH_DEPTH_OUTPUT,
+        SCRATCH_DISPLAY_EDGES,
+        SCRATCH_PAUSED_OVERLAY,
+        SCRATCH_PYRAMID,
+        SCRATCH_FOREGROUND,
+        SCRATCH_COUNT
+    };
+
+    // Size of the rectified workspace and its resolution across the table
+    static const int RECTIFIED_WIDTH = 640;
+    static const int RECTIFIED_HEIGHT = 480;
+    static const int RECTIFIED_PIXELS_PER_CM = 10;
+
+    // Coarsest work resolution, below it the objects are only a few pixels across
+    static const int MIN_ROI_PIXELS_PER_CM = 2;
+
+    // Levels of the pyramid filters, the work resolution and half of it
+    static const int PYRAMID_LEVEL_COUNT = 2;
+
+    // Area range of the targets at the rectified resolution, in pixels
+    static const int MIN_TARGET_AREA = 200;
+    static const int MAX_TARGET_AREA = 700;
+
+    // Largest distance in x and in y between a target and its position in the previous frame, in rectified pixels
+    static const int TARGET_GATE = 12;
+
+    // Largest root mean square distance between a target's predicted and seen positions for it to be sent, in rectified pixels
+    static const int MAX_LOCK_INNOVATION = 3;
+
+    // Time the tracker pauses for after sending a target
+    static const int PAUSE_MILLISECONDS = 3000;
+
+    // Paused frames per edge detection with PAUSE_DECIMATE
+    static const int PAUSED_DETECTION_INTERVAL = 5;
+
 public:
+    // Types:
+    // What the edge filters do while the tracker is paused after sending a target
+    enum PausePolicy
+    {
+        // Keep detecting on every frame
+        PAUSE_DETECT = 0,
+
+        // Detect on one paused frame in PAUSED_DETECTION_INTERVAL, showing the last overlay in between
+        PAUSE_DECIMATE,
+
+        // Detect on the first paused frame only, then show its overlay until the pause ends
+        PAUSE_SKIP
+    };
+
     /// <summary>
     /// Constructor
     /// </summary>
@@ -47,6 +118,107 @@ public:
     /// <param name="filterID">resource ID of filter to use</param>
     void SetDepthFilter(int filterID);
 
+    /// <summary>
+    /// Returns whether the active depth filter works on the depth band mask instead of the ARGB depth image
+    /// </summary>
+    /// <returns>true if the filter takes the depth band mask, false otherwise</returns>
+    bool UsesDepthMask() const;
+
+    /// <summary>
+    /// Fits the mapping of the rectified image to the arm's coordinates on the table to the pairs of a
+    /// file, keeping the default mapping if the file does not fix one
+    /// </summary>
+    /// <param name="path">path of a text file with a pixel's x and y and the table's x and y in millimeters per line</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT LoadTableCalibration(LPCWSTR path);
+
+    /// <summary>
+    /// Moves the trapezoid of the workspace and the alignment of the depth image to a workspace
+    /// found by WorkspaceCalibrator. Only called while this helper is not filtering a frame.
+    /// </summary>
+    /// <param name="workspace">workspace to use</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the corners or the alignment do not form a convex quadrilateral</returns>
+    HRESULT SetWorkspace(const Workspace& workspace);
+
+    /// <summary>
+    /// Returns the workspace in use
+    /// </summary>
+    /// <returns>corners of the trapezoid and alignment of the depth image</returns>
+    Workspace GetWorkspace() const;
+
+    /// <summary>
+    /// Adds a pair of frames to the workspace calibration, and moves the trapezoid to the workspace
+    /// once it is found. The current alignment is kept if the sensor's calibration cannot be read.
+    /// </summary>
+    /// <param name="color">color frame</param>
+    /// <param name="depth">raw depth frame captured with it</param>
+    /// <param name="colorResolution">resolution of the color frames</param>
+    /// <param name="depthResolution">resolution of the depth frames</param>
+    /// <returns>S_OK once the workspace is found and used, S_FALSE while frames are still needed, E_FAIL if it was not found and the frames start over, an error code otherwise</returns>
+    HRESULT CalibrateWorkspace(const Mat& color, const Mat& depth, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution);
+
+    /// <summary>
+    /// Loads a workspace saved by WorkspaceCalibrator and moves the trapezoid to it
+    /// </summary>
+    /// <param name="path">path of the file</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT LoadWorkspace(LPCWSTR path);
+
+    /// <summary>
+    /// Returns whether the active depth filter works on the raw 16 bit depth frame
+    /// </summary>
+    /// <returns>true if the filter takes the raw depth, false otherwise</returns>
+    bool UsesRawDepth() const;
+
+    /// <summary>
+    /// Returns whether the active depth filter samples the raw 16 bit depth frame besides its image
+    /// </summary>
+    /// <returns>true if the filter needs the raw depth passed to ApplyDepthFilter, false otherwise</returns>
+    bool UsesDepthSamples() const;
+
+    /// <summary>
+    /// Loads the background model of the depth stream saved with SaveDepthBackground, for a warm start
+    /// </summary>
+    /// <param name="path">path of the file</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT LoadDepthBackground(LPCWSTR path);
+
+    /// <summary>
+    /// Saves the background model of the depth stream
+    /// </summary>
+    /// <param name="path">path of the file to create</param>
+    /// <returns>S_OK if successful, S_FALSE if nothing has been learned to save, an error code otherwise</returns>
+    HRESULT SaveDepthBackground(LPCWSTR path) const;
+
+    /// <summary>
+    /// Sets the resolution the edge detection runs at. The rectified workspace is 640x480, about
+    /// 10 pixels per cm of table; a coarser resolution warps the workspace straight into a smaller
+    /// work buffer and scales the detection back for display.
+    /// </summary>
+    /// <param name="pixelsPerCm">pixels per cm of table, 0 for the full rectified resolution</param>
+    void SetRoiResolution(int pixelsPerCm);
+
+    /// <summary>
+    /// Sets how much of the workspace has to change for the edge detection to run again. Frames
+    /// below the threshold reuse the edges and contours of the last frame the detection ran on.
+    /// </summary>
+    /// <param name="changedFraction">fraction of the workspace from 0 to 1, 0 or less to run the detection on every frame</param>
+    void SetSceneGate(double changedFraction);
+
+    /// <summary>
+    /// Sets the number of threads the blur, Canny and closing of the edge filters run on, in
+    /// horizontal bands of the image, for each stream
+    /// </summary>
+    /// <param name="threadCount">number of threads, 1 to run the filters one after the other on the whole image</param>
+    /// <returns>S_OK if successful, an error code if a thread could not be started</returns>
+    HRESULT SetEdgeThreads(int threadCount);
+
+    /// <summary>
+    /// Sets what the edge filters do while the tracker is paused after sending a target
+    /// </summary>
+    /// <param name="policy">pause policy</param>
+    void SetPausePolicy(PausePolicy policy);
+
     /// <summary>
     /// Applies the color image filter to the given Mat
     /// </summary>
@@ -58,8 +230,9 @@ public:
     /// Applies the depth image filter to the given Mat
     /// </summary>
     /// <param name="pImg">pointer to Mat to filter</param>
+    /// <param name="depth">raw CV_16UC1 depth frame the image comes from, for the filters that sample the depth, may be empty</param>
     /// <returns>S_OK if successful, an error code otherwise</returns>
-    HRESULT ApplyDepthFilter(Mat* pImg, Socket* s);
+    HRESULT ApplyDepthFilter(Mat* pImg, Socket* s, const Mat& depth = Mat());
 
     /// <summary>
     /// Draws the skeletons from the skeleton frame in the given color image Mat
@@ -82,8 +255,187 @@ public:
     HRESULT DrawSkeletonsInDepthImage(Mat* pImg, NUI_SKELETON_FRAME* pSkeletons, 
         NUI_IMAGE_RESOLUTION depthResolution);
 
+    /// <summary>
+    /// Aligns a depth band mask with the color image and rectifies the workspace at 640x480,
+    /// as the depth edge filters see it
+    /// </summary>
+    /// <param name="src">depth band mask</param>
+    /// <param name="pDst">pointer to the destination</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT RectifyDepth(const Mat& src, Mat* pDst);
+
+    /// <summary>
+    /// Gets the number of times the filters have had to (re)allocate a scratch buffer,
+    /// which only grows when the resolution or the filter changes
+    /// </summary>
+    /// <returns>number of scratch buffer allocations</returns>
+    LONG GetScratchAllocationCount() const;
+
+    /// <summary>
+    /// Gets the number of frames of both streams the scene gate skipped the detection of and ran it on
+    /// </summary>
+    /// <param name="pHits">pointer in which to return the number of frames skipped</param>
+    /// <param name="pMisses">pointer in which to return the number of frames the detection ran on</param>
+    void GetSceneGateCounts(LONG* pHits, LONG* pMisses) const;
+
 private:
+    // Types:
+    // Buffers and tracked target of the color or the depth stream, so the two streams
+    // can be filtered at the same time
+    struct StreamState
+    {
+        // Reused buffers of the filters, all of them allocated up front so the stages can hold several at once
+        ScratchArena scratch{SCRATCH_COUNT};
+
+        // Components of the edge detection in the target area range, and their contours, at the
+        // work resolution and reused between frames. The pyramid filters label the coarse level
+        // and refine its components at the work resolution.
+        ComponentLabeler labeler;
+        PyramidRefiner refiner;
+
+        // Runs the blur, Canny and closing in bands when more than one thread is set
+        TiledEdgeChain edgeChain;
+        std::vector<Component> components;
+        std::vector<std::vector<Point> > contours;
+
+        // Contours scaled to the rectified resolution for drawing
+        std::vector<std::vector<Point> > displayContours;
+
+        // Skips the edge detection while the workspace holds still
+        Microsoft::KinectBridge::SceneChangeGate gate;
+
+        // Depth of the empty table, learned by the background filter of the depth stream
+        Microsoft::KinectBridge::DepthBackground background;
+
+        // Candidates of the last frame at the rectified resolution, and their components
+        std::vector<Point2f> candidates;
+        std::vector<int> candidateComponents;
+
+        // Positions of the candidates on the table, in millimeters
+        std::vector<Point2f> tableCandidates;
+
+        // Targets on the table, the last one sent
+        TargetTracker tracker;
+        int latestX = 0;
+        int latestY = 0;
+
+        // Distance to the last target sent in millimeters, 0 if unknown
+        float latestDepth = 0.0f;
+
+        // Performance counter value at which we can read again, and frames seen since pausing
+        LONGLONG resumeTime = 0;
+        int pausedFrameCount = 0;
+        bool paused = false;
+    };
+
+    // Frame passed through the filter stages
+    struct StageFrame : FilterFrame
+    {
+        OpenCVHelper* pHelper;
+        StreamState* pStream;
+        Socket* pSocket;
+
+        // Time the frame was received at, in seconds
+        double time;
+
+        // Raw depth frame the image comes from, empty for the color frames
+        Mat depth;
+
+        // Pyramid level of the image, and the work resolution image once the pyramid filters go down a level
+        int level;
+        Mat fine;
+    };
+
+    typedef FilterPipelineBase<StageFrame> Pipeline;
+
+    // Stages of the filter pipelines, defined with the pipelines
+    struct TrapezoidStage;
+    struct GaussianBlurStage;
+    struct DilateStage;
+    struct ErodeStage;
+    struct DepthProbeStage;
+    template <int OutputBuffer> struct PauseStage;
+    struct SceneGateStage;
+    struct ColorWarpStage;
+    struct DepthWarpStage;
+    struct DepthGrayStage;
+    struct BackgroundStage;
+    struct BinarizeStage;
+    struct PyramidDownStage;
+    struct TiledEdgesStage;
+    struct BlurStage;
+    struct CannyStage;
+    struct CloseStage;
+    struct LabelStage;
+    struct CoarseLabelStage;
+    struct RefineStage;
+    template <int OutputBuffer, int Level> struct DrawEdgesStage;
+    template <int LockFrames> struct TrackStage;
+
     // Functions:
+    /// <summary>
+    /// Gets the prebuilt pipeline of a filter
+    /// </summary>
+    /// <param name="filterID">resource ID of the filter</param>
+    /// <returns>pipeline of the filter, an empty one for an unknown ID</returns>
+    static const Pipeline* GetPipeline(int filterID);
+
+    /// <summary>
+    /// Runs a filter pipeline on the given Mat
+    /// </summary>
+    /// <param name="pPipeline">pipeline to run</param>
+    /// <param name="pStream">state of the stream the image belongs to</param>
+    /// <param name="pImg">pointer to Mat to filter, pointed at the result if successful</param>
+    /// <param name="depth">raw depth frame the image comes from, may be empty</param>
+    /// <param name="out">socket to send the target to</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT RunPipeline(const Pipeline* pPipeline, StreamState* pStream, Mat* pImg, const Mat& depth, Socket* out);
+
+    /// <summary>
+    /// Aligns a depth image with the color image and rectifies the trapezoid, composing
+    /// warp and warpRe into one pass
+    /// </summary>
+    /// <param name="src">depth image</param>
+    /// <param name="pDst">pointer to the destination</param>
+    /// <param name="atWorkResolution">true to rectify at the work resolution, false at 640x480</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT ApplyDepthWarp(const Mat& src, Mat* pDst, bool atWorkResolution);
+
+    /// <summary>
+    /// Scales a homography onto the rectified workspace down to the work resolution
+    /// </summary>
+    /// <param name="homography">homography onto the 640x480 rectified workspace</param>
+    /// <param name="pScaled">pointer in which to return the scaled homography, reused between frames</param>
+    void ScaleToWork(const Mat& homography, Mat* pScaled) const;
+
+    /// <summary>
+    /// Tracks the targets among the components of the edge detection, sends the one followed
+    /// most closely once it is confirmed and draws the result into the 640x480 output image
+    /// </summary>
+    /// <param name="pStream">state of the stream, with the components and the tracked targets</param>
+    /// <param name="pImg">pointer to the output image to draw in</param>
+    /// <param name="depth">raw depth frame to read the target's distance from, may be empty</param>
+    /// <param name="lockFrames">fewest frames a target has to be seen in before it is sent</param>
+    /// <param name="frameTime">time the frame was received at, in seconds</param>
+    /// <param name="out">socket to send the target to</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT TrackTarget(StreamState* pStream, Mat* pImg, const Mat& depth, int lockFrames, double frameTime, Socket* out);
+
+    /// <summary>
+    /// Reads the performance counter in seconds
+    /// </summary>
+    /// <returns>current time in seconds</returns>
+    double GetSeconds() const;
+
+    /// <summary>
+    /// Draws contours found at the work resolution into a 640x480 image
+    /// </summary>
+    /// <param name="pStream">state of the stream, whose contours are drawn</param>
+    /// <param name="pImg">pointer to the image to draw in</param>
+    /// <param name="index">index of the contour to draw, -1 for all of them</param>
+    /// <param name="color">color to draw with</param>
+    void DrawWorkContours(StreamState* pStream, Mat* pImg, int index, Scalar color);
+
     /// <summary>
     /// Draws the skeletons from the skeleton frame in the given Mat
     /// </summary>
@@ -119,6 +471,11 @@ private:
     void DrawBone(Mat* pImg, NUI_SKELETON_DATA* pSkel, NUI_SKELETON_POSITION_INDEX joint0, 
         NUI_SKELETON_POSITION_INDEX joint1, Point jointPositions[NUI_SKELETON_POSITION_COUNT], Scalar color);
 
+    /// <summary>
+    /// Points the depth sampler and the scene change gates at the current trapezoid
+    /// </summary>
+    void UpdateWorkspace();
+
     /// <summary>
     /// Converts a point in skeleton space to coordinates in color or depth space
     /// </summary>
@@ -136,10 +493,56 @@ private:
     int m_colorFilterID;
     int m_depthFilterID;
 
-    std::vector<int> latestDistances;
-    
-    int latestX = 0;
-    int latestY = 0;
+    // Pause after sending a target, its length in performance counter counts
+    PausePolicy m_pausePolicy;
+    LONGLONG m_pauseDuration;
+    double m_secondsPerCount;
+
+    // Pipelines of the active filters
+    const Pipeline* m_pColorPipeline;
+    const Pipeline* m_pDepthPipeline;
+
+    // Per stream state, each only touched by the thread filtering that stream
+    StreamState m_colorStream;
+    StreamState m_depthStream;
+
+    // Cached warps of the trapezoid, the depth one composed with the depth to color alignment
+    WarpEngine m_colorWarp;
+    WarpEngine m_depthWarp;
+
+    // Maps the targets in the rectified image to the arm's coordinates, read by both streams
+    TableCalibration m_tableCalibration;
+
+    // Maps positions of the rectified workspace back to the raw depth frame
+    DepthSampler m_depthSampler;
 
-    int firstObj = true;
+    // Trapezoid of the workspace in the color image and alignment of the depth image, set by hand
+    // until the helper loads or finds its own
+    Workspace m_workspace;
+    WorkspaceCalibrator m_workspaceCalibrator;
+
+    // Corners of the trapezoid, and inset so the colored border of the cardboard is left out of the color image
+    Point m_corners[4];
+    Point m_colorCorners[4];
+
+    // Homographies aligning the depth image with the color image, rectifying the trapezoid,
+    // and rectifying the inset trapezoid of the color image
+    Mat m_warp;
+    Mat m_warpRe;
+    Mat m_warpReColor;
+
+    // Edge detection resolution, as a fraction of the rectified one, and the half resolution of the pyramid filters
+    double m_workScale;
+    Size m_workSize;
+    Size m_coarseSize;
+
+    // Blur kernel and structuring element of the dilate and erode after the edge detection, by pyramid level
+    Size m_blurSizes[PYRAMID_LEVEL_COUNT];
+    Mat m_edgeElements[PYRAMID_LEVEL_COUNT];
+
+    // Trapezoid homographies scaled to the work resolution
+    Mat m_colorWorkWarp;
+    Mat m_depthWorkWarp;
+
+    std::vector<int> latestDistances;
 };
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "PyramidRefiner.h"
+
+/// <summary>
+/// Constructor
+/// </summary>
+PyramidRefiner::PyramidRefiner() :
+    m_filteredPixelCount(0)
+{
+}
+
+/// <summary>
+/// Finds the full resolution components around the coarse ones
+/// </summary>
+/// <param name="fine">CV_8UC1 full resolution image, before any filtering</param>
+/// <param name="coarse">components found on the half resolution level</param>
+/// <param name="settings">edge chain and area range of the full resolution detection</param>
+/// <param name="pComponents">pointer to the components to fill, in full resolution coordinates</param>
+/// <param name="pContours">pointer to the outer contours of the components to fill, in full resolution coordinates</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the image is empty or not CV_8UC1</returns>
+HRESULT PyramidRefiner::Refine(const Mat& fine, const std::vector<Component>& coarse, const Settings& settings,
+    std::vector<Component>* pComponents, std::vector<std::vector<Point> >* pContours)
+{
+    if (!pComponents || !pContours)
+    {
+        return E_POINTER;
+    }
+
+    if (fine.empty() || fine.type() != CV_8UC1)
+    {
+        return E_INVALIDARG;
+    }
+
+    // The buffers keep their memory between frames
+    m_blurred.create(fine.size(), CV_8UC1);
+    m_edges.create(fine.size(), CV_8UC1);
+    m_morph.create(fine.size(), CV_8UC1);
+
+    const Rect image(0, 0, fine.cols, fine.rows);
+    m_windows.clear();
+    for (size_t i = 0; i < coarse.size(); ++i)
+    {
+        const Rect& bounds = coarse[i].bounds;
+        Rect window(bounds.x * 2 - WINDOW_MARGIN, bounds.y * 2 - WINDOW_MARGIN,
+            bounds.width * 2 + 2 * WINDOW_MARGIN, bounds.height * 2 + 2 * WINDOW_MARGIN);
+        m_windows.push_back(window & image);
+    }
+    MergeWindows();
+
+    // Pixels of the window the filters depend on: the blur, the gradient and non-maximum
+    // suppression of Canny and the dilate and erode of the closing. Only the hysteresis of
+    // Canny may follow an edge further than that.
+    const int halo = settings.blurSize.width / 2 + 2 + (settings.edgeElement.cols - 1);
+
+    pComponents->clear();
+    size_t contourCount = 0;
+    m_filteredPixelCount = 0;
+    for (size_t i = 0; i < m_windows.size(); ++i)
+    {
+        const Rect& window = m_windows[i];
+        const Rect filtered = Rect(window.x - halo, window.y - halo, window.width + 2 * halo, window.height + 2 * halo) & image;
+        m_filteredPixelCount += filtered.area();
+
+        // The blur reads the image around the halo like it would on the whole image; the
+        // closing is isolated, the edges around the halo are left from other windows
+        Mat blurred = m_blurred(filtered);
+        Mat edges = m_edges(filtered);
+        Mat morph = m_morph(filtered);
+        blur(fine(filtered), blurred, settings.blurSize);
+        Canny(blurred, edges, settings.minThreshold, settings.maxThreshold);
+        dilate(edges, morph, settings.edgeElement, Point(-1, -1), 1, BORDER_CONSTANT | BORDER_ISOLATED, morphologyDefaultBorderValue());
+        erode(morph, edges, settings.edgeElement, Point(-1, -1), 1, BORDER_CONSTANT | BORDER_ISOLATED, morphologyDefaultBorderValue());
+
+        HRESULT hr = m_labeler.Label(m_edges(window), settings.minArea, settings.maxArea);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        const std::vector<Component>& components = m_labeler.GetComponents();
+        for (size_t c = 0; c < components.size(); ++c)
+        {
+            // A component cut by the window, rather than by the image, is not whole
+            const Rect& bounds = components[c].bounds;
+            if ((bounds.x == 0 && window.x > 0) || (bounds.y == 0 && window.y > 0) ||
+                (bounds.x + bounds.width == window.width && window.x + window.width < image.width) ||
+                (bounds.y + bounds.height == window.height && window.y + window.height < image.height))
+            {
+                continue;
+            }
+
+            if (contourCount == pContours->size())
+            {
+                pContours->resize(contourCount + 1);
+            }
+
+            std::vector<Point>& contour = (*pContours)[contourCount++];
+            hr = m_labeler.GetContour(c, &contour);
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+
+            const Point offset = window.tl();
+            for (size_t p = 0; p < contour.size(); ++p)
+            {
+                contour[p] += offset;
+            }
+
+            // The central moments do not move with the component
+            Component component = components[c];
+            component.centroid += Point2d(offset.x, offset.y);
+            component.bounds += offset;
+            pComponents->push_back(component);
+        }
+    }
+
+    pContours->resize(contourCount);
+    return S_OK;
+}
+
+/// <summary>
+/// Gets the number of windows the last refinement ran the edge chain on
+/// </summary>
+/// <returns>number of windows</returns>
+size_t PyramidRefiner::GetWindowCount() const
+{
+    return m_windows.size();
+}
+
+/// <summary>
+/// Gets the number of pixels the last refinement ran the edge chain on, halos included
+/// </summary>
+/// <returns>number of pixels</returns>
+int PyramidRefiner::GetFilteredPixelCount() const
+{
+    return m_filteredPixelCount;
+}
+
+/// <summary>
+/// Merges the windows that overlap until none do
+/// </summary>
+void PyramidRefiner::MergeWindows()
+{
+    // A merged window may reach windows already checked, so the pass starts over after each merge.
+    // There are only a few windows per frame.
+    size_t i = 0;
+    while (i < m_windows.size())
+    {
+        bool isMerged = false;
+        for (size_t j = 0; j < m_windows.size(); ++j)
+        {
+            if (j != i && (m_windows[i] & m_windows[j]).area() > 0)
+            {
+                m_windows[i] |= m_windows[j];
+                m_windows[j] = m_windows.back();
+                m_windows.pop_back();
+                isMerged = true;
+                break;
+            }
+        }
+
+        i = isMerged ? 0 : i + 1;
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#pragma warning(pop)
+
+#include "ComponentLabeler.h"
+
+using namespace cv;
+
+/// <summary>
+/// Refines the components found on the half resolution level of a pyramid. The edge chain of
+/// the full resolution detection, blur, Canny and a closing, only runs on windows around the
+/// coarse components, with a halo so the filters see the same neighbourhood they would on the
+/// whole image, and the windows are labeled again for the components and their sub-pixel
+/// centroids at full resolution. Overlapping windows are merged so every component is found once.
+/// </summary>
+class PyramidRefiner
+{
+public:
+    // Types:
+    // Edge chain and area range of the full resolution detection
+    struct Settings
+    {
+        Size blurSize;
+        Mat edgeElement;
+        double minThreshold;
+        double maxThreshold;
+        int minArea;
+        int maxArea;
+    };
+
+    // Constants:
+    // Full resolution pixels added around a coarse component, so the component's whole outline is in the window
+    static const int WINDOW_MARGIN = 8;
+
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    PyramidRefiner();
+
+    /// <summary>
+    /// Finds the full resolution components around the coarse ones
+    /// </summary>
+    /// <param name="fine">CV_8UC1 full resolution image, before any filtering</param>
+    /// <param name="coarse">components found on the half resolution level</param>
+    /// <param name="settings">edge chain and area range of the full resolution detection</param>
+    /// <param name="pComponents">pointer to the components to fill, in full resolution coordinates</param>
+    /// <param name="pContours">pointer to the outer contours of the components to fill, in full resolution coordinates</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the image is empty or not CV_8UC1</returns>
+    HRESULT Refine(const Mat& fine, const std::vector<Component>& coarse, const Settings& settings,
+        std::vector<Component>* pComponents, std::vector<std::vector<Point> >* pContours);
+
+    /// <summary>
+    /// Gets the number of windows the last refinement ran the edge chain on
+    /// </summary>
+    /// <returns>number of windows</returns>
+    size_t GetWindowCount() const;
+
+    /// <summary>
+    /// Gets the number of pixels the last refinement ran the edge chain on, halos included
+    /// </summary>
+    /// <returns>number of pixels</returns>
+    int GetFilteredPixelCount() const;
+
+private:
+    // Functions:
+    /// <summary>
+    /// Merges the windows that overlap until none do
+    /// </summary>
+    void MergeWindows();
+
+    // Variables:
+    // Full resolution buffers, only the windows are written
+    Mat m_blurred;
+    Mat m_edges;
+    Mat m_morph;
+
+    ComponentLabeler m_labeler;
+    std::vector<Rect> m_windows;
+    int m_filteredPixelCount;
+};
@@ -0,0 +1,656 @@
+#include "ReplayFrameSource.h"
+#include "DepthCodec.h"
+
+using namespace Microsoft::KinectBridge;
+
+/// <summary>
+/// Constructor
+/// </summary>
+ReplayFrameSource::ReplayFrameSource() :
+    m_hFile(INVALID_HANDLE_VALUE),
+    m_hMapping(NULL),
+    m_pView(NULL),
+    m_fileSize(0),
+    m_isRealTime(true),
+    m_isLooping(false),
+    m_hPacingThread(NULL),
+    m_hStopEvent(NULL)
+{
+    ZeroMemory(&m_fileHeader, sizeof(m_fileHeader));
+    m_fileHeader.colorResolution = NUI_IMAGE_RESOLUTION_INVALID;
+    m_fileHeader.depthResolution = NUI_IMAGE_RESOLUTION_INVALID;
+
+    for (int i = 0; i < CAPTURE_STREAM_COUNT; ++i)
+    {
+        m_streams[i].hNextFrameEvent = NULL;
+        m_streams[i].published = 0;
+        m_streams[i].consumed = 0;
+    }
+
+    m_hFinishedEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+ReplayFrameSource::~ReplayFrameSource()
+{
+    Shutdown();
+
+    if (m_pView)
+    {
+        UnmapViewOfFile(m_pView);
+    }
+
+    if (m_hMapping)
+    {
+        CloseHandle(m_hMapping);
+    }
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+    }
+
+    CloseHandle(m_hFinishedEvent);
+}
+
+/// <summary>
+/// Opens and maps a capture file and loads its frame index
+/// </summary>
+/// <param name="path">path of the capture file</param>
+/// <param name="realTime">true to pace frames by their timestamps, false to replay as fast as they are read</param>
+/// <param name="loop">true to restart from the first frame at the end of the file</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT ReplayFrameSource::Open(LPCWSTR path, bool realTime, bool loop)
+{
+    // Fail if a file is already open
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(CaptureFileHeader)))
+    {
+        CloseHandle(hFile);
+        return E_INVALIDARG;
+    }
+
+    // Map the whole file, a 32 bit process can only replay recordings that fit its address space
+    HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    const BYTE* pView = hMapping ? static_cast<const BYTE*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0)) : NULL;
+    if (!pView)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        if (hMapping)
+        {
+            CloseHandle(hMapping);
+        }
+        CloseHandle(hFile);
+        return hr;
+    }
+
+    // Check the file header
+    memcpy(&m_fileHeader, pView, sizeof(m_fileHeader));
+    if (m_fileHeader.magic != CAPTURE_FILE_MAGIC || m_fileHeader.version != CAPTURE_FILE_VERSION)
+    {
+        UnmapViewOfFile(pView);
+        CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return E_INVALIDARG;
+    }
+
+    m_hFile = hFile;
+    m_hMapping = hMapping;
+    m_pView = pView;
+    m_fileSize = fileSize.QuadPart;
+    m_isRealTime = realTime;
+    m_isLooping = loop;
+
+    // Files whose recording was cut short have no index
+    if (!LoadIndex())
+    {
+        ScanRecords();
+    }
+
+    for (size_t i = 0; i < m_records.size(); ++i)
+    {
+        m_streams[m_records[i].header.stream].records.push_back(i);
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Gets the recorded color resolution
+/// </summary>
+/// <returns>color resolution of the capture file</returns>
+NUI_IMAGE_RESOLUTION ReplayFrameSource::GetColorResolution() const
+{
+    return m_fileHeader.colorResolution;
+}
+
+/// <summary>
+/// Gets the recorded depth resolution
+/// </summary>
+/// <returns>depth resolution of the capture file</returns>
+NUI_IMAGE_RESOLUTION ReplayFrameSource::GetDepthResolution() const
+{
+    return m_fileHeader.depthResolution;
+}
+
+/// <summary>
+/// Gets an event signalled once every open image stream has been read to the end.
+/// Never signalled when looping.
+/// </summary>
+/// <returns>handle of the event</returns>
+HANDLE ReplayFrameSource::GetFinishedHandle() const
+{
+    return m_hFinishedEvent;
+}
+
+/// <summary>
+/// Starts the replay. The flags are ignored, every recorded stream can be opened.
+/// </summary>
+/// <param name="nuiInitFlags">streams to initialize</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT ReplayFrameSource::Initialize(DWORD nuiInitFlags)
+{
+    UNREFERENCED_PARAMETER(nuiInitFlags);
+
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return E_NOT_VALID_STATE;
+    }
+
+    for (int i = 0; i < CAPTURE_STREAM_COUNT; ++i)
+    {
+        m_streams[i].published = 0;
+        m_streams[i].consumed = 0;
+    }
+    ResetEvent(m_hFinishedEvent);
+
+    // In real time mode a thread publishes frames as their recorded time comes up
+    if (m_isRealTime && !m_records.empty())
+    {
+        m_hStopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        m_hPacingThread = CreateThread(NULL, 0, PacingThread, this, 0, NULL);
+        if (!m_hPacingThread)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Stops the replay
+/// </summary>
+void ReplayFrameSource::Shutdown()
+{
+    if (m_hPacingThread)
+    {
+        SetEvent(m_hStopEvent);
+        WaitForSingleObject(m_hPacingThread, INFINITE);
+        CloseHandle(m_hPacingThread);
+        m_hPacingThread = NULL;
+    }
+
+    if (m_hStopEvent)
+    {
+        CloseHandle(m_hStopEvent);
+        m_hStopEvent = NULL;
+    }
+
+    // The events belong to the consumer
+    for (int i = 0; i < CAPTURE_STREAM_COUNT; ++i)
+    {
+        m_streams[i].hNextFrameEvent = NULL;
+    }
+}
+
+/// <summary>
+/// Opens a recorded image stream. The resolution must match the recorded one.
+/// </summary>
+/// <param name="imageType">type of the stream to open</param>
+/// <param name="resolution">resolution of the stream</param>
+/// <param name="imageFlags">ignored, the flags in effect while recording apply</param>
+/// <param name="hNextFrameEvent">manual reset event signalled when a frame is ready</param>
+/// <param name="phStreamHandle">pointer in which to return the stream handle</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT ReplayFrameSource::OpenImageStream(NUI_IMAGE_TYPE imageType, NUI_IMAGE_RESOLUTION resolution, DWORD imageFlags, HANDLE hNextFrameEvent, HANDLE* phStreamHandle)
+{
+    UNREFERENCED_PARAMETER(imageFlags);
+
+    CaptureStream stream;
+    NUI_IMAGE_RESOLUTION recordedResolution;
+    if (imageType == NUI_IMAGE_TYPE_COLOR)
+    {
+        stream = CAPTURE_STREAM_COLOR;
+        recordedResolution = m_fileHeader.colorResolution;
+    }
+    else if (imageType == NUI_IMAGE_TYPE_DEPTH || imageType == NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX)
+    {
+        stream = CAPTURE_STREAM_DEPTH;
+        recordedResolution = m_fileHeader.depthResolution;
+    }
+    else
+    {
+        return E_INVALIDARG;
+    }
+
+    if (resolution != recordedResolution)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_streams[stream].hNextFrameEvent = hNextFrameEvent;
+    *phStreamHandle = reinterpret_cast<HANDLE>(static_cast<ULONG_PTR>(stream + 1));
+
+    // As fast as possible, frames are always ready until the end of the file
+    if (!m_isRealTime && !m_streams[stream].records.empty())
+    {
+        SetEvent(hNextFrameEvent);
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Ignored, the flags in effect while recording apply
+/// </summary>
+/// <param name="hStreamHandle">stream to update</param>
+/// <param name="imageFlags">new flags</param>
+/// <returns>S_OK</returns>
+HRESULT ReplayFrameSource::SetImageStreamFlags(HANDLE hStreamHandle, DWORD imageFlags)
+{
+    UNREFERENCED_PARAMETER(hStreamHandle);
+    UNREFERENCED_PARAMETER(imageFlags);
+
+    return S_OK;
+}
+
+/// <summary>
+/// Opens the recorded skeleton stream
+/// </summary>
+/// <param name="hNextFrameEvent">manual reset event signalled when a frame is ready</param>
+/// <param name="trackingFlags">ignored, the flags in effect while recording apply</param>
+/// <returns>S_OK</returns>
+HRESULT ReplayFrameSource::EnableSkeletonTracking(HANDLE hNextFrameEvent, DWORD trackingFlags)
+{
+    UNREFERENCED_PARAMETER(trackingFlags);
+
+    m_streams[CAPTURE_STREAM_SKELETON].hNextFrameEvent = hNextFrameEvent;
+
+    if (!m_isRealTime && !m_streams[CAPTURE_STREAM_SKELETON].records.empty())
+    {
+        SetEvent(hNextFrameEvent);
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Gets the next recorded frame of an image stream
+/// </summary>
+/// <param name="hStreamHandle">stream to read</param>
+/// <param name="waitMillis">number of milliseconds to wait</param>
+/// <param name="pFrame">pointer in which to return the frame</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT ReplayFrameSource::GetNextImageFrame(HANDLE hStreamHandle, DWORD waitMillis, SourceFrame* pFrame)
+{
+    ULONG_PTR handle = reinterpret_cast<ULONG_PTR>(hStreamHandle);
+    if (handle != CAPTURE_STREAM_COLOR + 1 && handle != CAPTURE_STREAM_DEPTH + 1)
+    {
+        return E_INVALIDARG;
+    }
+
+    CaptureStream stream = static_cast<CaptureStream>(handle - 1);
+    const CaptureIndexEntry* pEntry = NULL;
+
+    HRESULT hr = ReadNextFrame(stream, &pEntry);
+    if (hr == E_NUI_FRAME_NO_DATA && waitMillis > 0 && m_streams[stream].hNextFrameEvent)
+    {
+        WaitForSingleObject(m_streams[stream].hNextFrameEvent, waitMillis);
+        hr = ReadNextFrame(stream, &pEntry);
+    }
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Raw frames point into the read only mapping, which stays valid while the source exists
+    const CaptureRecordHeader& header = pEntry->header;
+    BYTE* pBits = const_cast<BYTE*>(m_pView + pEntry->payloadOffset);
+    if (header.encoding == CAPTURE_ENCODING_DEPTH_CODEC)
+    {
+        DWORD width, height;
+        NuiImageResolutionToSize(m_fileHeader.depthResolution, width, height);
+
+        std::vector<BYTE>& decodeBuffer = m_streams[stream].decodeBuffer;
+        decodeBuffer.resize(header.rawSize);
+        hr = DepthCodec::Decode(pBits, header.size, decodeBuffer.data(), header.pitch, width, height);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        pBits = decodeBuffer.data();
+    }
+
+    ZeroMemory(&pFrame->imageFrame, sizeof(pFrame->imageFrame));
+    pFrame->pBits = pBits;
+    pFrame->size = header.rawSize;
+    pFrame->pitch = header.pitch;
+    pFrame->timestamp.QuadPart = header.timestamp;
+    pFrame->frameNumber = header.frameNumber;
+
+    pFrame->imageFrame.liTimeStamp = pFrame->timestamp;
+    pFrame->imageFrame.dwFrameNumber = pFrame->frameNumber;
+    pFrame->imageFrame.eResolution = (stream == CAPTURE_STREAM_COLOR) ? m_fileHeader.colorResolution : m_fileHeader.depthResolution;
+
+    return S_OK;
+}
+
+/// <summary>
+/// Releases a frame returned by GetNextImageFrame
+/// </summary>
+/// <param name="hStreamHandle">stream the frame came from</param>
+/// <param name="pFrame">frame to release</param>
+/// <returns>S_OK</returns>
+HRESULT ReplayFrameSource::ReleaseImageFrame(HANDLE hStreamHandle, SourceFrame* pFrame)
+{
+    UNREFERENCED_PARAMETER(hStreamHandle);
+
+    // The data belongs to the mapping or the stream's decode buffer, nothing to release
+    pFrame->pBits = NULL;
+
+    return S_OK;
+}
+
+/// <summary>
+/// Gets the next recorded skeleton frame, which was smoothed when it was recorded
+/// </summary>
+/// <param name="waitMillis">number of milliseconds to wait</param>
+/// <param name="pSkeletonFrame">pointer in which to return the frame</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT ReplayFrameSource::GetNextSkeletonFrame(DWORD waitMillis, NUI_SKELETON_FRAME* pSkeletonFrame)
+{
+    const CaptureIndexEntry* pEntry = NULL;
+
+    HRESULT hr = ReadNextFrame(CAPTURE_STREAM_SKELETON, &pEntry);
+    if (hr == E_NUI_FRAME_NO_DATA && waitMillis > 0 && m_streams[CAPTURE_STREAM_SKELETON].hNextFrameEvent)
+    {
+        WaitForSingleObject(m_streams[CAPTURE_STREAM_SKELETON].hNextFrameEvent, waitMillis);
+        hr = ReadNextFrame(CAPTURE_STREAM_SKELETON, &pEntry);
+    }
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    memcpy_s(pSkeletonFrame, sizeof(NUI_SKELETON_FRAME), m_pView + pEntry->payloadOffset, sizeof(NUI_SKELETON_FRAME));
+
+    return S_OK;
+}
+
+/// <summary>
+/// A replay has no sensor behind it
+/// </summary>
+/// <returns>NULL</returns>
+BSTR ReplayFrameSource::GetDeviceConnectionId() const
+{
+    return NULL;
+}
+
+/// <summary>
+/// Thread that publishes frames at their recorded times, calls class instance thread processor
+/// </summary>
+/// <param name="lpParam">instance pointer</param>
+/// <returns>0</returns>
+DWORD WINAPI ReplayFrameSource::PacingThread(LPVOID lpParam)
+{
+    ReplayFrameSource* pThis = reinterpret_cast<ReplayFrameSource*>(lpParam);
+    return pThis->PacingThread();
+}
+
+/// <summary>
+/// Thread that publishes frames at their recorded times
+/// </summary>
+/// <returns>0</returns>
+DWORD WINAPI ReplayFrameSource::PacingThread()
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    do
+    {
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+        LONGLONG firstTimestamp = m_records.front().header.timestamp;
+
+        for (size_t i = 0; i < m_records.size(); ++i)
+        {
+            const CaptureRecordHeader& header = m_records[i].header;
+
+            // Wait until the frame is due, relative to the first frame of the pass
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            LONGLONG elapsedMillis = (now.QuadPart - start.QuadPart) * 1000 / frequency.QuadPart;
+            LONGLONG dueMillis = header.timestamp - firstTimestamp;
+            DWORD waitMillis = (dueMillis > elapsedMillis) ? static_cast<DWORD>(dueMillis - elapsedMillis) : 0;
+
+            if (WaitForSingleObject(m_hStopEvent, waitMillis) == WAIT_OBJECT_0)
+            {
+                return 0;
+            }
+
+            ReplayStream& stream = m_streams[header.stream];
+            InterlockedIncrement(&stream.published);
+            if (stream.hNextFrameEvent)
+            {
+                SetEvent(stream.hNextFrameEvent);
+            }
+        }
+    } while (m_isLooping);
+
+    return 0;
+}
+
+/// <summary>
+/// Checks that a record is one this source can replay and lies within the given end
+/// </summary>
+/// <param name="entry">record to check</param>
+/// <param name="endOffset">file offset its payload must end before</param>
+/// <returns>true if the record is valid, false otherwise</returns>
+bool ReplayFrameSource::IsValidRecord(const CaptureIndexEntry& entry, LONGLONG endOffset) const
+{
+    const CaptureRecordHeader& header = entry.header;
+    if (header.stream >= CAPTURE_STREAM_COUNT || header.size < 0 ||
+        entry.payloadOffset < CAPTURE_RECORD_ALIGNMENT || entry.payloadOffset + header.size > endOffset)
+    {
+        return false;
+    }
+
+    if (header.stream == CAPTURE_STREAM_SKELETON)
+    {
+        return header.encoding == CAPTURE_ENCODING_RAW && header.size == sizeof(NUI_SKELETON_FRAME);
+    }
+
+    if (header.encoding == CAPTURE_ENCODING_RAW)
+    {
+        return header.rawSize == header.size;
+    }
+
+    // Encoded depth decodes to whole rows of the recorded resolution
+    DWORD width, height;
+    NuiImageResolutionToSize(m_fileHeader.depthResolution, width, height);
+    return header.encoding == CAPTURE_ENCODING_DEPTH_CODEC && header.stream == CAPTURE_STREAM_DEPTH &&
+        header.pitch >= static_cast<INT>(width * sizeof(USHORT)) && static_cast<LONGLONG>(header.pitch) * height == header.rawSize;
+}
+
+/// <summary>
+/// Loads the frame index written at the end of a closed capture file
+/// </summary>
+/// <returns>true if the file has a valid index, false otherwise</returns>
+bool ReplayFrameSource::LoadIndex()
+{
+    LONGLONG footerOffset = m_fileSize - static_cast<LONGLONG>(sizeof(CaptureFileFooter));
+    if (footerOffset < CAPTURE_RECORD_ALIGNMENT)
+    {
+        return false;
+    }
+
+    CaptureFileFooter footer;
+    memcpy(&footer, m_pView + footerOffset, sizeof(footer));
+    if (footer.magic != CAPTURE_INDEX_MAGIC || footer.indexOffset < CAPTURE_RECORD_ALIGNMENT ||
+        footer.indexOffset + static_cast<LONGLONG>(footer.recordCount) * sizeof(CaptureIndexEntry) != footerOffset)
+    {
+        return false;
+    }
+
+    m_records.resize(footer.recordCount);
+    if (footer.recordCount > 0)
+    {
+        memcpy(m_records.data(), m_pView + footer.indexOffset, footer.recordCount * sizeof(CaptureIndexEntry));
+    }
+
+    // Reject the whole index if any entry points outside the records
+    for (size_t i = 0; i < m_records.size(); ++i)
+    {
+        if (!IsValidRecord(m_records[i], footer.indexOffset))
+        {
+            m_records.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Indexes the records by walking the file, for recordings that were cut short.
+/// Stops at the first incomplete record.
+/// </summary>
+void ReplayFrameSource::ScanRecords()
+{
+    m_records.clear();
+
+    CaptureIndexEntry entry;
+    LONGLONG offset = AlignCaptureOffset(sizeof(CaptureFileHeader));
+    while (offset + CAPTURE_RECORD_ALIGNMENT <= m_fileSize)
+    {
+        memcpy(&entry.header, m_pView + offset, sizeof(entry.header));
+        entry.payloadOffset = offset + CAPTURE_RECORD_ALIGNMENT;
+
+        if (!IsValidRecord(entry, m_fileSize))
+        {
+            break;
+        }
+
+        m_records.push_back(entry);
+        offset = AlignCaptureOffset(entry.payloadOffset + entry.header.size);
+    }
+}
+
+/// <summary>
+/// Gets the next frame of a stream. In real time mode this is the latest published
+/// frame, frames the consumer was too slow for are skipped like on the sensor.
+/// </summary>
+/// <param name="stream">stream to read</param>
+/// <param name="ppEntry">pointer in which to return the record of the frame</param>
+/// <returns>S_OK if successful, E_NUI_FRAME_NO_DATA if no frame is pending, an error code otherwise</returns>
+HRESULT ReplayFrameSource::ReadNextFrame(CaptureStream stream, const CaptureIndexEntry** ppEntry)
+{
+    ReplayStream& replayStream = m_streams[stream];
+    LONG recordCount = static_cast<LONG>(replayStream.records.size());
+    if (recordCount == 0)
+    {
+        return E_NUI_FRAME_NO_DATA;
+    }
+
+    // Find the sequence number of the frame to hand out
+    LONG sequence;
+    if (m_isRealTime)
+    {
+        sequence = replayStream.published;
+        if (sequence <= replayStream.consumed)
+        {
+            return E_NUI_FRAME_NO_DATA;
+        }
+    }
+    else
+    {
+        if (!m_isLooping && replayStream.consumed >= recordCount)
+        {
+            return E_NUI_FRAME_NO_DATA;
+        }
+        sequence = replayStream.consumed + 1;
+    }
+
+    const CaptureIndexEntry& entry = m_records[replayStream.records[(sequence - 1) % recordCount]];
+    replayStream.consumed = sequence;
+
+    // Keep the event signalled only while frames are pending
+    if (replayStream.hNextFrameEvent)
+    {
+        if (m_isRealTime)
+        {
+            ResetEvent(replayStream.hNextFrameEvent);
+            if (replayStream.published > replayStream.consumed)
+            {
+                SetEvent(replayStream.hNextFrameEvent);
+            }
+        }
+        else if (!m_isLooping && replayStream.consumed >= recordCount)
+        {
+            ResetEvent(replayStream.hNextFrameEvent);
+        }
+    }
+
+    CheckFinished();
+
+    *ppEntry = &entry;
+    return S_OK;
+}
+
+/// <summary>
+/// Signals the finished event if every open image stream has been read to the end
+/// </summary>
+void ReplayFrameSource::CheckFinished()
+{
+    if (m_isLooping)
+    {
+        return;
+    }
+
+    bool anyOpen = false;
+    for (int i = CAPTURE_STREAM_COLOR; i <= CAPTURE_STREAM_DEPTH; ++i)
+    {
+        const ReplayStream& replayStream = m_streams[i];
+        if (!replayStream.hNextFrameEvent)
+        {
+            continue;
+        }
+
+        anyOpen = true;
+        if (replayStream.consumed < static_cast<LONG>(replayStream.records.size()))
+        {
+            return;
+        }
+    }
+
+    if (anyOpen)
+    {
+        SetEvent(m_hFinishedEvent);
+    }
+}
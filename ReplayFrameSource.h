@@ -0,0 +1,153 @@
+#pragma once
+
+#include "FrameSource.h"
+#include "CaptureFile.h"
+#include <vector>
+
+namespace Microsoft {
+    namespace KinectBridge {
+        /// <summary>
+        /// Frame source that replays a capture file written by CaptureWriter, either paced
+        /// by the recorded timestamps or as fast as the consumer reads frames. The file is
+        /// mapped into memory and raw frames are handed out in place, without copying.
+        /// Encoded depth frames are decoded into a buffer of the stream.
+        /// </summary>
+        class ReplayFrameSource : public IFrameSource
+        {
+        public:
+            /// <summary>
+            /// Constructor
+            /// </summary>
+            ReplayFrameSource();
+
+            /// <summary>
+            /// Destructor
+            /// </summary>
+            ~ReplayFrameSource();
+
+            /// <summary>
+            /// Opens and maps a capture file and loads its frame index
+            /// </summary>
+            /// <param name="path">path of the capture file</param>
+            /// <param name="realTime">true to pace frames by their timestamps, false to replay as fast as they are read</param>
+            /// <param name="loop">true to restart from the first frame at the end of the file</param>
+            /// <returns>S_OK if successful, an error code otherwise</returns>
+            HRESULT Open(LPCWSTR path, bool realTime, bool loop);
+
+            /// <summary>
+            /// Gets the recorded color resolution
+            /// </summary>
+            /// <returns>color resolution of the capture file</returns>
+            NUI_IMAGE_RESOLUTION GetColorResolution() const;
+
+            /// <summary>
+            /// Gets the recorded depth resolution
+            /// </summary>
+            /// <returns>depth resolution of the capture file</returns>
+            NUI_IMAGE_RESOLUTION GetDepthResolution() const;
+
+            /// <summary>
+            /// Gets an event signalled once every open image stream has been read to the end.
+            /// Never signalled when looping.
+            /// </summary>
+            /// <returns>handle of the event</returns>
+            HANDLE GetFinishedHandle() const;
+
+            HRESULT Initialize(DWORD nuiInitFlags) override;
+            void Shutdown() override;
+            HRESULT OpenImageStream(NUI_IMAGE_TYPE imageType, NUI_IMAGE_RESOLUTION resolution, DWORD imageFlags, HANDLE hNextFrameEvent, HANDLE* phStreamHandle) override;
+            HRESULT SetImageStreamFlags(HANDLE hStreamHandle, DWORD imageFlags) override;
+            HRESULT EnableSkeletonTracking(HANDLE hNextFrameEvent, DWORD trackingFlags) override;
+            HRESULT GetNextImageFrame(HANDLE hStreamHandle, DWORD waitMillis, SourceFrame* pFrame) override;
+            HRESULT ReleaseImageFrame(HANDLE hStreamHandle, SourceFrame* pFrame) override;
+            HRESULT GetNextSkeletonFrame(DWORD waitMillis, NUI_SKELETON_FRAME* pSkeletonFrame) override;
+            BSTR GetDeviceConnectionId() const override;
+
+        private:
+            // Replay state of one recorded stream
+            struct ReplayStream
+            {
+                // Indices into m_records of the stream's frames, in file order
+                std::vector<size_t> records;
+
+                // Event of the consumer, NULL while the stream is closed
+                HANDLE hNextFrameEvent;
+
+                // Sequence numbers of the last published and last consumed frames
+                volatile LONG published;
+                LONG consumed;
+
+                // Decoded payload of the frame handed out last, for encoded frames
+                std::vector<BYTE> decodeBuffer;
+            };
+
+            /// <summary>
+            /// Thread that publishes frames at their recorded times, calls class instance thread processor
+            /// </summary>
+            /// <param name="lpParam">instance pointer</param>
+            /// <returns>0</returns>
+            static DWORD WINAPI PacingThread(LPVOID lpParam);
+
+            /// <summary>
+            /// Thread that publishes frames at their recorded times
+            /// </summary>
+            /// <returns>0</returns>
+            DWORD WINAPI PacingThread();
+
+            /// <summary>
+            /// Checks that a record is one this source can replay and lies within the given end
+            /// </summary>
+            /// <param name="entry">record to check</param>
+            /// <param name="endOffset">file offset its payload must end before</param>
+            /// <returns>true if the record is valid, false otherwise</returns>
+            bool IsValidRecord(const CaptureIndexEntry& entry, LONGLONG endOffset) const;
+
+            /// <summary>
+            /// Loads the frame index written at the end of a closed capture file
+            /// </summary>
+            /// <returns>true if the file has a valid index, false otherwise</returns>
+            bool LoadIndex();
+
+            /// <summary>
+            /// Indexes the records by walking the file, for recordings that were cut short.
+            /// Stops at the first incomplete record.
+            /// </summary>
+            void ScanRecords();
+
+            /// <summary>
+            /// Gets the next frame of a stream
+            /// </summary>
+            /// <param name="stream">stream to read</param>
+            /// <param name="ppEntry">pointer in which to return the record of the frame</param>
+            /// <returns>S_OK if successful, E_NUI_FRAME_NO_DATA if no frame is pending, an error code otherwise</returns>
+            HRESULT ReadNextFrame(CaptureStream stream, const CaptureIndexEntry** ppEntry);
+
+            /// <summary>
+            /// Signals the finished event if every open image stream has been read to the end
+            /// </summary>
+            void CheckFinished();
+
+            // Capture file, mapped read only for the lifetime of the source
+            HANDLE m_hFile;
+            HANDLE m_hMapping;
+            const BYTE* m_pView;
+            LONGLONG m_fileSize;
+            CaptureFileHeader m_fileHeader;
+            std::vector<CaptureIndexEntry> m_records;
+
+            // Per stream replay state
+            ReplayStream m_streams[CAPTURE_STREAM_COUNT];
+
+            // Replay settings
+            bool m_isRealTime;
+            bool m_isLooping;
+
+            // Pacing thread handles
+            HANDLE m_hPacingThread;
+            HANDLE m_hStopEvent;
+
+            // Signalled when the replay has been read to the end
+            HANDLE m_hFinishedEvent;
+        };
+    }
+}
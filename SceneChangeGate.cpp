@@ -0,0 +1,226 @@
+#include "SceneChangeGate.h"
+#include "SimdSupport.h"
+#include <opencv2/imgproc/types_c.h>
+#include <immintrin.h>
+
+using namespace Microsoft::KinectBridge;
+
+namespace
+{
+    // Change counters, all take two buffers, a count of bytes and the threshold
+    typedef size_t (*CountFunc)(const BYTE* pA, const BYTE* pB, size_t count, BYTE threshold);
+
+    size_t CountChangedScalar(const BYTE* pA, const BYTE* pB, size_t count, BYTE threshold)
+    {
+        size_t changed = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            int difference = pA[i] - pB[i];
+            changed += (difference > threshold || -difference > threshold) ? 1 : 0;
+        }
+        return changed;
+    }
+
+    // Blocks of bytes counted into 8 bit lanes before the lanes are summed, so no lane overflows
+    const size_t LANE_BLOCKS = 255;
+
+    size_t CountChangedSse2(const BYTE* pA, const BYTE* pB, size_t count, BYTE threshold)
+    {
+        const __m128i limit = _mm_set1_epi8(static_cast<char>(threshold));
+        const __m128i one = _mm_set1_epi8(1);
+        const __m128i zero = _mm_setzero_si128();
+
+        size_t changed = 0;
+        size_t i = 0;
+        while (i + 16 <= count)
+        {
+            // Each lane counts the changed bytes at its position, 1 or 0 per block
+            __m128i lanes = zero;
+            for (size_t block = 0; block < LANE_BLOCKS && i + 16 <= count; ++block, i += 16)
+            {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pA + i));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pB + i));
+                __m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+                lanes = _mm_add_epi8(lanes, _mm_min_epu8(_mm_subs_epu8(difference, limit), one));
+            }
+
+            __m128i sums = _mm_sad_epu8(lanes, zero);
+            changed += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+        }
+
+        return changed + CountChangedScalar(pA + i, pB + i, count - i, threshold);
+    }
+
+    size_t CountChangedAvx2(const BYTE* pA, const BYTE* pB, size_t count, BYTE threshold)
+    {
+        const __m256i limit = _mm256_set1_epi8(static_cast<char>(threshold));
+        const __m256i one = _mm256_set1_epi8(1);
+        const __m256i zero = _mm256_setzero_si256();
+
+        size_t changed = 0;
+        size_t i = 0;
+        while (i + 32 <= count)
+        {
+            __m256i lanes = zero;
+            for (size_t block = 0; block < LANE_BLOCKS && i + 32 <= count; ++block, i += 32)
+            {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pA + i));
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pB + i));
+                __m256i difference = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+                lanes = _mm256_add_epi8(lanes, _mm256_min_epu8(_mm256_subs_epu8(difference, limit), one));
+            }
+
+            // The four sums are folded into two as in the SSE2 path, 32 bit builds have no 64 bit extract
+            __m256i sums = _mm256_sad_epu8(lanes, zero);
+            __m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+            changed += _mm_cvtsi128_si32(halves) + _mm_cvtsi128_si32(_mm_srli_si128(halves, 8));
+        }
+
+        return changed + CountChangedSse2(pA + i, pB + i, count - i, threshold);
+    }
+}
+
+/// <summary>
+/// Constructor, the gate lets every frame through until a threshold is set
+/// </summary>
+SceneChangeGate::SceneChangeGate() :
+    m_threshold(0.0),
+    m_pixelThreshold(DEFAULT_PIXEL_THRESHOLD),
+    m_hasReference(false),
+    m_hitCount(0),
+    m_missCount(0)
+{
+}
+
+/// <summary>
+/// Sets the region of the frames to watch
+/// </summary>
+/// <param name="region">region in frame pixels, empty for the whole frame</param>
+void SceneChangeGate::SetRegion(Rect region)
+{
+    m_region = region;
+    Reset();
+}
+
+/// <summary>
+/// Sets the fraction of the thumbnail pixels that has to change for a frame to be let through
+/// </summary>
+/// <param name="changedFraction">fraction from 0 to 1, 0 or less to let every frame through</param>
+void SceneChangeGate::SetThreshold(double changedFraction)
+{
+    m_threshold = changedFraction;
+    Reset();
+}
+
+/// <summary>
+/// Returns whether the gate compares the frames
+/// </summary>
+/// <returns>true if a threshold is set, false if every frame is let through</returns>
+bool SceneChangeGate::IsEnabled() const
+{
+    return m_threshold > 0.0;
+}
+
+/// <summary>
+/// Compares a frame with the last frame let through, which it replaces if it has changed
+/// </summary>
+/// <param name="frame">frame with 1 or 4 channels of 8 bits</param>
+/// <returns>true if the frame has changed or nothing is known to compare with, false otherwise</returns>
+bool SceneChangeGate::HasChanged(const Mat& frame)
+{
+    if (!IsEnabled())
+    {
+        return true;
+    }
+
+    if (frame.depth() != CV_8U || (frame.channels() != 1 && frame.channels() != 4))
+    {
+        ++m_missCount;
+        return true;
+    }
+
+    // The region is clipped to the frame, all of it if nothing is left
+    Rect region = m_region & Rect(0, 0, frame.cols, frame.rows);
+    if (region.area() == 0)
+    {
+        region = Rect(0, 0, frame.cols, frame.rows);
+    }
+
+    // Area averaging also evens out the sensor noise
+    Size thumbnailSize(region.width / DECIMATION, region.height / DECIMATION);
+    if (thumbnailSize.area() == 0)
+    {
+        ++m_missCount;
+        return true;
+    }
+
+    if (frame.channels() == 4)
+    {
+        resize(frame(region), m_decimated, thumbnailSize, 0, 0, INTER_AREA);
+        cvtColor(m_decimated, m_thumbnail, CV_RGBA2GRAY);
+    }
+    else
+    {
+        resize(frame(region), m_thumbnail, thumbnailSize, 0, 0, INTER_AREA);
+    }
+
+    // Compared with the last frame let through, so slow changes add up until they count
+    if (m_hasReference && m_reference.size() == m_thumbnail.size() && m_thumbnail.isContinuous() && m_reference.isContinuous())
+    {
+        size_t changed = CountChanged(m_thumbnail.data, m_reference.data, m_thumbnail.total(), m_pixelThreshold);
+        if (changed <= m_threshold * m_thumbnail.total())
+        {
+            ++m_hitCount;
+            return false;
+        }
+    }
+
+    // The buffers keep their memory, the current thumbnail becomes the reference
+    std::swap(m_thumbnail, m_reference);
+    m_hasReference = true;
+
+    ++m_missCount;
+    return true;
+}
+
+/// <summary>
+/// Forgets the last frame let through, so the next frame is let through
+/// </summary>
+void SceneChangeGate::Reset()
+{
+    m_hasReference = false;
+}
+
+/// <summary>
+/// Gets the number of frames held back as unchanged since construction
+/// </summary>
+/// <returns>number of hits</returns>
+LONG SceneChangeGate::GetHitCount() const
+{
+    return m_hitCount;
+}
+
+/// <summary>
+/// Gets the number of frames let through while enabled since construction
+/// </summary>
+/// <returns>number of misses</returns>
+LONG SceneChangeGate::GetMissCount() const
+{
+    return m_missCount;
+}
+
+/// <summary>
+/// Counts the bytes of two buffers that differ by more than a threshold
+/// </summary>
+/// <param name="pA">first buffer</param>
+/// <param name="pB">second buffer</param>
+/// <param name="count">number of bytes in each buffer</param>
+/// <param name="threshold">largest difference not counted</param>
+/// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+/// <returns>number of differing bytes</returns>
+size_t SceneChangeGate::CountChanged(const BYTE* pA, const BYTE* pB, size_t count, BYTE threshold, SimdPath path /* = PATH_AUTO */)
+{
+    SimdPath supportedPath = GetSupportedPath(path, PATHS);
+    CountFunc countFunc = supportedPath == PATH_AVX2 ? CountChangedAvx2 : supportedPath == PATH_SSE2 ? CountChangedSse2 : CountChangedScalar;
+    return countFunc(pA, pB, count, threshold);
+}
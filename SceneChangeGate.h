@@ -0,0 +1,111 @@
+#pragma once
+
+#include "windows.h"
+#include "SimdSupport.h"
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#pragma warning(pop)
+
+using namespace cv;
+
+namespace Microsoft {
+    namespace KinectBridge {
+        /// <summary>
+        /// Tells whether a region of the frames has changed since the last frame that was let
+        /// through, so the detection can be skipped on a static scene. The region is decimated
+        /// to a small gray thumbnail and compared with the thumbnail of the last frame let through,
+        /// counting the pixels that differ by more than a noise threshold with SSE2 or AVX2.
+        /// </summary>
+        class SceneChangeGate
+        {
+        public:
+            // Constants:
+            // Code paths of the comparison, a set of bits 1 << path
+            static const UINT PATHS = (1 << PATH_SCALAR) | (1 << PATH_SSE2) | (1 << PATH_AVX2);
+
+            // Pixels of the region averaged into one thumbnail pixel, across and down
+            static const int DECIMATION = 4;
+
+            // Gray levels a thumbnail pixel may drift by without counting as changed
+            static const BYTE DEFAULT_PIXEL_THRESHOLD = 12;
+
+            // Functions:
+            /// <summary>
+            /// Constructor, the gate lets every frame through until a threshold is set
+            /// </summary>
+            SceneChangeGate();
+
+            /// <summary>
+            /// Sets the region of the frames to watch
+            /// </summary>
+            /// <param name="region">region in frame pixels, empty for the whole frame</param>
+            void SetRegion(Rect region);
+
+            /// <summary>
+            /// Sets the fraction of the thumbnail pixels that has to change for a frame to be let through
+            /// </summary>
+            /// <param name="changedFraction">fraction from 0 to 1, 0 or less to let every frame through</param>
+            void SetThreshold(double changedFraction);
+
+            /// <summary>
+            /// Returns whether the gate compares the frames
+            /// </summary>
+            /// <returns>true if a threshold is set, false if every frame is let through</returns>
+            bool IsEnabled() const;
+
+            /// <summary>
+            /// Compares a frame with the last frame let through, which it replaces if it has changed
+            /// </summary>
+            /// <param name="frame">frame with 1 or 4 channels of 8 bits</param>
+            /// <returns>true if the frame has changed or nothing is known to compare with, false otherwise</returns>
+            bool HasChanged(const Mat& frame);
+
+            /// <summary>
+            /// Forgets the last frame let through, so the next frame is let through
+            /// </summary>
+            void Reset();
+
+            /// <summary>
+            /// Gets the number of frames held back as unchanged since construction
+            /// </summary>
+            /// <returns>number of hits</returns>
+            LONG GetHitCount() const;
+
+            /// <summary>
+            /// Gets the number of frames let through while enabled since construction
+            /// </summary>
+            /// <returns>number of misses</returns>
+            LONG GetMissCount() const;
+
+            /// <summary>
+            /// Counts the bytes of two buffers that differ by more than a threshold
+            /// </summary>
+            /// <param name="pA">first buffer</param>
+            /// <param name="pB">second buffer</param>
+            /// <param name="count">number of bytes in each buffer</param>
+            /// <param name="threshold">largest difference not counted</param>
+            /// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+            /// <returns>number of differing bytes</returns>
+            static size_t CountChanged(const BYTE* pA, const BYTE* pB, size_t count, BYTE threshold, SimdPath path = PATH_AUTO);
+
+        private:
+            // Variables:
+            Rect m_region;
+            double m_threshold;
+            BYTE m_pixelThreshold;
+
+            // Thumbnails of the current frame and of the last frame let through, reused between frames
+            Mat m_decimated;
+            Mat m_thumbnail;
+            Mat m_reference;
+            bool m_hasReference;
+
+            LONG m_hitCount;
+            LONG m_missCount;
+        };
+    }
+}
@@ -0,0 +1,89 @@
+#include "ScratchArena.h"
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="bufferCount">number of buffers, the ids handed to Get are below it</param>
+ScratchArena::ScratchArena(int bufferCount) :
+    m_buffers(bufferCount),
+    m_allocationCount(0)
+{
+}
+
+/// <summary>
+/// Gets a scratch matrix, reallocating it if it does not have the given size and type.
+/// The contents are left from its previous use.
+/// </summary>
+/// <param name="id">caller defined buffer id, below the number of buffers</param>
+/// <param name="size">size of the matrix</param>
+/// <param name="type">Mat type of the matrix</param>
+/// <returns>scratch matrix owned by the arena</returns>
+Mat& ScratchArena::Get(int id, Size size, int type)
+{
+    Mat& buffer = m_buffers[id];
+    if (buffer.size() != size || buffer.type() != type)
+    {
+        buffer.create(size, type);
+        ++m_allocationCount;
+    }
+
+    return buffer;
+}
+
+/// <summary>
+/// Releases the memory of all scratch matrices, the buffers themselves are kept
+/// </summary>
+void ScratchArena::Clear()
+{
+    for (size_t i = 0; i < m_buffers.size(); ++i)
+    {
+        m_buffers[i].release();
+    }
+}
+
+/// <summary>
+/// Gets the number of times a scratch matrix has been (re)allocated since construction
+/// </summary>
+/// <returns>number of allocations</returns>
+LONG ScratchArena::GetAllocationCount() const
+{
+    return m_allocationCount;
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+CountingMatAllocator::CountingMatAllocator() :
+    m_allocationCount(0)
+{
+}
+
+UMatData* CountingMatAllocator::allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, UMatUsageFlags usageFlags) const
+{
+    // Headers over user data do not allocate
+    if (!data)
+    {
+        InterlockedIncrement(&m_allocationCount);
+    }
+
+    return Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+}
+
+bool CountingMatAllocator::allocate(UMatData* u, AccessFlag accessFlags, UMatUsageFlags usageFlags) const
+{
+    return Mat::getStdAllocator()->allocate(u, accessFlags, usageFlags);
+}
+
+void CountingMatAllocator::deallocate(UMatData* u) const
+{
+    Mat::getStdAllocator()->deallocate(u);
+}
+
+/// <summary>
+/// Gets the number of Mat allocations made through the allocator
+/// </summary>
+/// <returns>number of allocations</returns>
+LONG CountingMatAllocator::GetAllocationCount() const
+{
+    return m_allocationCount;
+}
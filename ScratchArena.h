@@ -0,0 +1,88 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#pragma warning(pop)
+
+using namespace cv;
+
+/// <summary>
+/// Hands out the scratch matrices of the per-frame processing. Each buffer keeps its
+/// memory between frames and is only reallocated when the requested size or type changes,
+/// so once the resolution settles the filters run without allocating. The number of buffers
+/// is fixed on construction, so the matrices never move and callers may hold several at once.
+/// </summary>
+class ScratchArena
+{
+public:
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="bufferCount">number of buffers, the ids handed to Get are below it</param>
+    explicit ScratchArena(int bufferCount);
+
+    /// <summary>
+    /// Gets a scratch matrix, reallocating it if it does not have the given size and type.
+    /// The contents are left from its previous use.
+    /// </summary>
+    /// <param name="id">caller defined buffer id, below the number of buffers</param>
+    /// <param name="size">size of the matrix</param>
+    /// <param name="type">Mat type of the matrix</param>
+    /// <returns>scratch matrix owned by the arena</returns>
+    Mat& Get(int id, Size size, int type);
+
+    /// <summary>
+    /// Releases the memory of all scratch matrices, the buffers themselves are kept
+    /// </summary>
+    void Clear();
+
+    /// <summary>
+    /// Gets the number of times a scratch matrix has been (re)allocated since construction
+    /// </summary>
+    /// <returns>number of allocations</returns>
+    LONG GetAllocationCount() const;
+
+private:
+    // Variables:
+    // Scratch matrices by id, never resized after construction
+    std::vector<Mat> m_buffers;
+
+    // Number of (re)allocations
+    LONG m_allocationCount;
+};
+
+/// <summary>
+/// Mat allocator that counts the allocations made through it and hands the memory
+/// management to the standard allocator. Installed as the default allocator it counts
+/// every Mat allocation in the process.
+/// </summary>
+class CountingMatAllocator : public MatAllocator
+{
+public:
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    CountingMatAllocator();
+
+    UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag flags, UMatUsageFlags usageFlags) const override;
+    bool allocate(UMatData* u, AccessFlag accessFlags, UMatUsageFlags usageFlags) const override;
+    void deallocate(UMatData* u) const override;
+
+    /// <summary>
+    /// Gets the number of Mat allocations made through the allocator
+    /// </summary>
+    /// <returns>number of allocations</returns>
+    LONG GetAllocationCount() const;
+
+private:
+    // Variables:
+    // Number of allocations, incremented from any thread
+    mutable volatile LONG m_allocationCount;
+};
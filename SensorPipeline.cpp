@@ -0,0 +1,438 @@
+#include "SensorPipeline.h"
+
+using namespace Microsoft::KinectBridge;
+
+/// <summary>
+/// Constructor
+/// </summary>
+/// <param name="index">index of the pipeline, which selects its socket port and processor</param>
+SensorPipeline::SensorPipeline(UINT index) :
+    m_index(index),
+    m_frameInput(&m_frameHelper, &m_openCVHelper),
+    m_isSyncingFrames(false),
+    m_hReplayFinishedEvent(NULL),
+    m_hProcessStopEvent(NULL),
+    m_hProcessThread(NULL),
+    m_isUsingSocket(false),
+    m_colorFrameCount(0),
+    m_depthFrameCount(0),
+    m_startTime(0),
+    m_stopTime(0),
+    m_busyTime(0)
+{
+    // Skeletons are only drawn in the window, which pipelines have none of
+    m_frameHelper.SetNuiInitFlags(true, true, false);
+}
+
+/// <summary>
+/// Destructor
+/// </summary>
+SensorPipeline::~SensorPipeline()
+{
+    Stop();
+
+    if (m_hProcessThread)
+    {
+        CloseHandle(m_hProcessThread);
+    }
+
+    if (m_hProcessStopEvent)
+    {
+        CloseHandle(m_hProcessStopEvent);
+    }
+}
+
+/// <summary>
+/// Initializes the pipeline with a sensor, at the default resolutions
+/// </summary>
+/// <param name="pNuiSensor">sensor to acquire frames from</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT SensorPipeline::InitializeSensor(INuiSensor* pNuiSensor)
+{
+    m_frameHelper.SetColorFrameResolution(NUI_IMAGE_RESOLUTION_640x480);
+    m_frameHelper.SetDepthFrameResolution(NUI_IMAGE_RESOLUTION_640x480);
+
+    HRESULT hr = m_frameHelper.Initialize(pNuiSensor);
+    if (FAILED(hr))
+    {
+        m_frameHelper.UnInitialize();
+        return hr;
+    }
+
+    CreateImages();
+    return S_OK;
+}
+
+/// <summary>
+/// Initializes the pipeline with a replay, at the recorded resolutions
+/// </summary>
+/// <param name="path">path of the capture file</param>
+/// <param name="isRealTime">true to replay at the recorded pace, false as fast as frames are processed</param>
+/// <param name="isLooping">true to restart at the end of the recording</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT SensorPipeline::InitializeReplay(LPCWSTR path, bool isRealTime, bool isLooping)
+{
+    ReplayFrameSource* pReplaySource = new ReplayFrameSource();
+    HRESULT hr = pReplaySource->Open(path, isRealTime, isLooping);
+    if (FAILED(hr))
+    {
+        delete pReplaySource;
+        return hr;
+    }
+
+    // Streams have to be opened at the recorded resolutions
+    m_frameHelper.SetColorFrameResolution(pReplaySource->GetColorResolution());
+    m_frameHelper.SetDepthFrameResolution(pReplaySource->GetDepthResolution());
+
+    // The helper owns the replay source from here on
+    m_hReplayFinishedEvent = pReplaySource->GetFinishedHandle();
+    hr = m_frameHelper.Initialize(pReplaySource);
+    if (FAILED(hr))
+    {
+        m_frameHelper.UnInitialize();
+        m_hReplayFinishedEvent = NULL;
+        return hr;
+    }
+
+    CreateImages();
+    return S_OK;
+}
+
+/// <summary>
+/// Sets the depth band of the depth images
+/// </summary>
+/// <param name="minDepth">nearest depth in the band, in millimeters</param>
+/// <param name="maxDepth">farthest depth in the band, in millimeters</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the band is empty or beyond the depth range</returns>
+HRESULT SensorPipeline::SetDepthBand(USHORT minDepth, USHORT maxDepth)
+{
+    return m_frameHelper.SetDepthBand(minDepth, maxDepth);
+}
+
+/// <summary>
+/// Sets the color and depth filters to the ones corresponding to the given resource IDs
+/// </summary>
+/// <param name="colorFilterID">resource ID of the color filter</param>
+/// <param name="depthFilterID">resource ID of the depth filter</param>
+void SensorPipeline::SetFilters(int colorFilterID, int depthFilterID)
+{
+    m_openCVHelper.SetColorFilter(colorFilterID);
+    m_openCVHelper.SetDepthFilter(depthFilterID);
+}
+
+/// <summary>
+/// Sets the resolution the edge detection runs at
+/// </summary>
+/// <param name="pixelsPerCm">pixels per cm of table, 0 for the full rectified resolution</param>
+void SensorPipeline::SetRoiResolution(int pixelsPerCm)
+{
+    m_openCVHelper.SetRoiResolution(pixelsPerCm);
+}
+
+/// <summary>
+/// Sets how much of the workspace has to change for the edge detection to run again
+/// </summary>
+/// <param name="changedFraction">fraction of the workspace from 0 to 1, 0 or less to run the detection on every frame</param>
+void SensorPipeline::SetSceneGate(double changedFraction)
+{
+    m_openCVHelper.SetSceneGate(changedFraction);
+}
+
+/// <summary>
+/// Sets what the edge filters do while the tracker is paused after sending a target
+/// </summary>
+/// <param name="policy">pause policy</param>
+void SensorPipeline::SetPausePolicy(OpenCVHelper::PausePolicy policy)
+{
+    m_openCVHelper.SetPausePolicy(policy);
+}
+
+/// <summary>
+/// Sets the number of threads the blur, Canny and closing of the edge filters run on for each stream
+/// </summary>
+/// <param name="threadCount">number of threads, 1 to run the filters one after the other on the whole image</param>
+/// <returns>S_OK if successful, an error code if a thread could not be started</returns>
+HRESULT SensorPipeline::SetEdgeThreads(int threadCount)
+{
+    return m_openCVHelper.SetEdgeThreads(threadCount);
+}
+
+/// <summary>
+/// Fits the mapping of the rectified image to the arm's coordinates on the table to the pairs of a file
+/// </summary>
+/// <param name="path">path of the file</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT SensorPipeline::LoadTableCalibration(LPCWSTR path)
+{
+    return m_openCVHelper.LoadTableCalibration(path);
+}
+
+/// <summary>
+/// Loads the depth of the empty table the background filter learned in an earlier run
+/// </summary>
+/// <param name="path">path of the file</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT SensorPipeline::LoadDepthBackground(LPCWSTR path)
+{
+    return m_openCVHelper.LoadDepthBackground(path);
+}
+
+/// <summary>
+/// Saves the depth of the empty table the background filter has learned, once the pipeline is stopped
+/// </summary>
+/// <param name="path">path of the file to create</param>
+/// <returns>S_OK if successful, S_FALSE if nothing has been learned to save, an error code otherwise</returns>
+HRESULT SensorPipeline::SaveDepthBackground(LPCWSTR path) const
+{
+    return m_openCVHelper.SaveDepthBackground(path);
+}
+
+/// <summary>
+/// Loads the trapezoid of the workspace the sensor found in an earlier run, or finds it in the
+/// first frames and saves it if there is none to load or calibration is asked for
+/// </summary>
+/// <param name="path">path of the file, empty not to load or save the workspace</param>
+/// <param name="isCalibrating">true to find the workspace even if it can be loaded</param>
+void SensorPipeline::InitializeWorkspace(const std::wstring& path, bool isCalibrating)
+{
+    char name[32];
+    sprintf_s(name, "Sensor %u workspace", m_index);
+    m_frameInput.InitializeWorkspace(path, isCalibrating, name);
+}
+
+/// <summary>
+/// Sets whether only color and depth frames captured together are processed
+/// </summary>
+/// <param name="isSyncing">true to synchronize the frames</param>
+/// <param name="toleranceMillis">largest time difference between matched frames</param>
+void SensorPipeline::SetSynchronization(bool isSyncing, LONGLONG toleranceMillis)
+{
+    m_isSyncingFrames = isSyncing;
+    m_frameSynchronizer.SetTolerance(toleranceMillis);
+}
+
+/// <summary>
+/// Starts the processing thread
+/// </summary>
+/// <param name="useSocket">true to wait for a client on the pipeline's command socket</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT SensorPipeline::Start(bool useSocket)
+{
+    if (!m_frameHelper.IsInitialized())
+    {
+        return E_NUI_DEVICE_NOT_READY;
+    }
+
+    if (m_hProcessThread)
+    {
+        return S_OK;
+    }
+
+    m_isUsingSocket = useSocket;
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    m_startTime = now.QuadPart;
+    m_stopTime = 0;
+
+    m_hProcessStopEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    m_hProcessThread = CreateThread(NULL, 0, ProcessThread, this, 0, NULL);
+    if (!m_hProcessStopEvent || !m_hProcessThread)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Spread the pipelines over the processors, the scheduler may still move them
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    SetThreadIdealProcessor(m_hProcessThread, m_index % systemInfo.dwNumberOfProcessors);
+
+    return S_OK;
+}
+
+/// <summary>
+/// Stops the processing thread and waits for it to exit
+/// </summary>
+void SensorPipeline::Stop()
+{
+    if (!m_hProcessThread || m_stopTime)
+    {
+        return;
+    }
+
+    SetEvent(m_hProcessStopEvent);
+    WaitForSingleObject(m_hProcessThread, INFINITE);
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    m_stopTime = now.QuadPart;
+}
+
+/// <summary>
+/// Gets a handle signalled when the replay has been read to the end, or when the
+/// processing thread exits for a sensor
+/// </summary>
+/// <returns>handle to wait on, NULL if the pipeline has not been started</returns>
+HANDLE SensorPipeline::GetFinishedHandle() const
+{
+    if (!m_hProcessThread)
+    {
+        return NULL;
+    }
+
+    return m_hReplayFinishedEvent ? m_hReplayFinishedEvent : m_hProcessThread;
+}
+
+/// <summary>
+/// Gets the index of the pipeline
+/// </summary>
+/// <returns>index given on construction</returns>
+UINT SensorPipeline::GetIndex() const
+{
+    return m_index;
+}
+
+/// <summary>
+/// Gets the throughput of the pipeline, exact once it has been stopped
+/// </summary>
+/// <param name="pStats">pointer in which to return the statistics</param>
+void SensorPipeline::GetStats(SensorPipelineStats* pStats) const
+{
+    LARGE_INTEGER frequency, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+
+    LONGLONG stopTime = m_stopTime ? m_stopTime : now.QuadPart;
+    LONGLONG runTime = m_startTime ? stopTime - m_startTime : 0;
+
+    pStats->colorFrameCount = m_colorFrameCount;
+    pStats->depthFrameCount = m_depthFrameCount;
+    pStats->runSeconds = static_cast<double>(runTime) / frequency.QuadPart;
+    pStats->busySeconds = static_cast<double>(m_busyTime) / frequency.QuadPart;
+    pStats->matchedCount = m_isSyncingFrames ? m_frameSynchronizer.GetMatchedCount() : 0;
+    pStats->unmatchedCount = m_isSyncingFrames ? m_frameSynchronizer.GetDroppedCount() : 0;
+    pStats->scratchAllocationCount = m_openCVHelper.GetScratchAllocationCount();
+}
+
+/// <summary>
+/// Thread to handle frame processing, calls class instance thread processor
+/// </summary>
+/// <param name="lpParam">instance pointer</param>
+/// <returns>0</returns>
+DWORD WINAPI SensorPipeline::ProcessThread(LPVOID lpParam)
+{
+    // Use class instance thread processor
+    SensorPipeline* pThis = reinterpret_cast<SensorPipeline*>(lpParam);
+    return pThis->ProcessThread();
+}
+
+/// <summary>
+/// Thread to handle frame processing
+/// </summary>
+/// <returns>0</returns>
+DWORD WINAPI SensorPipeline::ProcessThread()
+{
+    // Initialize array of events to wait for
+    HANDLE hEvents[3] = {m_hProcessStopEvent, NULL, NULL};
+    m_frameHelper.GetColorHandle(hEvents + 1);
+    m_frameHelper.GetDepthHandle(hEvents + 2);
+
+    // Blocks until a client connects, only this pipeline waits
+    if (m_isUsingSocket)
+    {
+        m_socket.createSocket(BASE_SOCKET_PORT + m_index);
+    }
+
+    while (true)
+    {
+        // Wait for any event to be signalled
+        DWORD eventId = WaitForMultipleObjects(_countof(hEvents), hEvents, FALSE, 100);
+
+        // No events were signalled in time
+        if (WAIT_TIMEOUT == eventId)
+        {
+            continue;
+        }
+
+        // Stop event was signalled
+        if (WAIT_OBJECT_0 == eventId)
+        {
+            break;
+        }
+
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+
+        // Update color and depth frames
+        bool hasColorFrame = SUCCEEDED(m_frameHelper.UpdateColorFrame());
+        bool hasDepthFrame = SUCCEEDED(m_frameHelper.UpdateDepthFrame());
+
+        // Only process color and depth captured together
+        if (m_isSyncingFrames)
+        {
+            hasColorFrame = hasDepthFrame = m_frameHelper.SynchronizeFrames(&m_frameSynchronizer, hasColorFrame, hasDepthFrame, false);
+        }
+
+        // The trapezoid is only moved between frames, while no filter uses it
+        if (m_frameInput.IsCalibrating() && hasColorFrame && hasDepthFrame)
+        {
+            m_frameInput.CalibrateWorkspace();
+        }
+
+        if (hasColorFrame && SUCCEEDED(ProcessColorFrame()))
+        {
+            InterlockedIncrement(&m_colorFrameCount);
+        }
+
+        if (hasDepthFrame && SUCCEEDED(ProcessDepthFrame()))
+        {
+            InterlockedIncrement(&m_depthFrameCount);
+        }
+
+        QueryPerformanceCounter(&end);
+        m_busyTime += end.QuadPart - start.QuadPart;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Converts and filters the current color frame
+/// </summary>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT SensorPipeline::ProcessColorFrame()
+{
+    Mat colorImage;
+    HRESULT hr = m_frameInput.GetColorImage(&colorImage);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    return m_openCVHelper.ApplyColorFilter(&colorImage, &m_socket);
+}
+
+/// <summary>
+/// Converts and filters the current depth frame
+/// </summary>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT SensorPipeline::ProcessDepthFrame()
+{
+    Mat depthImage, depth;
+    HRESULT hr = m_frameInput.GetDepthImages(&depthImage, &depth);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    return m_openCVHelper.ApplyDepthFilter(&depthImage, &m_socket, depth);
+}
+
+/// <summary>
+/// Allocates the color and depth matrices at the stream resolutions
+/// </summary>
+void SensorPipeline::CreateImages()
+{
+    m_frameInput.CreateColorImage();
+    m_frameInput.CreateDepthImages();
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <Windows.h>
+#include <NuiApi.h>
+#include <string>
+
+#include "Socket.h"
+#include "OpenCVHelper.h"
+#include "FrameInput.h"
+#include "ReplayFrameSource.h"
+#include "FrameSynchronizer.h"
+
+/// <summary>
+/// Throughput of a sensor pipeline
+/// </summary>
+struct SensorPipelineStats
+{
+    // Number of frames processed
+    LONG colorFrameCount;
+    LONG depthFrameCount;
+
+    // Seconds the pipeline ran and seconds of that spent acquiring and processing frames
+    double runSeconds;
+    double busySeconds;
+
+    // Synchronizer statistics, zero when frames are not synchronized
+    LONG matchedCount;
+    LONG unmatchedCount;
+
+    // Number of times the filter scratch buffers were allocated
+    LONG scratchAllocationCount;
+};
+
+/// <summary>
+/// Acquires and processes the frames of one sensor or replay on its own thread. Each pipeline
+/// has its own frame helper, frame buffers, filters, tracker state and command socket, so one
+/// host can serve several workcells and the pipelines scale across cores without sharing locks.
+/// </summary>
+class SensorPipeline
+{
+public:
+    // Constants:
+    // Command socket port of the first pipeline, the following pipelines use the following ports
+    static const int BASE_SOCKET_PORT = 8888;
+
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    /// <param name="index">index of the pipeline, which selects its socket port and processor</param>
+    SensorPipeline(UINT index);
+
+    /// <summary>
+    /// Destructor
+    /// </summary>
+    ~SensorPipeline();
+
+    /// <summary>
+    /// Initializes the pipeline with a sensor, at the default resolutions
+    /// </summary>
+    /// <param name="pNuiSensor">sensor to acquire frames from</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT InitializeSensor(INuiSensor* pNuiSensor);
+
+    /// <summary>
+    /// Initializes the pipeline with a replay, at the recorded resolutions
+    /// </summary>
+    /// <param name="path">path of the capture file</param>
+    /// <param name="isRealTime">true to replay at the recorded pace, false as fast as frames are processed</param>
+    /// <param name="isLooping">true to restart at the end of the recording</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT InitializeReplay(LPCWSTR path, bool isRealTime, bool isLooping);
+
+    /// <summary>
+    /// Sets the depth band of the depth images
+    /// </summary>
+    /// <param name="minDepth">nearest depth in the band, in millimeters</param>
+    /// <param name="maxDepth">farthest depth in the band, in millimeters</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the band is empty or beyond the depth range</returns>
+    HRESULT SetDepthBand(USHORT minDepth, USHORT maxDepth);
+
+    /// <summary>
+    /// Sets the color and depth filters to the ones corresponding to the given resource IDs
+    /// </summary>
+    /// <param name="colorFilterID">resource ID of the color filter</param>
+    /// <param name="depthFilterID">resource ID of the depth filter</param>
+    void SetFilters(int colorFilterID, int depthFilterID);
+
+    /// <summary>
+    /// Sets the resolution the edge detection runs at
+    /// </summary>
+    /// <param name="pixelsPerCm">pixels per cm of table, 0 for the full rectified resolution</param>
+    void SetRoiResolution(int pixelsPerCm);
+
+    /// <summary>
+    /// Sets how much of the workspace has to change for the edge detection to run again
+    /// </summary>
+    /// <param name="changedFraction">fraction of the workspace from 0 to 1, 0 or less to run the detection on every frame</param>
+    void SetSceneGate(double changedFraction);
+
+    /// <summary>
+    /// Sets what the edge filters do while the tracker is paused after sending a target
+    /// </summary>
+    /// <param name="policy">pause policy</param>
+    void SetPausePolicy(OpenCVHelper::PausePolicy policy);
+
+    /// <summary>
+    /// Sets the number of threads the blur, Canny and closing of the edge filters run on for each stream
+    /// </summary>
+    /// <param name="threadCount">number of threads, 1 to run the filters one after the other on the whole image</param>
+    /// <returns>S_OK if successful, an error code if a thread could not be started</returns>
+    HRESULT SetEdgeThreads(int threadCount);
+
+    /// <summary>
+    /// Fits the mapping of the rectified image to the arm's coordinates on the table to the pairs of a file
+    /// </summary>
+    /// <param name="path">path of the file</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT LoadTableCalibration(LPCWSTR path);
+
+    /// <summary>
+    /// Loads the depth of the empty table the background filter learned in an earlier run
+    /// </summary>
+    /// <param name="path">path of the file</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT LoadDepthBackground(LPCWSTR path);
+
+    /// <summary>
+    /// Saves the depth of the empty table the background filter has learned, once the pipeline is stopped
+    /// </summary>
+    /// <param name="path">path of the file to create</param>
+    /// <returns>S_OK if successful, S_FALSE if nothing has been learned to save, an error code otherwise</returns>
+    HRESULT SaveDepthBackground(LPCWSTR path) const;
+
+    /// <summary>
+    /// Loads the trapezoid of the workspace the sensor found in an earlier run, or finds it in the
+    /// first frames and saves it if there is none to load or calibration is asked for
+    /// </summary>
+    /// <param name="path">path of the file, empty not to load or save the workspace</param>
+    /// <param name="isCalibrating">true to find the workspace even if it can be loaded</param>
+    void InitializeWorkspace(const std::wstring& path, bool isCalibrating);
+
+    /// <summary>
+    /// Sets whether only color and depth frames captured together are processed
+    /// </summary>
+    /// <param name="isSyncing">true to synchronize the frames</param>
+    /// <param name="toleranceMillis">largest time difference between matched frames</param>
+    void SetSynchronization(bool isSyncing, LONGLONG toleranceMillis);
+
+    /// <summary>
+    /// Starts the processing thread
+    /// </summary>
+    /// <param name="useSocket">true to wait for a client on the pipeline's command socket</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT Start(bool useSocket);
+
+    /// <summary>
+    /// Stops the processing thread and waits for it to exit
+    /// </summary>
+    void Stop();
+
+    /// <summary>
+    /// Gets a handle signalled when the replay has been read to the end, or when the
+    /// processing thread exits for a sensor
+    /// </summary>
+    /// <returns>handle to wait on, NULL if the pipeline has not been started</returns>
+    HANDLE GetFinishedHandle() const;
+
+    /// <summary>
+    /// Gets the index of the pipeline
+    /// </summary>
+    /// <returns>index given on construction</returns>
+    UINT GetIndex() const;
+
+    /// <summary>
+    /// Gets the throughput of the pipeline, exact once it has been stopped
+    /// </summary>
+    /// <param name="pStats">pointer in which to return the statistics</param>
+    void GetStats(SensorPipelineStats* pStats) const;
+
+private:
+    // Functions:
+    /// <summary>
+    /// Thread to handle frame processing, calls class instance thread processor
+    /// </summary>
+    /// <param name="lpParam">instance pointer</param>
+    /// <returns>0</returns>
+    static DWORD WINAPI ProcessThread(LPVOID lpParam);
+
+    /// <summary>
+    /// Thread to handle frame processing
+    /// </summary>
+    /// <returns>0</returns>
+    DWORD WINAPI ProcessThread();
+
+    /// <summary>
+    /// Converts and filters the current color frame
+    /// </summary>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT ProcessColorFrame();
+
+    /// <summary>
+    /// Converts and filters the current depth frame
+    /// </summary>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    HRESULT ProcessDepthFrame();
+
+    /// <summary>
+    /// Allocates the color and depth matrices at the stream resolutions
+    /// </summary>
+    void CreateImages();
+
+    // Variables:
+    UINT m_index;
+
+    // Helpers
+    Microsoft::KinectBridge::OpenCVFrameHelper m_frameHelper;
+    OpenCVHelper m_openCVHelper;
+    FrameInput m_frameInput;
+    Socket m_socket;
+
+    // Pairs color and depth frames by capture time when syncing
+    bool m_isSyncingFrames;
+    Microsoft::KinectBridge::FrameSynchronizer m_frameSynchronizer;
+
+    // Signalled when the replay has been read to the end, owned by the replay source
+    HANDLE m_hReplayFinishedEvent;
+
+    // Processing thread handles
+    HANDLE m_hProcessStopEvent;
+    HANDLE m_hProcessThread;
+    bool m_isUsingSocket;
+
+    // Number of frames processed
+    volatile LONG m_colorFrameCount;
+    volatile LONG m_depthFrameCount;
+
+    // Performance counter values at start and stop, and counts spent on frames, written by the processing thread
+    LONGLONG m_startTime;
+    LONGLONG m_stopTime;
+    LONGLONG m_busyTime;
+};
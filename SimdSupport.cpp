@@ -0,0 +1,86 @@
+#include "SimdSupport.h"
+#include <intrin.h>
+
+using namespace Microsoft::KinectBridge;
+
+namespace
+{
+    /// <summary>
+    /// Queries cpuid for the supported instruction set extensions
+    /// </summary>
+    /// <returns>detected features</returns>
+    CpuFeatures DetectCpuFeatures()
+    {
+        CpuFeatures features = {};
+
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+
+        if (maxLeaf >= 1)
+        {
+            __cpuid(info, 1);
+            features.hasSse2 = (info[3] & (1 << 26)) != 0;
+            features.hasSsse3 = (info[2] & (1 << 9)) != 0;
+            features.hasSse41 = (info[2] & (1 << 19)) != 0;
+
+            // AVX state has to be enabled by the operating system through XSAVE
+            bool hasOsAvx = false;
+            if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)))
+            {
+                hasOsAvx = (_xgetbv(0) & 0x6) == 0x6;
+            }
+
+            if (hasOsAvx && maxLeaf >= 7)
+            {
+                __cpuidex(info, 7, 0);
+                features.hasAvx2 = (info[1] & (1 << 5)) != 0;
+            }
+        }
+
+        return features;
+    }
+}
+
+/// <summary>
+/// Gets the instruction set extensions of the running processor, detected once
+/// </summary>
+/// <returns>detected features</returns>
+const CpuFeatures& Microsoft::KinectBridge::GetCpuFeatures()
+{
+    static const CpuFeatures features = DetectCpuFeatures();
+    return features;
+}
+
+/// <summary>
+/// Gets the fastest of the paths of a kernel the running processor supports
+/// </summary>
+/// <param name="kernelPaths">paths the kernel implements, as bits 1 << path</param>
+/// <returns>path to run</returns>
+SimdPath Microsoft::KinectBridge::GetBestPath(UINT kernelPaths)
+{
+    return GetSupportedPath(PATH_AUTO, kernelPaths);
+}
+
+/// <summary>
+/// Clamps a path to the paths of a kernel the running processor supports, so a path
+/// the kernel does not implement or the processor cannot run falls back to a slower one
+/// </summary>
+/// <param name="path">requested path, PATH_AUTO for the fastest</param>
+/// <param name="kernelPaths">paths the kernel implements, as bits 1 << path</param>
+/// <returns>path to run</returns>
+SimdPath Microsoft::KinectBridge::GetSupportedPath(SimdPath path, UINT kernelPaths)
+{
+    const CpuFeatures& features = GetCpuFeatures();
+    const bool isSupported[] = { false, true, features.hasSse2, features.hasSsse3, features.hasAvx2 };
+
+    for (int candidate = path == PATH_AUTO ? PATH_AVX2 : path; candidate > PATH_SCALAR; --candidate)
+    {
+        if ((kernelPaths & (1 << candidate)) && isSupported[candidate])
+        {
+            return static_cast<SimdPath>(candidate);
+        }
+    }
+
+    return PATH_SCALAR;
+}
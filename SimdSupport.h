@@ -0,0 +1,67 @@
+#pragma once
+
+#include "windows.h"
+#include <immintrin.h>
+
+namespace Microsoft {
+    namespace KinectBridge {
+        /// <summary>
+        /// Instruction set extensions available on the running processor
+        /// </summary>
+        struct CpuFeatures
+        {
+            bool hasSse2;
+            bool hasSsse3;
+            bool hasSse41;
+
+            // Only set when the operating system also saves the AVX registers
+            bool hasAvx2;
+        };
+
+        // Code paths of the kernels with SIMD versions, from the slowest to the fastest. Each kernel
+        // implements some of them and gives them as a set of bits 1 << path, PATH_SCALAR always among them.
+        enum SimdPath
+        {
+            PATH_AUTO = 0,
+            PATH_SCALAR,
+            PATH_SSE2,
+            PATH_SSSE3,
+            PATH_AVX2
+        };
+
+        /// <summary>
+        /// Gets the instruction set extensions of the running processor, detected once
+        /// </summary>
+        /// <returns>detected features</returns>
+        const CpuFeatures& GetCpuFeatures();
+
+        /// <summary>
+        /// Gets the fastest of the paths of a kernel the running processor supports
+        /// </summary>
+        /// <param name="kernelPaths">paths the kernel implements, as bits 1 << path</param>
+        /// <returns>path to run</returns>
+        SimdPath GetBestPath(UINT kernelPaths);
+
+        /// <summary>
+        /// Clamps a path to the paths of a kernel the running processor supports, so a path
+        /// the kernel does not implement or the processor cannot run falls back to a slower one
+        /// </summary>
+        /// <param name="path">requested path, PATH_AUTO for the fastest</param>
+        /// <param name="kernelPaths">paths the kernel implements, as bits 1 << path</param>
+        /// <returns>path to run</returns>
+        SimdPath GetSupportedPath(SimdPath path, UINT kernelPaths);
+
+        /// <summary>
+        /// Packs two vectors of sixteen 16 bit masks into thirty two 8 bit masks in pixel order.
+        /// The pack works within each 128 bit lane, the permute puts the lanes back in order.
+        /// Only called on processors with AVX2.
+        /// </summary>
+        /// <param name="first">masks of the first sixteen pixels, all ones or zeros</param>
+        /// <param name="second">masks of the next sixteen pixels, all ones or zeros</param>
+        /// <returns>masks of the thirty two pixels</returns>
+        inline __m256i PackMasksAvx2(__m256i first, __m256i second)
+        {
+            return _mm256_permute4x64_epi64(_mm256_packs_epi16(first, second), 0xD8);
+        }
+    }
+}
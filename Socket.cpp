@@ -4,8 +4,10 @@
 #include <string.h>
 #include<winsock.h>
 
-Socket::Socket() {
-
+Socket::Socket() :
+    out_socket(INVALID_SOCKET),
+    s(INVALID_SOCKET) {
+    InitializeCriticalSection(&lock);
 }
 
 void Socket::createSocket(int port) {
@@ -50,12 +52,24 @@ void Socket::createSocket(int port) {
 Socket::~Socket() {
     closesocket(s);
     WSACleanup();
+    DeleteCriticalSection(&lock);
 }
 
 void Socket::setMessage(char* msg) {
+    EnterCriticalSection(&lock);
     strcpy_s(message, msg);
+    LeaveCriticalSection(&lock);
 }
 
 void Socket::sendMessage() {
+    EnterCriticalSection(&lock);
+    send(out_socket, message, strlen(message), 0);
+    LeaveCriticalSection(&lock);
+}
+
+void Socket::sendMessage(const char* msg) {
+    EnterCriticalSection(&lock);
+    strcpy_s(message, msg);
     send(out_socket, message, strlen(message), 0);
+    LeaveCriticalSection(&lock);
 }
\ No newline at end of file
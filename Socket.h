@@ -23,10 +23,14 @@ public:
 	void setMessage(char*);
 	void sendMessage();
 
+	// Sends a message at once, safe to call from the color and depth threads together
+	void sendMessage(const char*);
+
 private:
 	WSADATA wsa;
 	SOCKET s;
 	struct sockaddr_in server, client;
 	int c;
 	char message[50];
+	CRITICAL_SECTION lock;		// serializes the messages
 };
\ No newline at end of file
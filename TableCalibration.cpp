@@ -0,0 +1,236 @@
+#include "TableCalibration.h"
+#include "SimdSupport.h"
+#include <errno.h>
+#include <stdio.h>
+#include <vector>
+#include <emmintrin.h>
+
+using namespace Microsoft::KinectBridge;
+
+namespace
+{
+    // Transforms, all take the coefficients, the positions to map, the positions to fill and their count
+    typedef void (*TransformFunc)(const float* pH, const Point2f* pSrc, Point2f* pDst, size_t count);
+
+    void TransformScalar(const float* pH, const Point2f* pSrc, Point2f* pDst, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            float x = pSrc[i].x;
+            float y = pSrc[i].y;
+            float w = pH[6] * x + pH[7] * y + pH[8];
+            pDst[i].x = (pH[0] * x + pH[1] * y + pH[2]) / w;
+            pDst[i].y = (pH[3] * x + pH[4] * y + pH[5]) / w;
+        }
+    }
+
+    void TransformSse2(const float* pH, const Point2f* pSrc, Point2f* pDst, size_t count)
+    {
+        const __m128 h0 = _mm_set1_ps(pH[0]), h1 = _mm_set1_ps(pH[1]), h2 = _mm_set1_ps(pH[2]);
+        const __m128 h3 = _mm_set1_ps(pH[3]), h4 = _mm_set1_ps(pH[4]), h5 = _mm_set1_ps(pH[5]);
+        const __m128 h6 = _mm_set1_ps(pH[6]), h7 = _mm_set1_ps(pH[7]), h8 = _mm_set1_ps(pH[8]);
+
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            // Split the x and the y of four positions
+            const float* pIn = &pSrc[i].x;
+            __m128 a = _mm_loadu_ps(pIn);
+            __m128 b = _mm_loadu_ps(pIn + 4);
+            __m128 x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+            // Same operations in the same order as the scalar transform, so the results are the same
+            __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(h6, x), _mm_mul_ps(h7, y)), h8);
+            __m128 u = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(h0, x), _mm_mul_ps(h1, y)), h2), w);
+            __m128 v = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(h3, x), _mm_mul_ps(h4, y)), h5), w);
+
+            float* pOut = &pDst[i].x;
+            _mm_storeu_ps(pOut, _mm_unpacklo_ps(u, v));
+            _mm_storeu_ps(pOut + 4, _mm_unpackhi_ps(u, v));
+        }
+
+        TransformScalar(pH, pSrc + i, pDst + i, count - i);
+    }
+}
+
+/// <summary>
+/// Constructor, maps every position to itself until a homography is set
+/// </summary>
+TableCalibration::TableCalibration()
+{
+    SetHomography(Mat::eye(3, 3, CV_64F));
+}
+
+/// <summary>
+/// Sets the homography
+/// </summary>
+/// <param name="homography">3x3 matrix mapping rectified pixels to table millimeters</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the matrix is not 3x3 or is singular</returns>
+HRESULT TableCalibration::SetHomography(const Mat& homography)
+{
+    if (homography.rows != 3 || homography.cols != 3 || (homography.type() != CV_64FC1 && homography.type() != CV_32FC1))
+    {
+        return E_INVALIDARG;
+    }
+
+    Mat converted;
+    homography.convertTo(converted, CV_64F);
+    if (determinant(converted) == 0.0)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Scaled so the last coefficient is 1, as a fitted homography is
+    double scale = converted.at<double>(2, 2);
+    if (scale != 0.0)
+    {
+        converted /= scale;
+    }
+
+    m_homography = converted;
+    for (int i = 0; i < 9; ++i)
+    {
+        m_coefficients[i] = static_cast<float>(m_homography.at<double>(i / 3, i % 3));
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Fits the homography to pairs of positions
+/// </summary>
+/// <param name="pPixels">positions in the rectified image</param>
+/// <param name="pTable">same positions on the table, in millimeters</param>
+/// <param name="count">number of pairs, at least MIN_PAIR_COUNT</param>
+/// <returns>S_OK if successful, E_INVALIDARG if there are too few pairs or they do not fix a homography</returns>
+HRESULT TableCalibration::Fit(const Point2f* pPixels, const Point2f* pTable, int count)
+{
+    if (!pPixels || !pTable)
+    {
+        return E_POINTER;
+    }
+
+    if (count < MIN_PAIR_COUNT)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Two equations per pair in the first eight coefficients, the last one is 1
+    Mat a(2 * count, 8, CV_64F, Scalar(0));
+    Mat b(2 * count, 1, CV_64F);
+    for (int i = 0; i < count; ++i)
+    {
+        double x = pPixels[i].x;
+        double y = pPixels[i].y;
+        double u = pTable[i].x;
+        double v = pTable[i].y;
+
+        double* pRow = a.ptr<double>(2 * i);
+        pRow[0] = x;
+        pRow[1] = y;
+        pRow[2] = 1.0;
+        pRow[6] = -u * x;
+        pRow[7] = -u * y;
+        b.at<double>(2 * i) = u;
+
+        pRow = a.ptr<double>(2 * i + 1);
+        pRow[3] = x;
+        pRow[4] = y;
+        pRow[5] = 1.0;
+        pRow[6] = -v * x;
+        pRow[7] = -v * y;
+        b.at<double>(2 * i + 1) = v;
+    }
+
+    // Least squares, failing if the pairs are collinear or repeated
+    Mat h;
+    if (!solve(a, b, h, DECOMP_QR))
+    {
+        return E_INVALIDARG;
+    }
+
+    Mat homography(3, 3, CV_64F);
+    for (int i = 0; i < 8; ++i)
+    {
+        homography.at<double>(i / 3, i % 3) = h.at<double>(i);
+    }
+    homography.at<double>(2, 2) = 1.0;
+
+    return SetHomography(homography);
+}
+
+/// <summary>
+/// Fits the homography to the pairs of a text file, one per line as the pixel's x and y
+/// followed by the table's x and y
+/// </summary>
+/// <param name="path">path of the file</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the pairs do not fix a homography, an error code otherwise</returns>
+HRESULT TableCalibration::Load(LPCWSTR path)
+{
+    if (!path)
+    {
+        return E_POINTER;
+    }
+
+    FILE* pFile = NULL;
+    errno_t error = _wfopen_s(&pFile, path, L"rt");
+    if (error != 0 || !pFile)
+    {
+        return error == ENOENT ? HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) : E_FAIL;
+    }
+
+    std::vector<Point2f> pixels;
+    std::vector<Point2f> table;
+    Point2f pixel, position;
+    while (fscanf_s(pFile, "%f %f %f %f", &pixel.x, &pixel.y, &position.x, &position.y) == 4)
+    {
+        pixels.push_back(pixel);
+        table.push_back(position);
+    }
+
+    // Anything but the end of the file after the last pair is a malformed line
+    bool isComplete = feof(pFile) != 0;
+    fclose(pFile);
+
+    if (!isComplete || pixels.size() < MIN_PAIR_COUNT)
+    {
+        return E_INVALIDARG;
+    }
+
+    return Fit(&pixels[0], &table[0], static_cast<int>(pixels.size()));
+}
+
+/// <summary>
+/// Gets the homography
+/// </summary>
+/// <returns>3x3 CV_64F matrix</returns>
+const Mat& TableCalibration::GetHomography() const
+{
+    return m_homography;
+}
+
+/// <summary>
+/// Maps a position in the rectified image to the table
+/// </summary>
+/// <param name="pixel">position in the rectified image</param>
+/// <returns>position on the table in millimeters</returns>
+Point2f TableCalibration::Transform(Point2f pixel) const
+{
+    Point2f position;
+    TransformScalar(m_coefficients, &pixel, &position, 1);
+    return position;
+}
+
+/// <summary>
+/// Maps positions in the rectified image to the table
+/// </summary>
+/// <param name="pPixels">positions in the rectified image</param>
+/// <param name="pTable">positions on the table to fill, in millimeters</param>
+/// <param name="count">number of positions</param>
+/// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+void TableCalibration::Transform(const Point2f* pPixels, Point2f* pTable, size_t count, SimdPath path /* = PATH_AUTO */) const
+{
+    static const TransformFunc transformFuncs[] = { TransformScalar, TransformSse2 };
+    transformFuncs[GetSupportedPath(path, PATHS) - PATH_SCALAR](m_coefficients, pPixels, pTable, count);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <windows.h>
+#include "SimdSupport.h"
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#pragma warning(pop)
+
+using namespace cv;
+
+/// <summary>
+/// Maps positions in the rectified image to the coordinates the arm takes on the table, in
+/// millimeters, with one homography. It is fitted to pairs of a pixel position and its table
+/// position, by least squares when there are more than four, so it also corrects what the
+/// trapezoid warp leaves of the perspective. The positions of all the candidates of a frame
+/// are mapped at once, four at a time with SSE2.
+/// </summary>
+class TableCalibration
+{
+public:
+    // Constants:
+    // Code paths of the transform, a set of bits 1 << path
+    static const UINT PATHS = (1 << Microsoft::KinectBridge::PATH_SCALAR) | (1 << Microsoft::KinectBridge::PATH_SSE2);
+
+    // Fewest pairs a homography is fitted to
+    static const int MIN_PAIR_COUNT = 4;
+
+    // Functions:
+    /// <summary>
+    /// Constructor, maps every position to itself until a homography is set
+    /// </summary>
+    TableCalibration();
+
+    /// <summary>
+    /// Sets the homography
+    /// </summary>
+    /// <param name="homography">3x3 matrix mapping rectified pixels to table millimeters</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the matrix is not 3x3 or is singular</returns>
+    HRESULT SetHomography(const Mat& homography);
+
+    /// <summary>
+    /// Fits the homography to pairs of positions
+    /// </summary>
+    /// <param name="pPixels">positions in the rectified image</param>
+    /// <param name="pTable">same positions on the table, in millimeters</param>
+    /// <param name="count">number of pairs, at least MIN_PAIR_COUNT</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if there are too few pairs or they do not fix a homography</returns>
+    HRESULT Fit(const Point2f* pPixels, const Point2f* pTable, int count);
+
+    /// <summary>
+    /// Fits the homography to the pairs of a text file, one per line as the pixel's x and y
+    /// followed by the table's x and y
+    /// </summary>
+    /// <param name="path">path of the file</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the pairs do not fix a homography, an error code otherwise</returns>
+    HRESULT Load(LPCWSTR path);
+
+    /// <summary>
+    /// Gets the homography
+    /// </summary>
+    /// <returns>3x3 CV_64F matrix</returns>
+    const Mat& GetHomography() const;
+
+    /// <summary>
+    /// Maps a position in the rectified image to the table
+    /// </summary>
+    /// <param name="pixel">position in the rectified image</param>
+    /// <returns>position on the table in millimeters</returns>
+    Point2f Transform(Point2f pixel) const;
+
+    /// <summary>
+    /// Maps positions in the rectified image to the table
+    /// </summary>
+    /// <param name="pPixels">positions in the rectified image</param>
+    /// <param name="pTable">positions on the table to fill, in millimeters</param>
+    /// <param name="count">number of positions</param>
+    /// <param name="path">code path to use, PATH_AUTO for the fastest supported one</param>
+    void Transform(const Point2f* pPixels, Point2f* pTable, size_t count, Microsoft::KinectBridge::SimdPath path = Microsoft::KinectBridge::PATH_AUTO) const;
+
+private:
+    // Variables:
+    // Homography in CV_64F, and its coefficients in row order for the transforms
+    Mat m_homography;
+    float m_coefficients[9];
+};
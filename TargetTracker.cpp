@@ -0,0 +1,306 @@
+#include "TargetTracker.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+namespace
+{
+    // Gains of the alpha-beta filter, how much of an innovation goes to the position and to the velocity
+    const float ALPHA = 0.6f;
+    const float BETA = 0.2f;
+
+    // Weight of the newest innovation in the running mean square
+    const float INNOVATION_WEIGHT = 0.5f;
+
+    // Shortest time between frames the velocity is estimated over, in seconds
+    const double MIN_INTERVAL = 0.001;
+
+    /// <summary>
+    /// Orders track indices by the x coordinate of the tracks
+    /// </summary>
+    struct ByX
+    {
+        const std::vector<float>* pX;
+
+        bool operator()(int a, int b) const
+        {
+            return (*pX)[a] < (*pX)[b];
+        }
+
+        bool operator()(int a, float x) const
+        {
+            return (*pX)[a] < x;
+        }
+    };
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+TargetTracker::TargetTracker() :
+    m_nextId(0)
+{
+}
+
+/// <summary>
+/// Associates the candidates of a frame with the tracks and updates the track table
+/// </summary>
+/// <param name="candidates">positions of the candidates</param>
+/// <param name="gate">largest distance in x and in y between a track's prediction and its candidate</param>
+/// <param name="time">time the candidates were seen at, in seconds</param>
+void TargetTracker::Update(const std::vector<Point2f>& candidates, float gate, double time)
+{
+    const int trackCount = static_cast<int>(m_ids.size());
+    const int candidateCount = static_cast<int>(candidates.size());
+
+    // Tracks predicted to the frame and sorted by x, so the tracks within the gate of a candidate are a contiguous range
+    m_predictedX.resize(trackCount);
+    m_predictedY.resize(trackCount);
+    m_order.resize(trackCount);
+    for (int i = 0; i < trackCount; ++i)
+    {
+        float elapsed = static_cast<float>(time - m_times[i]);
+        m_predictedX[i] = m_x[i] + m_vx[i] * elapsed;
+        m_predictedY[i] = m_y[i] + m_vy[i] * elapsed;
+        m_order[i] = i;
+    }
+
+    ByX byX = { &m_predictedX };
+    std::sort(m_order.begin(), m_order.end(), byX);
+
+    m_pairs.clear();
+    for (int c = 0; c < candidateCount; ++c)
+    {
+        const Point2f& candidate = candidates[c];
+        std::vector<int>::const_iterator it = std::lower_bound(m_order.begin(), m_order.end(), candidate.x - gate, byX);
+        for (; it != m_order.end() && m_predictedX[*it] <= candidate.x + gate; ++it)
+        {
+            float dx = m_predictedX[*it] - candidate.x;
+            float dy = m_predictedY[*it] - candidate.y;
+            if (fabs(dy) <= gate)
+            {
+                Pair pair = { dx * dx + dy * dy, *it, c };
+                m_pairs.push_back(pair);
+            }
+        }
+    }
+
+    // Closest pairs first, each track and candidate matched at most once
+    std::sort(m_pairs.begin(), m_pairs.end());
+    m_candidates.assign(trackCount, -1);
+    m_isCandidateMatched.assign(candidateCount, false);
+    for (size_t i = 0; i < m_pairs.size(); ++i)
+    {
+        const Pair& pair = m_pairs[i];
+        const int t = pair.track;
+        if (m_candidates[t] >= 0 || m_isCandidateMatched[pair.candidate])
+        {
+            continue;
+        }
+
+        m_candidates[t] = pair.candidate;
+        m_isCandidateMatched[pair.candidate] = true;
+
+        // Innovation of the prediction, split between the position and the velocity
+        const Point2f& candidate = candidates[pair.candidate];
+        float innovationX = candidate.x - m_predictedX[t];
+        float innovationY = candidate.y - m_predictedY[t];
+        double elapsed = time - m_times[t];
+
+        m_x[t] = m_predictedX[t] + ALPHA * innovationX;
+        m_y[t] = m_predictedY[t] + ALPHA * innovationY;
+        if (elapsed >= MIN_INTERVAL)
+        {
+            m_vx[t] += static_cast<float>(BETA * innovationX / elapsed);
+            m_vy[t] += static_cast<float>(BETA * innovationY / elapsed);
+        }
+        m_times[t] = time;
+
+        float squared = pair.distance;
+        m_innovations[t] = m_innovations[t] < 0.0f ? squared : m_innovations[t] + INNOVATION_WEIGHT * (squared - m_innovations[t]);
+
+        ++m_hits[t];
+        m_misses[t] = 0;
+    }
+
+    // Backwards, so removing a track only moves tracks already updated. Unmatched tracks
+    // keep their last filtered state and are predicted from it.
+    for (int i = trackCount - 1; i >= 0; --i)
+    {
+        if (m_candidates[i] < 0 && ++m_misses[i] > MAX_MISSES)
+        {
+            RemoveTrack(i);
+        }
+    }
+
+    for (int c = 0; c < candidateCount; ++c)
+    {
+        if (!m_isCandidateMatched[c])
+        {
+            AddTrack(candidates[c], time);
+            m_candidates.back() = c;
+        }
+    }
+}
+
+/// <summary>
+/// Drops every track
+/// </summary>
+void TargetTracker::Reset()
+{
+    m_ids.clear();
+    m_x.clear();
+    m_y.clear();
+    m_vx.clear();
+    m_vy.clear();
+    m_times.clear();
+    m_innovations.clear();
+    m_hits.clear();
+    m_misses.clear();
+    m_candidates.clear();
+}
+
+/// <summary>
+/// Gets the number of tracks
+/// </summary>
+/// <returns>number of tracks</returns>
+size_t TargetTracker::GetTrackCount() const
+{
+    return m_ids.size();
+}
+
+/// <summary>
+/// Gets the ID of a track, unique since construction
+/// </summary>
+/// <param name="index">index of the track</param>
+/// <returns>ID of the track</returns>
+int TargetTracker::GetId(size_t index) const
+{
+    return m_ids[index];
+}
+
+/// <summary>
+/// Gets the filtered position of a track at the time it was last matched
+/// </summary>
+/// <param name="index">index of the track</param>
+/// <returns>position of the track</returns>
+Point2f TargetTracker::GetPosition(size_t index) const
+{
+    return Point2f(m_x[index], m_y[index]);
+}
+
+/// <summary>
+/// Predicts the position of a track at a given time from its filtered position and velocity
+/// </summary>
+/// <param name="index">index of the track</param>
+/// <param name="time">time to predict to, in seconds</param>
+/// <returns>predicted position of the track</returns>
+Point2f TargetTracker::PredictPosition(size_t index, double time) const
+{
+    float elapsed = static_cast<float>(time - m_times[index]);
+    return Point2f(m_x[index] + m_vx[index] * elapsed, m_y[index] + m_vy[index] * elapsed);
+}
+
+/// <summary>
+/// Gets the root mean square of the recent innovations of a track
+/// </summary>
+/// <param name="index">index of the track</param>
+/// <returns>innovation in pixels, infinite until the track has been matched twice</returns>
+float TargetTracker::GetInnovation(size_t index) const
+{
+    return m_innovations[index] < 0.0f ? FLT_MAX : sqrt(m_innovations[index]);
+}
+
+/// <summary>
+/// Gets the number of frames a track has been matched in
+/// </summary>
+/// <param name="index">index of the track</param>
+/// <returns>number of confirmations</returns>
+int TargetTracker::GetHitCount(size_t index) const
+{
+    return m_hits[index];
+}
+
+/// <summary>
+/// Gets the candidate a track was matched with in the last frame
+/// </summary>
+/// <param name="index">index of the track</param>
+/// <returns>index of the candidate, -1 if the track was not matched</returns>
+int TargetTracker::GetCandidate(size_t index) const
+{
+    return m_candidates[index];
+}
+
+/// <summary>
+/// Finds the track matched in the last frame that is followed most closely, among those
+/// with enough confirmations and small enough innovations
+/// </summary>
+/// <param name="minHits">fewest confirmations</param>
+/// <param name="maxInnovation">largest innovation, in pixels</param>
+/// <returns>index of the track, -1 if none qualifies</returns>
+int TargetTracker::FindConfirmed(int minHits, float maxInnovation) const
+{
+    int best = -1;
+    for (size_t i = 0; i < m_ids.size(); ++i)
+    {
+        if (m_candidates[i] < 0 || m_hits[i] < minHits || GetInnovation(i) > maxInnovation)
+        {
+            continue;
+        }
+
+        if (best < 0 || m_innovations[i] < m_innovations[best])
+        {
+            best = static_cast<int>(i);
+        }
+    }
+    return best;
+}
+
+/// <summary>
+/// Adds a track for a candidate
+/// </summary>
+/// <param name="position">position of the candidate</param>
+/// <param name="time">time the candidate was seen at</param>
+void TargetTracker::AddTrack(Point2f position, double time)
+{
+    m_ids.push_back(m_nextId++);
+    m_x.push_back(position.x);
+    m_y.push_back(position.y);
+    m_vx.push_back(0.0f);
+    m_vy.push_back(0.0f);
+    m_times.push_back(time);
+    m_innovations.push_back(-1.0f);
+    m_hits.push_back(1);
+    m_misses.push_back(0);
+    m_candidates.push_back(-1);
+}
+
+/// <summary>
+/// Removes a track, moving the last one into its place
+/// </summary>
+/// <param name="index">index of the track</param>
+void TargetTracker::RemoveTrack(size_t index)
+{
+    size_t last = m_ids.size() - 1;
+    m_ids[index] = m_ids[last];
+    m_x[index] = m_x[last];
+    m_y[index] = m_y[last];
+    m_vx[index] = m_vx[last];
+    m_vy[index] = m_vy[last];
+    m_times[index] = m_times[last];
+    m_innovations[index] = m_innovations[last];
+    m_hits[index] = m_hits[last];
+    m_misses[index] = m_misses[last];
+    m_candidates[index] = m_candidates[last];
+
+    m_ids.pop_back();
+    m_x.pop_back();
+    m_y.pop_back();
+    m_vx.pop_back();
+    m_vy.pop_back();
+    m_times.pop_back();
+    m_innovations.pop_back();
+    m_hits.pop_back();
+    m_misses.pop_back();
+    m_candidates.pop_back();
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#pragma warning(pop)
+
+using namespace cv;
+
+/// <summary>
+/// Tracks every target candidate on the table with a stable ID. Each track runs a constant
+/// velocity alpha-beta filter, so it is predicted to the time of each frame before the
+/// candidates are associated with it by gated nearest neighbour: only pairs within the gate
+/// of each other are considered, found by sweeping the tracks sorted by predicted x, and the
+/// closest pairs are matched first. The innovations, the distances between the predictions
+/// and the matched candidates, tell how well a track is followed. Unmatched candidates start
+/// new tracks and tracks unmatched for too long are dropped. The track table is kept as a
+/// struct of arrays, so the sweep only touches the positions.
+/// </summary>
+class TargetTracker
+{
+public:
+    // Constants:
+    // Frames a track may go unmatched before it is dropped
+    static const int MAX_MISSES = 20;
+
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    TargetTracker();
+
+    /// <summary>
+    /// Associates the candidates of a frame with the tracks and updates the track table
+    /// </summary>
+    /// <param name="candidates">positions of the candidates</param>
+    /// <param name="gate">largest distance in x and in y between a track's prediction and its candidate</param>
+    /// <param name="time">time the candidates were seen at, in seconds</param>
+    void Update(const std::vector<Point2f>& candidates, float gate, double time);
+
+    /// <summary>
+    /// Drops every track
+    /// </summary>
+    void Reset();
+
+    /// <summary>
+    /// Gets the number of tracks
+    /// </summary>
+    /// <returns>number of tracks</returns>
+    size_t GetTrackCount() const;
+
+    /// <summary>
+    /// Gets the ID of a track, unique since construction
+    /// </summary>
+    /// <param name="index">index of the track</param>
+    /// <returns>ID of the track</returns>
+    int GetId(size_t index) const;
+
+    /// <summary>
+    /// Gets the filtered position of a track at the time it was last matched
+    /// </summary>
+    /// <param name="index">index of the track</param>
+    /// <returns>position of the track</returns>
+    Point2f GetPosition(size_t index) const;
+
+    /// <summary>
+    /// Predicts the position of a track at a given time from its filtered position and velocity
+    /// </summary>
+    /// <param name="index">index of the track</param>
+    /// <param name="time">time to predict to, in seconds</param>
+    /// <returns>predicted position of the track</returns>
+    Point2f PredictPosition(size_t index, double time) const;
+
+    /// <summary>
+    /// Gets the root mean square of the recent innovations of a track
+    /// </summary>
+    /// <param name="index">index of the track</param>
+    /// <returns>innovation in pixels, infinite until the track has been matched twice</returns>
+    float GetInnovation(size_t index) const;
+
+    /// <summary>
+    /// Gets the number of frames a track has been matched in
+    /// </summary>
+    /// <param name="index">index of the track</param>
+    /// <returns>number of confirmations</returns>
+    int GetHitCount(size_t index) const;
+
+    /// <summary>
+    /// Gets the candidate a track was matched with in the last frame
+    /// </summary>
+    /// <param name="index">index of the track</param>
+    /// <returns>index of the candidate, -1 if the track was not matched</returns>
+    int GetCandidate(size_t index) const;
+
+    /// <summary>
+    /// Finds the track matched in the last frame that is followed most closely, among those
+    /// with enough confirmations and small enough innovations
+    /// </summary>
+    /// <param name="minHits">fewest confirmations</param>
+    /// <param name="maxInnovation">largest innovation, in pixels</param>
+    /// <returns>index of the track, -1 if none qualifies</returns>
+    int FindConfirmed(int minHits, float maxInnovation) const;
+
+private:
+    // Types:
+    // Track and candidate within the gate of each other
+    struct Pair
+    {
+        float distance;
+        int track;
+        int candidate;
+
+        bool operator<(const Pair& other) const
+        {
+            return distance < other.distance;
+        }
+    };
+
+    // Functions:
+    /// <summary>
+    /// Adds a track for a candidate
+    /// </summary>
+    /// <param name="position">position of the candidate</param>
+    /// <param name="time">time the candidate was seen at</param>
+    void AddTrack(Point2f position, double time);
+
+    /// <summary>
+    /// Removes a track, moving the last one into its place
+    /// </summary>
+    /// <param name="index">index of the track</param>
+    void RemoveTrack(size_t index);
+
+    // Variables:
+    // Track table, filtered positions and velocities at the time each track was last matched,
+    // and mean square of the recent innovations, negative until the first one
+    std::vector<int> m_ids;
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_vx;
+    std::vector<float> m_vy;
+    std::vector<double> m_times;
+    std::vector<float> m_innovations;
+    std::vector<int> m_hits;
+    std::vector<int> m_misses;
+    std::vector<int> m_candidates;
+
+    int m_nextId;
+
+    // Association buffers, reused between frames
+    std::vector<float> m_predictedX;
+    std::vector<float> m_predictedY;
+    std::vector<int> m_order;
+    std::vector<Pair> m_pairs;
+    std::vector<bool> m_isCandidateMatched;
+};
@@ -0,0 +1,403 @@
+#include "TiledEdgeChain.h"
+#include <math.h>
+#include <stdlib.h>
+
+namespace
+{
+    // tan(22.5 degrees) in Q15, the fixed point Canny's non-maximum suppression sorts the gradients with
+    const int TAN_22_5 = 13573;
+
+    /// <summary>
+    /// Marks the candidate pixels around an edge pixel as edges and pushes them to be followed
+    /// </summary>
+    /// <param name="pPixel">edge pixel of the map</param>
+    /// <param name="step">bytes between rows of the map</param>
+    /// <param name="pStack">pointer to the pixels still to follow</param>
+    inline void FollowNeighbours(uchar* pPixel, ptrdiff_t step, std::vector<uchar*>* pStack)
+    {
+        uchar* neighbours[] =
+        {
+            pPixel - step - 1, pPixel - step, pPixel - step + 1,
+            pPixel - 1, pPixel + 1,
+            pPixel + step - 1, pPixel + step, pPixel + step + 1
+        };
+
+        for (int i = 0; i < ARRAYSIZE(neighbours); ++i)
+        {
+            if (*neighbours[i] == 0)
+            {
+                *neighbours[i] = 2;
+                pStack->push_back(neighbours[i]);
+            }
+        }
+    }
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+TiledEdgeChain::TiledEdgeChain() :
+    m_threadCount(1),
+    m_phase(PHASE_EDGES),
+    m_bandCount(0)
+{
+    for (int i = 0; i < MAX_THREAD_COUNT; ++i)
+    {
+        m_workers[i].pChain = this;
+        m_workers[i].index = i;
+    }
+}
+
+/// <summary>
+/// Destructor, stops the worker threads
+/// </summary>
+TiledEdgeChain::~TiledEdgeChain()
+{
+    SetThreadCount(1);
+}
+
+/// <summary>
+/// Sets the number of threads the chain runs on, starting or stopping workers
+/// </summary>
+/// <param name="threadCount">number of threads, the calling thread included, clamped to 1..MAX_THREAD_COUNT</param>
+/// <returns>S_OK if successful, an error code if a worker could not be started</returns>
+HRESULT TiledEdgeChain::SetThreadCount(int threadCount)
+{
+    threadCount = threadCount < 1 ? 1 : (threadCount > MAX_THREAD_COUNT ? MAX_THREAD_COUNT : threadCount);
+
+    // Worker i runs the bands of thread i + 1, the calling thread is thread 0
+    for (int i = threadCount - 1; i < MAX_THREAD_COUNT - 1; ++i)
+    {
+        m_threads[i].Stop();
+    }
+
+    for (int i = 0; i < threadCount - 1; ++i)
+    {
+        if (!m_threads[i].IsRunning())
+        {
+            HRESULT hr = m_threads[i].Start(RunWorker, &m_workers[i + 1]);
+            if (FAILED(hr))
+            {
+                m_threadCount = i + 1;
+                return hr;
+            }
+        }
+    }
+
+    m_threadCount = threadCount;
+    return S_OK;
+}
+
+/// <summary>
+/// Gets the number of threads the chain runs on
+/// </summary>
+/// <returns>number of threads, the calling thread included</returns>
+int TiledEdgeChain::GetThreadCount() const
+{
+    return m_threadCount;
+}
+
+/// <summary>
+/// Blurs an image, finds its Canny edges and closes them
+/// </summary>
+/// <param name="src">CV_8UC1 image</param>
+/// <param name="settings">filters of the chain</param>
+/// <param name="pDst">pointer to the CV_8UC1 closed edges to fill, not sharing memory with the image</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the image is empty or not CV_8UC1</returns>
+HRESULT TiledEdgeChain::Run(const Mat& src, const Settings& settings, Mat* pDst)
+{
+    if (!pDst)
+    {
+        return E_POINTER;
+    }
+
+    if (src.empty() || src.type() != CV_8UC1)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_src = src;
+    m_settings = settings;
+    pDst->create(src.size(), CV_8UC1);
+    m_dst = *pDst;
+
+    // The bands fill in the map's border columns on their rows
+    m_map.create(src.rows + 2, src.cols + 2, CV_8UC1);
+    m_map.row(0).setTo(Scalar::all(1));
+    m_map.row(src.rows + 1).setTo(Scalar::all(1));
+    m_bandCount = (src.rows + BAND_ROWS - 1) / BAND_ROWS;
+
+    HRESULT hr = RunPhase(PHASE_EDGES);
+    if (SUCCEEDED(hr))
+    {
+        FollowBorderEdges();
+        hr = RunPhase(PHASE_CLOSE);
+    }
+
+    // Not kept past the frame
+    m_src.release();
+    m_dst.release();
+    return hr;
+}
+
+/// <summary>
+/// Runs a phase on every thread and waits for all of them
+/// </summary>
+/// <param name="phase">filters to run</param>
+/// <returns>S_OK if successful, the first error of a thread otherwise</returns>
+HRESULT TiledEdgeChain::RunPhase(Phase phase)
+{
+    m_phase = phase;
+    for (int i = 0; i < m_threadCount - 1; ++i)
+    {
+        m_threads[i].Post();
+    }
+
+    HRESULT hr = RunWorker(&m_workers[0]);
+    for (int i = 0; i < m_threadCount - 1; ++i)
+    {
+        HRESULT hrThread = m_threads[i].Wait();
+        if (SUCCEEDED(hr))
+        {
+            hr = hrThread;
+        }
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// Runs the current phase on the bands of a worker, called on the worker thread
+/// </summary>
+/// <param name="pContext">worker</param>
+/// <returns>S_OK</returns>
+HRESULT TiledEdgeChain::RunWorker(LPVOID pContext)
+{
+    Worker* pWorker = static_cast<Worker*>(pContext);
+    TiledEdgeChain* pChain = pWorker->pChain;
+    const int rows = pChain->m_src.rows;
+
+    if (pChain->m_phase == PHASE_EDGES)
+    {
+        pWorker->borderEdges.clear();
+    }
+
+    // Bands are dealt round robin, there are more bands than threads
+    for (int band = pWorker->index; band < pChain->m_bandCount; band += pChain->m_threadCount)
+    {
+        const int y0 = band * BAND_ROWS;
+        const int y1 = y0 + BAND_ROWS < rows ? y0 + BAND_ROWS : rows;
+        if (pChain->m_phase == PHASE_EDGES)
+        {
+            pChain->FindEdges(pWorker, y0, y1);
+        }
+        else
+        {
+            pChain->CloseEdges(pWorker, y0, y1);
+        }
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// Blurs a band and finds its edges, following them inside the band
+/// </summary>
+/// <param name="pWorker">worker running the band</param>
+/// <param name="y0">first row of the band</param>
+/// <param name="y1">row after the last one of the band</param>
+void TiledEdgeChain::FindEdges(Worker* pWorker, int y0, int y1)
+{
+    const int width = m_src.cols;
+    const int height = m_src.rows;
+
+    // The suppression of the band needs the magnitudes of a row on each side of it, whose
+    // gradients need another blurred row. The blur reads the rows around the range like it
+    // would on the whole image.
+    const int firstBlurred = y0 - 2 > 0 ? y0 - 2 : 0;
+    const int lastBlurred = y1 + 2 < height ? y1 + 2 : height;
+    blur(m_src.rowRange(firstBlurred, lastBlurred), pWorker->blurred, m_settings.blurSize);
+
+    pWorker->dx.resize(3 * width);
+    pWorker->dy.resize(3 * width);
+    pWorker->magnitudes.resize(3 * (width + 2));
+
+    // Same rounding of the thresholds as Canny
+    const int low = cvFloor(m_settings.minThreshold);
+    const int high = cvFloor(m_settings.maxThreshold);
+
+    ComputeGradients(pWorker, firstBlurred, y0 - 1);
+    ComputeGradients(pWorker, firstBlurred, y0);
+    for (int y = y0; y < y1; ++y)
+    {
+        ComputeGradients(pWorker, firstBlurred, y + 1);
+
+        const int* pPrev = &pWorker->magnitudes[((y + 2) % 3) * (width + 2) + 1];
+        const int* pMagnitudes = &pWorker->magnitudes[(y % 3) * (width + 2) + 1];
+        const int* pNext = &pWorker->magnitudes[((y + 1) % 3) * (width + 2) + 1];
+        const short* pDx = &pWorker->dx[(y % 3) * width];
+        const short* pDy = &pWorker->dy[(y % 3) * width];
+        uchar* pMap = m_map.ptr<uchar>(y + 1) + 1;
+        pMap[-1] = 1;
+        pMap[width] = 1;
+
+        for (int x = 0; x < width; ++x)
+        {
+            // Non-maximum suppression along the gradient, sorted into horizontal, vertical and
+            // diagonal, with the ties Canny breaks towards the right and the bottom
+            const int magnitude = pMagnitudes[x];
+            bool isPeak = false;
+            if (magnitude > low)
+            {
+                const int xs = pDx[x];
+                const int ys = pDy[x];
+                const int ax = abs(xs);
+                const int ay = abs(ys) << 15;
+                const int tg22x = ax * TAN_22_5;
+                if (ay < tg22x)
+                {
+                    isPeak = magnitude > pMagnitudes[x - 1] && magnitude >= pMagnitudes[x + 1];
+                }
+                else if (ay > tg22x + (ax << 16))
+                {
+                    isPeak = magnitude > pPrev[x] && magnitude >= pNext[x];
+                }
+                else
+                {
+                    const int s = (xs ^ ys) < 0 ? -1 : 1;
+                    isPeak = magnitude > pPrev[x - s] && magnitude > pNext[x + s];
+                }
+            }
+
+            if (!isPeak)
+            {
+                pMap[x] = 1;
+            }
+            else if (magnitude > high)
+            {
+                pMap[x] = 2;
+                pWorker->stack.push_back(pMap + x);
+            }
+            else
+            {
+                pMap[x] = 0;
+            }
+        }
+    }
+
+    // Hysteresis inside the band. The first and last rows have neighbours in other bands,
+    // still being written, so the edges reaching them are followed after all bands are done.
+    const uchar* pInnerBegin = m_map.ptr<uchar>(y0 + 2);
+    const uchar* pInnerEnd = m_map.ptr<uchar>(y1);
+    const ptrdiff_t step = m_map.step;
+    std::vector<uchar*>& stack = pWorker->stack;
+    while (!stack.empty())
+    {
+        uchar* pPixel = stack.back();
+        stack.pop_back();
+        if (pPixel < pInnerBegin || pPixel >= pInnerEnd)
+        {
+            pWorker->borderEdges.push_back(pPixel);
+            continue;
+        }
+
+        FollowNeighbours(pPixel, step, &stack);
+    }
+}
+
+/// <summary>
+/// Computes the Sobel gradients and the L1 magnitude of a row into the worker's ring of rows
+/// </summary>
+/// <param name="pWorker">worker running the band</param>
+/// <param name="firstBlurred">image row of the worker's first blurred row</param>
+/// <param name="y">row, whose magnitude is zero outside the image</param>
+void TiledEdgeChain::ComputeGradients(Worker* pWorker, int firstBlurred, int y)
+{
+    const int width = m_src.cols;
+    const int height = m_src.rows;
+    const int slot = (y + 3) % 3;
+    int* pMagnitudes = &pWorker->magnitudes[slot * (width + 2) + 1];
+    pMagnitudes[-1] = 0;
+    pMagnitudes[width] = 0;
+
+    if (y < 0 || y >= height)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            pMagnitudes[x] = 0;
+        }
+        return;
+    }
+
+    // Sobel's 3x3 kernels with the border replicated
+    short* pDx = &pWorker->dx[slot * width];
+    short* pDy = &pWorker->dy[slot * width];
+    const uchar* pAbove = pWorker->blurred.ptr<uchar>((y > 0 ? y - 1 : 0) - firstBlurred);
+    const uchar* pRow = pWorker->blurred.ptr<uchar>(y - firstBlurred);
+    const uchar* pBelow = pWorker->blurred.ptr<uchar>((y < height - 1 ? y + 1 : y) - firstBlurred);
+    for (int x = 0; x < width; ++x)
+    {
+        const int left = x > 0 ? x - 1 : 0;
+        const int right = x < width - 1 ? x + 1 : x;
+        const int dx = (pAbove[right] - pAbove[left]) + 2 * (pRow[right] - pRow[left]) + (pBelow[right] - pBelow[left]);
+        const int dy = (pBelow[left] + 2 * pBelow[x] + pBelow[right]) - (pAbove[left] + 2 * pAbove[x] + pAbove[right]);
+        pDx[x] = static_cast<short>(dx);
+        pDy[x] = static_cast<short>(dy);
+        pMagnitudes[x] = abs(dx) + abs(dy);
+    }
+}
+
+/// <summary>
+/// Follows the edges reaching the rows shared between bands, once every band is done
+/// </summary>
+void TiledEdgeChain::FollowBorderEdges()
+{
+    std::vector<uchar*>& stack = m_workers[0].stack;
+    for (int i = 0; i < m_threadCount; ++i)
+    {
+        stack.insert(stack.end(), m_workers[i].borderEdges.begin(), m_workers[i].borderEdges.end());
+    }
+
+    const ptrdiff_t step = m_map.step;
+    while (!stack.empty())
+    {
+        uchar* pPixel = stack.back();
+        stack.pop_back();
+        FollowNeighbours(pPixel, step, &stack);
+    }
+}
+
+/// <summary>
+/// Writes the edges of a band and closes them
+/// </summary>
+/// <param name="pWorker">worker running the band</param>
+/// <param name="y0">first row of the band</param>
+/// <param name="y1">row after the last one of the band</param>
+void TiledEdgeChain::CloseEdges(Worker* pWorker, int y0, int y1)
+{
+    const int width = m_src.cols;
+    const int height = m_src.rows;
+
+    // The erode of the band reads the dilation of the rows around it, which reads the edges of the rows around those
+    const int radius = m_settings.edgeElement.rows / 2;
+    const int first = y0 - 2 * radius > 0 ? y0 - 2 * radius : 0;
+    const int last = y1 + 2 * radius < height ? y1 + 2 * radius : height;
+
+    pWorker->edges.create(last - first, width, CV_8UC1);
+    for (int y = first; y < last; ++y)
+    {
+        const uchar* pMap = m_map.ptr<uchar>(y + 1) + 1;
+        uchar* pEdges = pWorker->edges.ptr<uchar>(y - first);
+        for (int x = 0; x < width; ++x)
+        {
+            pEdges[x] = pMap[x] == 2 ? 255 : 0;
+        }
+    }
+
+    // The dilation stops at the rows written, as if they were the whole image, and the erode
+    // reads the dilated rows around the band
+    dilate(pWorker->edges, pWorker->dilated, m_settings.edgeElement, Point(-1, -1), 1,
+        BORDER_CONSTANT | BORDER_ISOLATED, morphologyDefaultBorderValue());
+    Mat band = m_dst.rowRange(y0, y1);
+    erode(pWorker->dilated.rowRange(y0 - first, y1 - first), band, m_settings.edgeElement);
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#pragma warning(pop)
+
+#include "FrameWorker.h"
+
+using namespace cv;
+
+/// <summary>
+/// Runs the edge chain of the detection, blur, Canny and a closing, in horizontal bands on a
+/// pool of threads, with the same result as the serial chain bit for bit. Each band is
+/// blurred with the rows around it, its gradients, non-maximum suppression and the hysteresis
+/// inside it follow right away while the rows are still in cache, then the edges reaching the
+/// rows shared with the neighbouring bands are followed once all bands are done. The closing
+/// runs per band last, on the edges of the band and of the rows its halo needs. The calling
+/// thread runs bands too.
+/// </summary>
+class TiledEdgeChain
+{
+public:
+    // Types:
+    // Filters of the chain
+    struct Settings
+    {
+        Size blurSize;
+        Mat edgeElement;
+        double minThreshold;
+        double maxThreshold;
+    };
+
+    // Constants:
+    // Most threads a chain runs on, the calling thread included
+    static const int MAX_THREAD_COUNT = 8;
+
+    // Rows of a band, so a band's buffers stay in the cache between the filters
+    static const int BAND_ROWS = 32;
+
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    TiledEdgeChain();
+
+    /// <summary>
+    /// Destructor, stops the worker threads
+    /// </summary>
+    ~TiledEdgeChain();
+
+    /// <summary>
+    /// Sets the number of threads the chain runs on, starting or stopping workers
+    /// </summary>
+    /// <param name="threadCount">number of threads, the calling thread included, clamped to 1..MAX_THREAD_COUNT</param>
+    /// <returns>S_OK if successful, an error code if a worker could not be started</returns>
+    HRESULT SetThreadCount(int threadCount);
+
+    /// <summary>
+    /// Gets the number of threads the chain runs on
+    /// </summary>
+    /// <returns>number of threads, the calling thread included</returns>
+    int GetThreadCount() const;
+
+    /// <summary>
+    /// Blurs an image, finds its Canny edges and closes them
+    /// </summary>
+    /// <param name="src">CV_8UC1 image</param>
+    /// <param name="settings">filters of the chain</param>
+    /// <param name="pDst">pointer to the CV_8UC1 closed edges to fill, not sharing memory with the image</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the image is empty or not CV_8UC1</returns>
+    HRESULT Run(const Mat& src, const Settings& settings, Mat* pDst);
+
+private:
+    // Types:
+    // Filters the threads run on their bands
+    enum Phase
+    {
+        PHASE_EDGES,
+        PHASE_CLOSE
+    };
+
+    // Buffers of a thread, reused between frames
+    struct Worker
+    {
+        TiledEdgeChain* pChain;
+        int index;
+
+        // Blurred rows of the band, gradients and magnitudes of three rows around the row
+        // being suppressed, padded with a zero magnitude on both sides
+        Mat blurred;
+        std::vector<short> dx;
+        std::vector<short> dy;
+        std::vector<int> magnitudes;
+
+        // Edges of the band and of the closing's halo, and their dilation
+        Mat edges;
+        Mat dilated;
+
+        // Edge pixels still to follow, and those on the rows shared with other bands
+        std::vector<uchar*> stack;
+        std::vector<uchar*> borderEdges;
+    };
+
+    // Functions:
+    /// <summary>
+    /// Runs a phase on every thread and waits for all of them
+    /// </summary>
+    /// <param name="phase">filters to run</param>
+    /// <returns>S_OK if successful, the first error of a thread otherwise</returns>
+    HRESULT RunPhase(Phase phase);
+
+    /// <summary>
+    /// Runs the current phase on the bands of a worker, called on the worker thread
+    /// </summary>
+    /// <param name="pContext">worker</param>
+    /// <returns>S_OK</returns>
+    static HRESULT RunWorker(LPVOID pContext);
+
+    /// <summary>
+    /// Blurs a band and finds its edges, following them inside the band
+    /// </summary>
+    /// <param name="pWorker">worker running the band</param>
+    /// <param name="y0">first row of the band</param>
+    /// <param name="y1">row after the last one of the band</param>
+    void FindEdges(Worker* pWorker, int y0, int y1);
+
+    /// <summary>
+    /// Computes the Sobel gradients and the L1 magnitude of a row into the worker's ring of rows
+    /// </summary>
+    /// <param name="pWorker">worker running the band</param>
+    /// <param name="firstBlurred">image row of the worker's first blurred row</param>
+    /// <param name="y">row, whose magnitude is zero outside the image</param>
+    void ComputeGradients(Worker* pWorker, int firstBlurred, int y);
+
+    /// <summary>
+    /// Follows the edges reaching the rows shared between bands, once every band is done
+    /// </summary>
+    void FollowBorderEdges();
+
+    /// <summary>
+    /// Writes the edges of a band and closes them
+    /// </summary>
+    /// <param name="pWorker">worker running the band</param>
+    /// <param name="y0">first row of the band</param>
+    /// <param name="y1">row after the last one of the band</param>
+    void CloseEdges(Worker* pWorker, int y0, int y1);
+
+    // Variables:
+    // Threads other than the caller's, and the buffers of every thread
+    FrameWorker m_threads[MAX_THREAD_COUNT - 1];
+    Worker m_workers[MAX_THREAD_COUNT];
+    int m_threadCount;
+
+    // Frame being filtered
+    Mat m_src;
+    Mat m_dst;
+    Settings m_settings;
+    Phase m_phase;
+    int m_bandCount;
+
+    // Canny's map of the whole image, with a border of non-edges: 0 for a pixel that becomes
+    // an edge if connected to one, 1 for a non-edge and 2 for an edge
+    Mat m_map;
+};
@@ -0,0 +1,209 @@
+#include "WarpEngine.h"
+
+namespace
+{
+    // Source position of the pixels the chain leaves black, far enough outside any image
+    // for the bilinear taps to all fall on the constant border
+    const float OUTSIDE_POSITION = -16384.0f;
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+WarpEngine::WarpEngine() :
+    m_chainLength(0),
+    m_buildCount(0)
+{
+}
+
+/// <summary>
+/// Sets the chain of homographies, in the order warpPerspective would apply them,
+/// rebuilding the remap tables if the chain or the sizes differ from the current ones
+/// </summary>
+/// <param name="pChain">homographies, 3x3 matrices</param>
+/// <param name="chainLength">number of homographies, 1 to MAX_CHAIN_LENGTH</param>
+/// <param name="srcSize">size of the source images</param>
+/// <param name="dstSize">size of the destination images</param>
+/// <param name="intermediateSize">size of the intermediate images, the destination size if empty</param>
+/// <returns>S_OK if the tables were rebuilt, S_FALSE if they were current, E_INVALIDARG for an invalid chain</returns>
+HRESULT WarpEngine::SetTransform(const Mat* pChain, int chainLength, Size srcSize, Size dstSize, Size intermediateSize /* = Size() */)
+{
+    if (!pChain)
+    {
+        return E_POINTER;
+    }
+
+    if (chainLength < 1 || chainLength > MAX_CHAIN_LENGTH || srcSize.area() == 0 || dstSize.area() == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    for (int i = 0; i < chainLength; ++i)
+    {
+        if (pChain[i].rows != 3 || pChain[i].cols != 3 || (pChain[i].type() != CV_64FC1 && pChain[i].type() != CV_32FC1))
+        {
+            return E_INVALIDARG;
+        }
+    }
+
+    if (intermediateSize.area() == 0)
+    {
+        intermediateSize = dstSize;
+    }
+
+    if (IsCurrent(pChain, chainLength, srcSize, dstSize, intermediateSize))
+    {
+        return S_FALSE;
+    }
+
+    for (int i = 0; i < chainLength; ++i)
+    {
+        pChain[i].convertTo(m_chain[i], CV_64F);
+    }
+    m_chainLength = chainLength;
+    m_srcSize = srcSize;
+    m_dstSize = dstSize;
+    m_intermediateSize = intermediateSize;
+
+    BuildTables();
+    return S_OK;
+}
+
+/// <summary>
+/// Warps an image with the current transform
+/// </summary>
+/// <param name="src">source image of the size given to SetTransform</param>
+/// <param name="pDst">pointer to the destination, (re)allocated to the destination size and the source type</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the source does not fit the transform</returns>
+HRESULT WarpEngine::Apply(const Mat& src, Mat* pDst) const
+{
+    if (!pDst)
+    {
+        return E_POINTER;
+    }
+
+    // The tables hold source positions, the source cannot also be the destination
+    if (m_chainLength == 0 || src.size() != m_srcSize || src.data == pDst->data)
+    {
+        return E_INVALIDARG;
+    }
+
+    remap(src, *pDst, m_map, m_weights, INTER_LINEAR, BORDER_CONSTANT);
+    return S_OK;
+}
+
+/// <summary>
+/// Gets the homography composed from the chain, mapping source to destination pixels
+/// </summary>
+/// <returns>3x3 CV_64F matrix, empty until a transform is set</returns>
+const Mat& WarpEngine::GetHomography() const
+{
+    return m_homography;
+}
+
+/// <summary>
+/// Gets the number of times the remap tables have been built
+/// </summary>
+/// <returns>number of builds</returns>
+LONG WarpEngine::GetBuildCount() const
+{
+    return m_buildCount;
+}
+
+/// <summary>
+/// Returns whether a chain and sizes are the ones the tables were built for
+/// </summary>
+/// <param name="pChain">homographies</param>
+/// <param name="chainLength">number of homographies</param>
+/// <param name="srcSize">size of the source images</param>
+/// <param name="dstSize">size of the destination images</param>
+/// <param name="intermediateSize">size of the intermediate images</param>
+/// <returns>true if the tables are current, false otherwise</returns>
+bool WarpEngine::IsCurrent(const Mat* pChain, int chainLength, Size srcSize, Size dstSize, Size intermediateSize) const
+{
+    if (chainLength != m_chainLength || srcSize != m_srcSize || dstSize != m_dstSize || intermediateSize != m_intermediateSize)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < chainLength; ++i)
+    {
+        Mat homography = pChain[i];
+        if (homography.type() != CV_64FC1)
+        {
+            pChain[i].convertTo(homography, CV_64F);
+        }
+
+        if (norm(homography, m_chain[i], NORM_INF) != 0.0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Builds the remap tables for the current chain
+/// </summary>
+void WarpEngine::BuildTables()
+{
+    m_homography = m_chain[0].clone();
+    for (int i = 1; i < m_chainLength; ++i)
+    {
+        m_homography = m_chain[i] * m_homography;
+    }
+
+    // Each destination pixel is walked back through the inverse of every stage, so
+    // positions that fall outside an intermediate image are known
+    Mat inverses[MAX_CHAIN_LENGTH];
+    for (int i = 0; i < m_chainLength; ++i)
+    {
+        inverses[i] = m_chain[i].inv();
+    }
+
+    const double maxX = m_intermediateSize.width - 1;
+    const double maxY = m_intermediateSize.height - 1;
+
+    Mat mapX(m_dstSize, CV_32FC1);
+    Mat mapY(m_dstSize, CV_32FC1);
+
+    for (int y = 0; y < m_dstSize.height; ++y)
+    {
+        float* pMapX = mapX.ptr<float>(y);
+        float* pMapY = mapY.ptr<float>(y);
+
+        for (int x = 0; x < m_dstSize.width; ++x)
+        {
+            double px = x;
+            double py = y;
+            bool isInside = true;
+
+            for (int i = m_chainLength - 1; i >= 0 && isInside; --i)
+            {
+                const double* h = inverses[i].ptr<double>();
+                double w = h[6] * px + h[7] * py + h[8];
+                w = w != 0.0 ? 1.0 / w : 0.0;
+
+                double qx = (h[0] * px + h[1] * py + h[2]) * w;
+                double qy = (h[3] * px + h[4] * py + h[5]) * w;
+                px = qx;
+                py = qy;
+
+                // The source border is left to remap, intermediate images end at their edges
+                if (i > 0)
+                {
+                    isInside = px >= 0.0 && py >= 0.0 && px <= maxX && py <= maxY;
+                }
+            }
+
+            pMapX[x] = isInside ? static_cast<float>(px) : OUTSIDE_POSITION;
+            pMapY[x] = isInside ? static_cast<float>(py) : OUTSIDE_POSITION;
+        }
+    }
+
+    // Same fixed-point positions and weights warpPerspective computes for every frame
+    convertMaps(mapX, mapY, m_map, m_weights, CV_16SC2);
+
+    ++m_buildCount;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <windows.h>
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#pragma warning(pop)
+
+using namespace cv;
+
+/// <summary>
+/// Applies a chain of perspective warps in a single bilinear pass. The homographies are
+/// composed into one and the source position of every destination pixel is precomputed
+/// into fixed-point remap tables, which are only rebuilt when a homography or a size changes.
+/// Pixels the chain would have taken from outside an intermediate image are left black,
+/// as chained warpPerspective calls would leave them.
+/// </summary>
+class WarpEngine
+{
+public:
+    // Constants:
+    // Longest chain of homographies
+    static const int MAX_CHAIN_LENGTH = 4;
+
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    WarpEngine();
+
+    /// <summary>
+    /// Sets the chain of homographies, in the order warpPerspective would apply them,
+    /// rebuilding the remap tables if the chain or the sizes differ from the current ones
+    /// </summary>
+    /// <param name="pChain">homographies, 3x3 matrices</param>
+    /// <param name="chainLength">number of homographies, 1 to MAX_CHAIN_LENGTH</param>
+    /// <param name="srcSize">size of the source images</param>
+    /// <param name="dstSize">size of the destination images</param>
+    /// <param name="intermediateSize">size of the intermediate images, the destination size if empty</param>
+    /// <returns>S_OK if the tables were rebuilt, S_FALSE if they were current, E_INVALIDARG for an invalid chain</returns>
+    HRESULT SetTransform(const Mat* pChain, int chainLength, Size srcSize, Size dstSize, Size intermediateSize = Size());
+
+    /// <summary>
+    /// Warps an image with the current transform
+    /// </summary>
+    /// <param name="src">source image of the size given to SetTransform</param>
+    /// <param name="pDst">pointer to the destination, (re)allocated to the destination size and the source type</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the source does not fit the transform</returns>
+    HRESULT Apply(const Mat& src, Mat* pDst) const;
+
+    /// <summary>
+    /// Gets the homography composed from the chain, mapping source to destination pixels
+    /// </summary>
+    /// <returns>3x3 CV_64F matrix, empty until a transform is set</returns>
+    const Mat& GetHomography() const;
+
+    /// <summary>
+    /// Gets the number of times the remap tables have been built
+    /// </summary>
+    /// <returns>number of builds</returns>
+    LONG GetBuildCount() const;
+
+private:
+    // Functions:
+    /// <summary>
+    /// Returns whether a chain and sizes are the ones the tables were built for
+    /// </summary>
+    /// <param name="pChain">homographies</param>
+    /// <param name="chainLength">number of homographies</param>
+    /// <param name="srcSize">size of the source images</param>
+    /// <param name="dstSize">size of the destination images</param>
+    /// <param name="intermediateSize">size of the intermediate images</param>
+    /// <returns>true if the tables are current, false otherwise</returns>
+    bool IsCurrent(const Mat* pChain, int chainLength, Size srcSize, Size dstSize, Size intermediateSize) const;
+
+    /// <summary>
+    /// Builds the remap tables for the current chain
+    /// </summary>
+    void BuildTables();
+
+    // Variables:
+    // Chain the tables were built for, copies in CV_64F
+    Mat m_chain[MAX_CHAIN_LENGTH];
+    int m_chainLength;
+    Size m_srcSize;
+    Size m_dstSize;
+    Size m_intermediateSize;
+
+    // Composed homography
+    Mat m_homography;
+
+    // Fixed-point remap tables, integer positions in CV_16SC2 and interpolation weights in CV_16UC1
+    Mat m_map;
+    Mat m_weights;
+
+    LONG m_buildCount;
+};
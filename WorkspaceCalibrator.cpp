@@ -0,0 +1,318 @@
+#include "WorkspaceCalibrator.h"
+#include "DepthSampler.h"
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    // Size of the images the warps work in, and their corners in the order of the workspace
+    const int WARP_WIDTH = 640;
+    const int WARP_HEIGHT = 480;
+    const Point2f IMAGE_CORNERS[4] = { Point2f(0, 0), Point2f(639, 0), Point2f(0, 479), Point2f(639, 479) };
+
+    // Largest fraction of the color image the cardboard covers, larger outlines are the frame itself
+    const int MAX_AREA_PERCENT = 95;
+
+    // Fraction of the way from each corner to the center where the depth is aligned, so it is
+    // read on the cardboard rather than across its border
+    const float ALIGNMENT_INSET = 0.1f;
+
+    // Orders points from top to bottom
+    struct ByY
+    {
+        bool operator()(const Point2f& a, const Point2f& b) const
+        {
+            return a.y < b.y;
+        }
+    };
+}
+
+/// <summary>
+/// Constructor
+/// </summary>
+WorkspaceCalibrator::WorkspaceCalibrator() :
+    m_frameCount(0)
+{
+}
+
+/// <summary>
+/// Adds a pair of frames, and finds the workspace once FRAME_COUNT have been added. The
+/// alignment is kept if the sensor's calibration cannot be read, as for a recording.
+/// </summary>
+/// <param name="color">color frame, BGRA or gray</param>
+/// <param name="depth">CV_16UC1 depth frame captured with it</param>
+/// <param name="colorResolution">resolution of the color frames</param>
+/// <param name="depthResolution">resolution of the depth frames</param>
+/// <param name="pWorkspace">pointer to the current workspace, replaced by the one found</param>
+/// <returns>S_OK once the workspace is found, S_FALSE while frames are still needed, E_FAIL if the cardboard was not found and the frames start over, an error code otherwise</returns>
+HRESULT WorkspaceCalibrator::AddFrame(const Mat& color, const Mat& depth, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution, Workspace* pWorkspace)
+{
+    if (!pWorkspace)
+    {
+        return E_POINTER;
+    }
+
+    if (color.empty() || (color.channels() != 4 && color.channels() != 1) || depth.empty() || depth.type() != CV_16UC1)
+    {
+        return E_INVALIDARG;
+    }
+
+    Mat gray = color;
+    if (color.channels() == 4)
+    {
+        cvtColor(color, gray, COLOR_BGRA2GRAY);
+    }
+
+    // A change of resolution starts over
+    if (m_colorSum.size() != gray.size())
+    {
+        m_colorSum = Mat::zeros(gray.size(), CV_32FC1);
+        m_frameCount = 0;
+    }
+
+    // The average steadies the edges against the sensor noise
+    accumulate(gray, m_colorSum);
+    if (++m_frameCount < FRAME_COUNT)
+    {
+        return S_FALSE;
+    }
+
+    Mat average;
+    m_colorSum.convertTo(average, CV_8U, 1.0 / m_frameCount);
+    Reset();
+
+    Point2f corners[4];
+    if (!FindCardboard(average, corners))
+    {
+        return E_FAIL;
+    }
+
+    const float scaleX = static_cast<float>(WARP_WIDTH) / average.cols;
+    const float scaleY = static_cast<float>(WARP_HEIGHT) / average.rows;
+    for (int i = 0; i < 4; ++i)
+    {
+        pWorkspace->corners[i] = Point2f(corners[i].x * scaleX, corners[i].y * scaleY);
+    }
+
+    Align(depth, colorResolution, depthResolution, pWorkspace);
+    return S_OK;
+}
+
+/// <summary>
+/// Forgets the frames added so far
+/// </summary>
+void WorkspaceCalibrator::Reset()
+{
+    m_colorSum.setTo(Scalar(0));
+    m_frameCount = 0;
+}
+
+/// <summary>
+/// Loads a workspace saved with Save
+/// </summary>
+/// <param name="path">path of the file</param>
+/// <param name="pWorkspace">pointer in which to return the workspace</param>
+/// <returns>S_OK if successful, E_INVALIDARG if the file is not a workspace, an error code otherwise</returns>
+HRESULT WorkspaceCalibrator::Load(LPCWSTR path, Workspace* pWorkspace)
+{
+    if (!pWorkspace)
+    {
+        return E_POINTER;
+    }
+
+    HANDLE hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // The workspace is only replaced once the whole file has been read
+    WorkspaceHeader header;
+    Workspace workspace;
+    HRESULT hr = S_OK;
+    DWORD read;
+    if (!ReadFile(hFile, &header, sizeof(header), &read, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (read != sizeof(header) || header.magic != WORKSPACE_MAGIC || header.version != WORKSPACE_VERSION)
+    {
+        hr = E_INVALIDARG;
+    }
+    else if (!ReadFile(hFile, &workspace, sizeof(workspace), &read, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if (read != sizeof(workspace))
+    {
+        hr = E_INVALIDARG;
+    }
+
+    CloseHandle(hFile);
+
+    if (SUCCEEDED(hr))
+    {
+        *pWorkspace = workspace;
+    }
+    return hr;
+}
+
+/// <summary>
+/// Saves a workspace
+/// </summary>
+/// <param name="path">path of the file to create</param>
+/// <param name="workspace">workspace to save</param>
+/// <returns>S_OK if successful, an error code otherwise</returns>
+HRESULT WorkspaceCalibrator::Save(LPCWSTR path, const Workspace& workspace)
+{
+    HANDLE hFile = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    WorkspaceHeader header;
+    header.magic = WORKSPACE_MAGIC;
+    header.version = WORKSPACE_VERSION;
+
+    HRESULT hr = S_OK;
+    DWORD written;
+    if (!WriteFile(hFile, &header, sizeof(header), &written, NULL) || !WriteFile(hFile, &workspace, sizeof(workspace), &written, NULL))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(hFile);
+    return hr;
+}
+
+/// <summary>
+/// Finds the corners of the cardboard
+/// </summary>
+/// <param name="gray">average of the color frames</param>
+/// <param name="pCorners">pointer to the four corners to fill, in the order of Workspace::corners</param>
+/// <returns>true if found, false otherwise</returns>
+bool WorkspaceCalibrator::FindCardboard(const Mat& gray, Point2f* pCorners)
+{
+    // Edges closed over small gaps, so the border of the cardboard is one outline
+    Mat edges;
+    GaussianBlur(gray, edges, Size(5, 5), 0);
+    Canny(edges, edges, 30, 90);
+    dilate(edges, edges, Mat());
+
+    std::vector<std::vector<Point> > contours;
+    findContours(edges, contours, RETR_LIST, CHAIN_APPROX_SIMPLE);
+
+    const double minArea = gray.total() * MIN_AREA_PERCENT / 100.0;
+    const double maxArea = gray.total() * MAX_AREA_PERCENT / 100.0;
+    double bestArea = 0.0;
+    std::vector<Point> best;
+    std::vector<Point> polygon;
+    for (size_t i = 0; i < contours.size(); ++i)
+    {
+        approxPolyDP(contours[i], polygon, 0.02 * arcLength(contours[i], true), true);
+        if (polygon.size() != 4 || !isContourConvex(polygon))
+        {
+            continue;
+        }
+
+        double area = contourArea(polygon);
+        if (area > minArea && area < maxArea && area > bestArea)
+        {
+            bestArea = area;
+            best = polygon;
+        }
+    }
+
+    if (best.empty())
+    {
+        return false;
+    }
+
+    // The two upper corners first, each pair from left to right
+    std::vector<Point2f> corners(best.begin(), best.end());
+    std::sort(corners.begin(), corners.end(), ByY());
+    if (corners[0].x > corners[1].x)
+    {
+        std::swap(corners[0], corners[1]);
+    }
+    if (corners[2].x > corners[3].x)
+    {
+        std::swap(corners[2], corners[3]);
+    }
+
+    cornerSubPix(gray, corners, Size(5, 5), Size(-1, -1), TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 20, 0.05));
+
+    std::copy(corners.begin(), corners.end(), pCorners);
+    return true;
+}
+
+/// <summary>
+/// Aligns the depth image with the color image on the cardboard
+/// </summary>
+/// <param name="depth">depth frame</param>
+/// <param name="colorResolution">resolution of the color frames</param>
+/// <param name="depthResolution">resolution of the depth frames</param>
+/// <param name="pWorkspace">pointer to the workspace with the corners found and the current alignment, which is replaced</param>
+/// <returns>S_OK if successful, an error code if the sensor's calibration could not be read</returns>
+HRESULT WorkspaceCalibrator::Align(const Mat& depth, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution, Workspace* pWorkspace)
+{
+    DWORD colorWidth, colorHeight;
+    NuiImageResolutionToSize(colorResolution, colorWidth, colorHeight);
+    if (colorWidth == 0 || colorHeight == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Points a little inside the corners, found in the depth image with the current alignment
+    Point2f center(0.0f, 0.0f);
+    for (int i = 0; i < 4; ++i)
+    {
+        center += pWorkspace->corners[i] * 0.25f;
+    }
+
+    std::vector<Point2f> colorPoints(4);
+    for (int i = 0; i < 4; ++i)
+    {
+        colorPoints[i] = pWorkspace->corners[i] + (center - pWorkspace->corners[i]) * ALIGNMENT_INSET;
+    }
+
+    std::vector<Point2f> depthPoints;
+    Mat alignment = getPerspectiveTransform(IMAGE_CORNERS, pWorkspace->alignment);
+    perspectiveTransform(colorPoints, depthPoints, alignment.inv());
+
+    // Where the sensor maps those depth pixels, at the depth read there
+    const float depthScaleX = static_cast<float>(depth.cols) / WARP_WIDTH;
+    const float depthScaleY = static_cast<float>(depth.rows) / WARP_HEIGHT;
+    DepthSampler sampler;
+    Point2f depthCorners[4];
+    Point2f colorCorners[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        LONG depthX = cvRound(depthPoints[i].x * depthScaleX);
+        LONG depthY = cvRound(depthPoints[i].y * depthScaleY);
+
+        float millimeters;
+        if (sampler.Sample(depth, Point2f(static_cast<float>(depthX), static_cast<float>(depthY)), DepthSampler::SAMPLE_MEDIAN, &millimeters) != S_OK)
+        {
+            return E_FAIL;
+        }
+
+        LONG colorX, colorY;
+        USHORT packedDepth = static_cast<USHORT>(cvRound(millimeters) << NUI_IMAGE_PLAYER_INDEX_SHIFT);
+        HRESULT hr = NuiImageGetColorPixelCoordinatesFromDepthPixelAtResolution(colorResolution, depthResolution, NULL, depthX, depthY, packedDepth, &colorX, &colorY);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        depthCorners[i] = Point2f(depthX / depthScaleX, depthY / depthScaleY);
+        colorCorners[i] = Point2f(static_cast<float>(colorX) * WARP_WIDTH / colorWidth, static_cast<float>(colorY) * WARP_HEIGHT / colorHeight);
+    }
+
+    // The cardboard is a plane, so one homography aligns all of it
+    std::vector<Point2f> aligned;
+    perspectiveTransform(std::vector<Point2f>(IMAGE_CORNERS, IMAGE_CORNERS + 4), aligned, getPerspectiveTransform(depthCorners, colorCorners));
+    std::copy(aligned.begin(), aligned.end(), pWorkspace->alignment);
+    return S_OK;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <windows.h>
+#include <NuiApi.h>
+
+// Suppress warnings that come from compiling OpenCV code since we have no control over it
+#pragma warning(push)
+#pragma warning(disable : 6294 6031)
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#pragma warning(pop)
+
+using namespace cv;
+
+// Workspace file layout: a WorkspaceHeader followed by the Workspace
+static const DWORD WORKSPACE_MAGIC = 0x534B424B;    // "KBKS"
+static const DWORD WORKSPACE_VERSION = 1;
+
+struct WorkspaceHeader
+{
+    DWORD magic;
+    DWORD version;
+};
+
+/// <summary>
+/// Where the workspace is in the images, in the 640x480 coordinates the warps work in
+/// </summary>
+struct Workspace
+{
+    // Corners of the cardboard in the color image: top left, top right, bottom left, bottom right
+    Point2f corners[4];
+
+    // Where the corners of the depth image fall in the color image, in the same order
+    Point2f alignment[4];
+};
+
+/// <summary>
+/// Finds the workspace in a few frames of the sensor. The cardboard is looked for in the
+/// average of the color frames, as the largest convex quadrilateral among the outlines of
+/// their edges, with its corners refined to a fraction of a pixel. The depth image is then
+/// aligned with the color image by mapping depth pixels on the cardboard into the color
+/// image with the sensor's own calibration. The result can be saved and loaded at startup.
+/// </summary>
+class WorkspaceCalibrator
+{
+public:
+    // Constants:
+    // Frames averaged before the cardboard is looked for
+    static const int FRAME_COUNT = 8;
+
+    // Smallest fraction of the color image the cardboard covers
+    static const int MIN_AREA_PERCENT = 10;
+
+    // Functions:
+    /// <summary>
+    /// Constructor
+    /// </summary>
+    WorkspaceCalibrator();
+
+    /// <summary>
+    /// Adds a pair of frames, and finds the workspace once FRAME_COUNT have been added. The
+    /// alignment is kept if the sensor's calibration cannot be read, as for a recording.
+    /// </summary>
+    /// <param name="color">color frame, BGRA or gray</param>
+    /// <param name="depth">CV_16UC1 depth frame captured with it</param>
+    /// <param name="colorResolution">resolution of the color frames</param>
+    /// <param name="depthResolution">resolution of the depth frames</param>
+    /// <param name="pWorkspace">pointer to the current workspace, replaced by the one found</param>
+    /// <returns>S_OK once the workspace is found, S_FALSE while frames are still needed, E_FAIL if the cardboard was not found and the frames start over, an error code otherwise</returns>
+    HRESULT AddFrame(const Mat& color, const Mat& depth, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution, Workspace* pWorkspace);
+
+    /// <summary>
+    /// Forgets the frames added so far
+    /// </summary>
+    void Reset();
+
+    /// <summary>
+    /// Loads a workspace saved with Save
+    /// </summary>
+    /// <param name="path">path of the file</param>
+    /// <param name="pWorkspace">pointer in which to return the workspace</param>
+    /// <returns>S_OK if successful, E_INVALIDARG if the file is not a workspace, an error code otherwise</returns>
+    static HRESULT Load(LPCWSTR path, Workspace* pWorkspace);
+
+    /// <summary>
+    /// Saves a workspace
+    /// </summary>
+    /// <param name="path">path of the file to create</param>
+    /// <param name="workspace">workspace to save</param>
+    /// <returns>S_OK if successful, an error code otherwise</returns>
+    static HRESULT Save(LPCWSTR path, const Workspace& workspace);
+
+private:
+    /// <summary>
+    /// Finds the corners of the cardboard
+    /// </summary>
+    /// <param name="gray">average of the color frames</param>
+    /// <param name="pCorners">pointer to the four corners to fill, in the order of Workspace::corners</param>
+    /// <returns>true if found, false otherwise</returns>
+    static bool FindCardboard(const Mat& gray, Point2f* pCorners);
+
+    /// <summary>
+    /// Aligns the depth image with the color image on the cardboard
+    /// </summary>
+    /// <param name="depth">depth frame</param>
+    /// <param name="colorResolution">resolution of the color frames</param>
+    /// <param name="depthResolution">resolution of the depth frames</param>
+    /// <param name="pWorkspace">pointer to the workspace with the corners found and the current alignment, which is replaced</param>
+    /// <returns>S_OK if successful, an error code if the sensor's calibration could not be read</returns>
+    static HRESULT Align(const Mat& depth, NUI_IMAGE_RESOLUTION colorResolution, NUI_IMAGE_RESOLUTION depthResolution, Workspace* pWorkspace);
+
+    // Variables:
+    // Sum of the gray color frames, and their number
+    Mat m_colorSum;
+    int m_frameCount;
+};